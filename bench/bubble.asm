@@ -0,0 +1,49 @@
+; bubble sort: sort 40 bytes at 0xd8 ascending, 32 times with a new sequence each time
+; the sequence is x = x * 5 + 0x11, continuing across rounds
+; result: [0xd8]..[0xff] hold the last sorted sequence
+
+    mov t2, 32
+    mov bp, 0x2b
+
+round:
+    mov si, 0xd8
+
+fill:
+    mov c, bp
+    add c, c
+    add c, c
+    add bp, c
+    add bp, 0x11
+    mov [si], bp
+    inc si
+    jnz fill
+
+    mov t1, 0xff
+
+pass:
+    mov si, 0xd8
+    mov di, 0xd9
+
+inner:
+    mov c, [si]
+    mov d, [di]
+    cmp d, c
+    jno ordered
+    mov [si], d
+    mov [di], c
+
+ordered:
+    cmp di, t1
+    jz passend
+    inc si
+    inc di
+    jmp inner
+
+passend:
+    dec t1
+    cmp t1, 0xd8
+    jnz pass
+    dec t2
+    jnz round
+
+    hlt
@@ -0,0 +1,32 @@
+; CRC-8: polynomial 0x07, initial value 0, over the first 128 bytes of memory, i.e. this program, 64 times
+; the CRC is shifted left one bit at a time, O is the bit shifted out
+; result: [0xf0] = the CRC, 0x33 for this program
+
+    mov t2, 64
+
+round:
+    mov c, 0
+    mov si, 0
+
+byte:
+    mov d, [si]
+    xor c, d
+    mov bp, 8
+
+bit:
+    add c, c
+    jno nopoly
+    xor c, 0x07
+
+nopoly:
+    dec bp
+    jnz bit
+    inc si
+    cmp si, 0x80
+    jnz byte
+
+    mov [0xf0], c
+    dec t2
+    jnz round
+
+    hlt
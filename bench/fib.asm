@@ -0,0 +1,42 @@
+; fibonacci: F(0)..F(47) modulo 2^16 into a table at 0xa0, little endian, 512 times
+; each term is computed from the two previous entries of the table
+; result: [0xa0]..[0xff] hold the table, F(24) = 0xb520 at 0xd0
+
+    mov t1, 2
+    mov t2, 0
+
+round:
+    mov [0xa0], 0
+    mov [0xa1], 0
+    mov [0xa2], 1
+    mov [0xa3], 0
+    mov si, 0xa0
+    mov di, 0xa4
+
+next:
+    mov c, [si]
+    inc si
+    mov d, [si]
+    inc si
+    mov bp, [si]
+    add c, bp
+    jno nocarry
+    inc d
+
+nocarry:
+    inc si
+    mov bp, [si]
+    add d, bp
+    dec si
+    mov [di], c
+    inc di
+    mov [di], d
+    inc di
+    jnz next
+
+    dec t2
+    jnz round
+    dec t1
+    jnz round
+
+    hlt
@@ -0,0 +1,32 @@
+; interrupt storm: 32768 software interrupts with INT and IRET
+; the handler counts them in D:C, its own INT does nothing because INT clears IE
+; result: [0xf0] = 0x00, [0xf1] = 0x80
+
+    mov ss, 1
+    mov sp, 0
+    mov c, 0
+    mov d, 0
+    mov bp, 0
+    mov t2, 128
+    sti
+
+loop:
+    int handler
+    dec bp
+    jnz loop
+    dec t2
+    jnz loop
+
+    mov [0xf0], c
+    mov [0xf1], d
+
+    hlt
+
+handler:
+    inc c
+    jnz counted
+    inc d
+
+counted:
+    int handler
+    iret
@@ -0,0 +1,42 @@
+; memcpy: copy 48 bytes from 0xa0 to 0xd0, 1024 times
+; the source is filled with x = x + 0x3b first, one source byte is incremented after each copy
+; result: [0xd0]..[0xff] hold the last copy
+
+    mov c, 0xa0
+    mov d, 0x5a
+
+fill:
+    mov [c], d
+    add d, 0x3b
+    inc c
+    cmp c, 0xd0
+    jnz fill
+
+    mov t2, 4
+    mov bp, 0
+
+copy:
+    mov si, 0xa0
+    mov di, 0xd0
+    mov d, 48
+
+next:
+    mov c, [si]
+    mov [di], c
+    inc si
+    inc di
+    dec d
+    jnz next
+
+    mov c, bp
+    and c, 0x1f
+    add c, 0xa0
+    mov d, [c]
+    inc d
+    mov [c], d
+    dec bp
+    jnz copy
+    dec t2
+    jnz copy
+
+    hlt
@@ -0,0 +1,90 @@
+; software multiply and divide: for x = 255..1, y = x ^ k, 4 rounds with k = 0x5b, 0x80, 0xa5, 0xca
+; p = x * y by shift and add, then p / ((y & 0x3f) | 0x40) by shift and subtract, both 16 bits
+; result: [0xf0] = 0xb7, the sum of the low bytes of the quotients, [0xf1] = 0x4a, the xor of the remainders
+
+    mov ss, 1
+    mov sp, 0
+    mov [0xf2], 4
+    mov [0xf3], 0x5b
+
+round:
+    mov t2, 0xff
+
+loop:
+    mov c, t2
+    mov d, [0xf3]
+    xor d, t2
+    mov t1, d
+    and t1, 0x3f
+    or t1, 0x40
+    call mul
+    call div
+    mov d, [0xf0]
+    add d, di
+    mov [0xf0], d
+    mov d, [0xf1]
+    xor d, c
+    mov [0xf1], d
+    dec t2
+    jnz loop
+
+    mov d, [0xf3]
+    add d, 0x25
+    mov [0xf3], d
+    mov d, [0xf2]
+    dec d
+    mov [0xf2], d
+    jnz round
+
+    hlt
+
+; SI:DI = C * D, uses D and BP
+mul:
+    mov di, 0
+    mov si, 0
+    mov bp, 8
+
+mulbit:
+    add si, si
+    add di, di
+    jno mulshift
+    inc si
+
+mulshift:
+    add d, d
+    jno mulnext
+    add di, c
+    jno mulnext
+    inc si
+
+mulnext:
+    dec bp
+    jnz mulbit
+    ret
+
+; SI:DI = SI:DI / T1, C = remainder, T1 must be less than 0x80, uses BP
+div:
+    mov c, 0
+    mov bp, 16
+
+divbit:
+    add c, c
+    add si, si
+    jno divlow
+    inc c
+
+divlow:
+    add di, di
+    jno divcmp
+    inc si
+
+divcmp:
+    cmp c, t1
+    jo divnext
+    sub c, t1
+    inc di
+
+divnext:
+    dec bp
+    jnz divbit
+    ret
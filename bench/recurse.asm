@@ -0,0 +1,29 @@
+; recursive CALL and RET: fib(21) modulo 256 by fib(n) = fib(n - 1) + fib(n - 2), 35421 calls
+; result: [0xf0] = 0xc2
+
+    mov ss, 1
+    mov sp, 0
+    mov c, 21
+    call fib
+    mov [0xf0], d
+
+    hlt
+
+; D = fib(C) modulo 256, C is preserved, uses T1
+fib:
+    cmp c, 2
+    jo small
+    dec c
+    call fib
+    push d
+    dec c
+    call fib
+    pop t1
+    add d, t1
+    inc c
+    inc c
+    ret
+
+small:
+    mov d, c
+    ret
@@ -0,0 +1,453 @@
+/**
+ * 批量执行引擎
+ *
+ * 同一程序的多个实例按BATCH_LANES个一组同步执行，寄存器、PC、PSW按结构数组存放，
+ * 每个字节对应一个实例。每步选出执行同一条指令的实例，用向量运算与掩码一起执行，
+ * 条件转移按各实例的PSW生成掩码。内存与计数仍在各自的CPU中，其余指令逐个实例执行。
+ * 向量类型由编译器生成AVX2（-mavx2）或SSE指令。
+ */
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include "fast.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// 每组的实例数，与向量寄存器的字节数一致
+#if defined(__AVX2__)
+#define BATCH_LANES 32
+#else
+#define BATCH_LANES 16
+#endif
+
+// 向量只在本文件的内联函数间传递，未开启AVX时的参数传递方式不影响兼容性
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+/// @brief 一组实例的同一个8位寄存器，每个字节对应一个实例
+typedef uint8_t Lanes __attribute__((vector_size(BATCH_LANES)));
+
+/// @brief 每个字节都为val
+/// @param val
+/// @return
+static inline Lanes Splat(uint8_t val)
+{
+    return (Lanes){} + val;
+}
+
+/// @brief 掩码为0xff的字节写入val
+/// @param reg
+/// @param val
+/// @param mask
+static inline void Blend(Lanes &reg, Lanes val, Lanes mask)
+{
+    reg = (val & mask) | (reg & ~mask);
+}
+
+/// @brief 每个字节的最高位组成的位掩码
+/// @param val
+/// @return
+static inline uint32_t MoveMask(const Lanes &val)
+{
+#if defined(__AVX2__)
+    __m256i v;
+    memcpy(&v, &val, sizeof(v));
+    return (uint32_t)_mm256_movemask_epi8(v);
+#elif defined(__SSE2__)
+    __m128i v;
+    memcpy(&v, &val, sizeof(v));
+    return (uint32_t)_mm_movemask_epi8(v);
+#else
+    uint32_t bits = 0;
+    for (int i = 0; i < BATCH_LANES; ++i)
+        bits |= (uint32_t)(val[i] >> 7) << i;
+    return bits;
+#endif
+}
+
+/// @brief ALU运算，与Alu()一致
+/// @param op 运算，即控制字中的OP_*字段
+/// @param a 寄存器A的值
+/// @param b 寄存器B的值
+/// @param flags 运算得到的溢出位、零位、奇偶位
+/// @return 运算结果
+static inline Lanes AluLanes(uint32_t op, Lanes a, Lanes b, Lanes &flags)
+{
+    Lanes result;
+    Lanes overflow = {};
+
+    switch (op & MASK_OP)
+    {
+    case OP_ADD:
+        result = a + b, overflow = (Lanes)(result < a);
+        break;
+    case OP_SUB:
+        result = a - b, overflow = (Lanes)(a < b);
+        break;
+    case OP_INC:
+        result = a + 1, overflow = (Lanes)(a == 0xff);
+        break;
+    case OP_DEC:
+        result = a - 1, overflow = (Lanes)(a == 0);
+        break;
+    case OP_AND:
+        result = a & b;
+        break;
+    case OP_OR:
+        result = a | b;
+        break;
+    case OP_XOR:
+        result = a ^ b;
+        break;
+    default: // OP_NOT
+        result = ~a;
+        break;
+    }
+
+    Lanes parity = result ^ (result >> 4);
+    parity ^= parity >> 2;
+    parity ^= parity >> 1;
+    flags = (overflow & PSW_O) | ((Lanes)(result == 0) & PSW_Z) | ((~parity & 1) << 2);
+    return result;
+}
+
+/// @brief 批量执行引擎
+struct BatchEngine
+{
+    /// @brief 一组实例的寄存器
+    struct Group
+    {
+        Lanes reg[32]; // 下标为pin.h中的编号
+        Lanes pc;
+        Lanes psw;
+        uint64_t cycles[BATCH_LANES];
+        uint64_t instructions[BATCH_LANES];
+        uint8_t watch[256];       // 交给各实例的CPU::watch，标记含已比较过代码的页
+        uint32_t same[256][8];    // 所有实例在该地址的指令都相同，下标为MSR、PC
+    };
+
+    /// @brief 一条指令的分类，由处理函数表得到
+    struct Row
+    {
+        bool uniform;   // 各psw下处理函数相同
+        bool branch;    // 条件转移
+        uint8_t need;   // 各psw下最多需要的微周期数，停止指令还需一个周期检测PIN_HLT
+        Lanes jump;     // 条件转移时按psw查表得到是否跳转
+    };
+
+    const FastEngine *fast;
+    Row rows[256]; // 下标为ir
+
+    /// @brief 由处理函数表生成各指令的分类
+    /// @param fast 已调用Build()的预译码执行引擎
+    BatchEngine(const FastEngine &fast) : fast(&fast)
+    {
+        for (int ir = 0; ir < 256; ++ir)
+        {
+            const Fused *row = &fast.table[ir << 4];
+            Row &r = rows[ir];
+            uint32_t taken;
+            r.uniform = FastEngine::IsUniform(row);
+            r.branch = FastEngine::IsBranch(row, taken);
+            r.need = 0;
+            for (int i = 0; i < 16; ++i)
+                if (row[i].cycles + !row[i].done > r.need)
+                    r.need = row[i].cycles + !row[i].done;
+            for (int i = 0; i < BATCH_LANES; ++i)
+                r.jump[i] = r.branch && ((taken >> (i & 0xf)) & 1) ? 0xff : 0;
+        }
+    }
+
+    /// @brief 将一个实例的寄存器与计数从组中写回CPU
+    static void Store(const Group &g, int lane, CPU &cpu)
+    {
+        for (int i = 0; i < 32; ++i)
+            cpu.reg[i] = g.reg[i][lane];
+        cpu.pc = g.pc[lane];
+        cpu.psw = g.psw[lane];
+        cpu.cycles = g.cycles[lane];
+        cpu.instructions = g.instructions[lane];
+    }
+
+    /// @brief 将一个实例的寄存器与计数从CPU读入组中
+    static void Load(Group &g, int lane, const CPU &cpu)
+    {
+        for (int i = 0; i < 32; ++i)
+            g.reg[i][lane] = cpu.reg[i];
+        g.pc[lane] = cpu.pc;
+        g.psw[lane] = cpu.psw;
+        g.cycles[lane] = cpu.cycles;
+        g.instructions[lane] = cpu.instructions;
+    }
+
+    /// @brief 为位掩码中的实例累加计数
+    static void Count(Group &g, uint32_t bits, uint32_t cycles, uint32_t instructions)
+    {
+        for (int lane = 0; lane < BATCH_LANES; ++lane)
+        {
+            uint64_t sel = (bits >> lane) & 1;
+            g.cycles[lane] += sel * cycles;
+            g.instructions[lane] += sel * instructions;
+        }
+    }
+
+    /// @brief 用向量运算执行一条寄存器之间的指令，含取指，无法执行时返回false
+    /// @param g
+    /// @param mask 执行的实例
+    /// @param f
+    /// @param ir
+    /// @param dst
+    /// @param src
+    /// @param pc 指令地址
+    /// @return
+    static bool ExecLanes(Group &g, const Lanes &mask, const Fused &f, uint8_t ir, uint8_t dst, uint8_t src, uint8_t pc)
+    {
+        uint8_t d = dst & 0x1f, s = src & 0x1f;
+        bool reads = f.kind == K_MOV_RR || f.kind == K_ALU_RR || f.kind == K_CMP_RR;
+        switch (f.kind)
+        {
+        case K_NOP:
+        case K_JMP:
+            break;
+        case K_MOV_RI:
+        case K_MOV_RR:
+        case K_ALU_RI:
+        case K_ALU_RR:
+        case K_CMP_RI:
+        case K_CMP_RR:
+        case K_ALU_R:
+            if (!FastEngine::IsPlain(d) || (reads && !FastEngine::IsPlain(s)))
+                return false;
+            break;
+        default:
+            return false;
+        }
+
+        // 取指
+        Blend(g.reg[IR], Splat(ir), mask);
+        if (f.fetch > 1)
+            Blend(g.reg[DST], Splat(dst), mask);
+        if (f.fetch > 2)
+            Blend(g.reg[SRC], Splat(src), mask);
+        Blend(g.reg[MAR], Splat(pc + f.fetch - 1), mask);
+        Blend(g.pc, Splat(pc + f.fetch), mask);
+
+        Lanes a, flags;
+        switch (f.kind)
+        {
+        case K_JMP:
+            Blend(g.pc, Splat(dst), mask);
+            break;
+        case K_MOV_RI:
+            Blend(g.reg[d], Splat(src), mask);
+            break;
+        case K_MOV_RR:
+            Blend(g.reg[d], g.reg[s], mask);
+            break;
+        case K_ALU_RI:
+        case K_ALU_RR:
+        case K_CMP_RI:
+        case K_CMP_RR:
+        case K_ALU_R:
+            a = g.reg[d];
+            Blend(g.reg[A], a, mask);
+            if (f.kind == K_ALU_RI || f.kind == K_CMP_RI)
+                Blend(g.reg[B], Splat(src), mask);
+            else if (f.kind != K_ALU_R)
+                Blend(g.reg[B], g.reg[s], mask);
+            a = AluLanes(f.last, g.reg[A], g.reg[B], flags);
+            if (f.kind != K_CMP_RI && f.kind != K_CMP_RR)
+                Blend(g.reg[d], a, mask);
+            if (!(f.last & PIN_ALU_INT_W))
+                flags |= g.psw & PSW_IE;
+            else if (!(f.last & PIN_ALU_INT))
+                flags |= PSW_IE;
+            Blend(g.psw, flags, mask);
+            break;
+        default:
+            break;
+        }
+        return true;
+    }
+
+    /// @brief 同步执行一组实例
+    /// @param cpus
+    /// @param n 实例数，不超过BATCH_LANES
+    /// @param maxcycles 每个实例的微周期上限
+    /// @param halted 返回各实例是否因PIN_HLT而停止
+    void RunGroup(CPU *const *cpus, int n, uint64_t maxcycles, bool *halted) const
+    {
+        Group g;
+        uint8_t *watch[BATCH_LANES];
+        const uint8_t *watchbits[BATCH_LANES];
+        uint32_t live = 0; // 仍在执行的实例
+        Lanes alive = {};  // 同live，每个字节对应一个实例
+        memset(&g, 0, sizeof(g));
+
+        for (int lane = 0; lane < n; ++lane)
+        {
+            // 从指令中间开始时先执行到指令边界
+            CPU &cpu = *cpus[lane];
+            bool run = true;
+            while (cpu.cyc != 0 && run)
+            {
+                if (cpu.cycles >= maxcycles)
+                    run = false, halted[lane] = false;
+                else if (!cpu.Step())
+                    run = false, halted[lane] = true;
+            }
+            live |= (uint32_t)run << lane;
+            alive[lane] = run ? 0xff : 0;
+            Load(g, lane, cpu);
+            watch[lane] = cpu.watch, watchbits[lane] = cpu.watchbits;
+            cpu.watch = g.watch, cpu.watchbits = NULL;
+        }
+
+        while (live)
+        {
+            // 以执行的微周期最少的实例为准，使各实例尽量保持在同一位置
+            int lead = __builtin_ctz(live);
+            for (uint32_t bits = live & (live - 1); bits; bits &= bits - 1)
+            {
+                int lane = __builtin_ctz(bits);
+                if (g.cycles[lane] < g.cycles[lead])
+                    lead = lane;
+            }
+
+            uint8_t msr = g.reg[MSR][lead];
+            uint8_t pc = g.pc[lead];
+            const uint8_t *code = &cpus[lead]->ram[msr << 8];
+            uint8_t ir = code[pc];
+            uint8_t dst = code[(uint8_t)(pc + 1)];
+            uint8_t src = code[(uint8_t)(pc + 2)];
+            const Fused *row = &fast->table[ir << 4];
+
+            const Row &r = rows[ir];
+
+            // 第一次执行到某个地址时比较所有实例在此处的指令，之后该页被写入前不再比较
+            uint32_t &same = g.same[msr][pc >> 5];
+            if (!(same & (1u << (pc & 31))))
+            {
+                bool equal = true;
+                for (int lane = 0; lane < n && equal; ++lane)
+                {
+                    const uint8_t *c = &cpus[lane]->ram[msr << 8];
+                    equal = c[pc] == ir && c[(uint8_t)(pc + 1)] == dst && c[(uint8_t)(pc + 2)] == src;
+                }
+                if (equal)
+                    same |= 1u << (pc & 31), g.watch[msr] = WATCH_CODE;
+            }
+            bool equal = same & (1u << (pc & 31));
+
+            // 找出执行同一条指令的实例，剩余微周期不足一条指令的实例逐微周期执行到上限
+            Lanes mask = alive & (Lanes)((g.reg[MSR] == msr) & (g.pc == pc));
+            uint32_t bits = MoveMask(mask);
+            for (uint32_t rest = bits; rest; rest &= rest - 1)
+            {
+                int lane = __builtin_ctz(rest);
+                CPU &cpu = *cpus[lane];
+                if (!equal)
+                {
+                    const uint8_t *c = &cpu.ram[msr << 8];
+                    if (c[pc] != ir || c[(uint8_t)(pc + 1)] != dst || c[(uint8_t)(pc + 2)] != src)
+                    {
+                        bits &= ~(1u << lane), mask[lane] = 0;
+                        continue;
+                    }
+                }
+                if (g.cycles[lane] + r.need <= maxcycles)
+                    continue;
+                const Fused &f = row[g.psw[lane] & 0xf];
+                if (g.cycles[lane] + f.cycles + !f.done > maxcycles)
+                {
+                    Store(g, lane, cpu);
+                    halted[lane] = cpu.Run(maxcycles);
+                    Load(g, lane, cpu);
+                    if (cpu.watchhit)
+                        cpu.watchhit = false, Unwatch(g);
+                    bits &= ~(1u << lane), mask[lane] = 0;
+                    live &= ~(1u << lane), alive[lane] = 0;
+                }
+            }
+            if (bits == 0)
+                continue;
+
+            if (r.uniform && ExecLanes(g, mask, row[0], ir, dst, src, pc))
+            {
+                Count(g, bits, row->cycles, row->done);
+            }
+            else if (r.branch)
+            {
+                // 按各实例的PSW查表得到是否跳转
+                Lanes jump = __builtin_shuffle(r.jump, g.psw & 0xf) & mask;
+                uint32_t jumpbits = MoveMask(jump);
+                uint32_t taken = MoveMask(r.jump) & 0xffff;
+
+                const Fused &nt = row[__builtin_ctz(~taken)];
+                const Fused &t = row[__builtin_ctz(taken)];
+                ExecLanes(g, mask, nt, ir, dst, src, pc);
+                Blend(g.pc, Splat(dst), jump);
+                Count(g, bits & ~jumpbits, nt.cycles, nt.done);
+                Count(g, jumpbits, t.cycles, t.done);
+            }
+            else
+            {
+                // 其余指令逐个实例执行
+                for (uint32_t rest = bits; rest; rest &= rest - 1)
+                {
+                    int lane = __builtin_ctz(rest);
+                    CPU &cpu = *cpus[lane];
+                    Store(g, lane, cpu);
+                    const Fused &f = row[cpu.psw & 0xf];
+                    FastEngine::Fetch(cpu, f, pc, ir, dst, src);
+                    if (FastEngine::Finish(cpu, f))
+                        live &= ~(1u << lane), alive[lane] = 0, halted[lane] = true;
+                    Load(g, lane, cpu);
+                    if (cpu.watchhit)
+                        cpu.watchhit = false, Unwatch(g);
+                }
+            }
+        }
+
+        for (int lane = 0; lane < n; ++lane)
+        {
+            // 把写入过的页转告实例原来监视的页
+            CPU &cpu = *cpus[lane];
+            Store(g, lane, cpu);
+            cpu.watch = watch[lane], cpu.watchbits = watchbits[lane];
+            for (int page = 0; page < 256 && cpu.watch != NULL; ++page)
+                if (g.watch[page] == WATCH_HIT && cpu.watch[page])
+                    cpu.watch[page] = WATCH_HIT, cpu.watchhit = true;
+        }
+    }
+
+    /// @brief 逐个实例执行后，作废被写入的页中已比较过的指令
+    /// @param g
+    static void Unwatch(Group &g)
+    {
+        for (int page = 0; page < 256; ++page)
+            if (g.watch[page] == WATCH_HIT)
+                g.watch[page] = 0, memset(g.same[page], 0, sizeof(g.same[page]));
+    }
+
+    /// @brief 执行所有实例到停止或达到微周期上限，每个实例的结果与CPU::Run一致
+    /// @param cpus
+    /// @param n 实例数
+    /// @param maxcycles 每个实例的微周期上限
+    /// @param halted 返回各实例是否因PIN_HLT而停止
+    void Run(CPU *const *cpus, size_t n, uint64_t maxcycles, bool *halted) const
+    {
+        if (!fast->fetchok)
+        {
+            for (size_t i = 0; i < n; ++i)
+                halted[i] = cpus[i]->Run(maxcycles);
+            return;
+        }
+        for (size_t i = 0; i < n; i += BATCH_LANES)
+            RunGroup(cpus + i, n - i < BATCH_LANES ? (int)(n - i) : BATCH_LANES, maxcycles, halted + i);
+    }
+};
+
+#endif //_BATCH_H_
@@ -0,0 +1,416 @@
+/**
+ * 基准测试
+ *
+ * 用compiler汇编程序（bench目录），在各执行引擎上运行到停机，记录微周期数与每个微周期的主机时间。
+ * 每个引擎运行几次取最快的一次，jit每次都清空翻译过的代码，翻译的时间也计入。
+ * 各引擎结束时的寄存器与内存须与第一个引擎（默认逐微周期执行）的相同。
+ * 给出基准文件时与之比较，微周期数或时间增加超过阈值即为退化，退出码为1，可在提交前检查。
+ * 基准文件每行为“程序 编码 引擎 微周期数 每微周期纳秒数 波动百分比”，以#开头的行为注释，编码为fixed或varlen，
+ * 基准文件中没有当前编码的结果时拒绝比较。纳秒数为各次测得的最快值，波动为最慢与最快之差，时间超出波动的上沿
+ * 再加阈值才是退化；-w写入已有的文件时合并，同一行的纳秒数取最快、波动扩大到包含新的结果，多次-w即得到本机的波动范围。
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "cpu.h"
+#include "builtin.h"
+#include "fast.h"
+#include "jit.h"
+#include "batch.h"
+
+#ifdef _WIN32
+#define popen  _popen
+#define pclose _pclose
+#endif
+
+/// @brief 一个程序在一个引擎上的结果
+struct BenchResult
+{
+    std::string program;  // 不含目录的文件名
+    std::string encoding; // fixed或varlen
+    std::string engine;
+    uint64_t cycles;
+    uint64_t instructions;
+    double ns;     // 每个微周期的主机时间，batch按实例数平均，取最快的一次
+    double spread; // 最慢一次比最快一次多的百分比
+};
+
+static MicroCode micro;
+static FastEngine fast;
+static JitEngine jit;
+
+/// @brief 打印用法
+static void PrintUsage()
+{
+    std::cout << "bench [options] program..." << std::endl
+              << std::endl
+              << "  program: assembly source, assembled to program.bin, or a .bin file, e.g. bench/*.asm" << std::endl
+              << "  -a file: compiler executable, default ./compiler" << std::endl
+              << "  -m file: microcode file, default built-in table" << std::endl
+              << "  -v:      variable-length encoding, passed to compiler, and the built-in variable-length microcode" << std::endl
+              << "  -c num:  max micro cycles, a program must halt before, default 100000000" << std::endl
+              << "  -e list: comma separated engines, default micro,fast,jit,batch, results must match the first" << std::endl
+              << "  -r num:  runs per engine, the fastest is used, default 3" << std::endl
+              << "  -b file: compare with a baseline written by -w, it must have results for the same encoding" << std::endl
+              << "  -w file: write the results as a baseline, merged into an existing file, run it several times" << std::endl
+              << "           to widen the time band to the spread of this machine" << std::endl
+              << "  -t pct:  allowed increase of host time per cycle over the band, default 10" << std::endl
+              << "  -g pct:  allowed increase of micro cycles, default 0" << std::endl
+              << std::endl
+              << "exit status is 1 when a program fails, the engines differ or a result regresses" << std::endl
+              << std::endl;
+}
+
+/// @brief 去掉路径中的目录
+static std::string BaseName(const std::string &path)
+{
+    size_t pos = path.find_last_of("/\\");
+    return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+
+/// @brief 用compiler汇编源文件，compiler成功时最后输出done
+/// @param compiler
+/// @param src
+/// @param bin
+/// @param varlen
+/// @return
+static bool Assemble(const std::string &compiler, const std::string &src, const std::string &bin, bool varlen)
+{
+    std::string cmd = "\"" + compiler + "\"" + (varlen ? " -v" : "") + " \"" + src + "\" \"" + bin + "\" 2>&1";
+    FILE *pipe = popen(cmd.c_str(), "r");
+    if (pipe == NULL)
+        return false;
+    std::string output, last;
+    char line[256];
+    while (fgets(line, sizeof(line), pipe) != NULL)
+    {
+        output += line;
+        last = line;
+    }
+    if (pclose(pipe) != 0 || last.compare(0, 4, "done") != 0)
+    {
+        std::cout << output;
+        return false;
+    }
+    return true;
+}
+
+/// @brief 读入程序文件
+static bool ReadProgram(const std::string &path, std::vector<uint8_t> &image)
+{
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    if (!in.is_open())
+        return false;
+    image.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    if (image.size() > RAM_SIZE)
+        image.resize(RAM_SIZE);
+    return true;
+}
+
+/// @brief 两个CPU结束时的状态是否相同
+static bool SameState(const CPU &a, const CPU &b)
+{
+    return memcmp(a.reg, b.reg, sizeof(a.reg)) == 0 && a.pc == b.pc && a.psw == b.psw && a.cyc == b.cyc &&
+           a.halt == b.halt && a.cycles == b.cycles && a.instructions == b.instructions &&
+           memcmp(a.ram, b.ram, RAM_SIZE) == 0;
+}
+
+/// @brief 在engine上从头运行一次
+/// @param engine
+/// @param cpus 载入程序的CPU，batch同时运行全部，其他引擎只运行第一个
+/// @param maxcycles
+/// @return 主机时间，秒
+static double RunOnce(const std::string &engine, std::vector<std::unique_ptr<CPU>> &cpus, uint64_t maxcycles)
+{
+    auto beg = std::chrono::steady_clock::now();
+    if (engine == "batch")
+    {
+        std::vector<CPU *> group;
+        for (auto &cpu : cpus)
+            group.push_back(cpu.get());
+        std::unique_ptr<bool[]> halted(new bool[group.size()]());
+        BatchEngine(fast).Run(group.data(), group.size(), maxcycles, halted.get());
+    }
+    else if (engine == "jit")
+    {
+        jit.Flush();
+        jit.Run(*cpus[0], maxcycles);
+    }
+    else if (engine == "fast")
+        fast.Run(*cpus[0], maxcycles);
+    else
+        cpus[0]->Run(maxcycles);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - beg).count();
+}
+
+/// @brief 基准文件中一行的键
+static std::string BaselineKey(const BenchResult &r)
+{
+    return r.program + " " + r.encoding + " " + r.engine;
+}
+
+/// @brief 读入基准文件，键为“程序 编码 引擎”
+static bool ReadBaseline(const std::string &path, std::map<std::string, BenchResult> &baseline)
+{
+    std::ifstream in(path);
+    if (!in.is_open())
+        return false;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::istringstream ss(line);
+        BenchResult r = {};
+        if (line.empty() || line[0] == '#' ||
+            !(ss >> r.program >> r.encoding >> r.engine >> r.cycles >> r.ns >> r.spread))
+            continue;
+        baseline[BaselineKey(r)] = r;
+    }
+    return true;
+}
+
+/// @brief 把结果合并到基准文件，微周期数不同时替换原来的行，否则扩大时间的波动范围
+static bool WriteBaseline(const std::string &path, const std::vector<BenchResult> &results)
+{
+    std::map<std::string, BenchResult> merged;
+    ReadBaseline(path, merged);
+    for (const auto &r : results)
+    {
+        auto it = merged.find(BaselineKey(r));
+        if (it == merged.end() || it->second.cycles != r.cycles)
+        {
+            merged[BaselineKey(r)] = r;
+            continue;
+        }
+        BenchResult &b = it->second;
+        double lo = std::min(b.ns, r.ns);
+        double hi = std::max(b.ns * (1 + b.spread / 100), r.ns * (1 + r.spread / 100));
+        b.ns = lo;
+        b.spread = lo > 0 ? (hi / lo - 1) * 100 : 0;
+    }
+
+    FILE *pf = fopen(path.c_str(), "w");
+    if (pf == NULL)
+        return false;
+    fprintf(pf, "# program encoding engine cycles ns/cycle spread%%, written by bench -w\n");
+    for (const auto &kv : merged)
+    {
+        const BenchResult &r = kv.second;
+        fprintf(pf, "%s %s %s %llu %.3f %.1f\n", r.program.c_str(), r.encoding.c_str(), r.engine.c_str(),
+                (unsigned long long)r.cycles, r.ns, r.spread);
+    }
+    return fclose(pf) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string compiler = "./compiler";
+    std::string microfile;
+    bool varlen = false;
+    uint64_t maxcycles = 100000000;
+    std::string enginelist = "micro,fast,jit,batch";
+    int runs = 3;
+    std::string basefile;
+    std::string writefile;
+    double timepct = 10;
+    double cyclepct = 0;
+    std::vector<std::string> programs;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-a" && i + 1 < argc)
+            compiler = argv[++i];
+        else if (arg == "-m" && i + 1 < argc)
+            microfile = argv[++i];
+        else if (arg == "-v")
+            varlen = true;
+        else if (arg == "-c" && i + 1 < argc)
+            maxcycles = std::strtoull(argv[++i], NULL, 0);
+        else if (arg == "-e" && i + 1 < argc)
+            enginelist = argv[++i];
+        else if (arg == "-r" && i + 1 < argc)
+            runs = std::atoi(argv[++i]);
+        else if (arg == "-b" && i + 1 < argc)
+            basefile = argv[++i];
+        else if (arg == "-w" && i + 1 < argc)
+            writefile = argv[++i];
+        else if (arg == "-t" && i + 1 < argc)
+            timepct = std::atof(argv[++i]);
+        else if (arg == "-g" && i + 1 < argc)
+            cyclepct = std::atof(argv[++i]);
+        else if (arg[0] != '-')
+            programs.push_back(arg);
+        else
+        {
+            PrintUsage();
+            return 0;
+        }
+    }
+
+    std::vector<std::string> engines;
+    std::istringstream list(enginelist);
+    for (std::string name; std::getline(list, name, ',');)
+    {
+        if (name != "micro" && name != "fast" && name != "jit" && name != "batch")
+        {
+            PrintUsage();
+            return 0;
+        }
+        engines.push_back(name);
+    }
+    if (programs.empty() || engines.empty())
+    {
+        PrintUsage();
+        return 0;
+    }
+    if (runs < 1)
+        runs = 1;
+
+    std::map<std::string, BenchResult> baseline;
+    if (!basefile.empty() && !ReadBaseline(basefile, baseline))
+    {
+        std::cout << "error: unable to open baseline file" << std::endl;
+        return 1;
+    }
+    const char *encoding = varlen ? "varlen" : "fixed";
+    if (!basefile.empty())
+    {
+        bool found = false;
+        for (const auto &kv : baseline)
+            found = found || kv.second.encoding == encoding;
+        if (!found)
+        {
+            std::cout << "error: baseline file has no results for the " << encoding << " encoding" << std::endl;
+            return 1;
+        }
+    }
+
+    if (microfile.empty())
+    {
+        const BuiltinMicro &builtin = varlen ? BUILTIN_MICRO_VARLEN : BUILTIN_MICRO;
+        micro.Load(builtin.index, builtin.pool[0], builtin.count);
+    }
+    else if (!micro.Load(microfile.c_str()))
+    {
+        std::cout << "error: unable to load microcode file" << std::endl;
+        return 1;
+    }
+    fast.Build(micro);
+    if (!jit.Init(fast))
+        std::cout << "warning: jit is not available, jit runs the fast engine" << std::endl;
+
+    std::vector<BenchResult> results;
+    int failures = 0;
+    printf("%-14s %-6s %12s %12s %9s %12s\n", "program", "engine", "cycles", "instructions", "ns/cycle",
+           "M cycles/s");
+    for (const std::string &path : programs)
+    {
+        std::string bin = path;
+        if (path.size() < 4 || path.compare(path.size() - 4, 4, ".bin") != 0)
+        {
+            bin = path + ".bin";
+            if (!Assemble(compiler, path, bin, varlen))
+            {
+                std::cout << "error: unable to assemble " << path << std::endl;
+                ++failures;
+                continue;
+            }
+        }
+        std::vector<uint8_t> image;
+        if (!ReadProgram(bin, image))
+        {
+            std::cout << "error: unable to open program file " << bin << std::endl;
+            ++failures;
+            continue;
+        }
+
+        std::unique_ptr<CPU> reference;
+        for (const std::string &engine : engines)
+        {
+            size_t count = engine == "batch" ? BATCH_LANES : 1;
+            std::vector<std::unique_ptr<CPU>> cpus;
+            double best = 0, worst = 0;
+            for (int run = 0; run < runs; ++run)
+            {
+                cpus.clear();
+                for (size_t i = 0; i < count; ++i)
+                {
+                    cpus.emplace_back(new CPU(&micro));
+                    memcpy(cpus.back()->ram, image.data(), image.size());
+                }
+                double sec = RunOnce(engine, cpus, maxcycles);
+                best = run == 0 ? sec : std::min(best, sec);
+                worst = std::max(worst, sec);
+            }
+
+            // 第一个引擎的结果作为参照，batch的每个实例都要相同
+            const CPU &cpu = *cpus[0];
+            bool ok = cpu.halt;
+            if (!ok)
+                std::cout << "error: " << path << " did not halt within " << maxcycles << " cycles on " << engine
+                          << std::endl;
+            if (reference == NULL)
+                reference.reset(new CPU(cpu));
+            for (auto &c : cpus)
+                if (ok && !SameState(*reference, *c))
+                {
+                    std::cout << "error: " << path << " ends in a different state on " << engine << " than on "
+                              << engines[0] << std::endl;
+                    ok = false;
+                }
+            if (!ok)
+            {
+                ++failures;
+                continue;
+            }
+
+            BenchResult r = {BaseName(path), encoding, engine, cpu.cycles, cpu.instructions,
+                             cpu.cycles ? best * 1e9 / cpu.cycles / count : 0, best > 0 ? (worst / best - 1) * 100 : 0};
+            results.push_back(r);
+            printf("%-14s %-6s %12llu %12llu %9.3f %12.2f", r.program.c_str(), engine.c_str(),
+                   (unsigned long long)r.cycles, (unsigned long long)r.instructions, r.ns, r.ns > 0 ? 1e3 / r.ns : 0);
+
+            auto it = baseline.find(BaselineKey(r));
+            if (it != baseline.end())
+            {
+                // 时间与波动范围的上沿比较
+                const BenchResult &b = it->second;
+                double hi = b.ns * (1 + b.spread / 100);
+                double dc = b.cycles ? ((double)r.cycles / b.cycles - 1) * 100 : 0;
+                double dt = hi > 0 ? (r.ns / hi - 1) * 100 : 0;
+                printf("  cycles %+lld", (long long)(r.cycles - b.cycles));
+                if (hi > 0)
+                    printf(", time %+.1f%% over the band", dt);
+                if (dc > cyclepct || dt > timepct)
+                {
+                    printf("  REGRESSION");
+                    ++failures;
+                }
+            }
+            printf("\n");
+        }
+    }
+    fflush(stdout);
+
+    if (!writefile.empty() && !WriteBaseline(writefile, results))
+    {
+        std::cout << "error: unable to write baseline file" << std::endl;
+        return 1;
+    }
+    if (failures != 0)
+    {
+        std::cout << failures << " failure(s)" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,403 @@
+/**
+ * 组合逻辑块的穷举测试
+ *
+ * 从LogicCircuit电路文件中取出一个子电路，用位并行模拟取遍所有输入组合，每次求值64组。
+ * ALU、Full Adder、532 Decoder、Parity、821 Selector有内置的参考模型，逐组比较结果，
+ * ALU的参考模型即emulator使用的Alu()
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include "bitsim.h"
+#include "gatesim.h"
+#include "cpu.h"
+
+#define MAX_FREE_BITS 30 // 取遍的输入最多位数
+
+/// @brief 参考模型
+struct Model
+{
+    const char *circuit;
+    std::vector<std::string> inputs;                        // 参考函数的参数
+    std::vector<std::pair<std::string, uint32_t>> outputs;  // 比较的引脚与比较的位
+    std::vector<std::pair<std::string, uint32_t>> fixed;    // 固定的输入
+    void (*ref)(const uint32_t *in, uint32_t *out);
+};
+
+/// @brief ALU：OP取遍OP_ADD到OP_NOT，ALU引脚的最低位为输出使能；
+/// PSW寄存器的输入即运算得到的标志位，IE位不由运算决定
+static void RefAlu(const uint32_t *in, uint32_t *out)
+{
+    uint8_t flags;
+    out[0] = Alu(in[2] << _OP_SHIFT, (uint8_t)in[0], (uint8_t)in[1], flags);
+    out[1] = out[0];
+    out[2] = flags;
+}
+
+static void RefFullAdder(const uint32_t *in, uint32_t *out)
+{
+    uint32_t sum = in[0] + in[1] + in[2];
+    out[0] = sum & 1, out[1] = sum >> 1;
+}
+
+static void RefDecoder(const uint32_t *in, uint32_t *out)
+{
+    out[0] = 1u << in[0];
+}
+
+static void RefParity(const uint32_t *in, uint32_t *out)
+{
+    out[0] = Parity((uint8_t)in[0]);
+}
+
+/// @brief 821 Selector：EN为1时选A，否则选B
+static void RefSelector(const uint32_t *in, uint32_t *out)
+{
+    out[0] = in[2] ? in[0] : in[1];
+}
+
+static const Model MODELS[] = {
+    {"ALU", {"A", "B", "OP"}, {{"S", 0xff}, {"O", 0xff}, {"Register@84,45/DI", PSW_O | PSW_Z | PSW_P}}, {{"ALU", 1}}, RefAlu},
+    {"Full Adder", {"A", "B", "CI"}, {{"S", 1}, {"CO", 1}}, {}, RefFullAdder},
+    {"532 Decoder", {"I"}, {{"O", 0xffffffff}}, {}, RefDecoder},
+    {"Parity", {"I"}, {{"O", 1}}, {}, RefParity},
+    {"821 Selector", {"A", "B", "EN"}, {{"S", 0xff}}, {}, RefSelector},
+};
+
+/// @brief 打印用法
+static void PrintUsage()
+{
+    std::cout << "bitsim [options] circuit" << std::endl
+              << std::endl
+              << "  circuit:    name of the circuit to test, e.g. ALU, \"Full Adder\"" << std::endl
+              << "  -x file:    circuit file, default cpu/MyCPU.CircuitProject" << std::endl
+              << "  -C dir:     netlist cache, default .netcache, \"\" to disable" << std::endl
+              << "  -p pin:     observe pin, may be repeated, default all combinational outputs" << std::endl
+              << "  -s pin=num: fix input pin, the other inputs take all values" << std::endl
+              << "  -g file:    write generated C++ code to file" << std::endl
+              << "  -t:         print truth table" << std::endl
+              << "  -e:         also run event-driven simulation and compare" << std::endl
+              << std::endl;
+}
+
+/// @brief 打印一个引脚的值，未驱动的位打印为z
+static std::string Format(uint32_t v, uint32_t z, size_t width)
+{
+    std::string s;
+    for (size_t b = width; b-- > 0;)
+        s += (z >> b) & 1 ? 'z' : (char)('0' + ((v >> b) & 1));
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string circuitfile = "cpu/MyCPU.CircuitProject";
+    std::string cachedir = ".netcache";
+    std::string circuit;
+    std::vector<std::string> pins;
+    std::vector<std::pair<std::string, uint32_t>> fixed;
+    std::string genfile;
+    bool table = false;
+    bool event = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-x" && i + 1 < argc)
+            circuitfile = argv[++i];
+        else if (arg == "-C" && i + 1 < argc)
+            cachedir = argv[++i];
+        else if (arg == "-p" && i + 1 < argc)
+            pins.push_back(argv[++i]);
+        else if (arg == "-s" && i + 1 < argc && strchr(argv[i + 1], '=') != NULL)
+        {
+            std::string s = argv[++i];
+            size_t eq = s.find('=');
+            fixed.emplace_back(s.substr(0, eq), (uint32_t)std::strtoul(s.c_str() + eq + 1, NULL, 0));
+        }
+        else if (arg == "-g" && i + 1 < argc)
+            genfile = argv[++i];
+        else if (arg == "-t")
+            table = true;
+        else if (arg == "-e")
+            event = true;
+        else if (arg[0] != '-' && circuit.empty())
+            circuit = arg;
+        else
+        {
+            PrintUsage();
+            return 0;
+        }
+    }
+
+    if (circuit.empty())
+    {
+        PrintUsage();
+        return 0;
+    }
+
+    // 有参考模型且没有指定观察的引脚时按模型比较，命令行固定的输入优先
+    const Model *model = NULL;
+    for (const Model &m : MODELS)
+        if (circuit == m.circuit && pins.empty())
+            model = &m;
+    if (model != NULL)
+    {
+        for (const auto &item : model->outputs)
+            pins.push_back(item.first);
+        for (const auto &item : model->fixed)
+        {
+            bool given = false;
+            for (const auto &f : fixed)
+                given = given || f.first == item.first;
+            if (!given)
+                fixed.push_back(item);
+        }
+    }
+
+    auto beg = std::chrono::steady_clock::now();
+    static Netlist netlist;
+    static NetIndex index;
+    static BitSim sim;
+    std::string error;
+    bool cached = false;
+    if (!LoadNetlistCached(circuitfile, cachedir, netlist, index, error, &cached, circuit) || !sim.Build(netlist, pins, error))
+    {
+        std::cout << "error: " << error << std::endl;
+        return 0;
+    }
+    auto built = std::chrono::steady_clock::now();
+    std::cout << "circuit: " << circuit << ", " << netlist.gates.size() << " gates, " << sim.ops.size()
+              << " operations in " << sim.depth << " levels, build time: "
+              << std::chrono::duration<double>(built - beg).count() * 1000 << " ms" << (cached ? " (cached)" : "") << std::endl;
+    for (const std::string &name : sim.skipped)
+        std::cout << "skip " << name << ": not combinational" << std::endl;
+    for (size_t k = 0; k < sim.outputs.size(); ++k)
+        if (sim.seqbits[k] != 0)
+            std::cout << "pin " << netlist.ports[sim.outputs[k]].name << ": bits "
+                      << Format(sim.seqbits[k], 0, netlist.ports[sim.outputs[k]].nets.size())
+                      << " are not combinational, read as z" << std::endl;
+
+    if (!genfile.empty())
+    {
+        std::string name;
+        for (char c : circuit)
+            name += isalnum((unsigned char)c) ? c : '_';
+        FILE *pf = fopen(genfile.c_str(), "w");
+        if (pf == NULL)
+        {
+            std::cout << "error: unable to open output file" << std::endl;
+            return 0;
+        }
+        std::string code = sim.Generate("Eval_" + name);
+        fwrite(code.data(), 1, code.size(), pf);
+        fclose(pf);
+    }
+
+    // 输入的取值：固定的输入为常数，其余用到的输入依次占计数器的各位
+    std::vector<uint32_t> value(sim.inputs.size(), 0), shift(sim.inputs.size(), 0);
+    std::vector<uint8_t> free(sim.inputs.size(), 0);
+    for (const auto &f : fixed)
+    {
+        size_t i = 0;
+        while (i < sim.inputs.size() && netlist.ports[sim.inputs[i]].name != f.first)
+            ++i;
+        if (i == sim.inputs.size())
+        {
+            std::cout << "error: no input pin named " << f.first << std::endl;
+            return 0;
+        }
+        value[i] = f.second;
+        free[i] = 2;
+    }
+    uint32_t nbits = 0;
+    for (size_t i = 0; i < sim.inputs.size(); ++i)
+        if (free[i] == 0 && sim.used[i])
+        {
+            free[i] = 1;
+            shift[i] = nbits;
+            nbits += (uint32_t)netlist.ports[sim.inputs[i]].nets.size();
+        }
+    if (nbits > MAX_FREE_BITS)
+    {
+        std::cout << "error: " << nbits << " input bits to enumerate, fix some with -s" << std::endl;
+        return 0;
+    }
+    uint64_t count = (uint64_t)1 << nbits;
+    uint64_t batches = (count + BITSIM_LANES - 1) / BITSIM_LANES;
+
+    // 第t位在64组中的取值，低6位在组内变化，其余每次求值相同
+    static const uint64_t PATTERN[6] = {0xaaaaaaaaaaaaaaaaull, 0xccccccccccccccccull, 0xf0f0f0f0f0f0f0f0ull,
+                                        0xff00ff00ff00ff00ull, 0xffff0000ffff0000ull, 0xffffffff00000000ull};
+    auto setup = [&](uint64_t batch) {
+        for (size_t i = 0; i < sim.inputs.size(); ++i)
+            for (size_t b = 0; b < netlist.ports[sim.inputs[i]].nets.size(); ++b)
+            {
+                uint64_t &lanes = sim.in[sim.inbase[i] + b];
+                uint32_t t = shift[i] + (uint32_t)b;
+                if (free[i] != 1)
+                    lanes = (value[i] >> b) & 1 ? ~(uint64_t)0 : 0;
+                else if (t < 6)
+                    lanes = PATTERN[t];
+                else
+                    lanes = (batch >> (t - 6)) & 1 ? ~(uint64_t)0 : 0;
+            }
+    };
+    auto inputs = [&](uint64_t k, uint32_t *v) {
+        for (size_t i = 0; i < sim.inputs.size(); ++i)
+        {
+            uint32_t width = (uint32_t)netlist.ports[sim.inputs[i]].nets.size();
+            v[i] = free[i] != 1 ? value[i] : (uint32_t)(k >> shift[i]) & (width >= 32 ? 0xffffffffu : (1u << width) - 1);
+        }
+    };
+
+    // 模拟并保存观察的引脚各位的结果
+    std::vector<uint32_t> outbits;
+    for (size_t p : sim.outputs)
+        for (uint32_t n : netlist.ports[p].nets)
+            outbits.push_back(n);
+    std::vector<uint64_t> results(batches * outbits.size() * 2);
+    beg = std::chrono::steady_clock::now();
+    for (uint64_t batch = 0; batch < batches; ++batch)
+    {
+        setup(batch);
+        sim.Eval();
+        uint64_t *r = &results[batch * outbits.size() * 2];
+        for (size_t j = 0; j < outbits.size(); ++j)
+            r[2 * j] = sim.one[outbits[j]], r[2 * j + 1] = sim.zero[outbits[j]];
+    }
+    auto end = std::chrono::steady_clock::now();
+    double sec = std::chrono::duration<double>(end - beg).count();
+    std::cout << count << " input combinations, " << batches << " evaluations, time: " << sec * 1000 << " ms, "
+              << (sec > 0 ? count / sec / 1e6 : 0) << " M combinations/s" << std::endl;
+
+    // 逐组取出结果
+    std::vector<uint32_t> in(sim.inputs.size()), out(sim.outputs.size()), outz(sim.outputs.size());
+    auto outputs = [&](uint64_t k) {
+        const uint64_t *r = &results[k / BITSIM_LANES * outbits.size() * 2];
+        int lane = (int)(k % BITSIM_LANES);
+        for (size_t o = 0, j = 0; o < sim.outputs.size(); ++o)
+        {
+            out[o] = outz[o] = 0;
+            for (size_t b = 0; b < netlist.ports[sim.outputs[o]].nets.size(); ++b, ++j)
+            {
+                out[o] |= (uint32_t)((r[2 * j] >> lane) & 1) << b;
+                outz[o] |= (uint32_t)((((r[2 * j] | r[2 * j + 1]) >> lane) & 1) ^ 1) << b;
+            }
+        }
+    };
+    auto print = [&](std::ostream &os) {
+        for (size_t i = 0; i < sim.inputs.size(); ++i)
+            if (free[i] != 0)
+                os << netlist.ports[sim.inputs[i]].name << "=" << in[i] << " ";
+        os << "->";
+        for (size_t o = 0; o < sim.outputs.size(); ++o)
+            os << " " << netlist.ports[sim.outputs[o]].name << "="
+               << Format(out[o], outz[o], netlist.ports[sim.outputs[o]].nets.size());
+    };
+
+    if (table)
+        for (uint64_t k = 0; k < count; ++k)
+        {
+            inputs(k, in.data());
+            outputs(k);
+            print(std::cout);
+            std::cout << std::endl;
+        }
+
+    if (model != NULL)
+    {
+        // 参考函数的参数在in中的位置，结果与观察的引脚一一对应
+        std::vector<size_t> args;
+        for (const std::string &name : model->inputs)
+        {
+            size_t i = 0;
+            while (i < sim.inputs.size() && netlist.ports[sim.inputs[i]].name != name)
+                ++i;
+            if (i == sim.inputs.size())
+            {
+                std::cout << "error: model input " << name << " not found" << std::endl;
+                return 0;
+            }
+            args.push_back(i);
+        }
+
+        uint64_t errors = 0;
+        std::vector<uint32_t> arg(args.size()), expect(model->outputs.size());
+        beg = std::chrono::steady_clock::now();
+        for (uint64_t k = 0; k < count; ++k)
+        {
+            inputs(k, in.data());
+            outputs(k);
+            for (size_t j = 0; j < args.size(); ++j)
+                arg[j] = in[args[j]];
+            model->ref(arg.data(), expect.data());
+            bool ok = true;
+            for (size_t o = 0; o < expect.size(); ++o)
+            {
+                uint32_t mask = model->outputs[o].second;
+                ok = ok && (outz[o] & mask) == 0 && ((out[o] ^ expect[o]) & mask) == 0;
+            }
+            if (!ok && errors++ < 10)
+            {
+                std::cout << "mismatch: ";
+                print(std::cout);
+                std::cout << ", expected";
+                for (size_t o = 0; o < expect.size(); ++o)
+                    std::cout << " " << model->outputs[o].first << "="
+                              << Format(expect[o] & model->outputs[o].second, 0, netlist.ports[sim.outputs[o]].nets.size());
+                std::cout << std::endl;
+            }
+        }
+        end = std::chrono::steady_clock::now();
+        std::cout << "check against model: " << (errors == 0 ? "pass" : std::to_string(errors) + " mismatches")
+                  << ", time: " << std::chrono::duration<double>(end - beg).count() * 1000 << " ms" << std::endl;
+    }
+
+    if (event)
+    {
+        // 用事件驱动的模拟逐组求值，比较两种模拟的结果
+        static GateSim gate;
+        gate.Build(netlist);
+        uint64_t errors = 0;
+        beg = std::chrono::steady_clock::now();
+        for (uint64_t k = 0; k < count; ++k)
+        {
+            inputs(k, in.data());
+            for (size_t i = 0; i < sim.inputs.size(); ++i)
+                gate.SetInput(sim.inputs[i], in[i]);
+            gate.Settle();
+            outputs(k);
+            bool ok = true;
+            for (size_t o = 0; o < sim.outputs.size(); ++o)
+            {
+                const NetPort &port = netlist.ports[sim.outputs[o]];
+                for (size_t b = 0; b < port.nets.size(); ++b)
+                {
+                    if ((sim.seqbits[o] >> b) & 1)
+                        continue;
+                    uint8_t v = gate.value[port.nets[b]];
+                    uint8_t w = (outz[o] >> b) & 1 ? LVZ : (uint8_t)((out[o] >> b) & 1);
+                    ok = ok && v == w;
+                }
+            }
+            if (!ok && errors++ < 10)
+            {
+                std::cout << "event-driven differs: ";
+                print(std::cout);
+                std::cout << std::endl;
+            }
+        }
+        end = std::chrono::steady_clock::now();
+        double esec = std::chrono::duration<double>(end - beg).count();
+        std::cout << "event-driven: " << (errors == 0 ? "same" : std::to_string(errors) + " differences")
+                  << ", time: " << esec * 1000 << " ms, " << (sec > 0 ? esec / sec : 0) << "x slower" << std::endl;
+    }
+
+    return 0;
+}
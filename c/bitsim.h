@@ -0,0 +1,545 @@
+/**
+ * 位并行的编译式门级模拟
+ *
+ * 穷举测试ALU、全加器、译码器这类组合逻辑块时，事件驱动的模拟大部分时间花在队列上。
+ * 这里把circuit.h展开的网表按拓扑顺序分层，得到一段没有分支的位运算：每根线用一个uint64_t
+ * 表示64组互不相关的输入下的值，每组占一位，一次求值得到64组结果。
+ * 三种状态用两个位表示，one为1表示驱动为1，zero为1表示驱动为0，都为0时未驱动，
+ * 门对未驱动输入的处理与gatesim.h相同。只读存储器按地址的最小项展开。
+ * 求值顺序可以直接解释执行，也可以用Generate()生成C++源码编译后调用。
+ *
+ * 只模拟观察的引脚所依赖的部分。经过反馈环（触发器）或可写存储器的位不是组合逻辑，不求值，
+ * 如ALU中PSW寄存器的输入，标志位由运算得到，IE位来自寄存器自身。
+ */
+
+#ifndef _BITSIM_H_
+#define _BITSIM_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include "circuit.h"
+
+#define BITSIM_LANES     64 // 一次求值的输入组数
+#define BITSIM_MAX_ABITS 10 // 只读存储器的最大地址位数，展开为1 << abits个最小项
+
+/// @brief 求值顺序中的一步
+struct BitOp
+{
+    enum Kind : uint8_t
+    {
+        GATE,     // 门，index为Netlist::gates中的下标
+        MEMORY,   // 只读存储器，index为Netlist::memories中的下标
+        CONSTANT, // 常量，index为Netlist::constants中的下标
+        INPUT,    // 输入引脚的一位，index为BitSim::in中的下标
+    };
+    Kind kind;
+    uint32_t index;
+    uint32_t net;   // 驱动的线，存储器为第一位读出数据
+    uint32_t level; // 所在的层，输入与常量为0
+};
+
+/// @brief 位并行模拟器
+struct BitSim
+{
+    const Netlist *nl;
+
+    std::vector<size_t> inputs;     // 输入引脚在Netlist::ports中的下标
+    std::vector<uint32_t> inbase;   // 各输入引脚第一位在in中的下标
+    std::vector<uint8_t> used;      // 各输入引脚是否影响观察的引脚
+    std::vector<size_t> outputs;    // 观察的引脚在Netlist::ports中的下标
+    std::vector<uint32_t> seqbits;  // 观察的引脚中不是组合逻辑的位，不求值，一直未驱动
+    std::vector<std::string> skipped; // 默认观察所有输出时，不是组合逻辑而跳过的输出
+    std::vector<BitOp> ops;         // 按层排列的求值顺序
+    std::vector<uint8_t> shared;    // 每根线是否有多个驱动源，此时各驱动源的结果合并
+    std::vector<uint32_t> sharedlist;
+    std::vector<uint8_t> driven;    // 每根线是否有需要求值的驱动源，没有时一直未驱动
+    uint32_t depth;                 // 层数
+
+    std::vector<uint64_t> in;   // 输入引脚的各位，由调用者设置
+    std::vector<uint64_t> one;  // 每根线为1的组
+    std::vector<uint64_t> zero; // 每根线为0的组
+    std::vector<uint64_t> minterm;
+
+    BitSim() : nl(NULL), depth(0)
+    {
+    }
+
+    /// @brief 分层并找出观察的引脚依赖的部分
+    /// @param netlist 在模拟器之后销毁
+    /// @param names 观察的引脚，为空时观察所有组合逻辑的输出引脚
+    /// @param error
+    /// @return
+    bool Build(const Netlist &netlist, const std::vector<std::string> &names, std::string &error)
+    {
+        nl = &netlist;
+        size_t ngates = nl->gates.size(), ncells = ngates + nl->memories.size();
+
+        inputs.clear(), inbase.clear();
+        uint32_t nin = 0;
+        for (size_t p = 0; p < nl->ports.size(); ++p)
+            if (nl->ports[p].kind == NetPort::INPUT)
+            {
+                inputs.push_back(p);
+                inbase.push_back(nin);
+                nin += (uint32_t)nl->ports[p].nets.size();
+            }
+        in.assign(nin, 0);
+
+        for (const NetMemory &m : nl->memories)
+            if (!m.writable && m.abits > BITSIM_MAX_ABITS)
+            {
+                error = "memory " + m.name + " is too large";
+                return false;
+            }
+
+        // 每根线尚未求值的驱动源数，以及读这根线的单元，同一单元多次读同一根线时记多次
+        std::vector<uint32_t> pending(nl->nets, 0), waiting(ncells, 0), netlevel(nl->nets, 0);
+        std::vector<uint32_t> fanidx(nl->nets + 1, 0), fanlist;
+        std::vector<std::pair<uint32_t, uint32_t>> reads;
+        for (size_t g = 0; g < ngates; ++g)
+        {
+            const NetGate &gate = nl->gates[g];
+            ++pending[gate.out];
+            for (uint32_t k = 0; k < gate.count; ++k)
+                reads.emplace_back(nl->pins[gate.first + k], (uint32_t)g);
+            waiting[g] = gate.count;
+        }
+        for (size_t m = 0; m < nl->memories.size(); ++m)
+        {
+            const NetMemory &mem = nl->memories[m];
+            uint32_t first = mem.first + mem.abits + (mem.writable ? mem.dbits : 0);
+            for (int b = 0; b < mem.dbits; ++b)
+                ++pending[nl->pins[first + b]];
+            for (int b = 0; b < mem.abits; ++b)
+                reads.emplace_back(nl->pins[mem.first + b], (uint32_t)(ngates + m));
+            waiting[ngates + m] = mem.abits;
+        }
+        for (const auto &c : nl->constants)
+            ++pending[c.first];
+        for (size_t i = 0; i < inputs.size(); ++i)
+            for (uint32_t v : nl->ports[inputs[i]].nets)
+                ++pending[v];
+        std::sort(reads.begin(), reads.end());
+        for (const auto &r : reads)
+        {
+            ++fanidx[r.first + 1];
+            fanlist.push_back(r.second);
+        }
+        for (size_t n = 0; n < nl->nets; ++n)
+            fanidx[n + 1] += fanidx[n];
+
+        // 拓扑排序：线的驱动源都求值后线就绪，单元的输入都就绪后单元可以求值，
+        // 反馈环中的单元和可写存储器永远不会求值
+        std::vector<BitOp> order;
+        std::vector<uint32_t> ready;
+        auto done = [&](uint32_t net, uint32_t level) {
+            netlevel[net] = std::max(netlevel[net], level);
+            if (--pending[net] == 0)
+                for (uint32_t i = fanidx[net]; i < fanidx[net + 1]; ++i)
+                    if (--waiting[fanlist[i]] == 0)
+                        ready.push_back(fanlist[i]);
+        };
+        for (size_t c = 0; c < ncells; ++c)
+            if (waiting[c] == 0)
+                ready.push_back((uint32_t)c);
+        for (size_t n = 0; n < nl->nets; ++n)
+            if (pending[n] == 0)
+                for (uint32_t i = fanidx[n]; i < fanidx[n + 1]; ++i)
+                    if (--waiting[fanlist[i]] == 0)
+                        ready.push_back(fanlist[i]);
+        for (size_t c = 0; c < nl->constants.size(); ++c)
+        {
+            order.push_back({BitOp::CONSTANT, (uint32_t)c, nl->constants[c].first, 0});
+            done(nl->constants[c].first, 0);
+        }
+        for (size_t i = 0; i < inputs.size(); ++i)
+        {
+            const NetPort &port = nl->ports[inputs[i]];
+            for (size_t b = 0; b < port.nets.size(); ++b)
+            {
+                order.push_back({BitOp::INPUT, inbase[i] + (uint32_t)b, port.nets[b], 0});
+                done(port.nets[b], 0);
+            }
+        }
+        while (!ready.empty())
+        {
+            uint32_t c = ready.back();
+            ready.pop_back();
+            if (c < ngates)
+            {
+                const NetGate &gate = nl->gates[c];
+                uint32_t level = 0;
+                for (uint32_t k = 0; k < gate.count; ++k)
+                    level = std::max(level, netlevel[nl->pins[gate.first + k]]);
+                order.push_back({BitOp::GATE, c, gate.out, level + 1});
+                done(gate.out, level + 1);
+                continue;
+            }
+            const NetMemory &mem = nl->memories[c - ngates];
+            if (mem.writable)
+                continue;
+            uint32_t level = 0;
+            for (int b = 0; b < mem.abits; ++b)
+                level = std::max(level, netlevel[nl->pins[mem.first + b]]);
+            order.push_back({BitOp::MEMORY, c - (uint32_t)ngates, nl->pins[mem.first + mem.abits], level + 1});
+            for (int b = 0; b < mem.dbits; ++b)
+                done(nl->pins[mem.first + mem.abits + b], level + 1);
+        }
+
+        // 观察的引脚
+        outputs.clear(), seqbits.clear(), skipped.clear();
+        auto sequential = [&](const NetPort &port) {
+            uint32_t mask = 0;
+            for (size_t b = 0; b < port.nets.size(); ++b)
+                mask |= (uint32_t)(pending[port.nets[b]] != 0) << b;
+            return mask;
+        };
+        auto all = [](const NetPort &port) {
+            return port.nets.size() >= 32 ? 0xffffffffu : (1u << port.nets.size()) - 1;
+        };
+        for (const std::string &name : names)
+        {
+            const NetPort *port = nl->Port(name);
+            if (port == NULL)
+            {
+                error = "no pin named " + name;
+                return false;
+            }
+            if (port->nets.size() > 32 || sequential(*port) == all(*port))
+            {
+                error = "pin " + name + " depends on a feedback loop or writable memory";
+                return false;
+            }
+            outputs.push_back(port - nl->ports.data());
+            seqbits.push_back(sequential(*port));
+        }
+        if (names.empty())
+            for (size_t p = 0; p < nl->ports.size(); ++p)
+                if (nl->ports[p].kind == NetPort::OUTPUT)
+                {
+                    if (nl->ports[p].nets.size() <= 32 && sequential(nl->ports[p]) != all(nl->ports[p]))
+                    {
+                        outputs.push_back(p);
+                        seqbits.push_back(sequential(nl->ports[p]));
+                    }
+                    else
+                        skipped.push_back(nl->ports[p].name);
+                }
+
+        // 从后向前只保留观察的引脚依赖的部分，驱动源都在读者之前
+        std::vector<uint8_t> need(nl->nets, 0);
+        for (size_t p : outputs)
+            for (uint32_t v : nl->ports[p].nets)
+                need[v] = pending[v] == 0;
+        std::vector<uint32_t> drivers(nl->nets, 0);
+        ops.clear();
+        for (size_t i = order.size(); i-- > 0;)
+        {
+            const BitOp &op = order[i];
+            if (op.kind == BitOp::MEMORY)
+            {
+                const NetMemory &mem = nl->memories[op.index];
+                bool keep = false;
+                for (int b = 0; b < mem.dbits; ++b)
+                    keep = keep || need[nl->pins[mem.first + mem.abits + b]];
+                if (!keep)
+                    continue;
+                for (int b = 0; b < mem.dbits; ++b)
+                    ++drivers[nl->pins[mem.first + mem.abits + b]];
+                for (int b = 0; b < mem.abits; ++b)
+                    need[nl->pins[mem.first + b]] = 1;
+            }
+            else
+            {
+                if (!need[op.net])
+                    continue;
+                ++drivers[op.net];
+                if (op.kind == BitOp::GATE)
+                {
+                    const NetGate &gate = nl->gates[op.index];
+                    for (uint32_t k = 0; k < gate.count; ++k)
+                        need[nl->pins[gate.first + k]] = 1;
+                }
+            }
+            ops.push_back(op);
+        }
+        std::reverse(ops.begin(), ops.end());
+        std::stable_sort(ops.begin(), ops.end(), [](const BitOp &a, const BitOp &b) { return a.level < b.level; });
+
+        depth = 0;
+        used.assign(inputs.size(), 0);
+        for (const BitOp &op : ops)
+        {
+            depth = std::max(depth, op.level);
+            if (op.kind == BitOp::INPUT)
+                for (size_t i = 0; i < inputs.size(); ++i)
+                    if (op.index >= inbase[i] && op.index < inbase[i] + nl->ports[inputs[i]].nets.size())
+                        used[i] = 1;
+        }
+        shared.assign(nl->nets, 0);
+        driven.assign(nl->nets, 0);
+        sharedlist.clear();
+        for (size_t n = 0; n < nl->nets; ++n)
+            driven[n] = drivers[n] != 0;
+        for (size_t n = 0; n < nl->nets; ++n)
+            if (drivers[n] > 1)
+            {
+                shared[n] = 1;
+                sharedlist.push_back((uint32_t)n);
+            }
+        one.assign(nl->nets, 0);
+        zero.assign(nl->nets, 0);
+        return true;
+    }
+
+    /// @brief 写一个驱动源的结果，有多个驱动源时有驱动为1的取1，否则有驱动为0的取0
+    inline void Set(uint32_t net, uint64_t o, uint64_t z)
+    {
+        if (shared[net])
+        {
+            one[net] |= o;
+            zero[net] = (zero[net] | z) & ~one[net];
+        }
+        else
+            one[net] = o, zero[net] = z;
+    }
+
+    /// @brief 求值一个门
+    inline void EvalGate(const NetGate &gate)
+    {
+        const uint32_t *p = &nl->pins[gate.first];
+        uint64_t r, z;
+        switch (gate.type)
+        {
+        case NG_AND:
+            r = ~(uint64_t)0;
+            for (uint32_t k = 0; k < gate.count; ++k)
+                r &= ~zero[p[k]];
+            z = ~r;
+            break;
+        case NG_OR:
+            r = 0;
+            for (uint32_t k = 0; k < gate.count; ++k)
+                r |= one[p[k]];
+            z = ~r;
+            break;
+        case NG_XOR:
+            r = 0;
+            for (uint32_t k = 0; k < gate.count; ++k)
+                r ^= one[p[k]];
+            z = ~r;
+            break;
+        case NG_BUF:
+            r = ~zero[p[0]], z = ~r;
+            break;
+        default: // NG_TRI
+            r = one[p[1]] & one[p[0]], z = one[p[1]] & zero[p[0]];
+            break;
+        }
+        if (gate.invert)
+            std::swap(r, z);
+        Set(gate.out, r, z);
+    }
+
+    /// @brief 求值一块只读存储器：先求出地址的各个最小项，每位读出数据为其中该位为1的字的或
+    void EvalMemory(const NetMemory &mem)
+    {
+        const uint32_t *p = &nl->pins[mem.first];
+        size_t size = (size_t)1 << mem.abits;
+        minterm.resize(size);
+        minterm[0] = ~(uint64_t)0;
+        for (size_t b = 0, n = 1; b < mem.abits; ++b, n *= 2)
+        {
+            uint64_t a = one[p[b]]; // 未驱动的地址视为0
+            for (size_t i = 0; i < n; ++i)
+            {
+                minterm[i + n] = minterm[i] & a;
+                minterm[i] &= ~a;
+            }
+        }
+        const uint32_t *words = &nl->words[mem.data];
+        for (int b = 0; b < mem.dbits; ++b)
+        {
+            uint64_t r = 0;
+            for (size_t i = 0; i < size; ++i)
+                if ((words[i] >> b) & 1)
+                    r |= minterm[i];
+            Set(p[mem.abits + b], r, ~r);
+        }
+    }
+
+    /// @brief 按in求值一次，得到64组结果
+    void Eval()
+    {
+        for (uint32_t n : sharedlist)
+            one[n] = zero[n] = 0;
+        for (const BitOp &op : ops)
+        {
+            switch (op.kind)
+            {
+            case BitOp::GATE:
+                EvalGate(nl->gates[op.index]);
+                break;
+            case BitOp::MEMORY:
+                EvalMemory(nl->memories[op.index]);
+                break;
+            case BitOp::CONSTANT:
+                Set(op.net, nl->constants[op.index].second ? ~(uint64_t)0 : 0, nl->constants[op.index].second ? 0 : ~(uint64_t)0);
+                break;
+            default: // BitOp::INPUT
+                Set(op.net, in[op.index], ~in[op.index]);
+                break;
+            }
+        }
+    }
+
+    /// @brief 读观察的引脚中一组的值，未驱动视为0
+    /// @param k outputs中的下标
+    /// @param lane
+    /// @param z 未驱动的位
+    uint32_t Read(size_t k, int lane, uint32_t &z) const
+    {
+        const NetPort &port = nl->ports[outputs[k]];
+        uint32_t v = 0;
+        z = 0;
+        for (size_t b = 0; b < port.nets.size(); ++b)
+        {
+            uint32_t n = port.nets[b];
+            v |= (uint32_t)((one[n] >> lane) & 1) << b;
+            z |= (uint32_t)((((one[n] | zero[n]) >> lane) & 1) ^ 1) << b;
+        }
+        return v;
+    }
+
+    /// @brief 生成与Eval()相同的C++函数：void name(const uint64_t *in, uint64_t *out)，
+    /// in与BitSim::in相同，out先依次为观察的引脚各位为1的组，再依次为各位为0的组
+    /// @param name 函数名
+    /// @return 源码
+    std::string Generate(const std::string &name) const
+    {
+        // 只有一个门驱动的线zero总是one取反，只保存one
+        std::vector<uint8_t> dual(nl->nets, 0);
+        for (size_t n = 0; n < nl->nets; ++n)
+            dual[n] = shared[n] || !driven[n];
+        for (const BitOp &op : ops)
+            if (op.kind == BitOp::GATE && nl->gates[op.index].type == NG_TRI)
+                dual[op.net] = 1;
+        auto One = [&](uint32_t n) { return driven[n] ? "v" + std::to_string(n) : "(uint64_t)0"; };
+        auto Zero = [&](uint32_t n) { return !driven[n] ? "(uint64_t)0" : dual[n] ? "z" + std::to_string(n) : "~v" + std::to_string(n); };
+        auto NotZero = [&](uint32_t n) { return !driven[n] ? "~(uint64_t)0" : dual[n] ? "~z" + std::to_string(n) : "v" + std::to_string(n); };
+        auto Put = [&](std::ostringstream &os, uint32_t n, const std::string &o, const std::string &z) {
+            if (shared[n])
+                os << "    " << One(n) << " |= " << o << ";\n    " << Zero(n) << " = (" << Zero(n) << " | (" << z << ")) & ~" << One(n) << ";\n";
+            else if (dual[n])
+                os << "    const uint64_t " << One(n) << " = " << o << ", " << Zero(n) << " = " << z << ";\n";
+            else
+                os << "    const uint64_t " << One(n) << " = " << o << ";\n";
+        };
+
+        std::ostringstream os;
+        os << "// generated by bitsim, " << ops.size() << " operations in " << depth << " levels\n";
+        for (size_t i = 0; i < inputs.size(); ++i)
+            os << "// in[" << inbase[i] << "..." << inbase[i] + nl->ports[inputs[i]].nets.size() - 1
+               << "]: " << nl->ports[inputs[i]].name << "\n";
+        uint32_t nout = 0;
+        for (size_t p : outputs)
+            nout += (uint32_t)nl->ports[p].nets.size();
+        for (size_t k = 0, pos = 0; k < outputs.size(); pos += nl->ports[outputs[k]].nets.size(), ++k)
+            os << "// out[" << pos << "..." << pos + nl->ports[outputs[k]].nets.size() - 1
+               << "]: " << nl->ports[outputs[k]].name << ", 0 at out[" << pos + nout << "...]\n";
+        os << "static inline void " << name << "(const uint64_t *in, uint64_t *out)\n{\n";
+        for (uint32_t n : sharedlist)
+            os << "    uint64_t " << One(n) << " = 0, " << Zero(n) << " = 0;\n";
+
+        for (const BitOp &op : ops)
+        {
+            switch (op.kind)
+            {
+            case BitOp::GATE:
+            {
+                const NetGate &gate = nl->gates[op.index];
+                const uint32_t *p = &nl->pins[gate.first];
+                std::string r, z;
+                if (gate.type == NG_TRI)
+                    r = One(p[1]) + " & " + One(p[0]), z = One(p[1]) + " & " + Zero(p[0]);
+                else
+                {
+                    const char *sep = gate.type == NG_AND ? " & " : gate.type == NG_OR ? " | " : " ^ ";
+                    for (uint32_t k = 0; k < gate.count; ++k)
+                    {
+                        if (k != 0)
+                            r += sep;
+                        r += gate.type == NG_AND || gate.type == NG_BUF ? NotZero(p[k]) : One(p[k]);
+                    }
+                    if (gate.count == 0)
+                        r = gate.type == NG_AND ? "~(uint64_t)0" : "(uint64_t)0";
+                    if (gate.invert)
+                        r = "~(" + r + ")";
+                    else if (gate.count > 1)
+                        r = "(" + r + ")";
+                }
+                if (gate.type == NG_TRI && gate.invert)
+                    std::swap(r, z);
+                if (gate.type != NG_TRI)
+                    z = "~" + r;
+                if (dual[op.net] && gate.type != NG_TRI)
+                {
+                    // 多个驱动源时先算出结果再合并
+                    os << "    {\n        const uint64_t t = " << r << ";\n";
+                    os << "        " << One(op.net) << " |= t;\n        " << Zero(op.net) << " = (" << Zero(op.net) << " | ~t) & ~" << One(op.net) << ";\n    }\n";
+                }
+                else
+                    Put(os, op.net, r, z);
+                break;
+            }
+            case BitOp::MEMORY:
+            {
+                const NetMemory &mem = nl->memories[op.index];
+                const uint32_t *p = &nl->pins[mem.first];
+                std::string m = "m" + std::to_string(op.index) + "_";
+                os << "    // " << mem.name << "\n";
+                for (uint32_t i = 0; i < (1u << mem.abits); ++i)
+                {
+                    os << "    const uint64_t " << m << i << " = ";
+                    for (int b = 0; b < mem.abits; ++b)
+                        os << (b != 0 ? " & " : "") << ((i >> b) & 1 ? "" : "~") << One(p[b]);
+                    os << (mem.abits == 0 ? "~(uint64_t)0;\n" : ";\n");
+                }
+                for (int b = 0; b < mem.dbits; ++b)
+                {
+                    std::string r;
+                    for (uint32_t i = 0; i < (1u << mem.abits); ++i)
+                        if ((nl->words[mem.data + i] >> b) & 1)
+                            r += (r.empty() ? "" : " | ") + m + std::to_string(i);
+                    if (r.empty())
+                        r = "(uint64_t)0";
+                    Put(os, p[mem.abits + b], r, "~(" + r + ")");
+                }
+                break;
+            }
+            case BitOp::CONSTANT:
+                Put(os, op.net, nl->constants[op.index].second ? "~(uint64_t)0" : "(uint64_t)0",
+                    nl->constants[op.index].second ? "(uint64_t)0" : "~(uint64_t)0");
+                break;
+            default: // BitOp::INPUT
+                Put(os, op.net, "in[" + std::to_string(op.index) + "]", "~in[" + std::to_string(op.index) + "]");
+                break;
+            }
+        }
+
+        uint32_t pos = 0;
+        for (size_t p : outputs)
+            for (uint32_t n : nl->ports[p].nets)
+            {
+                os << "    out[" << pos << "] = " << One(n) << ", out[" << pos + nout << "] = " << Zero(n) << ";\n";
+                ++pos;
+            }
+        os << "}\n";
+        return os.str();
+    }
+};
+
+#endif //_BITSIM_H_
@@ -0,0 +1,73 @@
+/**
+ * 编译期生成的微程序
+ *
+ * 由micro.h在编译期生成并去重，与controller.c生成的micro.bin逐位相同，
+ * 不需要在启动时读取文件。定长与变长编码各一张
+ */
+
+#ifndef _BUILTIN_H_
+#define _BUILTIN_H_
+
+#include "micro.h"
+#include "rom.h"
+
+#define BUILTIN_MAX_ROWS 64 // 去重后行数的上限
+
+/// @brief 去重后的微程序，布局与rom.h中的压缩格式相同
+struct BuiltinMicro
+{
+    uint16_t index[ROM_ROWS];                   // 下标为ir << 4 | psw，值为pool中的行号
+    uint32_t pool[BUILTIN_MAX_ROWS][ROM_STEPS]; // 去重后的行
+    int count;                                  // 去重后的行数，超过上限时为-1
+    bool ends;                                  // 是否每行都在16个微周期内以PIN_CYC或PIN_HLT结束
+};
+
+/// @brief 在编译期生成所有(ir, psw)的控制字并去重
+/// @param varlen 是否使用变长编码
+/// @return
+constexpr BuiltinMicro BuildMicro(bool varlen)
+{
+    BuiltinMicro m{};
+    m.ends = true;
+
+    for (int i = 0; i < ROM_ROWS; ++i)
+    {
+        uint32_t row[ROM_STEPS] = {};
+        MicroRow(row, i >> 4, i & 0xf, varlen);
+        m.ends = m.ends && MicroRowEnds(row);
+
+        int j = 0;
+        for (; j < m.count; ++j)
+        {
+            bool same = true;
+            for (int k = 0; k < ROM_STEPS && same; ++k)
+                same = m.pool[j][k] == row[k];
+            if (same)
+                break;
+        }
+        if (j == m.count)
+        {
+            if (m.count == BUILTIN_MAX_ROWS)
+            {
+                m.count = -1;
+                return m;
+            }
+            for (int k = 0; k < ROM_STEPS; ++k)
+                m.pool[j][k] = row[k];
+            ++m.count;
+        }
+        m.index[i] = (uint16_t)j;
+    }
+    return m;
+}
+
+constexpr BuiltinMicro BUILTIN_MICRO = BuildMicro(false);       // 定长编码，与micro.bin相同
+constexpr BuiltinMicro BUILTIN_MICRO_VARLEN = BuildMicro(true); // 变长编码，与controller -v相同
+
+static_assert(MICRO_STEPS == ROM_STEPS, "micro.h and rom.h disagree on row length");
+static_assert(BUILTIN_MICRO.count > 0, "too many distinct microcode rows, raise BUILTIN_MAX_ROWS");
+static_assert(BUILTIN_MICRO.ends, "an instruction does not end in PIN_CYC or PIN_HLT within 16 micro cycles");
+static_assert(BUILTIN_MICRO_VARLEN.count > 0, "too many distinct microcode rows, raise BUILTIN_MAX_ROWS");
+static_assert(BUILTIN_MICRO_VARLEN.ends, "an instruction does not end in PIN_CYC or PIN_HLT within 16 micro cycles");
+
+#endif //_BUILTIN_H_
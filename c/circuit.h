@@ -0,0 +1,1134 @@
+/**
+ * LogicCircuit电路文件
+ *
+ * 读取cpu/MyCPU.CircuitProject，把子电路层次展开为位级网表：只剩基本门、三态门、
+ * 存储器、常量和输入（按钮、时钟），分线器与子电路的引脚都只是把线连在一起。
+ * 也可以只展开某个子电路，如ALU，其自身的引脚成为网表的输入与输出。
+ *
+ * 文件中只记录元件的位置与导线的端点，连接关系由坐标决定：导线在端点处相连，
+ * 元件的引脚（jam）落在导线端点或其他引脚上即相连。引脚的位置按LogicCircuit的规则推算：
+ *
+ *   - 基本门宽3，高max(4, 输入数 + 1)，输入在左边，输出在右边中点；时钟、LED、常量、按钮为2 x 2
+ *   - 子电路宽max(3, 上下边最多引脚数 + 1)，高max(4, 左右边最多引脚数 + 1)，
+ *     显示形状的子电路为其中按钮、LED等显示元件的外接矩形
+ *   - 一条边长L上的n个引脚间距s = max(1, L / n)，从max(1, s / 2)开始，按Index和引脚在电路中的位置排列
+ *   - 分线器宽1，高n + 1，宽端在中点，窄端从上到下依次为低位到高位
+ *   - 旋转为绕中心(w / 2, h / 2)顺时针转90度若干次，每次x向下、y向上取整
+ */
+
+#ifndef _CIRCUIT_H_
+#define _CIRCUIT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+
+// 信号的三种状态，LZ为未驱动（三态门关闭或悬空）
+#define LV0 0
+#define LV1 1
+#define LVZ 2
+
+/// @brief 门的类型
+enum NetGateType : uint8_t
+{
+    NG_AND, // 与，未驱动的输入视为1
+    NG_OR,  // 或，未驱动的输入视为0
+    NG_XOR, // 异或，未驱动的输入视为0
+    NG_BUF, // 缓冲，invert为1时为非门
+    NG_TRI, // 三态门，输入为数据与使能，使能不为1时输出未驱动
+};
+
+/// @brief 一个门，输入为pins[first, first + count)
+struct NetGate
+{
+    uint8_t type;   // NetGateType
+    uint8_t invert; // 输出是否取反
+    uint16_t count; // 输入数
+    uint32_t first; // 输入在Netlist::pins中的位置
+    uint32_t out;   // 输出的线
+};
+
+/// @brief 一块存储器，pins[first]开始依次为地址、写入数据、读出数据、写信号，
+/// 只读存储器没有写入数据与写信号
+struct NetMemory
+{
+    uint8_t abits;    // 地址位数
+    uint8_t dbits;    // 数据位数，不超过32
+    uint8_t writable; // 是否可写
+    uint8_t writeon1; // 写信号由0变为1时写入，否则由1变为0时写入
+    uint32_t first;   // 引脚在Netlist::pins中的位置
+    uint32_t data;    // 初始内容在Netlist::words中的位置，共1 << abits个字
+    std::string name; // 所在电路的路径
+};
+
+/// @brief 带名字的一组线，用于设置输入和观察结果
+struct NetPort
+{
+    enum Kind : uint8_t
+    {
+        BUTTON, // 按钮，由模拟器设置
+        CLOCK,  // 时钟，由模拟器设置
+        PROBE,  // 探针
+        PIN,    // 顶层电路中子电路的引脚
+        INPUT,  // 展开的根电路自身的输入引脚，由模拟器设置
+        OUTPUT, // 展开的根电路自身的输出引脚
+    };
+    std::string name;           // 路径，如Power@2,3/POW
+    Kind kind;                  // 类型
+    std::vector<uint32_t> nets; // 从低位到高位
+};
+
+/// @brief 展开后的位级网表，线从0开始编号
+struct Netlist
+{
+    uint32_t nets;                                 // 线数
+    std::vector<NetGate> gates;                    // 门
+    std::vector<uint32_t> pins;                    // 门与存储器引脚所接的线
+    std::vector<NetMemory> memories;               // 存储器
+    std::vector<uint32_t> words;                   // 存储器初始内容
+    std::vector<std::pair<uint32_t, uint8_t>> constants; // 常量驱动的线与值
+    std::vector<NetPort> ports;                    // 输入与观察点
+    std::vector<std::string> blocks;               // 顶层电路中的子电路实例，第0个为顶层电路自身
+    std::vector<uint32_t> gateblock;               // 每个门所在的实例，即blocks中的下标
+    std::vector<uint32_t> memblock;                // 每个存储器所在的实例
+
+    Netlist() : nets(0)
+    {
+    }
+
+    /// @brief 按名字查找
+    /// @param name
+    /// @return 没有时返回NULL
+    const NetPort *Port(const std::string &name) const
+    {
+        for (const NetPort &port : ports)
+            if (port.name == name)
+                return &port;
+        return NULL;
+    }
+};
+
+/// @brief 线的驱动源与读者，只由网表决定，可以与网表一起缓存。驱动源依次为门、存储器读出数据的各位、
+/// 常量、按钮与时钟及输入引脚的各位；读者为单元，依次为门、存储器
+struct NetIndex
+{
+    std::vector<uint32_t> slotnet;  // 驱动源所接的线
+    std::vector<uint32_t> drvidx;   // 线 -> drvlist中的区间，即接在这根线上的驱动源
+    std::vector<uint32_t> drvlist;
+    std::vector<uint32_t> fanidx;   // 线 -> fanlist中的区间，即读这根线的单元
+    std::vector<uint32_t> fanlist;
+    std::vector<uint32_t> memslot;  // 存储器读出数据的第一个驱动源
+    std::vector<uint32_t> portslot; // 按钮、时钟与输入引脚的第一个驱动源，其他观察点为UINT32_MAX
+    uint32_t constslot;             // 第一个常量驱动源
+
+    NetIndex() : constslot(0)
+    {
+    }
+
+    /// @brief 根据网表建立驱动与扇出表
+    /// @param nl
+    void Build(const Netlist &nl)
+    {
+        slotnet.clear();
+        for (const NetGate &gate : nl.gates)
+            slotnet.push_back(gate.out);
+        memslot.clear();
+        for (const NetMemory &m : nl.memories)
+        {
+            memslot.push_back((uint32_t)slotnet.size());
+            uint32_t first = m.first + m.abits + (m.writable ? m.dbits : 0);
+            for (int b = 0; b < m.dbits; ++b)
+                slotnet.push_back(nl.pins[first + b]);
+        }
+        constslot = (uint32_t)slotnet.size();
+        for (const auto &c : nl.constants)
+            slotnet.push_back(c.first);
+        portslot.clear();
+        for (const NetPort &port : nl.ports)
+        {
+            bool input = port.kind == NetPort::BUTTON || port.kind == NetPort::CLOCK || port.kind == NetPort::INPUT;
+            portslot.push_back(input ? (uint32_t)slotnet.size() : UINT32_MAX);
+            if (input)
+                for (uint32_t v : port.nets)
+                    slotnet.push_back(v);
+        }
+
+        // 驱动表
+        drvidx.assign(nl.nets + 1, 0);
+        for (uint32_t n : slotnet)
+            ++drvidx[n + 1];
+        for (size_t n = 0; n < nl.nets; ++n)
+            drvidx[n + 1] += drvidx[n];
+        drvlist.resize(slotnet.size());
+        std::vector<uint32_t> pos(drvidx.begin(), drvidx.end() - 1);
+        for (size_t s = 0; s < slotnet.size(); ++s)
+            drvlist[pos[slotnet[s]]++] = (uint32_t)s;
+
+        // 扇出表，同一单元多次读同一根线时只记一次
+        std::vector<std::pair<uint32_t, uint32_t>> reads;
+        for (size_t g = 0; g < nl.gates.size(); ++g)
+        {
+            const NetGate &gate = nl.gates[g];
+            for (uint32_t k = 0; k < gate.count; ++k)
+                reads.emplace_back(nl.pins[gate.first + k], (uint32_t)g);
+        }
+        for (size_t m = 0; m < nl.memories.size(); ++m)
+        {
+            const NetMemory &mem = nl.memories[m];
+            uint32_t n = mem.abits + (mem.writable ? mem.dbits : 0);
+            for (uint32_t k = 0; k < n; ++k)
+                reads.emplace_back(nl.pins[mem.first + k], (uint32_t)(nl.gates.size() + m));
+            if (mem.writable)
+                reads.emplace_back(nl.pins[mem.first + n + mem.dbits], (uint32_t)(nl.gates.size() + m));
+        }
+        std::sort(reads.begin(), reads.end());
+        reads.erase(std::unique(reads.begin(), reads.end()), reads.end());
+        fanidx.assign(nl.nets + 1, 0);
+        fanlist.clear();
+        for (const auto &r : reads)
+        {
+            ++fanidx[r.first + 1];
+            fanlist.push_back(r.second);
+        }
+        for (size_t n = 0; n < nl.nets; ++n)
+            fanidx[n + 1] += fanidx[n];
+    }
+};
+
+/// @brief XML中的一个元素，如<lc:Wire>，只保留一层子元素的文本
+struct XmlRecord
+{
+    std::string tag;
+    std::unordered_map<std::string, std::string> fields;
+
+    /// @brief 取字段，没有时返回默认值
+    std::string Get(const std::string &name, const std::string &def = "") const
+    {
+        auto it = fields.find(name);
+        return it == fields.end() ? def : it->second;
+    }
+
+    /// @brief 取整数字段
+    int GetInt(const std::string &name, int def = 0) const
+    {
+        auto it = fields.find(name);
+        return it == fields.end() ? def : (int)strtol(it->second.c_str(), NULL, 10);
+    }
+
+    /// @brief 取布尔字段
+    bool GetBool(const std::string &name) const
+    {
+        return Get(name) == "True";
+    }
+};
+
+/// @brief 电路文件
+struct CircuitProject
+{
+    std::vector<XmlRecord> records;
+    std::unordered_map<std::string, size_t> byid;                   // 元素Id -> records中的下标
+    std::unordered_map<std::string, std::vector<size_t>> symbols;   // LogicalCircuitId -> CircuitSymbol
+    std::unordered_map<std::string, std::vector<size_t>> wires;     // LogicalCircuitId -> Wire
+    std::unordered_map<std::string, std::vector<size_t>> circpins;  // LogicalCircuitId -> Pin
+    std::string main;                                               // 顶层电路
+
+    /// @brief 还原XML实体
+    static std::string Unescape(const std::string &s)
+    {
+        static const char *const names[][2] = {{"&lt;", "<"}, {"&gt;", ">"}, {"&amp;", "&"}, {"&quot;", "\""}, {"&apos;", "'"}};
+        std::string out;
+        for (size_t i = 0; i < s.size(); ++i)
+        {
+            bool done = false;
+            if (s[i] == '&')
+            {
+                for (const auto &item : names)
+                {
+                    size_t len = strlen(item[0]);
+                    if (s.compare(i, len, item[0]) == 0)
+                    {
+                        out += item[1], i += len - 1, done = true;
+                        break;
+                    }
+                }
+            }
+            if (!done)
+                out += s[i];
+        }
+        return out;
+    }
+
+    /// @brief 读取电路文件
+    /// @param path
+    /// @param error 失败原因
+    /// @return
+    bool Load(const std::string &path, std::string &error)
+    {
+        FILE *pf = fopen(path.c_str(), "rb");
+        if (pf == NULL)
+        {
+            error = "unable to open " + path;
+            return false;
+        }
+        std::string s;
+        char buf[65536];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), pf)) > 0)
+            s.append(buf, n);
+        fclose(pf);
+        return Parse(s, error);
+    }
+
+    /// @brief 解析文件内容。文件只有两层：根元素下是各个元素，元素下是字段
+    /// @param s
+    /// @param error
+    /// @return
+    bool Parse(const std::string &s, std::string &error)
+    {
+        size_t pos = s.find("<lc:CircuitProject");
+        if (pos == std::string::npos || (pos = s.find('>', pos)) == std::string::npos)
+        {
+            error = "not a LogicCircuit project";
+            return false;
+        }
+
+        auto skipspace = [&]() {
+            while (pos < s.size() && isspace((unsigned char)s[pos]))
+                ++pos;
+        };
+        auto readtag = [&](std::string &tag, bool &closing, bool &empty) {
+            // pos指向'<'
+            size_t end = s.find('>', pos);
+            if (end == std::string::npos || s.compare(pos, 1, "<") != 0)
+                return false;
+            std::string body = s.substr(pos + 1, end - pos - 1);
+            pos = end + 1;
+            closing = !body.empty() && body[0] == '/';
+            empty = !body.empty() && body.back() == '/';
+            size_t b = closing ? 1 : 0, e = body.find_first_of(" /", b);
+            tag = body.substr(b, e == std::string::npos ? std::string::npos : e - b);
+            if (tag.compare(0, 3, "lc:") == 0)
+                tag = tag.substr(3);
+            return true;
+        };
+
+        for (++pos;;)
+        {
+            skipspace();
+            std::string tag, field;
+            bool closing, empty;
+            if (!readtag(tag, closing, empty))
+            {
+                error = "unexpected end of file";
+                return false;
+            }
+            if (closing)
+                break;
+            XmlRecord rec;
+            rec.tag = tag;
+            while (!empty)
+            {
+                skipspace();
+                if (!readtag(field, closing, empty))
+                {
+                    error = "unexpected end of file in " + tag;
+                    return false;
+                }
+                if (closing)
+                    break;
+                if (empty)
+                {
+                    rec.fields[field] = "";
+                    empty = false;
+                    continue;
+                }
+                size_t end = s.find("</lc:" + field + ">", pos);
+                if (end == std::string::npos)
+                {
+                    error = "unterminated " + field + " in " + tag;
+                    return false;
+                }
+                rec.fields[field] = Unescape(s.substr(pos, end - pos));
+                pos = end + field.size() + 6;
+            }
+            records.push_back(std::move(rec));
+        }
+
+        for (size_t i = 0; i < records.size(); ++i)
+        {
+            const XmlRecord &rec = records[i];
+            std::string id = rec.Get(rec.tag + "Id");
+            if (!id.empty())
+                byid[id] = i;
+            if (rec.tag == "CircuitSymbol")
+                symbols[rec.Get("LogicalCircuitId")].push_back(i);
+            else if (rec.tag == "Wire")
+                wires[rec.Get("LogicalCircuitId")].push_back(i);
+            else if (rec.tag == "Pin")
+                circpins[rec.Get("CircuitId")].push_back(i);
+            else if (rec.tag == "Project")
+                main = rec.Get("LogicalCircuitId");
+        }
+        if (byid.find(main) == byid.end())
+        {
+            error = "project has no main circuit";
+            return false;
+        }
+        return true;
+    }
+
+    /// @brief 按Id查找元素
+    /// @param id
+    /// @return 没有时返回NULL，基本门没有对应的元素
+    const XmlRecord *Find(const std::string &id) const
+    {
+        auto it = byid.find(id);
+        return it == byid.end() ? NULL : &records[it->second];
+    }
+
+    /// @brief 电路名，顶层电路没有Name
+    std::string Name(const std::string &id) const
+    {
+        const XmlRecord *rec = Find(id);
+        return rec == NULL ? id : rec->Get("Name", "Main");
+    }
+
+    /// @brief 按名字查找电路
+    /// @param name
+    /// @return LogicalCircuitId，没有时返回空串
+    std::string CircuitByName(const std::string &name) const
+    {
+        for (const XmlRecord &rec : records)
+            if (rec.tag == "LogicalCircuit" && rec.Get("Name") == name)
+                return rec.Get("LogicalCircuitId");
+        return "";
+    }
+};
+
+/// @brief 元件的一个引脚
+struct Jam
+{
+    int x, y;  // 相对元件左上角的位置，旋转前
+    int width; // 位数
+};
+
+/// @brief 元件的外形
+struct SymbolShape
+{
+    enum Kind
+    {
+        GATE,     // 基本门
+        TRISTATE, // 三态门
+        CLOCK,    // 时钟
+        SINK,     // LED、LED矩阵等只显示的元件
+        PIN,      // 子电路内的引脚
+        CONSTANT, // 常量
+        BUTTON,   // 按钮
+        PROBE,    // 探针
+        SPLITTER, // 分线器，jams[0]为宽端
+        MEMORY,   // 存储器，jams依次为地址、写入数据、读出数据、写信号
+        CIRCUIT,  // 子电路，jams与CircuitProject::circpins中的引脚一一对应
+    };
+    Kind kind;
+    int w, h;
+    std::vector<Jam> jams;
+    const XmlRecord *rec; // 对应的元素，基本门为NULL
+    NetGateType type;     // 基本门的类型
+    bool invert;          // 基本门是否取反
+
+    SymbolShape() : kind(SINK), w(2), h(2), rec(NULL), type(NG_AND), invert(false)
+    {
+    }
+};
+
+/// @brief 把子电路展开为网表
+struct Flattener
+{
+    const CircuitProject &proj;
+    Netlist &out;
+    std::string error;
+
+    std::unordered_map<std::string, SymbolShape> shapes; // CircuitId -> 外形
+    std::vector<uint32_t> parent;                        // 线的并查集，展开时两根线相连即合并
+    uint32_t block;                                      // 正在展开的顶层实例，即Netlist::blocks中的下标
+
+    /// @brief 一个电路内各引脚所在的连通块
+    struct Layout
+    {
+        std::vector<std::vector<int>> groups; // 每个元件各引脚所在的连通块
+        std::vector<int> widths;              // 每个连通块的位数
+    };
+    std::unordered_map<std::string, Layout> layouts;
+
+    Flattener(const CircuitProject &proj, Netlist &out) : proj(proj), out(out), block(0)
+    {
+    }
+
+    /// @brief 一条边上n个引脚的位置：单个引脚居中，多个引脚从1开始，等距排到len-1以内
+    static int Place(int n, int len, int i)
+    {
+        if (n == 1)
+            return len / 2;
+        return 1 + i * std::max(1, (len - 2) / (n - 1));
+    }
+
+    /// @brief 向下取整的除2
+    static int FloorHalf(int v)
+    {
+        return v >= 0 ? v / 2 : -((-v + 1) / 2);
+    }
+
+    /// @brief 旋转后引脚相对元件左上角的位置
+    /// @param x
+    /// @param y
+    /// @param w 旋转前的宽
+    /// @param h 旋转前的高
+    /// @param rot 顺时针转90度的次数
+    static void Rotate(int &x, int &y, int w, int h, int rot)
+    {
+        for (int i = 0; i < rot; ++i)
+        {
+            int nx = FloorHalf(w + h - 2 * y);
+            int ny = -FloorHalf(-(h - w + 2 * x));
+            x = nx, y = ny;
+        }
+    }
+
+    static int Rotation(const std::string &name)
+    {
+        return name == "Right" ? 1 : name == "Down" ? 2 : name == "Left" ? 3 : 0;
+    }
+
+    /// @brief 常量、按钮的引脚位置
+    static Jam SideJam(const std::string &side, int width)
+    {
+        if (side == "Left")
+            return {0, 1, width};
+        if (side == "Top")
+            return {1, 0, width};
+        if (side == "Bottom")
+            return {1, 2, width};
+        return {2, 1, width};
+    }
+
+    /// @brief 显示形状的子电路的大小，为其中显示元件的外接矩形
+    bool DisplaySize(const std::string &id, int &w, int &h)
+    {
+        int x0 = INT32_MAX, y0 = INT32_MAX, x1 = INT32_MIN, y1 = INT32_MIN;
+        auto it = proj.symbols.find(id);
+        if (it != proj.symbols.end())
+        {
+            for (size_t i : it->second)
+            {
+                const XmlRecord &sym = proj.records[i];
+                const SymbolShape *shape = Shape(sym.Get("CircuitId"));
+                if (shape == NULL)
+                    return false;
+                bool display = shape->kind == SymbolShape::BUTTON || shape->kind == SymbolShape::SINK ||
+                               (shape->kind == SymbolShape::CIRCUIT && shape->rec->Get("CircuitShape") == "Display");
+                if (!display)
+                    continue;
+                int sw = shape->w, sh = shape->h;
+                if (Rotation(sym.Get("Rotation")) & 1)
+                    std::swap(sw, sh);
+                int x = sym.GetInt("X"), y = sym.GetInt("Y");
+                x0 = std::min(x0, x), y0 = std::min(y0, y);
+                x1 = std::max(x1, x + sw), y1 = std::max(y1, y + sh);
+            }
+        }
+        w = x0 <= x1 ? x1 - x0 : 2;
+        h = y0 <= y1 ? y1 - y0 : 2;
+        return true;
+    }
+
+    /// @brief 元件的外形
+    /// @param id CircuitSymbol的CircuitId
+    /// @return 未知元件返回NULL
+    const SymbolShape *Shape(const std::string &id)
+    {
+        auto it = shapes.find(id);
+        if (it != shapes.end())
+            return &it->second;
+
+        SymbolShape s;
+        s.rec = proj.Find(id);
+        if (s.rec == NULL)
+        {
+            // 基本门的Id为00000000-0000-0000-0000-000000TTNNII，TT为类型，NN为输入数，II为是否取反
+            if (id.size() != 36 || id.compare(0, 30, "00000000-0000-0000-0000-000000") != 0)
+            {
+                error = "unknown element " + id;
+                return NULL;
+            }
+            int type = (int)strtol(id.substr(30, 2).c_str(), NULL, 16);
+            int n = (int)strtol(id.substr(32, 2).c_str(), NULL, 16);
+            s.invert = id.substr(34, 2) != "00";
+            switch (type)
+            {
+            case 1:
+                s.kind = SymbolShape::CLOCK, s.w = s.h = 2;
+                s.jams.push_back({2, 1, 1});
+                break;
+            case 2:
+            case 3:
+            case 4:
+            case 5:
+                s.kind = SymbolShape::GATE, s.w = 3, s.h = std::max(4, n + 1);
+                s.type = type == 2 ? NG_BUF : type == 3 ? NG_OR : type == 4 ? NG_AND : NG_XOR;
+                for (int i = 0; i < n; ++i)
+                    s.jams.push_back({0, Place(n, s.h, i), 1});
+                s.jams.push_back({3, s.h / 2, 1});
+                break;
+            case 8:
+                // LED与七段数码管只用于显示
+                s.kind = SymbolShape::SINK;
+                s.w = n == 1 ? 2 : 3, s.h = n == 1 ? 2 : 5;
+                break;
+            case 10:
+            case 11:
+                s.kind = SymbolShape::TRISTATE, s.w = 3, s.h = 4;
+                s.type = NG_TRI;
+                s.jams.push_back({0, 2, 1});
+                s.jams.push_back({1, 0, 1});
+                s.jams.push_back({3, 2, 1});
+                break;
+            default:
+                error = "unsupported gate " + id;
+                return NULL;
+            }
+            return &shapes.emplace(id, std::move(s)).first->second;
+        }
+
+        const XmlRecord &rec = *s.rec;
+        if (rec.tag == "Pin")
+        {
+            s.kind = SymbolShape::PIN, s.w = s.h = 2;
+            bool output = rec.Get("PinType") == "Output";
+            s.jams.push_back({output ? 0 : 2, 1, rec.GetInt("BitWidth", 1)});
+        }
+        else if (rec.tag == "Constant" || rec.tag == "CircuitButton")
+        {
+            s.kind = rec.tag == "Constant" ? SymbolShape::CONSTANT : SymbolShape::BUTTON;
+            s.w = s.h = 2;
+            s.jams.push_back(SideJam(rec.Get("PinSide", "Right"), rec.GetInt("BitWidth", 1)));
+        }
+        else if (rec.tag == "CircuitProbe")
+        {
+            s.kind = SymbolShape::PROBE, s.w = s.h = 2;
+            s.jams.push_back({0, 1, 0});
+        }
+        else if (rec.tag == "LedMatrix")
+        {
+            s.kind = SymbolShape::SINK;
+            s.w = rec.GetInt("Columns", 1) + 1, s.h = rec.GetInt("Rows", 1) + 1;
+        }
+        else if (rec.tag == "Splitter")
+        {
+            int width = rec.GetInt("BitWidth", 1), n = std::max(1, rec.GetInt("PinCount", 1));
+            bool clockwise = rec.GetBool("Clockwise");
+            s.kind = SymbolShape::SPLITTER, s.w = 1, s.h = n + 1;
+            s.jams.push_back({clockwise ? 0 : 1, s.h / 2, width});
+            for (int i = 0; i < n; ++i)
+                s.jams.push_back({clockwise ? 1 : 0, i + 1, width / n});
+        }
+        else if (rec.tag == "Memory")
+        {
+            int abits = rec.GetInt("AddressBitWidth", 1), dbits = rec.GetInt("DataBitWidth", 1);
+            s.kind = SymbolShape::MEMORY, s.w = 3, s.h = 4;
+            if (rec.GetBool("Writable"))
+            {
+                s.jams.push_back({0, 1, abits});
+                s.jams.push_back({0, 3, dbits});
+                s.jams.push_back({3, 2, dbits});
+                s.jams.push_back({1, 4, 1});
+            }
+            else
+            {
+                s.jams.push_back({0, 2, abits});
+                s.jams.push_back({3, 2, dbits});
+            }
+        }
+        else if (rec.tag == "LogicalCircuit")
+        {
+            // 按边分组，同一边按Index排列，Index相同时按引脚在电路中的位置，左右边从上到下，上下边从左到右，
+            // 仍相同时再按另一个坐标
+            static const char *const sides[] = {"Left", "Top", "Right", "Bottom"};
+            typedef std::pair<int, std::pair<int, int>> PinKey;
+            std::vector<std::pair<PinKey, size_t>> side[4];
+            std::vector<size_t> pins;
+            auto it = proj.circpins.find(id);
+            if (it != proj.circpins.end())
+                pins = it->second;
+            std::unordered_map<std::string, std::pair<int, int>> where;
+            auto sit = proj.symbols.find(id);
+            if (sit != proj.symbols.end())
+                for (size_t i : sit->second)
+                    where[proj.records[i].Get("CircuitId")] = std::make_pair(proj.records[i].GetInt("X"), proj.records[i].GetInt("Y"));
+            for (size_t k = 0; k < pins.size(); ++k)
+            {
+                const XmlRecord &pin = proj.records[pins[k]];
+                int sd = (int)(std::find(sides, sides + 4, pin.Get("PinSide", "Left")) - sides) & 3;
+                std::pair<int, int> pos = where[pin.Get("PinId")];
+                std::pair<int, int> key = (sd & 1) ? pos : std::make_pair(pos.second, pos.first);
+                side[sd].push_back(std::make_pair(PinKey(pin.GetInt("Index"), key), k));
+            }
+            for (auto &list : side)
+                std::stable_sort(list.begin(), list.end(),
+                                 [](const std::pair<PinKey, size_t> &a, const std::pair<PinKey, size_t> &b) {
+                                     return a.first < b.first;
+                                 });
+
+            s.kind = SymbolShape::CIRCUIT;
+            if (rec.Get("CircuitShape") == "Display")
+            {
+                shapes.emplace(id, s); // 防止显示元件中出现自身时无限递归
+                if (!DisplaySize(id, s.w, s.h))
+                    return NULL;
+            }
+            else
+            {
+                s.w = std::max<int>(3, (int)std::max(side[1].size(), side[3].size()) + 1);
+                s.h = std::max<int>(4, (int)std::max(side[0].size(), side[2].size()) + 1);
+            }
+            s.jams.resize(pins.size());
+            for (int sd = 0; sd < 4; ++sd)
+            {
+                int n = (int)side[sd].size();
+                for (int i = 0; i < n; ++i)
+                {
+                    size_t k = side[sd][i].second;
+                    Jam &jam = s.jams[k];
+                    jam.width = proj.records[pins[k]].GetInt("BitWidth", 1);
+                    jam.x = sd == 0 ? 0 : sd == 2 ? s.w : Place(n, s.w, i);
+                    jam.y = sd == 1 ? 0 : sd == 3 ? s.h : Place(n, s.h, i);
+                }
+            }
+        }
+        else
+        {
+            error = "unsupported element " + rec.tag;
+            return NULL;
+        }
+        shapes[id] = std::move(s);
+        return &shapes[id];
+    }
+
+    /// @brief 计算电路内的连通关系：导线端点相同即相连，引脚落在同一点即相连
+    const Layout *GetLayout(const std::string &id)
+    {
+        auto found = layouts.find(id);
+        if (found != layouts.end())
+            return &found->second;
+
+        std::map<std::pair<int, int>, int> points;
+        std::vector<int> dsu;
+        auto point = [&](int x, int y) {
+            auto res = points.emplace(std::make_pair(x, y), (int)dsu.size());
+            if (res.second)
+                dsu.push_back((int)dsu.size());
+            return res.first->second;
+        };
+        std::function<int(int)> find = [&](int v) { return dsu[v] == v ? v : dsu[v] = find(dsu[v]); };
+        std::unordered_map<int, int> ends; // 导线端点被几条导线用到
+
+        auto wit = proj.wires.find(id);
+        if (wit != proj.wires.end())
+        {
+            for (size_t i : wit->second)
+            {
+                const XmlRecord &w = proj.records[i];
+                int a = point(w.GetInt("X1"), w.GetInt("Y1"));
+                int b = point(w.GetInt("X2"), w.GetInt("Y2"));
+                ++ends[a], ++ends[b];
+                dsu[find(a)] = find(b);
+            }
+        }
+
+        Layout layout;
+        std::vector<std::vector<int>> ids;
+        auto sit = proj.symbols.find(id);
+        std::vector<size_t> syms;
+        if (sit != proj.symbols.end())
+            syms = sit->second;
+        for (size_t i : syms)
+        {
+            const XmlRecord &sym = proj.records[i];
+            const SymbolShape *shape = Shape(sym.Get("CircuitId"));
+            if (shape == NULL)
+                return NULL;
+            int rot = Rotation(sym.Get("Rotation"));
+            int x0 = sym.GetInt("X"), y0 = sym.GetInt("Y");
+            ids.emplace_back();
+            for (const Jam &jam : shape->jams)
+            {
+                int x = jam.x, y = jam.y;
+                Rotate(x, y, shape->w, shape->h, rot);
+                ids.back().push_back(point(x0 + x, y0 + y));
+            }
+        }
+
+        // 引脚位置按LogicCircuit的规则计算，不再猜测连接：悬空的引脚旁边紧挨着悬空的导线端点时，
+        // 说明两边的布局算法不一致，直接报错而不是把它们接起来
+        std::unordered_map<int, int> used;
+        for (const std::vector<int> &list : ids)
+            for (int p : list)
+                ++used[p];
+        for (const auto &item : points)
+        {
+            int p = item.second;
+            if (ends.count(p) != 0 || used[p] != 1)
+                continue;
+            static const int dx[4] = {1, -1, 0, 0}, dy[4] = {0, 0, 1, -1};
+            for (int d = 0; d < 4; ++d)
+            {
+                auto near = points.find(std::make_pair(item.first.first + dx[d], item.first.second + dy[d]));
+                if (near != points.end() && ends.count(near->second) != 0 && ends[near->second] == 1 && used.count(near->second) == 0)
+                {
+                    error = "pin at " + std::to_string(item.first.first) + "," + std::to_string(item.first.second) + " in " +
+                            proj.Name(id) + " is not connected, but a wire ends next to it";
+                    return NULL;
+                }
+            }
+        }
+
+        // 连通块编号，位数取其中引脚的最大位数
+        std::unordered_map<int, int> dense;
+        for (size_t k = 0; k < syms.size(); ++k)
+        {
+            const SymbolShape *shape = Shape(proj.records[syms[k]].Get("CircuitId"));
+            layout.groups.emplace_back();
+            for (size_t j = 0; j < ids[k].size(); ++j)
+            {
+                auto res = dense.emplace(find(ids[k][j]), (int)layout.widths.size());
+                if (res.second)
+                    layout.widths.push_back(0);
+                int g = res.first->second;
+                layout.widths[g] = std::max(layout.widths[g], shape->jams[j].width);
+                layout.groups.back().push_back(g);
+            }
+        }
+        return &layouts.emplace(id, std::move(layout)).first->second;
+    }
+
+    uint32_t NewNet()
+    {
+        parent.push_back((uint32_t)parent.size());
+        return (uint32_t)parent.size() - 1;
+    }
+
+    uint32_t Find(uint32_t v)
+    {
+        while (parent[v] != v)
+            v = parent[v] = parent[parent[v]];
+        return v;
+    }
+
+    void Join(uint32_t a, uint32_t b)
+    {
+        parent[Find(a)] = Find(b);
+    }
+
+    /// @brief 展开一个电路
+    /// @param id 电路的LogicalCircuitId
+    /// @param outer 外部连接到各引脚的线，与circpins中的顺序一致，顶层电路为空
+    /// @param path 电路的路径，顶层电路为空
+    /// @param depth 嵌套深度
+    /// @return
+    bool Expand(const std::string &id, const std::vector<std::vector<uint32_t>> &outer, const std::string &path, int depth)
+    {
+        if (depth > 64)
+        {
+            error = "circuit " + proj.Name(id) + " is recursive";
+            return false;
+        }
+        const Layout *layout = GetLayout(id);
+        if (layout == NULL)
+            return false;
+
+        // 为每个连通块分配线
+        std::vector<uint32_t> base(layout->widths.size());
+        for (size_t g = 0; g < base.size(); ++g)
+        {
+            base[g] = (uint32_t)parent.size();
+            for (int b = 0; b < layout->widths[g]; ++b)
+                NewNet();
+        }
+        auto nets = [&](int g, int width) {
+            std::vector<uint32_t> v;
+            for (int b = 0; b < width; ++b)
+                v.push_back(b < layout->widths[g] ? base[g] + b : NewNet());
+            return v;
+        };
+
+        const std::vector<size_t> &pins = proj.circpins.count(id) ? proj.circpins.at(id) : std::vector<size_t>();
+        const std::vector<size_t> &syms = proj.symbols.count(id) ? proj.symbols.at(id) : std::vector<size_t>();
+        for (size_t k = 0; k < syms.size(); ++k)
+        {
+            const XmlRecord &sym = proj.records[syms[k]];
+            const std::string cid = sym.Get("CircuitId");
+            const SymbolShape &shape = *Shape(cid);
+            const std::vector<int> &groups = layout->groups[k];
+            std::string where = shape.kind == SymbolShape::CIRCUIT ? proj.Name(cid) : shape.rec != NULL ? shape.rec->tag : "";
+            where += "@" + sym.Get("X") + "," + sym.Get("Y");
+
+            switch (shape.kind)
+            {
+            case SymbolShape::GATE:
+            case SymbolShape::TRISTATE:
+            {
+                NetGate gate;
+                gate.type = shape.type;
+                gate.invert = shape.invert;
+                gate.count = (uint16_t)(groups.size() - 1);
+                gate.first = (uint32_t)out.pins.size();
+                for (size_t j = 0; j + 1 < groups.size(); ++j)
+                    out.pins.push_back(nets(groups[j], 1)[0]);
+                gate.out = nets(groups.back(), 1)[0];
+                out.gates.push_back(gate);
+                out.gateblock.push_back(block);
+                break;
+            }
+            case SymbolShape::CLOCK:
+                out.ports.push_back({path + "Clock" + where, NetPort::CLOCK, nets(groups[0], 1)});
+                break;
+            case SymbolShape::PIN:
+            {
+                size_t idx = std::find(pins.begin(), pins.end(), proj.byid.at(cid)) - pins.begin();
+                std::vector<uint32_t> inner = nets(groups[0], shape.jams[0].width);
+                if (depth == 0)
+                    out.ports.push_back({shape.rec->Get("Name"),
+                                         shape.rec->Get("PinType") == "Output" ? NetPort::OUTPUT : NetPort::INPUT, inner});
+                if (idx < outer.size())
+                    for (size_t b = 0; b < inner.size() && b < outer[idx].size(); ++b)
+                        Join(inner[b], outer[idx][b]);
+                break;
+            }
+            case SymbolShape::CONSTANT:
+            {
+                std::vector<uint32_t> v = nets(groups[0], shape.jams[0].width);
+                uint32_t value = (uint32_t)strtoul(shape.rec->Get("Value", "0").c_str(), NULL, 10);
+                for (size_t b = 0; b < v.size(); ++b)
+                    out.constants.emplace_back(v[b], (uint8_t)((value >> b) & 1));
+                break;
+            }
+            case SymbolShape::BUTTON:
+                out.ports.push_back({path + shape.rec->Get("Notation", where),
+                                     NetPort::BUTTON, nets(groups[0], shape.jams[0].width)});
+                break;
+            case SymbolShape::PROBE:
+                out.ports.push_back({path + shape.rec->Get("Name"), NetPort::PROBE,
+                                     nets(groups[0], layout->widths[groups[0]])});
+                break;
+            case SymbolShape::SPLITTER:
+            {
+                std::vector<uint32_t> wide = nets(groups[0], shape.jams[0].width);
+                size_t n = groups.size() - 1, part = wide.size() / n;
+                for (size_t i = 0; i < n; ++i)
+                {
+                    std::vector<uint32_t> narrow = nets(groups[i + 1], (int)part);
+                    for (size_t b = 0; b < part; ++b)
+                        Join(narrow[b], wide[i * part + b]);
+                }
+                break;
+            }
+            case SymbolShape::MEMORY:
+            {
+                const XmlRecord &rec = *shape.rec;
+                NetMemory mem;
+                mem.abits = (uint8_t)rec.GetInt("AddressBitWidth", 1);
+                mem.dbits = (uint8_t)rec.GetInt("DataBitWidth", 1);
+                mem.writable = rec.GetBool("Writable");
+                mem.writeon1 = rec.Get("WriteOn1", "True") == "True";
+                mem.first = (uint32_t)out.pins.size();
+                mem.data = (uint32_t)out.words.size();
+                mem.name = path + where;
+                if (mem.abits > 24 || mem.dbits > 32)
+                {
+                    error = "memory " + mem.name + " is too large";
+                    return false;
+                }
+                for (size_t j = 0; j < groups.size(); ++j)
+                    for (uint32_t v : nets(groups[j], shape.jams[j].width))
+                        out.pins.push_back(v);
+                LoadData(rec, mem);
+                out.memories.push_back(mem);
+                out.memblock.push_back(block);
+                break;
+            }
+            case SymbolShape::CIRCUIT:
+            {
+                std::vector<std::vector<uint32_t>> inner;
+                const std::vector<size_t> &sub = proj.circpins.count(cid) ? proj.circpins.at(cid) : std::vector<size_t>();
+                for (size_t j = 0; j < groups.size(); ++j)
+                {
+                    inner.push_back(nets(groups[j], shape.jams[j].width));
+                    if (depth == 0)
+                        out.ports.push_back({where + "/" + proj.records[sub[j]].Get("Name"), NetPort::PIN, inner.back()});
+                }
+                if (depth == 0)
+                {
+                    block = (uint32_t)out.blocks.size();
+                    out.blocks.push_back(where);
+                }
+                if (!Expand(cid, inner, path + where + "/", depth + 1))
+                    return false;
+                if (depth == 0)
+                    block = 0;
+                break;
+            }
+            case SymbolShape::SINK:
+                break;
+            }
+        }
+        return true;
+    }
+
+    /// @brief 解码存储器的初始内容：Base64，每个字按字节对齐，小端
+    void LoadData(const XmlRecord &rec, const NetMemory &mem)
+    {
+        static const std::string table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::vector<uint8_t> bytes;
+        uint32_t acc = 0;
+        int bits = 0;
+        for (char c : rec.Get("Data"))
+        {
+            size_t v = table.find(c);
+            if (v == std::string::npos)
+                continue;
+            acc = (acc << 6) | (uint32_t)v, bits += 6;
+            if (bits >= 8)
+                bytes.push_back((uint8_t)(acc >> (bits - 8))), bits -= 8;
+        }
+        size_t size = (size_t)1 << mem.abits, stride = (mem.dbits + 7) / 8;
+        uint32_t mask = mem.dbits >= 32 ? 0xffffffffu : (1u << mem.dbits) - 1;
+        for (size_t i = 0; i < size; ++i)
+        {
+            uint32_t word = 0;
+            for (size_t b = 0; b < stride && i * stride + b < bytes.size(); ++b)
+                word |= (uint32_t)bytes[i * stride + b] << (8 * b);
+            out.words.push_back(word & mask);
+        }
+    }
+
+    /// @brief 展开顶层电路，合并相连的线后重新编号
+    /// @param root 作为根展开的电路名，为空时展开顶层电路，根电路自身的引脚成为INPUT与OUTPUT
+    /// @return
+    bool Run(const std::string &root = "")
+    {
+        std::string id = root.empty() ? proj.main : proj.CircuitByName(root);
+        if (id.empty())
+        {
+            error = "no circuit named " + root;
+            return false;
+        }
+        out.blocks.assign(1, "");
+        if (!Expand(id, {}, "", 0))
+            return false;
+
+        std::vector<uint32_t> dense(parent.size(), UINT32_MAX);
+        uint32_t count = 0;
+        auto remap = [&](uint32_t &v) {
+            uint32_t r = Find(v);
+            if (dense[r] == UINT32_MAX)
+                dense[r] = count++;
+            v = dense[r];
+        };
+        for (NetGate &gate : out.gates)
+            remap(gate.out);
+        for (uint32_t &v : out.pins)
+            remap(v);
+        for (auto &c : out.constants)
+            remap(c.first);
+        for (NetPort &port : out.ports)
+            for (uint32_t &v : port.nets)
+                remap(v);
+        out.nets = count;
+        return true;
+    }
+};
+
+/// @brief 读取电路文件并展开为网表
+/// @param path
+/// @param out
+/// @param error 失败原因
+/// @param root 作为根展开的电路名，为空时展开顶层电路
+/// @return
+static inline bool LoadNetlist(const std::string &path, Netlist &out, std::string &error, const std::string &root = "")
+{
+    CircuitProject proj;
+    if (!proj.Load(path, error))
+        return false;
+    Flattener flat(proj, out);
+    if (!flat.Run(root))
+    {
+        error = flat.error;
+        return false;
+    }
+    return true;
+}
+
+/// @brief 把网表复制为多份，得到多核的大电路，用于测试大电路上的模拟速度。各份互不相连，
+/// 按钮、时钟与输入引脚共用第0份的线；第k份（k > 0）的存储器、观察点与实例名前加"#k/"，
+/// 存储器的下标为第0份的下标加k乘原存储器数
+/// @param nl
+/// @param copies 份数，不大于1时不变
+static inline void ReplicateNetlist(Netlist &nl, int copies)
+{
+    const Netlist one = nl;
+    std::vector<uint32_t> shared(one.nets, UINT32_MAX); // 输入的线 -> 自身
+    for (const NetPort &port : one.ports)
+        if (port.kind == NetPort::BUTTON || port.kind == NetPort::CLOCK || port.kind == NetPort::INPUT)
+            for (uint32_t v : port.nets)
+                shared[v] = v;
+    for (int k = 1; k < copies; ++k)
+    {
+        uint32_t netbase = one.nets * k, pinbase = (uint32_t)nl.pins.size(), wordbase = (uint32_t)nl.words.size();
+        uint32_t blockbase = (uint32_t)nl.blocks.size();
+        std::string prefix = "#" + std::to_string(k) + "/";
+        auto net = [&](uint32_t v) { return shared[v] != UINT32_MAX ? v : netbase + v; };
+        for (NetGate gate : one.gates)
+        {
+            gate.first += pinbase;
+            gate.out = net(gate.out);
+            nl.gates.push_back(gate);
+        }
+        for (uint32_t v : one.pins)
+            nl.pins.push_back(net(v));
+        for (NetMemory mem : one.memories)
+        {
+            mem.first += pinbase;
+            mem.data += wordbase;
+            mem.name = prefix + mem.name;
+            nl.memories.push_back(mem);
+        }
+        nl.words.insert(nl.words.end(), one.words.begin(), one.words.end());
+        for (const auto &c : one.constants)
+            nl.constants.emplace_back(net(c.first), c.second);
+        for (const NetPort &port : one.ports)
+        {
+            if (port.kind == NetPort::BUTTON || port.kind == NetPort::CLOCK || port.kind == NetPort::INPUT)
+                continue;
+            NetPort copy = {prefix + port.name, port.kind, {}};
+            for (uint32_t v : port.nets)
+                copy.nets.push_back(net(v));
+            nl.ports.push_back(copy);
+        }
+        for (const std::string &name : one.blocks)
+            nl.blocks.push_back(prefix + name);
+        for (uint32_t b : one.gateblock)
+            nl.gateblock.push_back(blockbase + b);
+        for (uint32_t b : one.memblock)
+            nl.memblock.push_back(blockbase + b);
+        nl.nets = netbase + one.nets;
+    }
+}
+
+#endif //_CIRCUIT_H_
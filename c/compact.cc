@@ -0,0 +1,451 @@
+/**
+ * 微程序压缩
+ *
+ * 分析每个控制字用到的总线源与目的、读写的寄存器和字段，在结果不变的前提下
+ * 将互不冲突的微周期合并为一个，必要时把无关的微周期提前，生成更短的微程序。
+ * 之后在随机状态下逐个(ir, psw)用CPU分别按原微程序与新微程序执行一条指令并比较全部状态
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdio>
+#include <cstring>
+#include "cpu.h"
+#include "builtin.h"
+#include "asm.h"
+
+// 资源编号：寄存器与pin.h中相同，RAM表示内存
+#define RES_PC      24 // 程序计数器
+#define RES_PSW     25 // 程序状态字
+#define RES_ALLREGS (((1ull << (T2 + 1)) - 1) & ~1ull)
+
+/// @brief 一个控制字的读写集合与字段占用
+struct Step
+{
+    uint32_t word;
+    uint64_t reads;  // 周期开始时读取的资源
+    uint64_t writes; // 周期结束时写入的资源
+    bool bus;        // 是否使用总线（输出或从总线写入）
+    bool alu;        // 是否使用ALU的结果或标志位
+
+    static uint64_t Bit(int r) { return 1ull << r; }
+
+    /// @brief 分析控制字，与CPU::Step()的行为一致
+    /// @param w
+    /// @return
+    static Step Analyze(uint32_t w)
+    {
+        Step s = {w, 0, 0, false, false};
+        const uint64_t addr = Bit(MSR) | Bit(MAR); // 访问内存时用到的地址
+
+        uint8_t out = w & MASK_OUT;
+        if (out)
+        {
+            s.reads |= Bit(out) | (out == RAM ? addr : 0);
+            s.bus = true;
+        }
+        if (w & PIN_SRC_R)
+            s.reads |= Bit(SRC) | RES_ALLREGS, s.bus = true;
+        if (w & PIN_DST_R)
+            s.reads |= Bit(DST) | RES_ALLREGS, s.bus = true;
+
+        if (w & PIN_PC_CS)
+        {
+            if (!(w & PIN_PC_WE))
+                s.reads |= Bit(RES_PC), s.bus = true; // PC输出到总线
+            else if (w & PIN_PC_EN)
+                s.reads |= Bit(RES_PC), s.writes |= Bit(RES_PC); // PC自增
+            else
+                s.writes |= Bit(RES_PC), s.bus = true; // 从总线写PC
+        }
+
+        if (w & (PIN_ALU_OUT | PIN_ALU_PSW))
+        {
+            s.reads |= Bit(A) | Bit(B);
+            s.alu = true;
+        }
+        if (w & PIN_ALU_OUT)
+            s.bus = true;
+        if (w & PIN_ALU_PSW)
+        {
+            s.writes |= Bit(RES_PSW);
+            if (!(w & PIN_ALU_INT_W))
+                s.reads |= Bit(RES_PSW); // 保留原来的中断允许位
+        }
+
+        uint8_t in = (w & MASK_IN) >> _DST_SHIFT;
+        if (in)
+        {
+            s.writes |= Bit(in);
+            s.reads |= in == RAM ? addr : 0;
+            s.bus = true;
+        }
+        if (w & PIN_DST_W)
+            s.reads |= Bit(DST) | addr, s.writes |= RES_ALLREGS, s.bus = true;
+        if (w & PIN_SRC_W)
+            s.reads |= Bit(SRC) | addr, s.writes |= RES_ALLREGS, s.bus = true;
+        return s;
+    }
+
+    /// @brief 之后的控制字b能否与a放在同一个微周期
+    /// @param a 原来在前的控制字
+    /// @param b 原来在后的控制字
+    /// @return
+    static bool Compatible(const Step &a, const Step &b)
+    {
+        if ((b.reads & a.writes) || (a.writes & b.writes))
+            return false; // b依赖a的结果，或写同一个资源
+        if (a.bus && b.bus)
+            return false; // 只有一条总线
+        if ((a.word & MASK_IN) && (b.word & MASK_IN))
+            return false;
+        if ((a.word & MASK_OUT) && (b.word & MASK_OUT))
+            return false;
+        if ((a.word & (PIN_PC_CS | PIN_PC_WE | PIN_PC_EN)) && (b.word & (PIN_PC_CS | PIN_PC_WE | PIN_PC_EN)))
+            return false;
+        if ((a.word & (PIN_ALU_INT_W | PIN_ALU_INT)) && (b.word & (PIN_ALU_INT_W | PIN_ALU_INT)))
+            return false;
+        uint32_t op = (a.word | b.word) & MASK_OP; // 合并后的运算不能改变使用ALU的一方
+        if ((a.alu && (a.word & MASK_OP) != op) || (b.alu && (b.word & MASK_OP) != op))
+            return false;
+        return true;
+    }
+};
+
+/// @brief 压缩一行
+/// @param row 原来的16个控制字
+/// @param out 压缩后的16个控制字
+/// @param fixed 不参与合并和移动的前缀长度，至少为2，即所有行共用的取IR两个微周期
+/// @return 压缩后的微周期数，不能压缩时返回原来的微周期数并原样复制
+static int CompactRow(const uint32_t *row, uint32_t *out, int fixed)
+{
+    memcpy(out, row, ROM_STEPS * sizeof(uint32_t));
+
+    int end = 0;
+    while (end < ROM_STEPS && !(row[end] & (PIN_CYC | PIN_HLT)))
+        ++end;
+    if (end == ROM_STEPS || (row[end] & PIN_HLT) || end < fixed)
+        return end + 1; // 不以PIN_CYC结束、停机或全在前缀中
+
+    // 执行中改写IR或PSW会切换到另一行，这样的行保持原样
+    std::vector<Step> steps;
+    for (int i = fixed; i <= end; ++i)
+    {
+        steps.push_back(Step::Analyze(row[i]));
+        if (i < end && (steps.back().writes & (Step::Bit(IR) | Step::Bit(RES_PSW))))
+            return end + 1;
+    }
+
+    // 按原顺序逐个放入最早的可行微周期
+    std::vector<std::vector<int>> cycles;
+    std::vector<int> at(steps.size());
+    for (int s = 0; s < (int)steps.size(); ++s)
+    {
+        bool last = s == (int)steps.size() - 1;
+        int lb = last ? std::max(0, (int)cycles.size() - 1) : 0; // PIN_CYC只能在最后一个微周期
+        for (int p = 0; p < s; ++p)
+        {
+            if ((steps[s].reads & steps[p].writes) || (steps[s].writes & steps[p].writes))
+                lb = std::max(lb, at[p] + 1);
+            else if (steps[p].reads & steps[s].writes)
+                lb = std::max(lb, at[p]); // 同一周期内读的是周期开始时的值
+        }
+
+        int c = lb;
+        for (; c < (int)cycles.size(); ++c)
+        {
+            bool ok = true;
+            for (int p : cycles[c])
+                ok = ok && (p < s ? Step::Compatible(steps[p], steps[s]) : Step::Compatible(steps[s], steps[p]));
+            if (ok)
+                break;
+        }
+        if (c == (int)cycles.size())
+            cycles.emplace_back();
+        cycles[c].push_back(s);
+        at[s] = c;
+    }
+
+    int len = fixed + (int)cycles.size();
+    if (len >= end + 1)
+        return end + 1;
+    for (int i = fixed; i < ROM_STEPS; ++i)
+        out[i] = 0;
+    for (int c = 0; c < (int)cycles.size(); ++c)
+        for (int s : cycles[c])
+            out[fixed + c] |= steps[s].word;
+    return len;
+}
+
+/// @brief 指令的名字，如“MOV reg, imm”
+/// @param ir
+/// @return
+static std::string Mnemonic(uint8_t ir)
+{
+    static const char *const AM[] = {"imm", "reg", "[imm]", "[reg]"};
+    static const char *const OP2[] = {"MOV", "ADD", "SUB", "AND", "OR", "XOR", "CMP", "?"};
+    static const char *const OP1[] = {"INC", "DEC", "NOT", "JMP", "JO", "JZ", "JP", "JNO",
+                                      "JNZ", "JNP", "PUSH", "POP", "CALL", "INT", "?", "?"};
+    if (ir & ADDR2)
+        return std::string(OP2[(ir >> ADDR2_SHIFT) & 7]) + " " + AM[(ir >> 2) & 3] + ", " + AM[ir & 3];
+    if (ir & ADDR1)
+        return std::string(OP1[(ir >> ADDR1_SHIFT) & 0xf]) + " " + AM[ir & 3];
+    switch (ir)
+    {
+    case NOP:
+        return "NOP";
+    case RET:
+        return "RET";
+    case IRET:
+        return "IRET";
+    case STI:
+        return "STI";
+    case CLI:
+        return "CLI";
+    case HLT:
+        return "HLT";
+    default:
+        return "?";
+    }
+}
+
+/// @brief 在随机状态下分别用两张微程序执行一条指令并比较
+struct Checker
+{
+    CPU a, b;
+    std::vector<uint8_t> pristine; // 两个CPU共同的初始内存
+    uint8_t watch_a[256], watch_b[256];
+    std::mt19937 rng;
+
+    Checker(const MicroCode *ma, const MicroCode *mb) : a(ma), b(mb), pristine(RAM_SIZE), rng(12345)
+    {
+        for (uint8_t &x : pristine)
+            x = (uint8_t)rng();
+        memcpy(a.ram, pristine.data(), RAM_SIZE);
+        memcpy(b.ram, pristine.data(), RAM_SIZE);
+        memset(watch_a, WATCH_CODE, sizeof(watch_a));
+        memset(watch_b, WATCH_CODE, sizeof(watch_b));
+        a.watch = watch_a, b.watch = watch_b;
+    }
+
+    /// @brief 寄存器编号，一半取有效寄存器
+    uint8_t RandomOperand()
+    {
+        uint8_t x = (uint8_t)rng();
+        return (x & 1) ? (uint8_t)(MSR + x % T2) : x;
+    }
+
+    /// @brief 执行一条指令，直到微周期计数器回零或停机
+    static void RunOne(CPU &cpu)
+    {
+        for (int i = 0; i < 64 && cpu.instructions == 0; ++i)
+            if (!cpu.Step())
+                break;
+    }
+
+    /// @brief 比较一次
+    /// @return 是否一致
+    bool Trial(uint8_t ir, uint8_t psw)
+    {
+        a.Reset();
+        for (int i = MSR; i <= T2; ++i)
+            a.reg[i] = (uint8_t)rng();
+        a.pc = (uint8_t)rng();
+        a.psw = psw;
+        uint16_t seg = a.reg[MSR] << 8;
+        a.ram[seg | a.pc] = ir;
+        a.ram[seg | (uint8_t)(a.pc + 1)] = RandomOperand();
+        a.ram[seg | (uint8_t)(a.pc + 2)] = RandomOperand();
+        b.Reset();
+        memcpy(b.reg, a.reg, sizeof(a.reg));
+        b.pc = a.pc, b.psw = a.psw;
+        for (int i = 0; i < 3; ++i)
+            b.ram[seg | (uint8_t)(a.pc + i)] = a.ram[seg | (uint8_t)(a.pc + i)];
+
+        RunOne(a);
+        RunOne(b);
+
+        bool same = memcmp(a.reg, b.reg, sizeof(a.reg)) == 0 && a.pc == b.pc && a.psw == b.psw &&
+                    a.halt == b.halt && a.instructions == b.instructions;
+
+        // 比较并还原写过的页与存放指令的页
+        watch_a[seg >> 8] = watch_b[seg >> 8] = WATCH_HIT;
+        for (int page = 0; page < 256; ++page)
+        {
+            if (watch_a[page] != WATCH_HIT && watch_b[page] != WATCH_HIT)
+                continue;
+            size_t off = (size_t)page << 8;
+            same = same && memcmp(a.ram + off, b.ram + off, 256) == 0;
+            memcpy(a.ram + off, pristine.data() + off, 256);
+            memcpy(b.ram + off, pristine.data() + off, 256);
+            watch_a[page] = watch_b[page] = WATCH_CODE;
+        }
+        return same;
+    }
+};
+
+/// @brief 打印用法
+static void PrintUsage()
+{
+    std::cout << "compact [-m file] [-v] [-z] [-n trials] [output]" << std::endl
+              << std::endl
+              << "  output:   compacted microcode file, default compact.bin" << std::endl
+              << "  -m file:  input microcode file, default built-in table" << std::endl
+              << "  -v:       use built-in variable-length microcode" << std::endl
+              << "  -z:       write compact format, see controller -z" << std::endl
+              << "  -n num:   randomized states checked per (ir, psw), default 256" << std::endl
+              << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string microfile;
+    std::string outfile = "compact.bin";
+    bool varlen = false;
+    bool compact = false;
+    int trials = 256;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-m" && i + 1 < argc)
+            microfile = argv[++i];
+        else if (arg == "-v")
+            varlen = true;
+        else if (arg == "-z")
+            compact = true;
+        else if (arg == "-n" && i + 1 < argc)
+            trials = std::atoi(argv[++i]);
+        else if (arg[0] != '-' && i == argc - 1)
+            outfile = arg;
+        else
+        {
+            PrintUsage();
+            return 0;
+        }
+    }
+
+    static MicroCode original, compacted;
+    if (microfile.empty())
+    {
+        const BuiltinMicro &m = varlen ? BUILTIN_MICRO_VARLEN : BUILTIN_MICRO;
+        original.Load(m.index, m.pool[0], m.count);
+    }
+    else if (!original.Load(microfile.c_str()))
+    {
+        std::cout << "error: unable to load microcode " << microfile << std::endl;
+        return 0;
+    }
+
+    // 前两个微周期在上一条指令的行中执行，所有行必须相同
+    static uint32_t flat[MICRO_SIZE], out[MICRO_SIZE];
+    original.Expand(flat);
+    for (int i = 1; i < ROM_ROWS; ++i)
+    {
+        if (flat[i * ROM_STEPS] != flat[0] || flat[i * ROM_STEPS + 1] != flat[1])
+        {
+            std::cout << "error: rows do not share the first two micro cycles" << std::endl;
+            return 0;
+        }
+    }
+
+    // 逐行压缩，前两个微周期固定
+    static int before[ROM_ROWS], after[ROM_ROWS];
+    for (int i = 0; i < ROM_ROWS; ++i)
+    {
+        const uint32_t *row = flat + i * ROM_STEPS;
+        int end = 0;
+        while (end < ROM_STEPS && !(row[end] & (PIN_CYC | PIN_HLT)))
+            ++end;
+        before[i] = std::min(end + 1, ROM_STEPS);
+        after[i] = std::min(CompactRow(row, out + i * ROM_STEPS, 2), ROM_STEPS);
+    }
+
+    static uint16_t index[ROM_ROWS];
+    static uint32_t pool[ROM_ROWS * ROM_STEPS];
+    int count = RomCompress(out, index, pool);
+    compacted.Load(index, pool, count);
+
+    // 等价性检查
+    Checker checker(&original, &compacted);
+    uint64_t checked = 0;
+    int mismatches = 0;
+    for (int i = 0; i < ROM_ROWS; ++i)
+    {
+        if (before[i] == after[i])
+            continue; // 未改变的行逐字相同
+        for (int t = 0; t < trials; ++t, ++checked)
+        {
+            if (!checker.Trial(i >> 4, i & 0xf))
+            {
+                if (mismatches++ < 10)
+                    std::cout << "mismatch: ir = 0x" << std::hex << (i >> 4) << ", psw = 0x" << (i & 0xf)
+                              << std::dec << " (" << Mnemonic(i >> 4) << ")" << std::endl;
+                break;
+            }
+        }
+    }
+
+    // 按指令输出缩短的微周期数
+    int changed = 0;
+    uint64_t total_before = 0, total_after = 0;
+    char buf[128];
+    std::cout << "  ir  instruction        cycles  psw" << std::endl;
+    for (int ir = 0; ir < 256; ++ir)
+    {
+        uint32_t probe[MICRO_STEPS] = {};
+        if (!MicroRow(probe, (uint8_t)ir, 0, varlen) && microfile.empty())
+            continue; // 未定义的指令
+        for (int psw = 0; psw < 16; ++psw)
+        {
+            int i = ir << 4 | psw;
+            total_before += before[i], total_after += after[i];
+        }
+        for (int psw = 0; psw < 16; ++psw)
+        {
+            int i = ir << 4 | psw;
+            if (before[i] == after[i])
+                continue;
+            // 同一条指令中缩短情况相同的psw合并为一行
+            bool first = true;
+            for (int p = 0; p < psw; ++p)
+                first = first && !(before[ir << 4 | p] == before[i] && after[ir << 4 | p] == after[i]);
+            if (!first)
+                continue;
+            std::string psws;
+            for (int p = psw; p < 16; ++p)
+                if (before[ir << 4 | p] == before[i] && after[ir << 4 | p] == after[i])
+                    psws += (psws.empty() ? "" : ",") + std::to_string(p);
+            snprintf(buf, sizeof(buf), "0x%02x  %-16s %2d -> %-2d %s", ir, Mnemonic(ir).c_str(),
+                     before[i], after[i], psws.size() > 30 ? "all" : psws.c_str());
+            std::cout << buf << std::endl;
+        }
+        for (int psw = 0; psw < 16; ++psw)
+            changed += before[ir << 4 | psw] != after[ir << 4 | psw];
+    }
+    std::cout << std::endl
+              << changed << " of " << ROM_ROWS << " rows shortened, "
+              << total_before - total_after << " micro cycles saved over all defined (ir, psw)" << std::endl;
+
+    if (mismatches)
+    {
+        std::cout << "error: " << mismatches << " row(s) not equivalent, output not written" << std::endl;
+        return 0;
+    }
+    std::cout << "equivalent on " << checked << " randomized states" << std::endl;
+
+    FILE *pf = fopen(outfile.c_str(), "wb");
+    if (pf == NULL)
+    {
+        std::cout << "error: unable to open " << outfile << std::endl;
+        return 0;
+    }
+    if (compact)
+        RomWrite(pf, index, pool, count);
+    else
+        fwrite(out, sizeof(out), 1, pf);
+    fclose(pf);
+    return 0;
+}
@@ -7,8 +7,25 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <chrono>
+#include <cstring>
+#include <iterator>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <sstream>
 #include "asm.h"
 #include "pin.h"
+#include "object.h"
+#include "micro.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define ASM_MMAP // 用mmap读取源文件
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 // 二地址指令
 std::map<std::string, uint8_t> op2 = {
@@ -166,6 +183,18 @@ struct AsmInstruction
     std::string dst;
     std::string src;
 
+    /// @brief 指令的字节数，与micro.h中的MicroLength一致
+    /// @param varlen 是否使用变长编码
+    /// @return
+    size_t Length(bool varlen) const
+    {
+        if (type == LABEL)
+            return 0;
+        if (!varlen || type == TWOADDR)
+            return 3;
+        return type == ONEADDR ? 2 : 1;
+    }
+
     /// @brief 解析指令
     /// @param codeline
     /// @return
@@ -409,6 +438,19 @@ bool GetAM(const std::string &addr, uint8_t &refam, uint8_t &refval)
     return false;
 }
 
+/// @brief 判断字符串是否可以作为标签名，即只含字母
+/// @param str
+/// @return
+bool IsLabel(const std::string &str)
+{
+    if (str.empty())
+        return false;
+    for (char c : str)
+        if (!std::isalpha(c))
+            return false;
+    return true;
+}
+
 /// @brief 检测二地址指令的寻址方式是否符合要求
 /// @param amd
 /// @param ams
@@ -425,8 +467,12 @@ bool CheckAM(uint8_t amd, uint8_t ams)
 /// @brief 编译程序
 /// @param file
 /// @param out
+/// @param varlen 是否使用变长编码：零地址指令1字节，一地址指令2字节，需配合controller -v生成的微程序
+/// @param map 行号表，为NULL时不输出，每行为“地址 行号 类型 内容”，类型I为指令，L为标签
+/// @param obj 不为NULL时生成目标文件：out中转移指令的标签目标为0，标签与重定位项写入obj，
+/// 未定义且不是寄存器的标签视为其他文件中的标签
 /// @return
-bool Compile(const std::vector<CodeLine> &file, std::ofstream &out)
+bool Compile(const std::vector<CodeLine> &file, std::ostream &out, bool varlen, std::ofstream *map, ObjectFile *obj = NULL)
 {
     std::vector<AsmInstruction> instructions;
     for (const CodeLine &codeline : file)
@@ -444,9 +490,11 @@ bool Compile(const std::vector<CodeLine> &file, std::ofstream &out)
 
     size_t programsize = 0;                 // 程序大小
     std::map<std::string, size_t> labelpos; // 标签所在位置
+    std::vector<size_t> pos;                // 每条指令或标签所在位置
     for (size_t i = 0; i < instructions.size(); ++i)
     {
         const AsmInstruction &item = instructions[i];
+        pos.push_back(programsize);
         if (item.type == AsmInstruction::LABEL)
         {
             if (!labelpos.count(item.name))
@@ -461,7 +509,7 @@ bool Compile(const std::vector<CodeLine> &file, std::ofstream &out)
         }
         else
         {
-            programsize += 3; // 指令长度固定为3
+            programsize += item.Length(varlen);
         }
     }
 
@@ -511,10 +559,16 @@ bool Compile(const std::vector<CodeLine> &file, std::ofstream &out)
                 return false;
             }
             op = op1[item.name];
-            if ((op == JMP                                                                  //
-                 || op == JO || op == JZ || op == JP || op == JNO || op == JNZ || op == JNP //
-                 || op == CALL || op == INT)                                                //
-                && labelpos.count(item.dst))
+            bool jump = op == JMP                                                                  //
+                        || op == JO || op == JZ || op == JP || op == JNO || op == JNZ || op == JNP //
+                        || op == CALL || op == INT;
+            if (jump && obj != NULL && IsLabel(item.dst)
+                && (labelpos.count(item.dst) || !regs.count(item.dst)))
+            {
+                obj->relocs.push_back({(uint32_t)pos[i], item.dst}); // 目标由链接器填写
+                item.dst = "0";
+            }
+            else if (jump && labelpos.count(item.dst))
             {
                 item.dst = std::to_string(labelpos[item.dst]); // 跳转指令替换标签为立即数
             }
@@ -527,7 +581,8 @@ bool Compile(const std::vector<CodeLine> &file, std::ofstream &out)
             ir = op | amd;
             out.write((char *)&ir, 1);
             out.write((char *)&dst, 1);
-            out.write((char *)&src, 1);
+            if (!varlen)
+                out.write((char *)&src, 1);
         }
         else if (item.type == AsmInstruction::ZEROADDR)
         {
@@ -541,8 +596,29 @@ bool Compile(const std::vector<CodeLine> &file, std::ofstream &out)
             dst = src = 0;
             ir = op;
             out.write((char *)&ir, 1);
-            out.write((char *)&dst, 1);
-            out.write((char *)&src, 1);
+            if (!varlen)
+            {
+                out.write((char *)&dst, 1);
+                out.write((char *)&src, 1);
+            }
+        }
+    }
+
+    if (obj != NULL)
+    {
+        for (const auto &item : labelpos)
+            obj->symbols.push_back({(uint32_t)item.second, item.first});
+    }
+
+    if (map != NULL)
+    {
+        char addr[8];
+        for (size_t i = 0; i < instructions.size(); ++i)
+        {
+            bool label = instructions[i].type == AsmInstruction::LABEL;
+            snprintf(addr, sizeof(addr), "%04zx", pos[i]);
+            *map << addr << ' ' << file[i].lineno << ' ' << (label ? 'L' : 'I') << ' '
+                 << (label ? instructions[i].name : file[i].line) << std::endl;
         }
     }
 
@@ -551,50 +627,1597 @@ bool Compile(const std::vector<CodeLine> &file, std::ofstream &out)
 
 /*============================================================*/
 
-int main(int argc, char *argv[])
+/// @brief 优化的统计
+struct OptStats
 {
-    std::string srcfile;
-    std::string outfile;
+    size_t removed;     // 删除的指令数
+    size_t bytes;       // 减少的字节数
+    uint64_t cycles;    // 每条路径执行一次少用的微周期数之和，为静态统计
+    size_t dead;        // 删除的无用传送
+    size_t redundant;   // 删除的冗余传送与NOP
+    size_t cmps;        // 删除的CMP
+    size_t threaded;    // 跳过的转移指令
+    size_t unreachable; // 删除的不可达指令
+    size_t skipped;     // 因使用数字转移目标而未优化的文件数
 
-    if (argc == 3)
+    OptStats() : removed(0), bytes(0), cycles(0), dead(0), redundant(0), cmps(0), threaded(0), unreachable(0), skipped(0)
     {
-        srcfile = argv[1];
-        outfile = argv[2];
     }
-    else if (argc == 2)
+
+    void Add(const OptStats &s)
     {
-        srcfile = argv[1];
-        outfile = srcfile + ".bin";
+        removed += s.removed, bytes += s.bytes, cycles += s.cycles;
+        dead += s.dead, redundant += s.redundant, cmps += s.cmps;
+        threaded += s.threaded, unreachable += s.unreachable, skipped += s.skipped;
     }
-    else
+
+    void Print(std::ostream &out) const
     {
-        std::cout << "compiler [srcfile] [outfile]" << std::endl
-                  << std::endl
-                  << "  srcfile: source file path" << std::endl
-                  << "  outfile: output file path" << std::endl
-                  << std::endl;
-        return 0;
+        out << "optimizer: removed " << removed << " instruction(s), " << bytes << " byte(s), "
+            << cycles << " micro cycle(s) on straight-line paths" << std::endl
+            << "  " << dead << " dead move(s), " << redundant << " redundant move(s) or NOP(s), "
+            << cmps << " CMP(s), " << threaded << " jump(s) threaded, " << unreachable << " unreachable" << std::endl;
+        if (skipped)
+            out << "  " << skipped << " file(s) not optimized, jump targets must be labels" << std::endl;
     }
+};
 
-    std::ifstream src;
-    std::ofstream out;
+/// @brief 窥孔优化，在解析后的指令上进行，结果仍为源码行，之后照常由Compile()汇编。
+/// 按基本块做活跃变量分析与值编号，删除无用和冗余的传送、标志位已由上一条运算设置的CMP、
+/// 不可达的指令，并将转移到转移指令的目标直接改为最终目标。
+/// A、B同时是ALU的操作数寄存器，运算、PUSH、POP等指令会改写它们，分析时一并考虑。
+/// 要求所有转移目标都是标签，且程序不把代码当作数据读写；遇到数字目标时不做任何修改
+struct Optimizer
+{
+    static const uint32_t LIVE_O = 1u << 24;    // 溢出位
+    static const uint32_t LIVE_Z = 1u << 25;    // 零位
+    static const uint32_t LIVE_P = 1u << 26;    // 奇偶位
+    static const uint32_t LIVE_FLAGS = LIVE_O | LIVE_Z | LIVE_P;
+    static const uint32_t LIVE_ALL = 0xffffffffu;
 
-    src.open(srcfile, std::ios::in);
-    if (!src.is_open())
+    /// @brief 一条指令或标签
+    struct Ins
     {
-        std::cout << "error: unable to open source file" << std::endl;
-        return 0;
+        CodeLine code;     // 源码行，修改后重新生成
+        AsmInstruction a;  // 解析结果
+        uint8_t op;        // 操作码
+        uint8_t amd, dst;  // 目标寻址方式与值
+        uint8_t ams, src;  // 源寻址方式与值
+        bool target;       // 是否为以标签为目标的转移指令，标签名在a.dst中
+        bool opaque;       // 是否使用了MSR、MAR等特殊寄存器或无效的转移目标，不做分析
+        uint32_t r, w;     // 读取与一定写入的寄存器和标志位
+        bool deleted;
+    };
+
+    std::vector<Ins> ins;
+    std::map<std::string, size_t> labels; // 标签 -> 在ins中的下标
+    bool varlen;
+    bool numeric;       // 是否遇到了数字转移目标
+    int cost[256];      // 每个ir取指加执行的微周期数，取所有psw中最多的
+    bool defined[256];  // 微程序中是否定义了该ir，未定义的指令执行时停机
+
+    static uint32_t Bit(uint8_t reg) { return 1u << reg; }
+
+    static bool IsSpecial(uint8_t reg)
+    {
+        return reg == MSR || reg == MAR || reg == MDR || reg == RAM || reg == IR || reg == DST || reg == SRC;
     }
 
-    out.open(outfile, std::ios::out | std::ios::binary);
-    if (!out.is_open())
+    /// @brief 删除对其写入时可以不保留的寄存器，SP、段寄存器与VEC由硬件隐式使用，不删除
+    static bool IsScratch(uint8_t reg)
     {
-        std::cout << "error: unable to open output file" << std::endl;
-        src.close();
-        return 0;
+        return reg == A || reg == B || reg == C || reg == D || reg == DI || reg == SI || reg == BP || reg == T1 || reg == T2;
+    }
+
+    static bool IsJump(uint8_t op)
+    {
+        return op == JMP || op == JO || op == JZ || op == JP || op == JNO || op == JNZ || op == JNP;
+    }
+
+    Optimizer(bool varlen) : varlen(varlen), numeric(false)
+    {
+        // 成本模型直接取自微程序
+        for (int ir = 0; ir < 256; ++ir)
+        {
+            cost[ir] = 0;
+            for (int psw = 0; psw < 16; ++psw)
+            {
+                uint32_t row[MICRO_STEPS] = {};
+                defined[ir] = MicroRow(row, (uint8_t)ir, (uint8_t)psw, varlen);
+                int n = MICRO_STEPS;
+                for (int i = 0; i < MICRO_STEPS; ++i)
+                    if (row[i] & (PIN_CYC | PIN_HLT))
+                    {
+                        n = i + 1;
+                        break;
+                    }
+                cost[ir] = std::max(cost[ir], n);
+            }
+        }
+    }
+
+    uint8_t Ir(const Ins &i) const
+    {
+        if (i.a.type == AsmInstruction::TWOADDR)
+            return i.op | (i.amd << 2) | i.ams;
+        if (i.a.type == AsmInstruction::ONEADDR)
+            return i.op | i.amd;
+        return i.op;
+    }
+
+    /// @brief 解码一条指令并计算读写集合
+    /// @return 是否为合法指令，不合法时由Compile()报告错误
+    bool Decode(Ins &i)
+    {
+        const AsmInstruction &a = i.a;
+        i.amd = i.dst = i.ams = i.src = 0;
+        i.target = i.opaque = i.deleted = false;
+        i.r = i.w = 0;
+
+        if (a.type == AsmInstruction::TWOADDR)
+        {
+            if (!op2.count(a.name) || !GetAM(a.dst, i.amd, i.dst) || !GetAM(a.src, i.ams, i.src) || !CheckAM(i.amd, i.ams))
+                return false;
+            i.op = op2[a.name];
+            uint32_t srcbit = (i.ams == AM_REG || i.ams == AM_RAM) ? Bit(i.src) : 0;
+            uint32_t dstbit = (i.amd == AM_REG || i.amd == AM_RAM) ? Bit(i.dst) : 0;
+            i.opaque = ((i.amd == AM_REG || i.amd == AM_RAM) && IsSpecial(i.dst)) ||
+                       ((i.ams == AM_REG || i.ams == AM_RAM) && IsSpecial(i.src));
+            if (i.op == MOV)
+            {
+                i.r = srcbit | (i.amd == AM_RAM ? dstbit : 0);
+                i.w = i.amd == AM_REG ? dstbit : 0;
+            }
+            else
+            {
+                i.r = srcbit | dstbit;
+                i.w = Bit(A) | Bit(B) | LIVE_FLAGS | (i.op == CMP ? 0 : dstbit);
+            }
+        }
+        else if (a.type == AsmInstruction::ONEADDR)
+        {
+            if (!op1.count(a.name))
+                return false;
+            i.op = op1[a.name];
+            if (IsJump(i.op) || i.op == CALL || i.op == INT)
+            {
+                if (IsInt(a.dst) || IsHexInt(a.dst))
+                {
+                    numeric = true; // 删除指令会改变地址，放弃优化
+                    return false;
+                }
+                if (IsLabel(a.dst) && (labels.count(a.dst) || !regs.count(a.dst)))
+                {
+                    i.target = true;
+                    i.amd = AM_INS;
+                }
+                else
+                    i.opaque = true; // 以寄存器为目标是未定义指令
+            }
+            else
+            {
+                if (!GetAM(a.dst, i.amd, i.dst))
+                    return false;
+                i.opaque = i.amd != AM_INS && IsSpecial(i.dst);
+            }
+
+            uint32_t dstbit = i.amd == AM_REG ? Bit(i.dst) : 0;
+            switch (i.op)
+            {
+            case INC:
+            case DEC:
+            case NOT:
+                i.r = dstbit, i.w = Bit(A) | dstbit | LIVE_FLAGS;
+                break;
+            case JO:
+            case JNO:
+                i.r = LIVE_O;
+                break;
+            case JZ:
+            case JNZ:
+                i.r = LIVE_Z;
+                break;
+            case JP:
+            case JNP:
+                i.r = LIVE_P;
+                break;
+            case PUSH:
+                i.r = dstbit | Bit(SP) | Bit(SS) | Bit(CS), i.w = Bit(A) | Bit(SP);
+                break;
+            case POP:
+                i.r = Bit(SP) | Bit(SS) | Bit(CS), i.w = Bit(A) | Bit(SP) | dstbit;
+                break;
+            case CALL:
+            case INT:
+                i.r = LIVE_ALL; // 被调用者可能读任何寄存器
+                break;
+            default:
+                break;
+            }
+        }
+        else if (a.type == AsmInstruction::ZEROADDR)
+        {
+            if (!op0.count(a.name))
+                return false;
+            i.op = op0[a.name];
+            if (i.op == STI || i.op == CLI)
+                i.r = Bit(A) | Bit(B), i.w = LIVE_FLAGS; // 标志位由A + B得到
+            else if (i.op != NOP)
+                i.r = LIVE_ALL; // RET、IRET、HLT之后的状态都可见
+        }
+        if (!defined[Ir(i)])
+            i.opaque = true;
+        if (i.opaque)
+            i.r = LIVE_ALL, i.w = 0;
+        return true;
+    }
+
+    /// @brief 是否结束基本块
+    static bool EndsBlock(const Ins &i)
+    {
+        return i.a.type != AsmInstruction::LABEL && (i.target || i.opaque || i.r == LIVE_ALL);
+    }
+
+    /// @brief 是否之后的指令不会顺序执行到。HLT不算：IE为1时中断唤醒停机的核心，从HLT的下一条继续执行
+    static bool NoFallthrough(const Ins &i)
+    {
+        if (i.a.type == AsmInstruction::ONEADDR)
+            return i.op == JMP;
+        return i.a.type == AsmInstruction::ZEROADDR && (i.op == RET || i.op == IRET);
+    }
+
+    /// @brief 标签之后第一条指令的下标
+    size_t FirstAfter(size_t at) const
+    {
+        while (at < ins.size() && (ins[at].deleted || ins[at].a.type == AsmInstruction::LABEL))
+            ++at;
+        return at;
+    }
+
+    void Remove(size_t at, size_t &counter, OptStats &stats)
+    {
+        ins[at].deleted = true;
+        ++counter, ++stats.removed;
+        stats.bytes += ins[at].a.Length(varlen);
+        stats.cycles += cost[Ir(ins[at])];
+    }
+
+    void SetText(Ins &i)
+    {
+        std::string text = i.a.name;
+        if (i.a.type == AsmInstruction::ONEADDR)
+            text += " " + i.a.dst;
+        i.code = CodeLine(i.code.lineno, text);
+    }
+
+    /// @brief 转移到转移：改为最终目标；JMP到RET、IRET：直接执行该指令；转移到下一条：删除；
+    /// 无条件转移之后到下一个标签之前的指令不可达
+    bool Thread(OptStats &stats)
+    {
+        bool changed = false;
+        for (size_t k = 0; k < ins.size(); ++k)
+        {
+            Ins &i = ins[k];
+            if (i.deleted)
+                continue;
+
+            if (i.target && i.op != INT)
+            {
+                for (int hops = 0; hops < 64 && labels.count(i.a.dst); ++hops)
+                {
+                    size_t t = FirstAfter(labels[i.a.dst]);
+                    if (t >= ins.size() || t == k)
+                        break;
+                    const Ins &j = ins[t];
+                    bool chain = j.target && (j.op == JMP || (j.op == i.op && i.op != CALL)) && j.a.dst != i.a.dst;
+                    if (!chain)
+                    {
+                        // JMP到RET、IRET：省去JMP的微周期，长度不增加
+                        if (i.op == JMP && j.a.type == AsmInstruction::ZEROADDR && NoFallthrough(j) &&
+                            j.a.Length(varlen) <= i.a.Length(varlen))
+                        {
+                            stats.cycles += cost[Ir(i)];
+                            stats.bytes += i.a.Length(varlen) - j.a.Length(varlen);
+                            i.a = j.a, i.code = CodeLine(i.code.lineno, j.code.line);
+                            Decode(i);
+                            ++stats.threaded, changed = true;
+                        }
+                        break;
+                    }
+                    stats.cycles += cost[Ir(j)];
+                    i.a.dst = j.a.dst;
+                    SetText(i);
+                    ++stats.threaded, changed = true;
+                }
+            }
+
+            // 转移到紧接着的标签
+            if (!i.deleted && i.target && IsJump(i.op) && labels.count(i.a.dst) && labels[i.a.dst] > k)
+            {
+                size_t t = k + 1;
+                while (t < labels[i.a.dst] && (ins[t].deleted || ins[t].a.type == AsmInstruction::LABEL))
+                    ++t;
+                if (t == labels[i.a.dst])
+                    Remove(k, stats.threaded, stats), changed = true;
+            }
+
+            if (!i.deleted && NoFallthrough(i))
+            {
+                for (size_t t = k + 1; t < ins.size() && ins[t].a.type != AsmInstruction::LABEL; ++t)
+                    if (!ins[t].deleted)
+                        Remove(t, stats.unreachable, stats), changed = true;
+            }
+        }
+        return changed;
+    }
+
+    /// @brief 基本块内的值编号，删除目标已有相同值的传送
+    bool Redundant(OptStats &stats)
+    {
+        bool changed = false;
+        std::vector<int> val(32);
+        int fresh = 0;
+        auto reset = [&]() {
+            for (int &v : val)
+                v = ++fresh;
+        };
+        auto konst = [](uint8_t k) { return -1 - (int)k; };
+        reset();
+
+        for (size_t k = 0; k < ins.size(); ++k)
+        {
+            Ins &i = ins[k];
+            if (i.deleted)
+                continue;
+            if (i.a.type == AsmInstruction::LABEL || i.opaque || i.r == LIVE_ALL)
+            {
+                reset();
+                continue;
+            }
+
+            if (i.a.type == AsmInstruction::ZEROADDR && i.op == NOP)
+            {
+                Remove(k, stats.redundant, stats), changed = true;
+                continue;
+            }
+
+            if (i.a.type == AsmInstruction::TWOADDR && i.op == MOV)
+            {
+                if (i.amd != AM_REG)
+                    continue;
+                int v;
+                if (i.ams == AM_REG)
+                    v = val[i.src & 0x1f];
+                else if (i.ams == AM_INS)
+                    v = konst(i.src);
+                else
+                    v = ++fresh;
+                if (val[i.dst & 0x1f] == v)
+                    Remove(k, stats.redundant, stats), changed = true;
+                else
+                    val[i.dst & 0x1f] = v;
+                continue;
+            }
+            if (i.a.type == AsmInstruction::TWOADDR)
+            {
+                // A先取dst，B再取src，src为A时取到的是新的A
+                val[A] = val[i.dst & 0x1f];
+                val[B] = i.ams == AM_INS ? konst(i.src) : val[i.src & 0x1f];
+                if (i.op != CMP)
+                    val[i.dst & 0x1f] = ++fresh;
+                continue;
+            }
+            if (i.a.type == AsmInstruction::ONEADDR)
+            {
+                switch (i.op)
+                {
+                case INC:
+                case DEC:
+                case NOT:
+                    val[A] = val[i.dst & 0x1f];
+                    val[i.dst & 0x1f] = ++fresh;
+                    break;
+                case PUSH:
+                    val[A] = val[SP];
+                    val[SP] = ++fresh;
+                    break;
+                case POP:
+                    val[i.dst & 0x1f] = ++fresh;
+                    val[A] = ++fresh;
+                    val[SP] = ++fresh;
+                    break;
+                default:
+                    break;
+                }
+            }
+            if (EndsBlock(i))
+                reset();
+        }
+        return changed;
+    }
+
+    /// @brief 活跃变量分析，得到每条指令之后活跃的寄存器与标志位
+    std::vector<uint32_t> Liveness() const
+    {
+        // 划分基本块
+        std::vector<size_t> begin;
+        std::vector<size_t> blockof(ins.size() + 1);
+        for (size_t k = 0; k < ins.size(); ++k)
+        {
+            bool lead = k == 0 || ins[k].a.type == AsmInstruction::LABEL || EndsBlock(ins[k - 1]);
+            if (lead && !(k > 0 && ins[k].a.type == AsmInstruction::LABEL && ins[k - 1].a.type == AsmInstruction::LABEL))
+                begin.push_back(k);
+            blockof[k] = begin.size() - 1;
+        }
+        size_t nblocks = begin.size();
+        begin.push_back(ins.size());
+        blockof[ins.size()] = nblocks;
+
+        auto transfer = [this](size_t b, size_t e, uint32_t live) {
+            for (size_t k = e; k-- > b;)
+                if (!ins[k].deleted)
+                    live = ins[k].r | (live & ~ins[k].w);
+            return live;
+        };
+
+        // 块的出口：顺序执行到下一块、转移到标签所在的块，外部标签与程序末尾视为全部活跃
+        std::vector<uint32_t> in(nblocks + 1, 0);
+        in[nblocks] = LIVE_ALL;
+        auto out = [&](size_t b) {
+            size_t last = begin[b + 1];
+            while (last > begin[b] && ins[last - 1].deleted)
+                --last;
+            uint32_t live = in[b + 1];
+            if (last > begin[b] && ins[last - 1].target)
+            {
+                const Ins &j = ins[last - 1];
+                auto it = labels.find(j.a.dst);
+                uint32_t t = it == labels.end() ? LIVE_ALL : in[blockof[it->second]];
+                live = NoFallthrough(j) ? t : live | t;
+            }
+            return live;
+        };
+
+        for (bool changed = true; changed;)
+        {
+            changed = false;
+            for (size_t b = nblocks; b-- > 0;)
+            {
+                uint32_t live = transfer(begin[b], begin[b + 1], out(b));
+                if (live != in[b])
+                    in[b] = live, changed = true;
+            }
+        }
+
+        std::vector<uint32_t> after(ins.size());
+        for (size_t b = 0; b < nblocks; ++b)
+        {
+            uint32_t live = out(b);
+            for (size_t k = begin[b + 1]; k-- > begin[b];)
+            {
+                after[k] = live;
+                if (!ins[k].deleted)
+                    live = ins[k].r | (live & ~ins[k].w);
+            }
+        }
+        return after;
+    }
+
+    /// @brief 删除结果不再使用的传送，以及紧跟在运算之后与0比较的CMP
+    bool Dead(OptStats &stats)
+    {
+        bool changed = false;
+        std::vector<uint32_t> after = Liveness();
+        size_t prev = ins.size();
+        for (size_t k = 0; k < ins.size(); ++k)
+        {
+            Ins &i = ins[k];
+            if (i.deleted)
+                continue;
+            bool reg = !i.opaque && i.a.type == AsmInstruction::TWOADDR && i.amd == AM_REG;
+
+            if (reg && i.op == MOV && i.ams != AM_DIR && i.ams != AM_RAM && IsScratch(i.dst) &&
+                !(after[k] & Bit(i.dst)))
+            {
+                Remove(k, stats.dead, stats), changed = true;
+                continue;
+            }
+
+            // CMP X, 0的Z、P由X决定，与上一条写X的运算相同；AND、OR、XOR、NOT与CMP X, 0的O都为0
+            if (reg && i.op == CMP && i.ams == AM_INS && i.src == 0 && prev < ins.size() &&
+                !(after[k] & (Bit(A) | Bit(B))))
+            {
+                const Ins &p = ins[prev];
+                bool writes = !p.opaque && p.amd == AM_REG && p.dst == i.dst &&
+                              ((p.a.type == AsmInstruction::TWOADDR && p.op != MOV && p.op != CMP) ||
+                               (p.a.type == AsmInstruction::ONEADDR && (p.op == INC || p.op == DEC || p.op == NOT)));
+                bool zeroo = p.op == AND || p.op == OR || p.op == XOR || (p.a.type == AsmInstruction::ONEADDR && p.op == NOT);
+                if (writes && (zeroo || !(after[k] & LIVE_O)))
+                {
+                    Remove(k, stats.cmps, stats), changed = true;
+                    continue;
+                }
+            }
+            prev = (i.a.type == AsmInstruction::LABEL || EndsBlock(i)) ? ins.size() : k;
+        }
+        return changed;
+    }
+
+    /// @brief 优化整个文件
+    /// @param file 输入，优化后原地替换
+    /// @param stats
+    /// @return 是否进行了优化，程序有错误或使用数字转移目标时返回false且不修改file
+    bool Run(std::vector<CodeLine> &file, OptStats &stats)
+    {
+        ins.clear(), labels.clear();
+        for (const CodeLine &line : file)
+        {
+            AsmInstruction a = AsmInstruction::Parse(line);
+            if (a.type == AsmInstruction::SYNTAXERROR)
+                return false;
+            if (a.type == AsmInstruction::LABEL && !labels.emplace(a.name, ins.size()).second)
+                return false;
+            ins.push_back({line, a, 0, 0, 0, 0, 0, false, false, 0, 0, false});
+        }
+        for (Ins &i : ins)
+            if (i.a.type != AsmInstruction::LABEL && !Decode(i))
+                return false;
+
+        for (int pass = 0; pass < 16; ++pass)
+        {
+            bool changed = Thread(stats);
+            changed = Redundant(stats) || changed;
+            changed = Dead(stats) || changed;
+            if (!changed)
+                break;
+        }
+
+        file.clear();
+        for (const Ins &i : ins)
+            if (!i.deleted)
+                file.push_back(i.code);
+        return true;
+    }
+};
+
+/*============================================================*/
+
+/// @brief 不超过4个字符的关键字的完美散列，用于快速识别指令与寄存器
+struct PerfectHash
+{
+    static const int BITS = 7; // 槽数为1 << BITS
+
+    uint32_t seed;                 // 乘数，构造时寻找使所有关键字互不冲突的值
+    uint32_t keys[1 << BITS];      // 打包后的关键字，0表示空槽
+    uint8_t values[1 << BITS];     // 关键字对应的值
+
+    /// @brief 将单词按大写打包为整数
+    /// @param s
+    /// @param n
+    /// @return 超过4个字符或为空时返回0
+    static inline uint32_t Pack(const char *s, size_t n)
+    {
+        if (n == 0 || n > 4)
+            return 0;
+        uint32_t k = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            uint8_t c = s[i];
+            k = k << 8 | ((c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c);
+        }
+        return k;
+    }
+
+    inline uint32_t Slot(uint32_t k) const
+    {
+        return (k * seed) >> (32 - BITS);
+    }
+
+    /// @brief 由关键字表构造
+    /// @param table
+    void Build(const std::map<std::string, uint8_t> &table)
+    {
+        for (seed = 0x9e3779b1;; seed += 2)
+        {
+            bool ok = true;
+            memset(keys, 0, sizeof(keys));
+            for (const auto &item : table)
+            {
+                uint32_t k = Pack(item.first.c_str(), item.first.size());
+                uint32_t slot = Slot(k);
+                if (keys[slot] != 0)
+                {
+                    ok = false;
+                    break;
+                }
+                keys[slot] = k, values[slot] = item.second;
+            }
+            if (ok)
+                return;
+        }
+    }
+
+    /// @brief 查找单词
+    /// @param s
+    /// @param n
+    /// @param value
+    /// @return 是否找到
+    inline bool Find(const char *s, size_t n, uint8_t &value) const
+    {
+        uint32_t k = Pack(s, n);
+        uint32_t slot = Slot(k);
+        if (k == 0 || keys[slot] != k)
+            return false;
+        value = values[slot];
+        return true;
+    }
+};
+
+/// @brief 只读映射整个文件，不支持mmap的平台上读入内存
+struct MappedFile
+{
+    const char *data;
+    size_t size;
+    std::string copy;
+#ifdef ASM_MMAP
+    void *addr;
+#endif
+
+    MappedFile() : data(NULL), size(0)
+    {
+#ifdef ASM_MMAP
+        addr = NULL;
+#endif
     }
 
-    if (Compile(CodeLine::ReadFile(src), out))
+    ~MappedFile()
+    {
+#ifdef ASM_MMAP
+        if (addr != NULL)
+            munmap(addr, size);
+#endif
+    }
+
+    /// @brief 打开文件
+    /// @param path
+    /// @return
+    bool Open(const std::string &path)
+    {
+#ifdef ASM_MMAP
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            close(fd);
+            return false;
+        }
+        size = st.st_size;
+        if (size != 0)
+        {
+            addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED)
+            {
+                addr = NULL;
+                close(fd);
+                return false;
+            }
+            madvise(addr, size, MADV_SEQUENTIAL);
+        }
+        close(fd);
+        data = (const char *)addr;
+        return true;
+#else
+        std::ifstream in(path, std::ios::in | std::ios::binary);
+        if (!in.is_open())
+            return false;
+        copy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        data = copy.data(), size = copy.size();
+        return true;
+#endif
+    }
+};
+
+/// @brief 快速汇编：直接在映射的文件上逐行解析，不复制行，关键字用完美散列识别，
+/// 输出写入预先分配的缓冲区。只接受没有错误的程序，遇到错误或少见的写法时返回false，
+/// 由Compile()重新汇编并报告错误，两者对同一程序的输出相同
+struct FastAssembler
+{
+    PerfectHash op2h, op1h, op0h, regh;
+    bool varlen;
+
+    /// @brief 标签，散列表中name为NULL表示空槽
+    struct Label
+    {
+        const char *name;
+        uint32_t len;
+        uint32_t hash;
+        size_t pos;
+    };
+    std::vector<Label> labels;
+    size_t nlabels;
+
+    /// @brief 目标可能是标签的转移指令，全部标签读完后再生成
+    struct Fixup
+    {
+        size_t at;        // 指令在输出中的位置
+        const char *name; // 目标
+        uint32_t len;
+        uint8_t op;
+    };
+    std::vector<Fixup> fixups;
+
+    std::vector<uint8_t> image; // 输出
+    size_t size;                // 输出的字节数
+    size_t lines;               // 读取的行数
+    ObjectFile *obj;            // 不为NULL时生成目标文件，与Compile()的obj参数相同
+
+    FastAssembler(bool varlen, ObjectFile *obj = NULL)
+        : varlen(varlen), labels(1024), nlabels(0), size(0), lines(0), obj(obj)
+    {
+        op2h.Build(op2);
+        op1h.Build(op1);
+        op0h.Build(op0);
+        regh.Build(regs);
+    }
+
+    static inline bool IsBlank(char c) { return c == ' ' || c == '\t'; }
+    static inline bool IsSpace(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+    static inline bool IsAlpha(char c) { return (uint8_t)((c | 0x20) - 'a') < 26; }
+    static inline bool IsDigit(char c) { return (uint8_t)(c - '0') < 10; }
+
+    /// @brief 标签名的散列，不区分大小写
+    static inline uint32_t Hash(const char *s, size_t n)
+    {
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < n; ++i)
+            h = (h ^ (uint8_t)(s[i] & 0xdf)) * 16777619u;
+        return h;
+    }
+
+    /// @brief 比较两个只含字母的单词，不区分大小写
+    static inline bool Equal(const char *a, const char *b, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+            if ((a[i] ^ b[i]) & 0xdf)
+                return false;
+        return true;
+    }
+
+    /// @brief 查找标签
+    /// @param name 只含字母
+    /// @param len
+    /// @return 找到的标签或空槽
+    Label &FindLabel(const char *name, size_t len, uint32_t hash)
+    {
+        size_t mask = labels.size() - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask)
+        {
+            Label &l = labels[i];
+            if (l.name == NULL || (l.hash == hash && l.len == len && Equal(l.name, name, len)))
+                return l;
+        }
+    }
+
+    /// @brief 定义标签
+    /// @return 重复定义时返回false
+    bool AddLabel(const char *name, size_t len)
+    {
+        if ((nlabels + 1) * 2 > labels.size())
+        {
+            std::vector<Label> old(labels.size() * 2);
+            old.swap(labels);
+            for (const Label &l : old)
+                if (l.name != NULL)
+                    FindLabel(l.name, l.len, l.hash) = l;
+        }
+        uint32_t hash = Hash(name, len);
+        Label &l = FindLabel(name, len, hash);
+        if (l.name != NULL)
+            return false;
+        l = {name, (uint32_t)len, hash, size};
+        ++nlabels;
+        return true;
+    }
+
+    /// @brief 标签名转为大写，与Compile()中的名字一致
+    static std::string Upper(const char *s, size_t n)
+    {
+        std::string name(s, n);
+        for (char &c : name)
+            c &= 0xdf;
+        return name;
+    }
+
+    /// @brief 解析数字，与IsInt、IsHexInt加atoi、sscanf的结果一致
+    bool Number(const char *s, size_t n, uint8_t &val) const
+    {
+        uint32_t v = 0;
+        if (n >= 3 && s[0] == '0' && (s[1] | 0x20) == 'x')
+        {
+            if (n > 10)
+                return false;
+            for (size_t i = 2; i < n; ++i)
+            {
+                char c = s[i];
+                if (IsDigit(c))
+                    v = v << 4 | (c - '0');
+                else if ((uint8_t)((c | 0x20) - 'a') < 6)
+                    v = v << 4 | ((c | 0x20) - 'a' + 10);
+                else
+                    return false;
+            }
+        }
+        else
+        {
+            if (n == 0 || n > 9)
+                return false;
+            for (size_t i = 0; i < n; ++i)
+            {
+                if (!IsDigit(s[i]))
+                    return false;
+                v = v * 10 + (s[i] - '0');
+            }
+        }
+        val = (uint8_t)v;
+        return true;
+    }
+
+    /// @brief 解析地址，与GetAM()一致
+    bool Operand(const char *s, size_t n, uint8_t &am, uint8_t &val) const
+    {
+        if (n > 2 && s[0] == '[' && s[n - 1] == ']')
+        {
+            if (regh.Find(s + 1, n - 2, val))
+                am = AM_RAM;
+            else if (Number(s + 1, n - 2, val))
+                am = AM_DIR;
+            else
+                return false;
+        }
+        else
+        {
+            if (regh.Find(s, n, val))
+                am = AM_REG;
+            else if (Number(s, n, val))
+                am = AM_INS;
+            else
+                return false;
+        }
+        return true;
+    }
+
+    inline void Emit(uint8_t ir, uint8_t dst, uint8_t src, size_t len)
+    {
+        uint8_t *p = &image[size];
+        p[0] = ir, p[1] = dst, p[2] = src;
+        size += len;
+    }
+
+    /// @brief 汇编一行
+    /// @param b 行首
+    /// @param e 行尾，不含换行
+    /// @return
+    bool Line(const char *b, const char *e)
+    {
+        const char *c = (const char *)memchr(b, ';', e - b);
+        if (c != NULL)
+            e = c;
+        while (b < e && IsSpace(*b))
+            ++b;
+        while (e > b && IsSpace(e[-1]))
+            --e;
+        if (b == e)
+            return true;
+        if (memchr(b, 0, e - b) != NULL)
+            return false;
+
+        // 第一个词：标签或指令
+        const char *w = b;
+        while (b < e && IsAlpha(*b))
+            ++b;
+        size_t wl = b - w;
+        if (wl == 0)
+            return false;
+        while (b < e && IsBlank(*b))
+            ++b;
+
+        uint8_t op, amd, ams, dst, src;
+        if (b == e)
+        {
+            // 零地址指令
+            if (!op0h.Find(w, wl, op))
+                return false;
+            Emit(op, 0, 0, varlen ? 1 : 3);
+            return true;
+        }
+        if (*b == ':')
+        {
+            for (++b; b < e; ++b)
+                if (!IsBlank(*b))
+                    return false;
+            return AddLabel(w, wl);
+        }
+
+        // dst
+        const char *d = b;
+        while (b < e && !IsBlank(*b) && *b != ',')
+            ++b;
+        size_t dl = b - d;
+        while (b < e && IsBlank(*b))
+            ++b;
+        if (dl == 0)
+            return false;
+
+        if (b == e)
+        {
+            // 一地址指令，转移指令的目标可能是之后定义的标签
+            if (!op1h.Find(w, wl, op))
+                return false;
+            bool jump = op == JMP || op == JO || op == JZ || op == JP || op == JNO || op == JNZ || op == JNP || op == CALL || op == INT;
+            bool alpha = true;
+            for (size_t i = 0; i < dl && alpha; ++i)
+                alpha = IsAlpha(d[i]);
+            if (jump && alpha)
+            {
+                fixups.push_back({size, d, (uint32_t)dl, op});
+                Emit(0, 0, 0, varlen ? 2 : 3);
+                return true;
+            }
+            if (!Operand(d, dl, amd, dst))
+                return false;
+            Emit(op | amd, dst, 0, varlen ? 2 : 3);
+            return true;
+        }
+
+        // 二地址指令
+        if (*b != ',')
+            return false;
+        for (++b; b < e && IsBlank(*b); ++b)
+            ;
+        const char *s = b;
+        for (; b < e; ++b)
+            if (IsBlank(*b) || *b == ',')
+                return false;
+        if (s == e || !op2h.Find(w, wl, op))
+            return false;
+        if (!Operand(d, dl, amd, dst) || !Operand(s, e - s, ams, src) || !CheckAM(amd, ams))
+            return false;
+        Emit(op | (amd << 2) | ams, dst, src, 3);
+        return true;
+    }
+
+    /// @brief 汇编整个文件
+    /// @param data
+    /// @param len
+    /// @return 是否成功，失败时应改用Compile()
+    bool Assemble(const char *data, size_t len)
+    {
+        // 每条指令在源文件中至少3个字符，输出不会超过源文件大小
+        image.resize(len + 3);
+        const char *p = data, *end = data + len;
+        while (p < end)
+        {
+            const char *nl = (const char *)memchr(p, '\n', end - p);
+            if (nl == NULL)
+                nl = end;
+            ++lines;
+            if (!Line(p, nl))
+                return false;
+            p = nl + 1;
+        }
+
+        for (const Fixup &f : fixups)
+        {
+            uint8_t amd, dst;
+            const Label &l = FindLabel(f.name, f.len, Hash(f.name, f.len));
+            if (obj != NULL && (l.name != NULL || !regh.Find(f.name, f.len, dst)))
+            {
+                obj->relocs.push_back({(uint32_t)f.at, Upper(f.name, f.len)}); // 目标由链接器填写
+                amd = AM_INS, dst = 0;
+            }
+            else if (l.name != NULL)
+                amd = AM_INS, dst = (uint8_t)l.pos;
+            else if (!Operand(f.name, f.len, amd, dst))
+                return false;
+            image[f.at] = f.op | amd;
+            image[f.at + 1] = dst;
+        }
+        image.resize(size);
+
+        if (obj != NULL)
+        {
+            for (const Label &l : labels)
+                if (l.name != NULL)
+                    obj->symbols.push_back({(uint32_t)l.pos, Upper(l.name, l.len)});
+        }
+        return true;
+    }
+};
+
+/// @brief 生成用于测试汇编速度的程序，包含各种指令、标签、注释与空行
+/// @param path
+/// @param lines 行数
+/// @return
+bool GenerateBenchmark(const std::string &path, size_t lines)
+{
+    static const char *const TEMPLATES[] = {
+        "    mov a, %u", "    mov b, c", "    mov [%u], a", "    mov [di], 0x%x", "    mov d, [si]",
+        "    add a, b", "    sub c, %u", "    and d, 0x%x", "    or a, c", "    xor b, b",
+        "    cmp a, %u", "    inc c", "    dec d", "    not a", "    push a",
+        "    pop b", "    nop", "    Mov A, B ; mixed case", "", "; comment only"};
+    static const char *const JUMPS[] = {"jmp", "jz", "jnz", "jo", "jno", "jp", "jnp", "call"};
+
+    FILE *pf = fopen(path.c_str(), "wb");
+    if (pf == NULL)
+        return false;
+
+    // 标签名只能含字母，第n个标签为l加上n的26进制
+    auto label = [](size_t n) {
+        std::string name = "l";
+        do
+            name += (char)('a' + n % 26), n /= 26;
+        while (n);
+        return name;
+    };
+
+    uint32_t rng = 1;
+    size_t nlabels = (lines + 14) / 16; // 最后一行为HLT，之前的每16行一个标签
+    for (size_t i = 0; i < lines; ++i)
+    {
+        rng = rng * 1103515245 + 12345;
+        uint32_t r = rng >> 8;
+        if (i == lines - 1)
+            fprintf(pf, "    hlt\n");
+        else if (i % 16 == 0)
+            fprintf(pf, "%s:\n", label(i / 16).c_str());
+        else if (i % 16 == 15)
+            fprintf(pf, "    %s %s\n", JUMPS[r % 8], label(r % nlabels).c_str());
+        else
+        {
+            fprintf(pf, TEMPLATES[r % 20], r & 0xff);
+            fputc('\n', pf);
+        }
+    }
+    fclose(pf);
+    return true;
+}
+
+/// @brief 生成测试程序，分别用FastAssembler与Compile()汇编，输出速度并比较结果
+/// @param srcfile 生成的程序
+/// @param outfile 快速汇编的输出，Compile()的输出为outfile.slow
+/// @param lines 行数
+/// @param varlen
+void Benchmark(const std::string &srcfile, const std::string &outfile, size_t lines, bool varlen)
+{
+    if (!GenerateBenchmark(srcfile, lines))
+    {
+        std::cout << "error: unable to open source file" << std::endl;
+        return;
+    }
+
+    auto report = [lines](const char *name, double sec, size_t bytes) {
+        std::cout << name << ": " << sec * 1000 << " ms, " << lines / sec / 1e6 << " M lines/s, "
+                  << bytes / sec / 1e6 << " MB/s" << std::endl;
+    };
+
+    auto t0 = std::chrono::steady_clock::now();
+    MappedFile file;
+    FastAssembler fast(varlen);
+    if (!file.Open(srcfile) || !fast.Assemble(file.data, file.size))
+    {
+        std::cout << "error: fast path rejected the generated program" << std::endl;
+        return;
+    }
+    std::ofstream out(outfile, std::ios::out | std::ios::binary);
+    out.write((const char *)fast.image.data(), fast.image.size());
+    out.close();
+    auto t1 = std::chrono::steady_clock::now();
+    std::cout << "lines: " << lines << ", source: " << file.size << " bytes, program: " << fast.image.size() << " bytes" << std::endl;
+    report("fast", std::chrono::duration<double>(t1 - t0).count(), file.size);
+
+    std::ifstream src(srcfile, std::ios::in);
+    std::ofstream slow(outfile + ".slow", std::ios::out | std::ios::binary);
+    Compile(CodeLine::ReadFile(src), slow, varlen, NULL);
+    slow.close();
+    auto t2 = std::chrono::steady_clock::now();
+    report("slow", std::chrono::duration<double>(t2 - t1).count(), file.size);
+
+    MappedFile check;
+    bool same = check.Open(outfile + ".slow") && check.size == fast.image.size() &&
+                memcmp(check.data, fast.image.data(), check.size) == 0;
+    std::cout << (same ? "outputs are identical" : "error: outputs differ") << std::endl;
+}
+
+/*============================================================*/
+
+/// @brief 文件的修改时间
+/// @param path
+/// @param ns 纳秒
+/// @return 不支持或文件不存在时返回false
+bool ModifiedTime(const std::string &path, int64_t &ns)
+{
+#ifdef ASM_MMAP
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+#ifdef __APPLE__
+    ns = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return true;
+#else
+    return false;
+#endif
+}
+
+/// @brief 判断目标文件是否比源文件新且编码方式、是否优化都相同，无法判断时视为需要重新汇编
+/// @param srcfile
+/// @param objfile
+/// @param varlen
+/// @param optimize
+/// @return
+bool IsUpToDate(const std::string &srcfile, const std::string &objfile, bool varlen, bool optimize)
+{
+    int64_t src, obj;
+    if (!ModifiedTime(srcfile, src) || !ModifiedTime(objfile, obj) || obj <= src)
+        return false;
+    char head[6];
+    FILE *pf = fopen(objfile.c_str(), "rb");
+    if (pf == NULL)
+        return false;
+    bool ok = fread(head, sizeof(head), 1, pf) == 1 && memcmp(head, OBJ_MAGIC, 4) == 0 &&
+              head[4] == varlen && head[5] == optimize;
+    fclose(pf);
+    return ok;
+}
+
+/// @brief 对象缓存的键：预处理后的源文件与指令、寄存器表的128位散列。
+/// 预处理与CodeLine相同，去掉注释、首尾空白和空行并转为大写，只改动注释或缩进时键不变
+struct SourceHash
+{
+    static const uint32_t VERSION = 2; // 目标文件格式或汇编规则改变时加一，使旧的缓存失效
+
+    uint64_t h1, h2;
+
+    SourceHash() : h1(14695981039346656037ull), h2(VERSION)
+    {
+    }
+
+    inline void Add(uint8_t c)
+    {
+        h1 = (h1 ^ c) * 1099511628211ull;
+        h2 = (h2 ^ c) * 0x9e3779b97f4a7c15ull;
+        h2 ^= h2 >> 29;
+    }
+
+    void Add(const char *s, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+            Add((uint8_t)s[i]);
+    }
+
+    void Add(const std::string &s)
+    {
+        Add(s.data(), s.size());
+        Add(0);
+    }
+
+    /// @brief 加入一行源码，处理方式与CodeLine的构造函数相同
+    /// @param b 行首
+    /// @param e 行尾，不含换行
+    void AddLine(const char *b, const char *e)
+    {
+        const char *c = (const char *)memchr(b, ';', e - b);
+        if (c != NULL)
+            e = c;
+        while (b < e && std::isspace((uint8_t)*b))
+            ++b;
+        while (e > b && std::isspace((uint8_t)e[-1]))
+            --e;
+        if (b == e)
+            return; // 空行
+        for (; b < e; ++b)
+            Add((uint8_t)std::toupper((uint8_t)*b));
+        Add('\n');
+    }
+
+    /// @brief 加入指令与寄存器表，表改变时所有缓存失效
+    void AddTables()
+    {
+        for (const auto *table : {&op0, &op1, &op2, &regs})
+        {
+            for (const auto &item : *table)
+                Add(item.first), Add(item.second);
+            Add(0xff);
+        }
+    }
+
+    std::string Hex() const
+    {
+        char buf[40];
+        snprintf(buf, sizeof(buf), "%016llx%016llx", (unsigned long long)h1, (unsigned long long)h2);
+        return buf;
+    }
+};
+
+/// @brief 复制文件，先写入临时文件再改名，多个线程同时写同一个目标时不会读到不完整的文件
+/// @param from
+/// @param to
+/// @return
+bool CopyFile(const std::string &from, const std::string &to)
+{
+    MappedFile file;
+    if (!file.Open(from))
+        return false;
+    std::ostringstream tmp;
+    tmp << to << ".tmp" << std::this_thread::get_id();
+    FILE *pf = fopen(tmp.str().c_str(), "wb");
+    if (pf == NULL)
+        return false;
+    bool ok = file.size == 0 || fwrite(file.data, 1, file.size, pf) == file.size;
+    ok = fclose(pf) == 0 && ok;
+    ok = ok && std::rename(tmp.str().c_str(), to.c_str()) == 0;
+    if (!ok)
+        std::remove(tmp.str().c_str());
+    return ok;
+}
+
+std::mutex outputlock; // 多个线程同时汇编时，报告错误的Compile()逐个执行
+
+/// @brief 汇编目标文件的统计
+struct BuildStats
+{
+    std::atomic<size_t> built;    // 重新汇编的文件数
+    std::atomic<size_t> uptodate; // 目标文件比源文件新而跳过的文件数
+    std::atomic<size_t> hits;     // 从缓存中取得的文件数
+    std::atomic<size_t> failed;   // 汇编失败的文件数
+    OptStats opt;                 // 各文件优化结果之和，在outputlock下修改
+
+    BuildStats() : built(0), uptodate(0), hits(0), failed(0)
+    {
+    }
+};
+
+/// @brief 优化并汇编，-O时使用
+/// @param file
+/// @param out
+/// @param varlen
+/// @param map
+/// @param obj
+/// @param stats 累加优化结果
+/// @return 与Compile()相同
+bool OptimizeAndCompile(std::vector<CodeLine> file, std::ostream &out, bool varlen, std::ofstream *map, ObjectFile *obj,
+                        OptStats &stats)
+{
+    Optimizer opt(varlen);
+    if (!opt.Run(file, stats) && opt.numeric)
+        ++stats.skipped;
+    return Compile(file, out, varlen, map, obj);
+}
+
+/// @brief 将一个源文件汇编为目标文件，先用快速路径，失败时用Compile()重新汇编并报告错误
+/// @param srcfile
+/// @param objfile
+/// @param varlen
+/// @param optimize 是否优化
+/// @param cachedir 对象缓存的目录，为空时不使用缓存
+/// @param stats
+/// @return
+bool AssembleObject(const std::string &srcfile, const std::string &objfile, bool varlen, bool optimize,
+                    const std::string &cachedir, BuildStats &stats)
+{
+    ObjectFile obj;
+    obj.varlen = varlen;
+    obj.optimized = optimize;
+
+    MappedFile file;
+    if (!file.Open(srcfile))
+    {
+        std::lock_guard<std::mutex> lock(outputlock);
+        std::cout << "error: unable to open source file " << srcfile << std::endl;
+        return false;
+    }
+
+    // 内容相同的源文件直接取缓存
+    std::string cachefile;
+    if (!cachedir.empty())
+    {
+        static const SourceHash tables = []() {
+            SourceHash h;
+            h.AddTables();
+            return h;
+        }();
+        SourceHash h = tables;
+        h.Add(varlen);
+        h.Add(optimize);
+        const char *p = file.data, *end = file.data + file.size;
+        while (p < end)
+        {
+            const char *nl = (const char *)memchr(p, '\n', end - p);
+            if (nl == NULL)
+                nl = end;
+            h.AddLine(p, nl);
+            p = nl + 1;
+        }
+        cachefile = cachedir + "/" + h.Hex() + ".o";
+        if (CopyFile(cachefile, objfile))
+        {
+            ++stats.hits;
+            return true;
+        }
+    }
+
+    // 快速路径接受的程序没有错误，优化时不会输出错误信息，不需要加锁
+    FastAssembler fast(varlen, &obj);
+    bool fastok = fast.Assemble(file.data, file.size);
+    if (fastok && !optimize)
+    {
+        obj.code.swap(fast.image);
+    }
+    else
+    {
+        std::unique_lock<std::mutex> lock(outputlock, std::defer_lock);
+        if (!fastok)
+            lock.lock();
+        std::ifstream src(srcfile, std::ios::in);
+        std::ostringstream out;
+        OptStats opt;
+        obj.symbols.clear(), obj.relocs.clear();
+        bool ok = optimize ? OptimizeAndCompile(CodeLine::ReadFile(src), out, varlen, NULL, &obj, opt)
+                           : Compile(CodeLine::ReadFile(src), out, varlen, NULL, &obj);
+        if (!lock.owns_lock())
+            lock.lock();
+        if (!ok)
+        {
+            std::cout << "error: failed to assemble " << srcfile << std::endl;
+            return false;
+        }
+        stats.opt.Add(opt);
+        std::string code = out.str();
+        obj.code.assign(code.begin(), code.end());
+    }
+
+    if (!obj.Write(objfile))
+    {
+        std::lock_guard<std::mutex> lock(outputlock);
+        std::cout << "error: unable to write object file " << objfile << std::endl;
+        return false;
+    }
+    ++stats.built;
+    if (!cachefile.empty())
+        CopyFile(objfile, cachefile); // 缓存写入失败不影响结果
+    return true;
+}
+
+/// @brief 用多个线程将源文件分别汇编为同名加.o的目标文件，跳过已是最新的目标文件
+/// @param srcfiles
+/// @param varlen
+/// @param optimize 是否优化
+/// @param threads
+/// @param cachedir 对象缓存的目录，为空时不使用缓存
+/// @return 是否全部成功
+bool AssembleObjects(const std::vector<std::string> &srcfiles, bool varlen, bool optimize, unsigned threads,
+                     const std::string &cachedir)
+{
+#ifdef ASM_MMAP
+    if (!cachedir.empty())
+        mkdir(cachedir.c_str(), 0755);
+#endif
+
+    BuildStats stats;
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i; (i = next++) < srcfiles.size();)
+        {
+            const std::string &srcfile = srcfiles[i];
+            std::string objfile = srcfile + ".o";
+            if (IsUpToDate(srcfile, objfile, varlen, optimize))
+                ++stats.uptodate;
+            else if (!AssembleObject(srcfile, objfile, varlen, optimize, cachedir, stats))
+                ++stats.failed;
+        }
+    };
+
+    threads = std::max(1u, std::min(threads, (unsigned)srcfiles.size()));
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; ++i)
+        pool.emplace_back(worker);
+    worker();
+    for (std::thread &t : pool)
+        t.join();
+
+    std::cout << stats.built << " assembled, " << stats.uptodate << " up to date";
+    if (stats.failed)
+        std::cout << ", " << stats.failed << " failed";
+    std::cout << std::endl;
+    if (!cachedir.empty())
+    {
+        size_t lookups = stats.hits + stats.built;
+        std::cout << "cache: " << stats.hits << " hits, " << stats.built << " misses";
+        if (lookups)
+            std::cout << " (" << 100 * stats.hits / lookups << "% hit rate)";
+        std::cout << std::endl;
+    }
+    if (optimize)
+        stats.opt.Print(std::cout);
+    return stats.failed == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string srcfile;
+    std::string outfile;
+    std::string mapfile;
+    size_t benchlines = 0;
+    bool varlen = false;
+    bool optimize = false;
+    bool objects = false;
+    unsigned threads = std::thread::hardware_concurrency();
+    std::string cachedir = ".asmcache";
+
+    while (argc > 1 && argv[1][0] == '-')
+    {
+        std::string arg = argv[1];
+        if (arg == "-v")
+        {
+            varlen = true;
+            --argc, ++argv;
+        }
+        else if (arg == "-l" && argc > 2)
+        {
+            mapfile = argv[2];
+            argc -= 2, argv += 2;
+        }
+        else if (arg == "-b" && argc > 2)
+        {
+            benchlines = std::strtoull(argv[2], NULL, 0);
+            argc -= 2, argv += 2;
+        }
+        else if (arg == "-O")
+        {
+            optimize = true;
+            --argc, ++argv;
+        }
+        else if (arg == "-c")
+        {
+            objects = true;
+            --argc, ++argv;
+        }
+        else if (arg == "-j" && argc > 2)
+        {
+            threads = (unsigned)std::strtoul(argv[2], NULL, 0);
+            argc -= 2, argv += 2;
+        }
+        else if (arg == "-C" && argc > 2)
+        {
+            cachedir = argv[2];
+            argc -= 2, argv += 2;
+        }
+        else
+        {
+            argc = 0;
+            break;
+        }
+    }
+
+    if (objects && argc > 1 && mapfile.empty() && benchlines == 0)
+    {
+        AssembleObjects(std::vector<std::string>(argv + 1, argv + argc), varlen, optimize, threads, cachedir);
+        return 0;
+    }
+    else if (objects)
+    {
+        argc = 0;
+    }
+
+    if (argc == 3)
+    {
+        srcfile = argv[1];
+        outfile = argv[2];
+    }
+    else if (argc == 2)
+    {
+        srcfile = argv[1];
+        outfile = srcfile + ".bin";
+    }
+    else
+    {
+        std::cout << "compiler [-v] [-O] [-l mapfile] [-b lines] [srcfile] [outfile]" << std::endl
+                  << "compiler -c [-v] [-O] [-j threads] [-C cachedir] srcfile..." << std::endl
+                  << std::endl
+                  << "  srcfile: source file path" << std::endl
+                  << "  outfile: output file path" << std::endl
+                  << "  -v:      variable-length encoding, 1 byte for zero-address and 2 bytes" << std::endl
+                  << "           for one-address instructions, run with controller -v microcode" << std::endl
+                  << "  -O:      peephole optimization, removes dead and redundant moves, CMPs after" << std::endl
+                  << "           ALU ops, unreachable code and jump chains; jump targets must be labels" << std::endl
+                  << "  -l file: write line map for the profiler, one \"addr line I|L text\" per line" << std::endl
+                  << "  -b num:  benchmark, generate a program of num lines into srcfile and" << std::endl
+                  << "           assemble it with the fast path and the original path" << std::endl
+                  << "  -c:      assemble each srcfile to a relocatable object srcfile.o for linker," << std::endl
+                  << "           in parallel, skipping objects newer than their source" << std::endl
+                  << "  -j num:  number of threads for -c, default all cores" << std::endl
+                  << "  -C dir:  object cache for -c keyed by a hash of the source without comments" << std::endl
+                  << "           and blanks, default .asmcache, \"\" to disable" << std::endl
+                  << std::endl;
+        return 0;
+    }
+
+    if (benchlines != 0)
+    {
+        Benchmark(srcfile, outfile, benchlines, varlen);
+        return 0;
+    }
+
+    // 先用快速汇编，失败时用Compile()重新汇编并报告错误，需要行号表或优化时直接使用Compile()
+    if (mapfile.empty() && !optimize)
+    {
+        MappedFile file;
+        if (!file.Open(srcfile))
+        {
+            std::cout << "error: unable to open source file" << std::endl;
+            return 0;
+        }
+        FastAssembler fast(varlen);
+        if (fast.Assemble(file.data, file.size))
+        {
+            std::ofstream out(outfile, std::ios::out | std::ios::binary);
+            if (!out.is_open())
+            {
+                std::cout << "error: unable to open output file" << std::endl;
+                return 0;
+            }
+            out.write((const char *)fast.image.data(), fast.image.size());
+            std::cout << "done" << std::endl;
+            return 0;
+        }
+    }
+
+    std::ifstream src;
+    std::ofstream out;
+
+    src.open(srcfile, std::ios::in);
+    if (!src.is_open())
+    {
+        std::cout << "error: unable to open source file" << std::endl;
+        return 0;
+    }
+
+    out.open(outfile, std::ios::out | std::ios::binary);
+    if (!out.is_open())
+    {
+        std::cout << "error: unable to open output file" << std::endl;
+        src.close();
+        return 0;
+    }
+
+    std::ofstream map;
+    if (!mapfile.empty())
+    {
+        map.open(mapfile, std::ios::out);
+        if (!map.is_open())
+        {
+            std::cout << "error: unable to open map file" << std::endl;
+            return 0;
+        }
+    }
+
+    bool ok;
+    if (optimize)
+    {
+        OptStats stats;
+        ok = OptimizeAndCompile(CodeLine::ReadFile(src), out, varlen, map.is_open() ? &map : NULL, NULL, stats);
+        if (ok)
+            stats.Print(std::cout);
+    }
+    else
+    {
+        ok = Compile(CodeLine::ReadFile(src), out, varlen, map.is_open() ? &map : NULL);
+    }
+    if (ok)
         std::cout << "done" << std::endl;
 
     src.close();
@@ -0,0 +1,145 @@
+/**
+ * 门级模型与微程序模拟器的锁步比较
+ *
+ * 同时用gatesim的电路模型与emulator的CPU执行一个程序，每条指令结束时比较寄存器、PC、PSW与写过的内存，
+ * 不一致时从最近的检查点二分，打印第一个不同的微周期与两边的寄存器
+ */
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include "cosim.h"
+#include "builtin.h"
+
+/// @brief 打印用法
+static void PrintUsage()
+{
+    std::cout << "cosim [options] program" << std::endl
+              << std::endl
+              << "  program: program file generated by compiler" << std::endl
+              << "  -x file: circuit file, default cpu/MyCPU.CircuitProject" << std::endl
+              << "  -C dir:  netlist cache, default .netcache, \"\" to disable" << std::endl
+              << "  -m file: microcode file, default built-in table" << std::endl
+              << "  -v:      use built-in variable-length microcode, see compiler -v" << std::endl
+              << "  -c num:  max clock cycles of the emulator, default 1000000" << std::endl
+              << "  -i num:  compare every num instructions, default 1" << std::endl
+              << "  -k num:  checkpoint every num instructions, default 1000" << std::endl
+              << "  -j num:  gate simulation threads, at most the number of cores, default 1" << std::endl
+              << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string circuitfile = "cpu/MyCPU.CircuitProject";
+    std::string cachedir = ".netcache";
+    std::string microfile;
+    bool varlen = false;
+    std::string program;
+    uint64_t maxcycles = 1000000;
+    uint64_t every = 1;
+    uint64_t interval = 1000;
+    int threads = 1;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-x" && i + 1 < argc)
+            circuitfile = argv[++i];
+        else if (arg == "-C" && i + 1 < argc)
+            cachedir = argv[++i];
+        else if (arg == "-m" && i + 1 < argc)
+            microfile = argv[++i];
+        else if (arg == "-v")
+            varlen = true;
+        else if (arg == "-c" && i + 1 < argc)
+            maxcycles = std::strtoull(argv[++i], NULL, 0);
+        else if (arg == "-i" && i + 1 < argc)
+            every = std::strtoull(argv[++i], NULL, 0);
+        else if (arg == "-k" && i + 1 < argc)
+            interval = std::strtoull(argv[++i], NULL, 0);
+        else if (arg == "-j" && i + 1 < argc)
+            threads = std::atoi(argv[++i]);
+        else if (arg[0] != '-' && program.empty())
+            program = arg;
+        else
+        {
+            PrintUsage();
+            return 0;
+        }
+    }
+
+    if (program.empty())
+    {
+        PrintUsage();
+        return 0;
+    }
+
+    static MicroCode micro;
+    if (microfile.empty())
+    {
+        const BuiltinMicro &builtin = varlen ? BUILTIN_MICRO_VARLEN : BUILTIN_MICRO;
+        micro.Load(builtin.index, builtin.pool[0], builtin.count);
+    }
+    else if (!micro.Load(microfile.c_str()))
+    {
+        std::cout << "error: unable to load microcode file" << std::endl;
+        return 0;
+    }
+
+    static GateMachine machine;
+    std::string error;
+    if (!machine.Load(circuitfile, error, cachedir, threads))
+    {
+        std::cout << "error: " << error << std::endl;
+        return 0;
+    }
+    static CPU cpu(&micro);
+    machine.LoadMicro(micro);
+    if (machine.LoadProgram(program.c_str()) < 0 || cpu.LoadProgram(program.c_str()) < 0)
+    {
+        std::cout << "error: unable to open program file" << std::endl;
+        return 0;
+    }
+    if (!machine.Boot())
+    {
+        std::cout << "error: circuit does not settle after power on" << std::endl;
+        return 0;
+    }
+
+    static CoSim cosim(machine, cpu, every, interval);
+    if (cosim.Start())
+        std::cout << "power on: circuit PSW is 0x" << std::hex << (int)cpu.psw << std::dec
+                  << ", copied to the emulator" << std::endl;
+
+    auto beg = std::chrono::steady_clock::now();
+    bool same = cosim.Run(maxcycles, error);
+    auto end = std::chrono::steady_clock::now();
+    double sec = std::chrono::duration<double>(end - beg).count();
+    if (!error.empty())
+        std::cout << "error: " << error << std::endl;
+
+    std::cout << "instructions: " << cosim.instr << ", emulator cycles: " << cpu.cycles
+              << ", circuit cycles: " << machine.cycles << ", counter races: " << cosim.races
+              << ", replays: " << cosim.replays << ", time: " << sec * 1000 << " ms" << std::endl;
+    if (same)
+    {
+        std::cout << (cpu.halt ? "halted" : "cycle limit reached") << ", no difference" << std::endl;
+        return 0;
+    }
+    if (!error.empty())
+        return 0;
+
+    printf("\nfirst difference in instruction %llu, micro-cycle %d: IR = 0x%02x, PSW = 0x%x, CYC = %d, word = 0x%08x\n",
+           (unsigned long long)cosim.badinstr, cosim.badstep, cosim.badir, cosim.badpsw, cosim.badcyc, cosim.badword);
+    for (const CoSimDiff &d : cosim.diffs)
+        printf("%12s: circuit 0x%02x, emulator 0x%02x\n", d.name.c_str(), d.gate, d.emu);
+
+    static CPU circuit(&micro);
+    machine.Export(circuit);
+    printf("\ncircuit:\n");
+    circuit.PrintRegisters(stdout);
+    printf("\nemulator:\n");
+    cpu.PrintRegisters(stdout);
+    return 0;
+}
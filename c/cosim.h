@@ -0,0 +1,277 @@
+/**
+ * 门级模型与微程序模拟器的锁步比较
+ *
+ * GateMachine与CPU执行同一程序，每条指令结束、微周期计数器回到0时比较pin.h中的寄存器、PC、PSW，
+ * 以及这段时间里任一方写过的内存。两者有两处已知的不同，见GateMachine：上电后电路的IE为1，
+ * 开始时把电路上电后的寄存器与PSW复制到CPU；同一微周期既写PSW又有PIN_CYC时电路按新PSW的控制字计数，
+ * 会多走几个微周期，所以按指令而不是按周期对齐，多走的指令数单独统计。
+ * 每隔一定指令数在两边一致时保存检查点，发现不同后从检查点重新执行，先按指令二分，
+ * 再在出错的指令内逐个微周期比较全部状态，找到第一个不同的微周期，不必从头再来
+ */
+
+#ifndef _COSIM_H_
+#define _COSIM_H_
+
+#include <string>
+#include <vector>
+#include "gatesim.h"
+
+#define COSIM_MAX_DIFFS 16 // 一次比较最多记录的不同处
+
+/// @brief 两边的一处不同
+struct CoSimDiff
+{
+    std::string name; // 寄存器名或RAM[地址]
+    uint32_t gate;    // 电路中的值
+    uint32_t emu;     // CPU中的值
+};
+
+/// @brief 锁步比较
+struct CoSim
+{
+    GateMachine &gate;
+    CPU &cpu;
+    uint64_t every;    // 每隔几条指令比较一次
+    uint64_t interval; // 每隔几条指令保存检查点
+
+    uint64_t instr;   // 已执行的指令数
+    uint64_t races;   // 电路比CPU多走微周期的指令数
+    uint64_t replays; // 二分时从检查点重新执行的次数
+
+    GateMachine::Checkpoint gatecp; // 检查点
+    CPU cpucp;
+    uint64_t cpinstr;              // 检查点所在的指令数
+    std::vector<uint8_t> watch;    // CPU写内存的页，见CPU::watch
+
+    std::vector<CoSimDiff> diffs; // 第一个不同处的各项
+    uint64_t badinstr;            // 第几条指令中出现不同，从1开始
+    int badstep;                  // 这条指令的第几个微周期之后不同，从1开始，指令结束后电路多走的周期中才不同时为CPU的周期数
+    uint8_t badir, badpsw, badcyc; // 这个微周期开始时CPU的IR、PSW与微周期计数器
+    uint32_t badword;              // 这个微周期的控制字
+
+    CoSim(GateMachine &gate, CPU &cpu, uint64_t every = 1, uint64_t interval = 1000)
+        : gate(gate), cpu(cpu), every(every < 1 ? 1 : every), interval(interval < 1 ? 1 : interval),
+          instr(0), races(0), replays(0), cpucp(cpu.micro), cpinstr(0), watch(RAM_SIZE >> 8, WATCH_CODE),
+          badinstr(0), badstep(0), badir(0), badpsw(0), badcyc(0), badword(0)
+    {
+    }
+
+    /// @brief 电路开机后调用：把电路的寄存器、PC、PSW与微周期计数器复制到CPU，内存两边应已载入同一程序
+    /// @return 复制前CPU的PSW是否与电路不同，即上电时IE位的不同
+    bool Start()
+    {
+        uint32_t addr = gate.MicroAddress();
+        bool differ = cpu.psw != ((addr >> 4) & 0xf);
+        for (int i = MSR; i <= T2; ++i)
+            if (i != RAM)
+                cpu.reg[i] = gate.Reg(i);
+        cpu.pc = gate.Pc();
+        cpu.psw = (addr >> 4) & 0xf;
+        cpu.cyc = addr & 0xf;
+        cpu.halt = gate.Halted();
+        cpu.cycles = cpu.instructions = 0;
+        cpu.watch = watch.data();
+        cpu.watchbits = NULL;
+        gate.LogRamWrites(true);
+        instr = races = replays = 0;
+        Save();
+        return differ;
+    }
+
+    /// @brief 在当前位置保存检查点
+    void Save()
+    {
+        gate.Save(gatecp);
+        cpucp = cpu;
+        cpinstr = instr;
+    }
+
+    /// @brief 回到检查点
+    void Restore()
+    {
+        gate.Restore(gatecp);
+        cpu = cpucp;
+        instr = cpinstr;
+        ClearWrites();
+    }
+
+    /// @brief 两边各执行一条指令，已停机的一方不动
+    /// @return 电路是否稳定
+    bool StepInstruction()
+    {
+        uint64_t emu = cpu.cycles, circuit = gate.cycles;
+        if (!cpu.halt)
+            while (cpu.Step() && cpu.cyc != 0)
+                ;
+        while (!gate.Halted())
+        {
+            if (!gate.Cycle())
+                return false;
+            if ((gate.MicroAddress() & 0xf) == 0)
+                break;
+        }
+        if (gate.cycles - circuit > cpu.cycles - emu)
+            ++races;
+        ++instr;
+        return true;
+    }
+
+    void Diff(const std::string &name, uint32_t g, uint32_t e)
+    {
+        if (diffs.size() < COSIM_MAX_DIFFS)
+            diffs.push_back({name, g, e});
+    }
+
+    void DiffRam(uint32_t addr)
+    {
+        uint8_t g = (uint8_t)gate.Ram()[addr];
+        if (g != cpu.ram[addr])
+        {
+            char name[16];
+            snprintf(name, sizeof(name), "RAM[%04x]", addr);
+            Diff(name, g, cpu.ram[addr]);
+        }
+    }
+
+    /// @brief 清空两边的写内存记录
+    void ClearWrites()
+    {
+        std::fill(watch.begin(), watch.end(), WATCH_CODE);
+        cpu.watchhit = false;
+        gate.RamWrites().clear();
+    }
+
+    /// @brief 比较两边的状态，不同处记入diffs
+    /// @param fullram 比较整个内存，否则只比较上次比较后写过的地址
+    /// @return 是否一致
+    bool Compare(bool fullram)
+    {
+        diffs.clear();
+        for (int i = MSR; i <= T2; ++i)
+            if (i != RAM && gate.Reg(i) != cpu.reg[i])
+                Diff(REG_NAMES[i], gate.Reg(i), cpu.reg[i]);
+        uint32_t addr = gate.MicroAddress();
+        if (gate.Pc() != cpu.pc)
+            Diff("PC", gate.Pc(), cpu.pc);
+        if (((addr >> 4) & 0xf) != cpu.psw)
+            Diff("PSW", (addr >> 4) & 0xf, cpu.psw);
+        if ((addr & 0xf) != cpu.cyc)
+            Diff("CYC", addr & 0xf, cpu.cyc);
+        if (gate.Halted() != cpu.halt)
+            Diff("HLT", gate.Halted(), cpu.halt);
+
+        if (fullram)
+        {
+            for (uint32_t a = 0; a < RAM_SIZE; ++a)
+                DiffRam(a);
+        }
+        else
+        {
+            for (const auto &w : gate.RamWrites())
+                if (w.first == (uint32_t)gate.ram)
+                    DiffRam(w.second);
+            if (cpu.watchhit)
+                for (uint32_t page = 0; page < watch.size(); ++page)
+                    if (watch[page] == WATCH_HIT)
+                        for (uint32_t a = page << 8; a < (page + 1) << 8; ++a)
+                            DiffRam(a);
+        }
+        ClearWrites();
+        return diffs.empty();
+    }
+
+    /// @brief 从检查点重新执行到第n条指令结束
+    /// @return 电路是否稳定
+    bool Replay(uint64_t n)
+    {
+        ++replays;
+        Restore();
+        while (instr < n)
+            if (!StepInstruction())
+                return false;
+        return true;
+    }
+
+    /// @brief 已知检查点一致、第bad条指令结束时不同，找到第一个不同的微周期，结果在diffs与bad*中
+    /// @param bad
+    /// @param error 电路振荡时的说明
+    /// @return 电路是否稳定
+    bool Bisect(uint64_t bad, std::string &error)
+    {
+        uint64_t good = every == 1 ? bad - 1 : cpinstr; // 每条指令都比较时上一条一定一致
+        while (bad - good > 1)
+        {
+            uint64_t mid = good + (bad - good) / 2;
+            if (!Replay(mid))
+                break;
+            (Compare(true) ? good : bad) = mid;
+        }
+        if (!Replay(bad - 1))
+        {
+            error = "circuit does not settle while bisecting";
+            return false;
+        }
+
+        // 在第bad条指令内两边逐个微周期执行
+        badinstr = bad;
+        for (badstep = 1;; ++badstep)
+        {
+            badir = cpu.reg[IR], badpsw = cpu.psw, badcyc = cpu.cyc;
+            badword = cpu.micro->Word(badir, badpsw, badcyc);
+            bool ended = cpu.halt || !cpu.Step() || cpu.cyc == 0;
+            if (!gate.Halted() && !gate.Cycle())
+            {
+                error = "circuit does not settle while bisecting";
+                return false;
+            }
+            if (ended)
+                break;
+            if (!Compare(true))
+                return true;
+        }
+
+        // CPU已结束这条指令，电路可能还在多走微周期
+        while (!gate.Halted() && (gate.MicroAddress() & 0xf) != 0)
+            if (!gate.Cycle())
+            {
+                error = "circuit does not settle while bisecting";
+                return false;
+            }
+        ++instr;
+        Compare(true);
+        return true;
+    }
+
+    /// @brief 锁步执行到两边都停机或CPU达到周期上限
+    /// @param maxcycles
+    /// @param error 电路振荡时的说明
+    /// @return 是否一致，不一致时diffs与bad*为第一个不同的微周期
+    bool Run(uint64_t maxcycles, std::string &error)
+    {
+        while (cpu.cycles < maxcycles && !(cpu.halt && gate.Halted()))
+        {
+            if (!StepInstruction())
+            {
+                error = "circuit does not settle in cycle " + std::to_string(gate.cycles);
+                return false;
+            }
+            if (instr % every != 0 && !cpu.halt && !gate.Halted())
+                continue;
+            if (!Compare(false))
+            {
+                Bisect(instr, error);
+                return false;
+            }
+            if (instr - cpinstr >= interval)
+                Save();
+        }
+        if (!Compare(true))
+        {
+            Bisect(instr, error);
+            return false;
+        }
+        return true;
+    }
+};
+
+#endif //_COSIM_H_
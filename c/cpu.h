@@ -0,0 +1,387 @@
+/**
+ * 微程序级CPU模型
+ */
+
+#ifndef _CPU_H_
+#define _CPU_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "pin.h"
+#include "rom.h"
+
+#define MICRO_SIZE 0x10000 // 微程序控制字个数
+#define RAM_SIZE   0x10000 // 内存大小，MSR为高8位，MAR为低8位
+
+#define PSW_O  (1 << 0) // 溢出位
+#define PSW_Z  (1 << 1) // 零位
+#define PSW_P  (1 << 2) // 奇偶位
+#define PSW_IE (1 << 3) // 中断允许位
+
+#define WATCH_CODE 1 // 页中有需要监视写入的内容
+#define WATCH_HIT  2 // 被监视的页已被写入
+
+// 控制字中各字段的掩码
+#define MASK_OUT (0x1f)               // 输出到总线的寄存器
+#define MASK_IN  (0x1f << _DST_SHIFT) // 从总线写入的寄存器
+#define MASK_OP  (0x7 << _OP_SHIFT)   // ALU运算
+
+// 寄存器名，下标为pin.h中的编号
+static const char *const REG_NAMES[] = {
+    "", "MSR", "MAR", "MDR", "RAM", "IR", "DST", "SRC", "A", "B", "C",
+    "D", "DI", "SI", "SP", "BP", "CS", "DS", "SS", "ES", "VEC", "T1", "T2"};
+
+/// @brief 奇偶校验：1的个数为偶数时为1，奇数时为0
+/// @param val
+/// @return
+static inline uint8_t Parity(uint8_t val)
+{
+    return !__builtin_parity(val);
+}
+
+/// @brief ALU运算
+/// @param op 运算，即控制字中的OP_*字段
+/// @param a 寄存器A的值
+/// @param b 寄存器B的值
+/// @param flags 运算得到的溢出位、零位、奇偶位
+/// @return 运算结果
+static inline uint8_t Alu(uint32_t op, uint8_t a, uint8_t b, uint8_t &flags)
+{
+    uint8_t result;
+    uint8_t overflow;
+
+    switch (op & MASK_OP)
+    {
+    case OP_ADD:
+        result = a + b, overflow = (a + b) > 0xff; // 加法溢出
+        break;
+    case OP_SUB:
+        result = a - b, overflow = a < b; // 减法溢出
+        break;
+    case OP_INC:
+        result = a + 1, overflow = a == 0xff; // 加一溢出
+        break;
+    case OP_DEC:
+        result = a - 1, overflow = a == 0; // 减一溢出
+        break;
+    case OP_AND:
+        result = a & b, overflow = 0;
+        break;
+    case OP_OR:
+        result = a | b, overflow = 0;
+        break;
+    case OP_XOR:
+        result = a ^ b, overflow = 0;
+        break;
+    default: // OP_NOT
+        result = ~a, overflow = 0;
+        break;
+    }
+
+    flags = (overflow ? PSW_O : 0) | (result ? 0 : PSW_Z) | (Parity(result) ? PSW_P : 0);
+    return result;
+}
+
+/// @brief 微程序控制器，即controller.c生成的micro.bin。
+/// 平铺格式与压缩格式都去重后保存，执行时只需访问用到的几行
+struct MicroCode
+{
+    uint16_t index[ROM_ROWS];                       // 下标为ir << 4 | psw，值为pool中的行号
+    alignas(64) uint32_t pool[ROM_ROWS][ROM_STEPS]; // 去重后的行，每行占一个缓存行
+    int count;                                      // 去重后的行数
+
+    /// @brief 计算平铺格式中控制字的下标，与controller.c中的main()一致
+    /// @param ir 指令
+    /// @param psw 程序状态字
+    /// @param cyc 微周期
+    /// @return
+    static inline uint32_t Index(uint8_t ir, uint8_t psw, uint8_t cyc)
+    {
+        return (ir << 8) | ((psw & 0xf) << 4) | (cyc & 0xf);
+    }
+
+    /// @brief 取一行控制字
+    /// @param ir 指令
+    /// @param psw 程序状态字
+    /// @return 16个控制字
+    inline const uint32_t *Row(uint8_t ir, uint8_t psw) const
+    {
+        return pool[index[(ir << 4) | (psw & 0xf)]];
+    }
+
+    /// @brief 取一个控制字
+    /// @param ir 指令
+    /// @param psw 程序状态字
+    /// @param cyc 微周期
+    /// @return
+    inline uint32_t Word(uint8_t ir, uint8_t psw, uint8_t cyc) const
+    {
+        return Row(ir, psw)[cyc & 0xf];
+    }
+
+    /// @brief 从文件读取微程序，自动识别平铺格式与压缩格式
+    /// @param path
+    /// @return
+    bool Load(const char *path)
+    {
+        FILE *pf = fopen(path, "rb");
+        if (pf == NULL)
+            return false;
+
+        count = RomRead(pf, index, pool[0]);
+        if (count < 0)
+        {
+            std::vector<uint32_t> flat(MICRO_SIZE);
+            rewind(pf);
+            if (fread(flat.data(), sizeof(uint32_t), MICRO_SIZE, pf) == MICRO_SIZE)
+                count = RomCompress(flat.data(), index, pool[0]);
+        }
+        fclose(pf);
+        return count > 0;
+    }
+
+    /// @brief 从内存中的去重表载入，如builtin.h中编译期生成的表
+    /// @param index 下标为ir << 4 | psw，值为行号
+    /// @param pool 去重后的行
+    /// @param count 行数
+    void Load(const uint16_t *index, const uint32_t *pool, int count)
+    {
+        memcpy(this->index, index, sizeof(this->index));
+        memcpy(this->pool, pool, count * sizeof(this->pool[0]));
+        this->count = count;
+    }
+
+    /// @brief 还原为平铺格式
+    /// @param flat MICRO_SIZE个控制字
+    void Expand(uint32_t *flat) const
+    {
+        RomExpand(index, pool[0], flat);
+    }
+};
+
+struct CPU;
+
+/// @brief 内存映射的设备，CPU::Store写入mapped置位的页时先交给store，见device.h
+struct IoBus
+{
+    uint8_t mapped[RAM_SIZE >> 8]; // 有设备的页置1，下标为地址高8位
+
+    /// @brief 写入有设备的页时调用
+    /// @return 地址是设备的寄存器时由设备写入并返回true，否则返回false，按普通内存写入
+    bool (*store)(IoBus *bus, CPU &cpu, uint16_t addr, uint8_t val);
+};
+
+/// @brief CPU与内存的状态，按微周期执行
+struct CPU
+{
+    uint8_t reg[32];       // 寄存器，下标为pin.h中的编号，RAM不占用
+    uint8_t pc;            // 程序计数器
+    uint8_t psw;           // 程序状态字
+    uint8_t cyc;           // 微周期计数器
+    bool halt;             // 是否已停止
+    uint64_t cycles;       // 已执行的微周期数
+    uint64_t instructions; // 已执行的指令数
+    uint8_t ram[RAM_SIZE]; // 内存
+
+    const MicroCode *micro;   // 微程序
+    uint8_t *watch;           // 需要监视写入的页，下标为地址高8位，为NULL时不监视
+    bool watchhit;            // 是否写入过被监视的页
+    const uint8_t *watchbits; // 被监视的页中只监视这些字节，按位，下标为地址，为NULL时监视整页
+    uint8_t *dirty;           // 写入过的页置1，下标为地址高8位，为NULL时不记录，见snapshot.h
+    IoBus *io;                // 内存映射的设备，为NULL时没有
+
+    CPU(const MicroCode *micro) : micro(micro), watch(NULL), watchhit(false), watchbits(NULL), dirty(NULL), io(NULL)
+    {
+        Reset();
+        memset(ram, 0, sizeof(ram));
+    }
+
+    /// @brief 复位寄存器，不清空内存
+    void Reset()
+    {
+        memset(reg, 0, sizeof(reg));
+        pc = psw = cyc = 0;
+        halt = false;
+        cycles = instructions = 0;
+    }
+
+    /// @brief 将程序载入内存
+    /// @param path 汇编器生成的程序文件
+    /// @param addr 载入位置
+    /// @return 载入的字节数，失败返回-1
+    long LoadProgram(const char *path, uint16_t addr = 0)
+    {
+        FILE *pf = fopen(path, "rb");
+        if (pf == NULL)
+            return -1;
+        size_t cnt = fread(ram + addr, 1, RAM_SIZE - addr, pf);
+        fclose(pf);
+        return (long)cnt;
+    }
+
+    /// @brief 当前MSR与MAR所指向的内存地址
+    /// @return
+    inline uint16_t Address() const
+    {
+        return (reg[MSR] << 8) | reg[MAR];
+    }
+
+    /// @brief 写内存，所有对内存的写入都经过这里
+    /// @param addr
+    /// @param val
+    inline void Store(uint16_t addr, uint8_t val)
+    {
+        if (io != NULL && io->mapped[addr >> 8] && io->store(io, *this, addr, val))
+            return;
+        ram[addr] = val;
+        if (dirty != NULL)
+            dirty[addr >> 8] = 1;
+        if (watch != NULL && watch[addr >> 8] && (watchbits == NULL || (watchbits[addr >> 3] >> (addr & 7) & 1)))
+            watch[addr >> 8] = WATCH_HIT, watchhit = true;
+    }
+
+    /// @brief 读取编号对应的寄存器，RAM为读内存，无效编号读出0
+    /// @param i
+    /// @return
+    inline uint8_t ReadReg(uint8_t i) const
+    {
+        return i == RAM ? ram[Address()] : reg[i & 0x1f];
+    }
+
+    /// @brief 写入编号对应的寄存器，RAM为写内存，无效编号忽略
+    /// @param i
+    /// @param val
+    inline void WriteReg(uint8_t i, uint8_t val)
+    {
+        Latch(i, val, Address());
+    }
+
+    /// @brief 在时钟沿将总线上的值写入寄存器或内存
+    /// @param i 寄存器编号
+    /// @param val 总线的值
+    /// @param addr 周期开始时的内存地址
+    inline void Latch(uint8_t i, uint8_t val, uint16_t addr)
+    {
+        if (i == RAM)
+            Store(addr, val);
+        else if (i >= MSR && i <= T2)
+            reg[i] = val;
+    }
+
+    /// @brief 将ALU标志位写入程序状态字，PIN_ALU_INT_W有效时同时写中断允许位
+    /// @param w 控制字
+    /// @param flags ALU运算得到的标志位
+    inline void LatchPsw(uint32_t w, uint8_t flags)
+    {
+        uint8_t ie = psw & PSW_IE;
+        if (w & PIN_ALU_INT_W)
+            ie = (w & PIN_ALU_INT) ? 0 : PSW_IE;
+        psw = ie | flags;
+    }
+
+    /// @brief 执行一个微周期
+    /// @return 是否继续执行，遇到PIN_HLT返回false
+    inline bool Step()
+    {
+        uint32_t w = micro->Word(reg[IR], psw, cyc);
+
+        if (w & PIN_HLT)
+        {
+            halt = true;
+            return false;
+        }
+
+        // 同一微周期内所有写入均使用周期开始时的DST、SRC、地址
+        uint8_t dst = reg[DST] & 0x1f;
+        uint8_t src = reg[SRC] & 0x1f;
+        uint16_t addr = Address();
+
+        // 输出到总线
+        uint8_t bus = 0;
+        if (w & MASK_OUT)
+            bus |= ReadReg(w & MASK_OUT);
+        if (w & PIN_SRC_R)
+            bus |= ReadReg(src);
+        if (w & PIN_DST_R)
+            bus |= ReadReg(dst);
+        if ((w & (PIN_PC_CS | PIN_PC_WE)) == PIN_PC_CS)
+            bus |= pc;
+
+        uint8_t flags;
+        uint8_t result = Alu(w, reg[A], reg[B], flags);
+        if (w & PIN_ALU_OUT)
+            bus |= result;
+
+        // 从总线写入
+        if (w & MASK_IN)
+            Latch((w & MASK_IN) >> _DST_SHIFT, bus, addr);
+        if (w & PIN_DST_W)
+            Latch(dst, bus, addr);
+        if (w & PIN_SRC_W)
+            Latch(src, bus, addr);
+
+        // 程序计数器
+        if ((w & (PIN_PC_CS | PIN_PC_WE)) == (PIN_PC_CS | PIN_PC_WE))
+            pc = (w & PIN_PC_EN) ? pc + 1 : bus;
+
+        // 程序状态字
+        if (w & PIN_ALU_PSW)
+            LatchPsw(w, flags);
+
+        // 微周期计数器为4位，计满16后同样回到取指
+        ++cycles;
+        if ((w & PIN_CYC) || cyc == 0xf)
+            cyc = 0, ++instructions;
+        else
+            ++cyc;
+        return true;
+    }
+
+    /// @brief 执行到停止或达到微周期上限
+    /// @param maxcycles 微周期上限
+    /// @return 是否因PIN_HLT而停止
+    bool Run(uint64_t maxcycles)
+    {
+        while (cycles < maxcycles)
+            if (!Step())
+                return true;
+        return false;
+    }
+
+    /// @brief 打印寄存器状态
+    /// @param out
+    void PrintRegisters(FILE *out) const
+    {
+        int col = 0;
+        for (int i = MSR; i <= T2; ++i)
+        {
+            if (i == RAM)
+                continue;
+            fprintf(out, "%4s = 0x%02x%s", REG_NAMES[i], reg[i], ++col % 6 ? "    " : "\n");
+        }
+        fprintf(out, "%4s = 0x%02x    %4s = 0x%02x (O=%d Z=%d P=%d IE=%d)\n", "PC", pc, "PSW", psw,
+                !!(psw & PSW_O), !!(psw & PSW_Z), !!(psw & PSW_P), !!(psw & PSW_IE));
+    }
+
+    /// @brief 打印内存中非零的行
+    /// @param out
+    void PrintRam(FILE *out) const
+    {
+        for (uint32_t row = 0; row < RAM_SIZE; row += 16)
+        {
+            bool zero = true;
+            for (int i = 0; i < 16 && zero; ++i)
+                zero = ram[row + i] == 0;
+            if (zero)
+                continue;
+            fprintf(out, "%04x:", row);
+            for (int i = 0; i < 16; ++i)
+                fprintf(out, " %02x", ram[row + i]);
+            fprintf(out, "\n");
+        }
+    }
+};
+
+#endif //_CPU_H_
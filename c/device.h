@@ -0,0 +1,399 @@
+/**
+ * 内存映射的设备
+ *
+ * 电路只有8LED、Digit-8bit、Digit-dec三个显示部件，没有其他输出。DeviceBus在MSR:MAR的地址空间中
+ * 占用DEV_REGS个字节作为设备的寄存器，程序用普通的MOV读写：所有写内存都经过CPU::Store，写入有设备的页时
+ * 先交给DeviceBus；读仍然只读内存，设备在被写入时把要给程序读的值写进自己的寄存器，所以执行引擎
+ * 的读内存路径不变。访问内存时MSR即代码段，默认把寄存器放在0号段的末尾DEV_BASE，
+ * 写寄存器不算改写代码。寄存器相对DEV_BASE的偏移：
+ *
+ *   DEV_CON   写：向控制台输出一个字节
+ *   DEV_LED   写：8LED
+ *   DEV_HEX   写：Digit-8bit，显示为两位十六进制
+ *   DEV_DEC   写：Digit-dec，显示为三位十进制
+ *   DEV_IN    读：输入文件的当前字节
+ *   DEV_STAT  读：DEV_IN的状态，DEV_READY有效，DEV_WAIT还没有读到，再写一次DEV_NEXT，DEV_EOF文件已结束
+ *   DEV_NEXT  写：取输入文件的下一个字节到DEV_IN
+ *   DEV_OUT   写：向输出文件写一个字节
+ *
+ * 与主机文件之间经过单生产者单消费者的环形缓冲区，由DeviceHost的后台线程写出与预读，
+ * 模拟的CPU不会等待主机的I/O：输出的环满时暂存在模拟线程自己的缓冲区中，下次写入时再放入环；
+ * 输入的环空时DEV_STAT为DEV_WAIT
+ */
+
+#ifndef _DEVICE_H_
+#define _DEVICE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include "cpu.h"
+
+#define DEV_RING_SIZE (1 << 16) // 环形缓冲区的字节数，为2的幂
+#define DEV_POLL_US   200       // 后台线程无事可做时的休眠时间，微秒
+#define DEV_BASE      0x00f8    // 默认的寄存器地址
+#define DEV_REGS      8         // 寄存器个数
+
+// 寄存器的偏移
+#define DEV_CON  0x00
+#define DEV_LED  0x01
+#define DEV_HEX  0x02
+#define DEV_DEC  0x03
+#define DEV_IN   0x04
+#define DEV_STAT 0x05
+#define DEV_NEXT 0x06
+#define DEV_OUT  0x07
+
+// DEV_STAT的值
+#define DEV_WAIT  0
+#define DEV_READY 1
+#define DEV_EOF   2
+
+/// @brief 单生产者单消费者的环形缓冲区
+/// @tparam N 字节数，为2的幂
+template <size_t N>
+struct SpscRing
+{
+    static_assert((N & (N - 1)) == 0, "ring size must be a power of 2");
+
+    std::atomic<size_t> tail; // 生产者写入的位置
+    size_t headcache;         // 生产者看到的head，不够时才重新读取
+    char pad0[64 - 2 * sizeof(size_t)];
+    std::atomic<size_t> head; // 消费者读取的位置，与tail相隔一个缓存行
+    char pad1[64 - sizeof(size_t)];
+    uint8_t buf[N];
+
+    SpscRing() : tail(0), headcache(0), head(0)
+    {
+    }
+
+    /// @brief 生产者写入一个字节
+    /// @return 环满时返回false
+    bool Push(uint8_t val)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - headcache == N && t - (headcache = head.load(std::memory_order_acquire)) == N)
+            return false;
+        buf[t & (N - 1)] = val;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief 生产者写入最多n个字节
+    /// @return 写入的字节数
+    size_t Write(const uint8_t *data, size_t n)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        headcache = head.load(std::memory_order_acquire);
+        n = std::min(n, N - (t - headcache));
+        for (size_t i = 0; i < n; ++i)
+            buf[(t + i) & (N - 1)] = data[i];
+        tail.store(t + n, std::memory_order_release);
+        return n;
+    }
+
+    /// @brief 消费者读取一个字节
+    /// @return 环空时返回false
+    bool Pop(uint8_t &val)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (tail.load(std::memory_order_acquire) == h)
+            return false;
+        val = buf[h & (N - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief 消费者读取最多n个字节
+    /// @return 读取的字节数
+    size_t Read(uint8_t *data, size_t n)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        n = std::min(n, tail.load(std::memory_order_acquire) - h);
+        for (size_t i = 0; i < n; ++i)
+            data[i] = buf[(h + i) & (N - 1)];
+        head.store(h + n, std::memory_order_release);
+        return n;
+    }
+
+    /// @brief 生产者可写入的字节数
+    size_t Free() const
+    {
+        return N - (tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire));
+    }
+};
+
+/// @brief 与一个主机文件相连的字节流，模拟线程与DeviceHost的线程各在环的一端
+struct HostStream
+{
+    std::string path;
+    FILE *file;
+    bool input;                 // 从文件读入，否则写出到文件
+    bool owned;                 // 结束时关闭file
+    SpscRing<DEV_RING_SIZE> ring;
+    std::atomic<bool> eof;      // 输入：文件已全部放入环
+    std::atomic<bool> failed;   // 读写文件出错
+    std::vector<uint8_t> spill; // 输出：环满时模拟线程暂存的字节
+    size_t spilled;             // spill中已放入环的字节数
+    uint64_t bytes;             // 模拟线程读写的字节数
+
+    HostStream(const std::string &path, FILE *file, bool input, bool owned)
+        : path(path), file(file), input(input), owned(owned), eof(false), failed(false), spilled(0), bytes(0)
+    {
+    }
+
+    ~HostStream()
+    {
+        if (owned)
+            fclose(file);
+    }
+
+    /// @brief 模拟线程输出一个字节，不等待
+    void Put(uint8_t val)
+    {
+        ++bytes;
+        if (spilled == spill.size())
+        {
+            if (ring.Push(val))
+                return;
+            spill.clear(), spilled = 0;
+        }
+        spill.push_back(val);
+        spilled += ring.Write(&spill[spilled], spill.size() - spilled);
+    }
+
+    /// @brief 模拟线程读入一个字节，不等待
+    /// @return DEV_READY、DEV_WAIT或DEV_EOF
+    int Get(uint8_t &val)
+    {
+        if (ring.Pop(val))
+            return ++bytes, DEV_READY;
+        if (!eof.load(std::memory_order_acquire))
+            return DEV_WAIT;
+        // eof之前放入的字节
+        if (ring.Pop(val))
+            return ++bytes, DEV_READY;
+        return DEV_EOF;
+    }
+
+    /// @brief 后台线程在环与文件之间搬运
+    /// @return 搬运的字节数
+    size_t Pump()
+    {
+        uint8_t buf[4096];
+        size_t moved = 0;
+        if (input)
+        {
+            while (!eof.load(std::memory_order_relaxed))
+            {
+                size_t want = std::min(sizeof(buf), ring.Free());
+                if (want == 0)
+                    break;
+                size_t n = fread(buf, 1, want, file);
+                ring.Write(buf, n);
+                moved += n;
+                if (n < want)
+                {
+                    failed.store(ferror(file) != 0, std::memory_order_relaxed);
+                    eof.store(true, std::memory_order_release);
+                }
+            }
+            return moved;
+        }
+        size_t n;
+        while ((n = ring.Read(buf, sizeof(buf))) != 0)
+        {
+            if (fwrite(buf, 1, n, file) != n)
+                failed.store(true, std::memory_order_relaxed);
+            moved += n;
+        }
+        if (moved != 0)
+            fflush(file);
+        return moved;
+    }
+
+    /// @brief 后台线程结束后在模拟线程中写出暂存的字节
+    void Drain()
+    {
+        if (input)
+            return;
+        Pump();
+        if (spilled != spill.size())
+        {
+            if (fwrite(&spill[spilled], 1, spill.size() - spilled, file) != spill.size() - spilled)
+                failed.store(true, std::memory_order_relaxed);
+            fflush(file);
+            spill.clear(), spilled = 0;
+        }
+    }
+};
+
+/// @brief 在后台线程中为所有HostStream读写主机文件
+struct DeviceHost
+{
+    std::vector<std::unique_ptr<HostStream>> streams;
+    std::atomic<bool> quit;
+    std::thread thread;
+
+    DeviceHost() : quit(false)
+    {
+    }
+
+    ~DeviceHost()
+    {
+        Stop();
+    }
+
+    DeviceHost(const DeviceHost &) = delete;
+    DeviceHost &operator=(const DeviceHost &) = delete;
+
+    /// @brief 打开主机文件
+    /// @param path
+    /// @param input
+    /// @return 打不开时返回NULL
+    HostStream *Open(const std::string &path, bool input)
+    {
+        FILE *pf = fopen(path.c_str(), input ? "rb" : "wb");
+        if (pf == NULL)
+            return NULL;
+        streams.emplace_back(new HostStream(path, pf, input, true));
+        return streams.back().get();
+    }
+
+    /// @brief 写到已打开的文件，如stdout
+    HostStream *Attach(const std::string &name, FILE *file)
+    {
+        streams.emplace_back(new HostStream(name, file, false, false));
+        return streams.back().get();
+    }
+
+    /// @brief 预读输入文件后启动后台线程，程序开始时的输入不受线程调度影响
+    void Start()
+    {
+        for (auto &s : streams)
+            if (s->input)
+                s->Pump();
+        quit = false;
+        thread = std::thread(&DeviceHost::Work, this);
+    }
+
+    /// @brief 写出所有输出后结束后台线程
+    void Stop()
+    {
+        if (!thread.joinable())
+            return;
+        quit.store(true, std::memory_order_release);
+        thread.join();
+        for (auto &s : streams)
+            s->Drain();
+    }
+
+    void Work()
+    {
+        while (1)
+        {
+            // 先读quit再搬运，之前放入环的字节都会写出
+            bool last = quit.load(std::memory_order_acquire);
+            size_t moved = 0;
+            for (auto &s : streams)
+                moved += s->Pump();
+            if (last)
+                return;
+            if (moved == 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(DEV_POLL_US));
+        }
+    }
+};
+
+/// @brief 按地址把写入分发给各设备，寄存器的布局见文件开头
+struct DeviceBus : IoBus
+{
+    uint16_t base;       // DEV_CON的地址
+    HostStream *console; // 为NULL时没有这个设备，下同
+    HostStream *input;
+    HostStream *output;
+    uint8_t display[3]; // 8LED、Digit-8bit、Digit-dec最后显示的值
+    uint64_t displays;  // 写显示部件的次数
+
+    explicit DeviceBus(uint16_t base = DEV_BASE)
+        : base(base), console(NULL), input(NULL), output(NULL), display(), displays(0)
+    {
+        memset(mapped, 0, sizeof(mapped));
+        for (int i = 0; i < DEV_REGS; ++i)
+            mapped[(uint16_t)(base + i) >> 8] = 1;
+        store = Store;
+    }
+
+    /// @brief 接到CPU上，在内存中写入设备寄存器的初值
+    void Attach(CPU &cpu)
+    {
+        Poke(cpu, DEV_IN, 0);
+        Poke(cpu, DEV_STAT, input != NULL ? DEV_WAIT : DEV_EOF);
+        cpu.io = this;
+    }
+
+    /// @brief 写设备的寄存器，按CPU::dirty记录，不按CPU::watch标记，执行引擎不必作废同一页中翻译过的代码
+    void Poke(CPU &cpu, int off, uint8_t val) const
+    {
+        uint16_t addr = base + off;
+        cpu.ram[addr] = val;
+        if (cpu.dirty != NULL)
+            cpu.dirty[addr >> 8] = 1;
+    }
+
+    static bool Store(IoBus *io, CPU &cpu, uint16_t addr, uint8_t val)
+    {
+        DeviceBus *bus = static_cast<DeviceBus *>(io);
+        int off = (uint16_t)(addr - bus->base);
+        if (off >= DEV_REGS)
+            return false;
+        bus->Poke(cpu, off, val);
+        switch (off)
+        {
+        case DEV_CON:
+            if (bus->console != NULL)
+                bus->console->Put(val);
+            break;
+        case DEV_LED:
+        case DEV_HEX:
+        case DEV_DEC:
+            bus->display[off - DEV_LED] = val;
+            ++bus->displays;
+            break;
+        case DEV_NEXT:
+            if (bus->input != NULL)
+            {
+                uint8_t byte = 0;
+                int stat = bus->input->Get(byte);
+                if (stat == DEV_READY)
+                    bus->Poke(cpu, DEV_IN, byte);
+                bus->Poke(cpu, DEV_STAT, stat);
+            }
+            break;
+        case DEV_OUT:
+            if (bus->output != NULL)
+                bus->output->Put(val);
+            break;
+        default:
+            break;
+        }
+        return true;
+    }
+
+    /// @brief 按电路的显示方式打印显示部件
+    void PrintDisplay(FILE *out) const
+    {
+        fprintf(out, "display: led ");
+        for (int i = 7; i >= 0; --i)
+            fputc((display[0] >> i) & 1 ? '1' : '0', out);
+        fprintf(out, ", hex %02X, dec %03d, %llu writes\n", display[1], display[2], (unsigned long long)displays);
+    }
+};
+
+#endif //_DEVICE_H_
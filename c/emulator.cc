@@ -0,0 +1,443 @@
+/**
+ * 模拟器
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstdlib>
+#include "cpu.h"
+#include "builtin.h"
+#include "fast.h"
+#include "jit.h"
+#include "batch.h"
+#include "profile.h"
+#include "snapshot.h"
+#include "idle.h"
+#include "irq.h"
+#include "device.h"
+
+/// @brief 打印用法
+static void PrintUsage()
+{
+    std::cout << "emulator [options] program" << std::endl
+              << std::endl
+              << "  program: program file generated by compiler" << std::endl
+              << "  -m file: microcode file, default built-in table" << std::endl
+              << "  -v:      use built-in variable-length microcode, see compiler -v" << std::endl
+              << "  -c num:  max micro cycles, default 100000000" << std::endl
+              << "  -e name: execution engine, micro, fast, jit or batch, default fast" << std::endl
+              << "  -i file: initial ram image loaded before program, may be repeated" << std::endl
+              << "  -n num:  number of instances, default number of images or 1" << std::endl
+              << "  -o file: dump ram to file after running, file.N for each instance" << std::endl
+              << "  -s file: save a snapshot of registers and ram after running, file.N for each instance" << std::endl
+              << "  -r file: start from a snapshot saved by -s instead of a program" << std::endl
+              << "  -z:      skip idle loops, jumping to their exit or the cycle limit" << std::endl
+              << "  -t n[:l]: timer interrupt every n cycles on line l, default 0, may be repeated" << std::endl
+              << "  -a c[:l]: raise an interrupt at cycle c on line l, default 0, may be repeated" << std::endl
+              << "  -d addr: map the console, display and file device registers at addr, default 0xf8, see c/device.h" << std::endl
+              << "  -u file: input file the program reads through the DEV_IN register, implies -d" << std::endl
+              << "  -w file: output file the program writes through the DEV_OUT register, implies -d" << std::endl
+              << "  -T file: record an execution trace for replay, see c/trace.h" << std::endl
+              << "  -k num:  with -T, keyframe every num instructions, default 262144" << std::endl
+              << "  -q:      do not print ram" << std::endl
+              << "  -p file: profile by source line and label, file is the line map from compiler -l" << std::endl
+              << "  -f file: with -p, also write folded stacks for flame graphs" << std::endl
+              << std::endl;
+}
+
+/// @brief 解析“数[:线号]”形式的参数
+/// @param arg
+/// @param num
+/// @param line
+/// @return 线号是否有效
+static bool ParseIrq(const char *arg, uint64_t &num, int &line)
+{
+    char *end;
+    num = std::strtoull(arg, &end, 0);
+    line = *end == ':' ? std::atoi(end + 1) : 0;
+    return line >= 0 && line < IRQ_LINES;
+}
+
+/// @brief 保存内存
+/// @param path
+/// @param cpu
+/// @return
+static bool DumpRam(const std::string &path, const CPU &cpu)
+{
+    FILE *pf = fopen(path.c_str(), "wb");
+    if (pf == NULL)
+        return false;
+    fwrite(cpu.ram, sizeof(cpu.ram), 1, pf);
+    fclose(pf);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string microfile;
+    bool varlen = false;
+    std::string program;
+    std::string dumpfile;
+    std::string snapfile;
+    std::string resumefile;
+    std::string engine = "fast";
+    std::string mapfile;
+    std::string foldedfile;
+    std::vector<std::string> images;
+    uint64_t maxcycles = 100000000;
+    size_t count = 0;
+    bool printram = true;
+    bool idle = false;
+    std::vector<std::pair<uint64_t, int>> timers; // 周期、线号
+    std::vector<std::pair<uint64_t, int>> raises; // 时间、线号
+    int devbase = -1;
+    std::string infile;
+    std::string outfile;
+    std::string tracefile;
+    uint64_t interval = TRACE_INTERVAL;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-m" && i + 1 < argc)
+            microfile = argv[++i];
+        else if (arg == "-v")
+            varlen = true;
+        else if (arg == "-c" && i + 1 < argc)
+            maxcycles = std::strtoull(argv[++i], NULL, 0);
+        else if (arg == "-e" && i + 1 < argc)
+            engine = argv[++i];
+        else if (arg == "-i" && i + 1 < argc)
+            images.push_back(argv[++i]);
+        else if (arg == "-n" && i + 1 < argc)
+            count = std::strtoull(argv[++i], NULL, 0);
+        else if (arg == "-o" && i + 1 < argc)
+            dumpfile = argv[++i];
+        else if (arg == "-s" && i + 1 < argc)
+            snapfile = argv[++i];
+        else if (arg == "-r" && i + 1 < argc)
+            resumefile = argv[++i];
+        else if (arg == "-p" && i + 1 < argc)
+            mapfile = argv[++i];
+        else if (arg == "-f" && i + 1 < argc)
+            foldedfile = argv[++i];
+        else if (arg == "-z")
+            idle = true;
+        else if ((arg == "-t" || arg == "-a") && i + 1 < argc)
+        {
+            uint64_t num;
+            int line;
+            if (!ParseIrq(argv[++i], num, line) || (arg == "-t" && num == 0))
+            {
+                PrintUsage();
+                return 0;
+            }
+            (arg == "-t" ? timers : raises).emplace_back(num, line);
+        }
+        else if (arg == "-d" && i + 1 < argc)
+            devbase = (int)std::strtoul(argv[++i], NULL, 0) & 0xffff;
+        else if (arg == "-u" && i + 1 < argc)
+            infile = argv[++i];
+        else if (arg == "-w" && i + 1 < argc)
+            outfile = argv[++i];
+        else if (arg == "-T" && i + 1 < argc)
+            tracefile = argv[++i];
+        else if (arg == "-k" && i + 1 < argc)
+            interval = std::strtoull(argv[++i], NULL, 0);
+        else if (arg == "-q")
+            printram = false;
+        else if (arg[0] != '-' && program.empty())
+            program = arg;
+        else
+        {
+            PrintUsage();
+            return 0;
+        }
+    }
+
+    if (program.empty() == resumefile.empty() || (engine != "micro" && engine != "fast" && engine != "jit" && engine != "batch"))
+    {
+        PrintUsage();
+        return 0;
+    }
+    if (count == 0)
+        count = images.empty() ? 1 : images.size();
+    if (!mapfile.empty() && count != 1)
+    {
+        std::cout << "error: profiling supports a single instance only" << std::endl;
+        return 0;
+    }
+    bool irq = !timers.empty() || !raises.empty();
+    if ((idle || irq) && (engine == "batch" || !mapfile.empty()))
+    {
+        std::cout << "error: -z, -t and -a support the micro, fast and jit engines only" << std::endl;
+        return 0;
+    }
+    if (irq && count != 1)
+    {
+        std::cout << "error: interrupts support a single instance only" << std::endl;
+        return 0;
+    }
+    bool tracing = !tracefile.empty();
+    if (tracing && (engine == "batch" || count != 1 || !mapfile.empty() || idle))
+    {
+        std::cout << "error: tracing supports a single instance without -z or profiling only" << std::endl;
+        return 0;
+    }
+    bool devices = devbase >= 0 || !infile.empty() || !outfile.empty();
+    if (devices && (engine == "batch" || count != 1))
+    {
+        std::cout << "error: devices support a single instance and the micro, fast and jit engines only" << std::endl;
+        return 0;
+    }
+
+    static Profiler profiler;
+    if (!mapfile.empty() && !profiler.LoadMap(mapfile))
+    {
+        std::cout << "error: unable to open map file" << std::endl;
+        return 0;
+    }
+
+    static MicroCode micro;
+    if (microfile.empty())
+    {
+        const BuiltinMicro &builtin = varlen ? BUILTIN_MICRO_VARLEN : BUILTIN_MICRO;
+        micro.Load(builtin.index, builtin.pool[0], builtin.count);
+    }
+    else if (!micro.Load(microfile.c_str()))
+    {
+        std::cout << "error: unable to load microcode file" << std::endl;
+        return 0;
+    }
+
+    std::shared_ptr<Snapshot> resume;
+    if (!resumefile.empty() && (resume = Snapshot::Read(resumefile)) == NULL)
+    {
+        std::cout << "error: unable to read snapshot " << resumefile << std::endl;
+        return 0;
+    }
+
+    // 第i个实例载入第i个内存映像，映像不足时循环使用
+    std::vector<CPU *> cpus(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        cpus[i] = new CPU(&micro);
+        if (resume != NULL)
+        {
+            resume->Export(*cpus[i]);
+            continue;
+        }
+        if (!images.empty() && cpus[i]->LoadProgram(images[i % images.size()].c_str()) < 0)
+        {
+            std::cout << "error: unable to open ram image " << images[i % images.size()] << std::endl;
+            return 0;
+        }
+        if (cpus[i]->LoadProgram(program.c_str()) < 0)
+        {
+            std::cout << "error: unable to open program file" << std::endl;
+            return 0;
+        }
+    }
+
+    static FastEngine fast;
+    static JitEngine jit;
+    if (engine != "micro" || !mapfile.empty())
+        fast.Build(micro);
+    if (engine == "jit" && !jit.Init(fast))
+        std::cout << "warning: jit is not available, using fast engine" << std::endl;
+
+    IdleEngine idler(engine == "micro" ? NULL : &fast, engine == "jit" ? &jit : NULL);
+    idler.probe = idle;
+    IrqMachine machine(idler);
+    if (irq && !machine.Init(micro))
+    {
+        std::cout << "error: INT in the microcode does not start with a standard fetch" << std::endl;
+        return 0;
+    }
+    for (const auto &t : timers)
+        machine.AddTimer(t.second, t.first, true, cpus[0]->cycles);
+    for (const auto &r : raises)
+        machine.RaiseAt(r.first, r.second);
+
+    // 设备的主机文件由后台线程读写，运行结束后停止线程再输出结果
+    static DeviceHost host;
+    static DeviceBus bus(devbase >= 0 ? devbase : DEV_BASE);
+    if (devices)
+    {
+        bus.console = host.Attach("stdout", stdout);
+        if (!infile.empty() && (bus.input = host.Open(infile, true)) == NULL)
+        {
+            std::cout << "error: unable to open input file " << infile << std::endl;
+            return 0;
+        }
+        if (!outfile.empty() && (bus.output = host.Open(outfile, false)) == NULL)
+        {
+            std::cout << "error: unable to open output file " << outfile << std::endl;
+            return 0;
+        }
+        bus.Attach(*cpus[0]);
+        std::cout << std::flush;
+        host.Start();
+    }
+
+    static TraceWriter trace;
+    if (tracing)
+    {
+        if (!trace.Open(tracefile, *cpus[0], interval))
+        {
+            std::cout << "error: unable to open trace file " << tracefile << std::endl;
+            return 0;
+        }
+        idler.trace = &trace;
+    }
+
+    std::unique_ptr<bool[]> halted(new bool[count]());
+    auto beg = std::chrono::steady_clock::now();
+    if (!mapfile.empty())
+    {
+        // 性能分析逐条指令执行，不使用-e指定的引擎
+        halted[0] = profiler.Run(fast, *cpus[0], maxcycles);
+    }
+    else if (engine == "batch")
+    {
+        BatchEngine batch(fast);
+        batch.Run(cpus.data(), count, maxcycles, halted.get());
+    }
+    else
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (irq)
+                halted[i] = machine.Run(*cpus[i], maxcycles);
+            else if (idle || tracing)
+                halted[i] = idler.Run(*cpus[i], maxcycles);
+            else if (engine == "jit")
+                halted[i] = jit.Run(*cpus[i], maxcycles);
+            else if (engine == "fast")
+                halted[i] = fast.Run(*cpus[i], maxcycles);
+            else
+                halted[i] = cpus[i]->Run(maxcycles);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    double sec = std::chrono::duration<double>(end - beg).count();
+    host.Stop();
+    bool traced = trace.Close();
+
+    uint64_t cycles = 0, instructions = 0;
+    for (CPU *cpu : cpus)
+        cycles += cpu->cycles, instructions += cpu->instructions;
+
+    if (count == 1)
+    {
+        std::cout << (halted[0] ? "halted" : "cycle limit reached") << std::endl;
+    }
+    else
+    {
+        for (size_t i = 0; i < count; ++i)
+            std::cout << "#" << i << ": " << (halted[i] ? "halted" : "cycle limit reached")
+                      << ", cycles: " << cpus[i]->cycles << ", instructions: " << cpus[i]->instructions << std::endl;
+        std::cout << "instances: " << count << ", ";
+    }
+    std::cout << "cycles: " << cycles << ", instructions: " << instructions
+              << ", time: " << sec * 1000 << " ms, "
+              << (sec > 0 ? cycles / sec / 1e6 : 0) << " M cycles/s, "
+              << (sec > 0 ? instructions / sec / 1e6 : 0) << " M instructions/s" << std::endl;
+    if (idle)
+        std::cout << "idle: " << idler.loops << " loops exited early, " << idler.repeats << " repeating states, "
+                  << idler.skipped << " cycles skipped" << std::endl;
+    if (irq)
+    {
+        for (int l = 0; l < IRQ_LINES; ++l)
+        {
+            const IrqLatency &lat = machine.pic.latency[l];
+            if (lat.count == 0 && machine.pic.merged[l] == 0 && !(machine.pic.pending & (1 << l)))
+                continue;
+            std::cout << "irq " << l << ": " << lat.count << " taken, " << machine.pic.merged[l] << " merged, "
+                      << ((machine.pic.pending >> l) & 1) << " pending";
+            if (lat.count != 0)
+                std::cout << ", latency min " << lat.min << ", avg " << (double)lat.total / lat.count
+                          << ", max " << lat.max << " cycles";
+            std::cout << std::endl;
+        }
+        if (idler.skipped != 0 && !idle)
+            std::cout << "halted waiting for interrupts: " << idler.skipped << " cycles skipped" << std::endl;
+    }
+
+    if (tracing)
+    {
+        std::cout << "trace: " << trace.records << " records, " << trace.keyframes << " keyframes, "
+                  << trace.bytes << " bytes" << std::endl;
+        if (!traced)
+            std::cout << "error: unable to write trace file " << tracefile << std::endl;
+    }
+    if (devices)
+    {
+        if (bus.console->bytes != 0)
+            std::cout << "console: " << bus.console->bytes << " bytes" << std::endl;
+        if (bus.input != NULL)
+            std::cout << "input: " << bus.input->bytes << " bytes read" << std::endl;
+        if (bus.output != NULL)
+            std::cout << "output: " << bus.output->bytes << " bytes written" << std::endl;
+        if (bus.displays != 0)
+            bus.PrintDisplay(stdout);
+        for (auto &s : host.streams)
+            if (s->failed)
+                std::cout << "error: unable to " << (s->input ? "read " : "write ") << s->path << std::endl;
+    }
+
+    if (count == 1)
+    {
+        std::cout << std::endl;
+        cpus[0]->PrintRegisters(stdout);
+        if (printram)
+        {
+            std::cout << std::endl;
+            cpus[0]->PrintRam(stdout);
+        }
+    }
+
+    if (!mapfile.empty())
+    {
+        std::cout << std::endl;
+        profiler.Print(std::cout);
+        if (!foldedfile.empty())
+        {
+            std::ofstream folded(foldedfile);
+            if (!folded.is_open())
+            {
+                std::cout << "error: unable to open folded stack file" << std::endl;
+                return 0;
+            }
+            profiler.WriteFolded(folded);
+        }
+    }
+
+    // 快照在后台写入，与后面的输出同时进行
+    std::unique_ptr<SnapshotWriter> writer;
+    if (!snapfile.empty())
+    {
+        writer.reset(new SnapshotWriter);
+        for (size_t i = 0; i < count; ++i)
+            writer->Write(Snapshot::Of(*cpus[i]), count == 1 ? snapfile : snapfile + "." + std::to_string(i));
+    }
+
+    if (!dumpfile.empty())
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!DumpRam(count == 1 ? dumpfile : dumpfile + "." + std::to_string(i), *cpus[i]))
+            {
+                std::cout << "error: unable to open dump file" << std::endl;
+                return 0;
+            }
+        }
+    }
+
+    if (writer != NULL && !writer->Wait())
+        std::cout << "error: unable to write snapshot " << writer->failed[0] << std::endl;
+    return 0;
+}
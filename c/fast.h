@@ -0,0 +1,634 @@
+/**
+ * 预译码的指令级执行引擎
+ *
+ * 载入时遍历微程序，把每个(ir, psw)的微指令序列识别为一个专用的处理函数，
+ * 执行时每条指令只分派一次，结果与逐微周期执行完全一致。
+ */
+
+#ifndef _FAST_H_
+#define _FAST_H_
+
+#include "cpu.h"
+#include "micro.h"
+
+// 最后一个控制字中可变的位，由处理函数按实际的值执行
+#define MASK_LAST (MASK_OP | PIN_ALU_INT_W | PIN_ALU_INT)
+
+/// @brief 微指令序列的类型
+enum FusedKind
+{
+    K_GENERIC, // 无法识别，逐微周期执行
+    K_HLT,     // 停止
+    K_NOP,     // 空操作，包括不跳转的转移指令
+    K_MOV_RI,  // MOV A, 1
+    K_MOV_RR,  // MOV A, B
+    K_MOV_RD,  // MOV A, [5]
+    K_MOV_RM,  // MOV A, [B]
+    K_MOV_DI,  // MOV [5], 1
+    K_MOV_DR,  // MOV [5], A
+    K_MOV_MI,  // MOV [A], 1
+    K_MOV_MR,  // MOV [A], B
+    K_ALU_RI,  // ADD A, 1
+    K_ALU_RR,  // ADD A, B
+    K_CMP_RI,  // CMP A, 1
+    K_CMP_RR,  // CMP A, B
+    K_ALU_R,   // INC A
+    K_JMP,     // 跳转
+    K_PUSH_I,  // PUSH 1
+    K_PUSH_R,  // PUSH A
+    K_POP,     // POP A
+    K_CALL,    // CALL
+    K_RET,     // RET
+    K_IRET,    // IRET
+    K_INT,     // 允许中断时的INT
+    K_PSW,     // STI、CLI
+    K_COUNT,
+};
+
+/// @brief 可识别的微指令序列，最后一个控制字比较时忽略MASK_LAST
+static const struct
+{
+    uint8_t kind;
+    uint8_t len;
+    uint32_t word[7];
+} FUSED_PATTERNS[] = {
+    {K_HLT, 1, {PIN_HLT}},
+    {K_NOP, 1, {PIN_CYC}},
+    {K_MOV_RI, 1, {PIN_DST_W | SRC_OUT | PIN_CYC}},
+    {K_MOV_RR, 1, {PIN_DST_W | PIN_SRC_R | PIN_CYC}},
+    {K_MOV_RD, 2, {MAR_IN | SRC_OUT, PIN_DST_W | RAM_OUT | PIN_CYC}},
+    {K_MOV_RM, 2, {MAR_IN | PIN_SRC_R, PIN_DST_W | RAM_OUT | PIN_CYC}},
+    {K_MOV_DI, 2, {MAR_IN | DST_OUT, RAM_IN | SRC_OUT | PIN_CYC}},
+    {K_MOV_DR, 2, {MAR_IN | DST_OUT, RAM_IN | PIN_SRC_R | PIN_CYC}},
+    {K_MOV_MI, 2, {MAR_IN | PIN_DST_R, RAM_IN | SRC_OUT | PIN_CYC}},
+    {K_MOV_MR, 2, {MAR_IN | PIN_DST_R, RAM_IN | PIN_SRC_R | PIN_CYC}},
+    {K_ALU_RI, 3, {A_IN | PIN_DST_R, B_IN | SRC_OUT, PIN_DST_W | PIN_ALU_OUT | PIN_ALU_PSW | PIN_CYC}},
+    {K_ALU_RR, 3, {A_IN | PIN_DST_R, B_IN | PIN_SRC_R, PIN_DST_W | PIN_ALU_OUT | PIN_ALU_PSW | PIN_CYC}},
+    {K_CMP_RI, 3, {A_IN | PIN_DST_R, B_IN | SRC_OUT, PIN_ALU_PSW | PIN_CYC}},
+    {K_CMP_RR, 3, {A_IN | PIN_DST_R, B_IN | PIN_SRC_R, PIN_ALU_PSW | PIN_CYC}},
+    {K_ALU_R, 2, {A_IN | PIN_DST_R, PIN_DST_W | PIN_ALU_OUT | PIN_ALU_PSW | PIN_CYC}},
+    {K_JMP, 1, {PC_IN | DST_OUT | PIN_CYC}},
+    {K_PUSH_I, 6, {A_IN | SP_OUT, SP_IN | OP_DEC | PIN_ALU_OUT, MAR_IN | SP_OUT, MSR_IN | SS_OUT, RAM_IN | DST_OUT, MSR_IN | CS_OUT | PIN_CYC}},
+    {K_PUSH_R, 6, {A_IN | SP_OUT, SP_IN | OP_DEC | PIN_ALU_OUT, MAR_IN | SP_OUT, MSR_IN | SS_OUT, RAM_IN | PIN_DST_R, MSR_IN | CS_OUT | PIN_CYC}},
+    {K_POP, 6, {MAR_IN | SP_OUT, MSR_IN | SS_OUT, PIN_DST_W | RAM_OUT, A_IN | SP_OUT, SP_IN | OP_INC | PIN_ALU_OUT, MSR_IN | CS_OUT | PIN_CYC}},
+    {K_CALL, 7, {A_IN | SP_OUT, SP_IN | OP_DEC | PIN_ALU_OUT, MAR_IN | SP_OUT, MSR_IN | SS_OUT, RAM_IN | PC_OUT, MSR_IN | CS_OUT, PC_IN | DST_OUT | PIN_CYC}},
+    {K_RET, 6, {MAR_IN | SP_OUT, MSR_IN | SS_OUT, PC_IN | RAM_OUT, A_IN | SP_OUT, SP_IN | OP_INC | PIN_ALU_OUT, MSR_IN | CS_OUT | PIN_CYC}},
+    {K_IRET, 6, {MAR_IN | SP_OUT, MSR_IN | SS_OUT, PC_IN | RAM_OUT, A_IN | SP_OUT, SP_IN | OP_INC | PIN_ALU_OUT, MSR_IN | CS_OUT | PIN_ALU_PSW | PIN_CYC}},
+    {K_INT, 7, {A_IN | SP_OUT, SP_IN | OP_DEC | PIN_ALU_OUT, MAR_IN | SP_OUT, MSR_IN | SS_OUT, RAM_IN | PC_OUT, MSR_IN | CS_OUT, PC_IN | DST_OUT | PIN_ALU_PSW | PIN_CYC}},
+    {K_PSW, 1, {PIN_ALU_PSW | PIN_CYC}},
+};
+
+/// @brief 一个(ir, psw)对应的专用处理函数
+struct Fused
+{
+    uint32_t last;  // 最后一个控制字，ALU运算和PSW写入取自此处
+    uint8_t kind;   // 序列类型
+    uint8_t cycles; // 含取指的微周期数
+    uint8_t done;   // 是否计为一条执行完的指令，停止指令不计
+    uint8_t fetch;  // 取指的字节数，每字节两个微周期
+};
+
+/*============================================================*/
+
+#define R (cpu.reg)
+
+/// @brief 当前DST寄存器所指向的寄存器编号
+#define RDST (R[DST] & 0x1f)
+
+/// @brief 当前SRC寄存器所指向的寄存器编号
+#define RSRC (R[SRC] & 0x1f)
+
+static inline bool ExecGeneric(CPU &, const Fused &)
+{
+    return false;
+}
+
+static inline bool ExecHlt(CPU &cpu, const Fused &)
+{
+    cpu.halt = true;
+    return true;
+}
+
+static inline bool ExecNop(CPU &, const Fused &)
+{
+    return true;
+}
+
+static inline bool ExecMovRI(CPU &cpu, const Fused &)
+{
+    cpu.WriteReg(RDST, R[SRC]);
+    return true;
+}
+
+static inline bool ExecMovRR(CPU &cpu, const Fused &)
+{
+    cpu.WriteReg(RDST, cpu.ReadReg(RSRC));
+    return true;
+}
+
+static inline bool ExecMovRD(CPU &cpu, const Fused &)
+{
+    R[MAR] = R[SRC];
+    cpu.WriteReg(RDST, cpu.ram[cpu.Address()]);
+    return true;
+}
+
+static inline bool ExecMovRM(CPU &cpu, const Fused &)
+{
+    R[MAR] = cpu.ReadReg(RSRC);
+    cpu.WriteReg(RDST, cpu.ram[cpu.Address()]);
+    return true;
+}
+
+static inline bool ExecMovDI(CPU &cpu, const Fused &)
+{
+    R[MAR] = R[DST];
+    cpu.Store(cpu.Address(), R[SRC]);
+    return true;
+}
+
+static inline bool ExecMovDR(CPU &cpu, const Fused &)
+{
+    R[MAR] = R[DST];
+    cpu.Store(cpu.Address(), cpu.ReadReg(RSRC));
+    return true;
+}
+
+static inline bool ExecMovMI(CPU &cpu, const Fused &)
+{
+    R[MAR] = cpu.ReadReg(RDST);
+    cpu.Store(cpu.Address(), R[SRC]);
+    return true;
+}
+
+static inline bool ExecMovMR(CPU &cpu, const Fused &)
+{
+    R[MAR] = cpu.ReadReg(RDST);
+    cpu.Store(cpu.Address(), cpu.ReadReg(RSRC));
+    return true;
+}
+
+static inline bool ExecAluRI(CPU &cpu, const Fused &f)
+{
+    uint8_t flags;
+    R[A] = cpu.ReadReg(RDST);
+    R[B] = R[SRC];
+    cpu.WriteReg(RDST, Alu(f.last, R[A], R[B], flags));
+    cpu.LatchPsw(f.last, flags);
+    return true;
+}
+
+static inline bool ExecAluRR(CPU &cpu, const Fused &f)
+{
+    uint8_t flags;
+    R[A] = cpu.ReadReg(RDST);
+    R[B] = cpu.ReadReg(RSRC);
+    cpu.WriteReg(RDST, Alu(f.last, R[A], R[B], flags));
+    cpu.LatchPsw(f.last, flags);
+    return true;
+}
+
+static inline bool ExecCmpRI(CPU &cpu, const Fused &f)
+{
+    uint8_t flags;
+    R[A] = cpu.ReadReg(RDST);
+    R[B] = R[SRC];
+    Alu(f.last, R[A], R[B], flags);
+    cpu.LatchPsw(f.last, flags);
+    return true;
+}
+
+static inline bool ExecCmpRR(CPU &cpu, const Fused &f)
+{
+    uint8_t flags;
+    R[A] = cpu.ReadReg(RDST);
+    R[B] = cpu.ReadReg(RSRC);
+    Alu(f.last, R[A], R[B], flags);
+    cpu.LatchPsw(f.last, flags);
+    return true;
+}
+
+static inline bool ExecAluR(CPU &cpu, const Fused &f)
+{
+    uint8_t flags;
+    R[A] = cpu.ReadReg(RDST);
+    cpu.WriteReg(RDST, Alu(f.last, R[A], R[B], flags));
+    cpu.LatchPsw(f.last, flags);
+    return true;
+}
+
+static inline bool ExecJmp(CPU &cpu, const Fused &)
+{
+    cpu.pc = R[DST];
+    return true;
+}
+
+/// @brief SP减一，并令MSR:MAR指向栈顶
+static inline void PushAddress(CPU &cpu)
+{
+    R[A] = R[SP];
+    R[SP] = R[A] - 1;
+    R[MAR] = R[SP];
+    R[MSR] = R[SS];
+}
+
+/// @brief 令MSR:MAR指向栈顶
+static inline void PopAddress(CPU &cpu)
+{
+    R[MAR] = R[SP];
+    R[MSR] = R[SS];
+}
+
+/// @brief SP加一，并恢复MSR为代码段
+static inline void PopFinish(CPU &cpu)
+{
+    R[A] = R[SP];
+    R[SP] = R[A] + 1;
+    R[MSR] = R[CS];
+}
+
+static inline bool ExecPushI(CPU &cpu, const Fused &)
+{
+    PushAddress(cpu);
+    cpu.Store(cpu.Address(), R[DST]);
+    R[MSR] = R[CS];
+    return true;
+}
+
+static inline bool ExecPushR(CPU &cpu, const Fused &)
+{
+    PushAddress(cpu);
+    cpu.Store(cpu.Address(), cpu.ReadReg(RDST));
+    R[MSR] = R[CS];
+    return true;
+}
+
+static inline bool ExecPop(CPU &cpu, const Fused &)
+{
+    // 写IR会改变之后的微指令序列
+    if (RDST == IR)
+        return false;
+    PopAddress(cpu);
+    cpu.WriteReg(RDST, cpu.ram[cpu.Address()]);
+    PopFinish(cpu);
+    return true;
+}
+
+static inline bool ExecCall(CPU &cpu, const Fused &)
+{
+    PushAddress(cpu);
+    cpu.Store(cpu.Address(), cpu.pc);
+    R[MSR] = R[CS];
+    cpu.pc = R[DST];
+    return true;
+}
+
+static inline bool ExecRet(CPU &cpu, const Fused &)
+{
+    PopAddress(cpu);
+    cpu.pc = cpu.ram[cpu.Address()];
+    PopFinish(cpu);
+    return true;
+}
+
+static inline bool ExecIret(CPU &cpu, const Fused &f)
+{
+    uint8_t flags;
+    PopAddress(cpu);
+    cpu.pc = cpu.ram[cpu.Address()];
+    PopFinish(cpu);
+    Alu(f.last, R[A], R[B], flags);
+    cpu.LatchPsw(f.last, flags);
+    return true;
+}
+
+static inline bool ExecInt(CPU &cpu, const Fused &f)
+{
+    uint8_t flags;
+    PushAddress(cpu);
+    cpu.Store(cpu.Address(), cpu.pc);
+    R[MSR] = R[CS];
+    Alu(f.last, R[A], R[B], flags);
+    cpu.LatchPsw(f.last, flags);
+    cpu.pc = R[DST];
+    return true;
+}
+
+static inline bool ExecPsw(CPU &cpu, const Fused &f)
+{
+    uint8_t flags;
+    Alu(f.last, R[A], R[B], flags);
+    cpu.LatchPsw(f.last, flags);
+    return true;
+}
+
+#undef R
+#undef RDST
+#undef RSRC
+
+/// @brief 执行取指之后的部分
+/// @param cpu
+/// @param f
+/// @return 是否已执行，返回false时该指令改为逐微周期执行
+static inline bool Exec(CPU &cpu, const Fused &f)
+{
+    switch (f.kind)
+    {
+    case K_HLT:
+        return ExecHlt(cpu, f);
+    case K_NOP:
+        return ExecNop(cpu, f);
+    case K_MOV_RI:
+        return ExecMovRI(cpu, f);
+    case K_MOV_RR:
+        return ExecMovRR(cpu, f);
+    case K_MOV_RD:
+        return ExecMovRD(cpu, f);
+    case K_MOV_RM:
+        return ExecMovRM(cpu, f);
+    case K_MOV_DI:
+        return ExecMovDI(cpu, f);
+    case K_MOV_DR:
+        return ExecMovDR(cpu, f);
+    case K_MOV_MI:
+        return ExecMovMI(cpu, f);
+    case K_MOV_MR:
+        return ExecMovMR(cpu, f);
+    case K_ALU_RI:
+        return ExecAluRI(cpu, f);
+    case K_ALU_RR:
+        return ExecAluRR(cpu, f);
+    case K_CMP_RI:
+        return ExecCmpRI(cpu, f);
+    case K_CMP_RR:
+        return ExecCmpRR(cpu, f);
+    case K_ALU_R:
+        return ExecAluR(cpu, f);
+    case K_JMP:
+        return ExecJmp(cpu, f);
+    case K_PUSH_I:
+        return ExecPushI(cpu, f);
+    case K_PUSH_R:
+        return ExecPushR(cpu, f);
+    case K_POP:
+        return ExecPop(cpu, f);
+    case K_CALL:
+        return ExecCall(cpu, f);
+    case K_RET:
+        return ExecRet(cpu, f);
+    case K_IRET:
+        return ExecIret(cpu, f);
+    case K_INT:
+        return ExecInt(cpu, f);
+    case K_PSW:
+        return ExecPsw(cpu, f);
+    default:
+        return ExecGeneric(cpu, f);
+    }
+}
+
+/*============================================================*/
+
+/// @brief 预译码执行引擎
+struct FastEngine
+{
+    Fused table[0x1000]; // 下标为ir << 4 | psw
+    bool fetchok;        // 是否所有指令都以标准取指开始且取指长度与psw无关，否则只能逐微周期执行
+    bool setie[256];     // 可能把IE置为1的指令，如STI、IRET
+
+    /// @brief 判断一行控制字以几个字节的标准取指开始，变长编码时零地址指令只取IR，一地址指令取IR与DST
+    /// @param word
+    /// @return 字节数，不以标准取指开始时返回0
+    static int FetchLength(const uint32_t *word)
+    {
+        int len = 0;
+        while (len < MICRO_FETCH_CYCLES / 2 && word[len * 2] == MICRO_FETCH[len * 2] &&
+               word[len * 2 + 1] == MICRO_FETCH[len * 2 + 1])
+            ++len;
+        return len;
+    }
+
+    /// @brief 判断某条指令在所有psw下从第from个微周期起是否全为空操作
+    /// @param micro
+    /// @param ir
+    /// @param from
+    /// @return
+    static bool IsIdleTail(const MicroCode &micro, uint8_t ir, int from)
+    {
+        for (int psw = 0; psw < 16; ++psw)
+            for (int cyc = from; cyc < 16; ++cyc)
+                if (micro.Word(ir, psw, cyc) != 0)
+                    return false;
+        return true;
+    }
+
+    /// @brief 将微程序的一行识别为专用处理函数
+    /// @param micro
+    /// @param ir 指令
+    /// @param psw 程序状态字
+    /// @return
+    static Fused Compile(const MicroCode &micro, uint8_t ir, uint8_t psw)
+    {
+        const uint32_t *word = micro.Row(ir, psw);
+        int fetch = FetchLength(word);
+        int start = fetch * 2;
+        Fused f = {0, K_GENERIC, 16, 0, (uint8_t)fetch};
+
+        // 找到执行阶段的最后一个控制字
+        int end = start;
+        while (end < 16 && !(word[end] & (PIN_CYC | PIN_HLT)))
+            ++end;
+        if (end == 16)
+        {
+            // 没有PIN_CYC的STI、CLI：写PSW后空转到微周期计数器回零，
+            // 写PSW后微指令行随之改变，因此要求所有psw下其后均为空操作
+            if ((word[start] & ~MASK_LAST) == PIN_ALU_PSW && IsIdleTail(micro, ir, start + 1))
+            {
+                f.last = word[start];
+                f.kind = K_PSW;
+                f.done = 1;
+            }
+            return f;
+        }
+        int len = end - start + 1;
+
+        for (const auto &p : FUSED_PATTERNS)
+        {
+            if (p.len != len)
+                continue;
+            bool match = true;
+            for (int i = 0; i < len - 1 && match; ++i)
+                match = word[start + i] == p.word[i];
+            if (match && (word[end] & ~MASK_LAST) == p.word[len - 1])
+            {
+                f.last = word[end];
+                f.kind = p.kind;
+                f.cycles = p.kind == K_HLT ? start : end + 1;
+                f.done = p.kind != K_HLT;
+                break;
+            }
+        }
+        return f;
+    }
+
+    /// @brief 遍历微程序生成处理函数表
+    /// @param micro
+    void Build(const MicroCode &micro)
+    {
+        fetchok = true;
+        for (int i = 0; i < 0x1000; ++i)
+        {
+            table[i] = Compile(micro, i >> 4, i & 0xf);
+            fetchok = fetchok && table[i].fetch != 0 && table[i].fetch == table[i & ~0xf].fetch;
+        }
+        for (int ir = 0; ir < 256; ++ir)
+        {
+            setie[ir] = false;
+            for (int psw = 0; psw < 16; ++psw)
+                for (int cyc = 0; cyc < 16; ++cyc)
+                {
+                    uint32_t w = micro.Word(ir, psw, cyc);
+                    setie[ir] = setie[ir] || ((w & PIN_ALU_INT_W) && !(w & PIN_ALU_INT));
+                }
+        }
+    }
+
+    /// @brief 判断一条指令在所有psw下的处理函数是否相同
+    /// @param row
+    /// @return
+    static bool IsUniform(const Fused *row)
+    {
+        for (int i = 1; i < 16; ++i)
+            if (row[i].kind != row[0].kind || row[i].last != row[0].last ||
+                row[i].cycles != row[0].cycles || row[i].done != row[0].done)
+                return false;
+        return true;
+    }
+
+    /// @brief 判断一条指令是否为条件转移，即各psw下只有不跳转和跳转两种
+    /// @param row
+    /// @param taken 返回跳转的psw集合
+    /// @return
+    static bool IsBranch(const Fused *row, uint32_t &taken)
+    {
+        const Fused *nop = NULL, *jmp = NULL;
+        taken = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            const Fused *&same = row[i].kind == K_JMP ? jmp : nop;
+            if (row[i].kind != K_JMP && row[i].kind != K_NOP)
+                return false;
+            if (same != NULL && (same->cycles != row[i].cycles || same->done != row[i].done))
+                return false;
+            same = &row[i];
+            if (row[i].kind == K_JMP)
+                taken |= 1 << i;
+        }
+        return nop != NULL && jmp != NULL;
+    }
+
+    /// @brief 判断寄存器编号是否可以直接读写reg[]，即不是RAM或无效编号
+    /// @param i
+    /// @return
+    static bool IsPlain(uint8_t i)
+    {
+        return i >= MSR && i <= T2 && i != RAM;
+    }
+
+    /// @brief 逐微周期执行到指令边界
+    /// @param cpu
+    /// @return 是否遇到PIN_HLT
+    static bool StepInstruction(CPU &cpu)
+    {
+        do
+        {
+            if (!cpu.Step())
+                return true;
+        } while (cpu.cyc != 0);
+        return false;
+    }
+
+    /// @brief 按处理函数的取指长度写IR、DST、SRC、MAR与PC，未取的寄存器保持不变
+    /// @param cpu
+    /// @param f
+    /// @param pc 指令地址
+    /// @param ir
+    /// @param dst
+    /// @param src
+    static inline void Fetch(CPU &cpu, const Fused &f, uint8_t pc, uint8_t ir, uint8_t dst, uint8_t src)
+    {
+        cpu.reg[IR] = ir;
+        if (f.fetch > 1)
+            cpu.reg[DST] = dst;
+        if (f.fetch > 2)
+            cpu.reg[SRC] = src;
+        cpu.reg[MAR] = pc + f.fetch - 1;
+        cpu.pc = pc + f.fetch;
+    }
+
+    /// @brief 取指之后执行一条指令并累加计数，无法识别的指令逐微周期执行
+    /// @param cpu
+    /// @param f
+    /// @return 是否遇到PIN_HLT
+    static inline bool Finish(CPU &cpu, const Fused &f)
+    {
+        if (Exec(cpu, f))
+        {
+            cpu.cycles += f.cycles;
+            cpu.instructions += f.done;
+            if (cpu.halt)
+            {
+                cpu.cyc = f.fetch * 2;
+                return true;
+            }
+            return false;
+        }
+        cpu.cycles += f.fetch * 2;
+        cpu.cyc = f.fetch * 2;
+        return StepInstruction(cpu);
+    }
+
+    /// @brief 执行到停止或达到微周期上限，结果与CPU::Run一致
+    /// @param cpu
+    /// @param maxcycles 微周期上限
+    /// @param stopie 为true时执行完把IE置为1的指令后在指令边界停止，要求fetchok
+    /// @return 是否因PIN_HLT而停止
+    bool Run(CPU &cpu, uint64_t maxcycles, bool stopie = false) const
+    {
+        if (!fetchok)
+            return cpu.Run(maxcycles);
+
+        uint8_t *reg = cpu.reg;
+        uint8_t *ram = cpu.ram;
+
+        // 从指令中间开始时先执行到指令边界
+        while (cpu.cyc != 0)
+        {
+            if (cpu.cycles >= maxcycles)
+                return false;
+            if (!cpu.Step())
+                return true;
+        }
+
+        while (1)
+        {
+            uint16_t seg = reg[MSR] << 8;
+            uint8_t pc = cpu.pc;
+            uint8_t ir = ram[seg | pc];
+            const Fused &f = table[(ir << 4) | (cpu.psw & 0xf)];
+
+            // 剩余微周期不足一条指令时逐微周期执行，停止指令还需一个周期检测PIN_HLT
+            if (cpu.cycles + f.cycles + !f.done > maxcycles)
+                return cpu.Run(maxcycles);
+
+            Fetch(cpu, f, pc, ir, ram[seg | (uint8_t)(pc + 1)], ram[seg | (uint8_t)(pc + 2)]);
+
+            if (Finish(cpu, f))
+                return true;
+            if (stopie && setie[ir] && (cpu.psw & PSW_IE))
+                return false;
+        }
+    }
+};
+
+#endif //_FAST_H_
@@ -0,0 +1,165 @@
+/**
+ * 门级模拟器
+ *
+ * 读取LogicCircuit电路文件，展开为门级网表后按时钟周期模拟，
+ * 微程序写入主电路的ROM，程序写入RAM，结果与emulator的输出格式相同
+ */
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include "gatesim.h"
+#include "builtin.h"
+
+/// @brief 打印用法
+static void PrintUsage()
+{
+    std::cout << "gatesim [options] program" << std::endl
+              << std::endl
+              << "  program: program file generated by compiler" << std::endl
+              << "  -x file: circuit file, default cpu/MyCPU.CircuitProject" << std::endl
+              << "  -C dir:  netlist cache keyed by a hash of the circuit file, default .netcache," << std::endl
+              << "           \"\" to disable" << std::endl
+              << "  -j num:  simulation threads, the circuit is partitioned by top-level blocks, at most the number of cores, default 1" << std::endl
+              << "  -n num:  replicate the cpu num times to simulate a larger circuit, default 1" << std::endl
+              << "  -m file: microcode file, default built-in table" << std::endl
+              << "  -v:      use built-in variable-length microcode, see compiler -v" << std::endl
+              << "  -c num:  max clock cycles, default 1000000" << std::endl
+              << "  -o file: dump ram to file after running" << std::endl
+              << "  -q:      do not print ram" << std::endl
+              << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string circuitfile = "cpu/MyCPU.CircuitProject";
+    std::string cachedir = ".netcache";
+    std::string microfile;
+    bool varlen = false;
+    std::string program;
+    std::string dumpfile;
+    uint64_t maxcycles = 1000000;
+    bool printram = true;
+    int threads = 1;
+    int copies = 1;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-x" && i + 1 < argc)
+            circuitfile = argv[++i];
+        else if (arg == "-C" && i + 1 < argc)
+            cachedir = argv[++i];
+        else if (arg == "-j" && i + 1 < argc)
+            threads = std::atoi(argv[++i]);
+        else if (arg == "-n" && i + 1 < argc)
+            copies = std::atoi(argv[++i]);
+        else if (arg == "-m" && i + 1 < argc)
+            microfile = argv[++i];
+        else if (arg == "-v")
+            varlen = true;
+        else if (arg == "-c" && i + 1 < argc)
+            maxcycles = std::strtoull(argv[++i], NULL, 0);
+        else if (arg == "-o" && i + 1 < argc)
+            dumpfile = argv[++i];
+        else if (arg == "-q")
+            printram = false;
+        else if (arg[0] != '-' && program.empty())
+            program = arg;
+        else
+        {
+            PrintUsage();
+            return 0;
+        }
+    }
+
+    if (program.empty())
+    {
+        PrintUsage();
+        return 0;
+    }
+
+    static MicroCode micro;
+    if (microfile.empty())
+    {
+        const BuiltinMicro &builtin = varlen ? BUILTIN_MICRO_VARLEN : BUILTIN_MICRO;
+        micro.Load(builtin.index, builtin.pool[0], builtin.count);
+    }
+    else if (!micro.Load(microfile.c_str()))
+    {
+        std::cout << "error: unable to load microcode file" << std::endl;
+        return 0;
+    }
+
+    auto beg = std::chrono::steady_clock::now();
+    static GateMachine machine;
+    std::string error;
+    if (!machine.Load(circuitfile, error, cachedir, threads, copies))
+    {
+        std::cout << "error: " << error << std::endl;
+        return 0;
+    }
+    auto loaded = std::chrono::steady_clock::now();
+    std::cout << "circuit: " << machine.netlist.nets << " nets, " << machine.netlist.gates.size() << " gates, "
+              << machine.netlist.memories.size() << " memories, load time: "
+              << std::chrono::duration<double>(loaded - beg).count() * 1000 << " ms"
+              << (machine.cached ? " (cached)" : "") << std::endl;
+    if (machine.sim.parts.size() > 1)
+        std::cout << "partitions: " << machine.sim.parts.size() << ", boundary drivers: " << machine.sim.Boundary() << std::endl;
+
+    machine.LoadMicro(micro);
+    if (machine.LoadProgram(program.c_str()) < 0)
+    {
+        std::cout << "error: unable to open program file" << std::endl;
+        return 0;
+    }
+    if (!machine.Boot())
+    {
+        std::cout << "error: circuit does not settle after power on" << std::endl;
+        return 0;
+    }
+
+    uint64_t rounds = machine.sim.rounds;
+    beg = std::chrono::steady_clock::now();
+    bool halted = machine.Run(maxcycles, error);
+    auto end = std::chrono::steady_clock::now();
+    double sec = std::chrono::duration<double>(end - beg).count();
+    if (!error.empty())
+        std::cout << "error: " << error << std::endl;
+
+    std::cout << (halted ? "halted" : "cycle limit reached") << std::endl;
+    std::cout << "cycles: " << machine.cycles << ", instructions: " << machine.instructions
+              << ", time: " << sec * 1000 << " ms, "
+              << (sec > 0 ? machine.cycles / sec / 1e3 : 0) << " K cycles/s, "
+              << (sec > 0 ? machine.sim.Evals() / sec / 1e6 : 0) << " M evals/s" << std::endl;
+    if (machine.sim.parts.size() > 1 && machine.cycles > 0)
+        std::cout << "exchange rounds per cycle: " << (double)(machine.sim.rounds - rounds) / machine.cycles << std::endl;
+    for (int k = 1; k < machine.cores; ++k)
+        if (machine.Ram(k) != machine.Ram(0))
+            std::cout << "error: ram of copy " << k << " differs from copy 0" << std::endl;
+
+    static CPU cpu(&micro);
+    machine.Export(cpu);
+    std::cout << std::endl;
+    cpu.PrintRegisters(stdout);
+    if (printram)
+    {
+        std::cout << std::endl;
+        cpu.PrintRam(stdout);
+    }
+
+    if (!dumpfile.empty())
+    {
+        FILE *pf = fopen(dumpfile.c_str(), "wb");
+        if (pf == NULL)
+        {
+            std::cout << "error: unable to open dump file" << std::endl;
+            return 0;
+        }
+        fwrite(cpu.ram, sizeof(cpu.ram), 1, pf);
+        fclose(pf);
+    }
+
+    return 0;
+}
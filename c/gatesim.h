@@ -0,0 +1,944 @@
+/**
+ * 门级事件驱动模拟
+ *
+ * 在circuit.h展开的网表上模拟，每根线为0、1或未驱动三种状态。某根线变化时只把读它的门
+ * 放入队列，依次求值直到没有变化，与LogicCircuit的求值方式相同：先求值的门的结果
+ * 立即对后面的门可见，交叉耦合的RS触发器上电时也能稳定下来。
+ * 多个三态门接在同一根线上时，有驱动为1的取1，否则有驱动为0的取0，都关闭时为未驱动。
+ * 大电路可以按顶层的寄存器、计数器等实例分区，每区一个线程并行模拟，见PartSim。
+ */
+
+#ifndef _GATESIM_H_
+#define _GATESIM_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "circuit.h"
+#include "netcache.h"
+#include "cpu.h"
+
+#define GATESIM_MAX_EVALS  10000000 // 一次稳定过程中的最大求值次数，超过时认为电路振荡
+#define GATESIM_MAX_ROUNDS 100000   // 分区模拟一次稳定过程中各区交换边界的最大轮数
+
+/// @brief 门级模拟器，驱动源与扇出表见NetIndex
+struct GateSim : NetIndex
+{
+    const Netlist *nl;
+
+    std::vector<uint8_t> value; // 每根线的值
+    std::vector<uint8_t> drive; // 每个驱动源的输出
+
+    size_t ngates;                          // 单元中[0, ngates)为门，之后为存储器
+    std::vector<uint32_t> cells;            // 求值的单元，分区模拟时只有本区的单元
+    std::vector<std::vector<uint32_t>> mem; // 存储器的内容
+    std::vector<uint8_t> memwrite;          // 存储器写信号上次是否有效
+    std::vector<std::pair<uint32_t, uint32_t>> writes; // 存储器写入记录：存储器，地址，logwrites为真时记录
+    bool logwrites;
+
+    std::vector<uint32_t> queue; // 待求值的单元，循环队列
+    std::vector<uint8_t> queued; // 单元是否已在队列中
+    size_t head, tail;
+    uint64_t evals; // 累计求值次数
+
+    GateSim() : nl(NULL), ngates(0), logwrites(false), head(0), tail(0), evals(0)
+    {
+    }
+
+    /// @brief 检查点：线与驱动源的值及可写存储器的内容，只读存储器的内容不变，不保存
+    struct State
+    {
+        std::vector<uint8_t> value, drive, memwrite;
+        std::vector<std::vector<uint32_t>> mem;
+    };
+
+    /// @brief 保存状态，需在稳定后调用
+    void Save(State &s) const
+    {
+        s.value = value;
+        s.drive = drive;
+        s.memwrite = memwrite;
+        s.mem.resize(mem.size());
+        for (size_t m = 0; m < mem.size(); ++m)
+            if (nl->memories[m].writable)
+                s.mem[m] = mem[m];
+    }
+
+    /// @brief 恢复保存的状态
+    void Restore(const State &s)
+    {
+        value = s.value;
+        drive = s.drive;
+        memwrite = s.memwrite;
+        for (size_t m = 0; m < mem.size(); ++m)
+            if (nl->memories[m].writable)
+                mem[m] = s.mem[m];
+        head = tail = 0;
+        std::fill(queued.begin(), queued.end(), 0);
+    }
+
+    /// @brief 根据网表建立驱动与扇出表
+    /// @param netlist 在模拟器之后销毁
+    /// @param index 缓存中读出的驱动与扇出表，为NULL时重新建立
+    /// @param own 只求值这些单元，扇出表中去掉其他单元，为NULL时求值全部单元
+    void Build(const Netlist &netlist, const NetIndex *index = NULL, const std::vector<uint32_t> *own = NULL)
+    {
+        nl = &netlist;
+        ngates = nl->gates.size();
+        size_t ncells = ngates + nl->memories.size();
+        if (index != NULL)
+            static_cast<NetIndex &>(*this) = *index;
+        else
+            NetIndex::Build(netlist);
+        if (own == NULL)
+        {
+            cells.resize(ncells);
+            for (size_t c = 0; c < ncells; ++c)
+                cells[c] = (uint32_t)c;
+        }
+        else
+        {
+            cells = *own;
+            std::vector<uint8_t> mine(ncells, 0);
+            for (uint32_t c : cells)
+                mine[c] = 1;
+            size_t k = 0;
+            for (size_t n = 0; n < nl->nets; ++n)
+            {
+                uint32_t beg = fanidx[n];
+                fanidx[n] = (uint32_t)k;
+                for (uint32_t i = beg; i < fanidx[n + 1]; ++i)
+                    if (mine[fanlist[i]])
+                        fanlist[k++] = fanlist[i];
+            }
+            fanidx[nl->nets] = (uint32_t)k;
+            fanlist.resize(k);
+        }
+
+        queue.assign(ncells + 1, 0);
+        queued.assign(ncells, 0);
+        Reset();
+    }
+
+    /// @brief 上电：所有线未驱动，存储器恢复初始内容，按钮松开，求值所有单元直到稳定
+    /// @return 是否稳定
+    bool Reset()
+    {
+        value.assign(nl->nets, LVZ);
+        drive.assign(slotnet.size(), LVZ);
+        mem.resize(nl->memories.size());
+        memwrite.assign(nl->memories.size(), 0);
+        for (uint32_t c : cells)
+        {
+            if (c < ngates)
+                continue;
+            const NetMemory &nm = nl->memories[c - ngates];
+            mem[c - ngates].assign(nl->words.begin() + nm.data, nl->words.begin() + nm.data + ((size_t)1 << nm.abits));
+        }
+        head = tail = 0;
+        std::fill(queued.begin(), queued.end(), 0);
+
+        uint32_t slot = constslot;
+        for (const auto &c : nl->constants)
+            Drive(slot++, c.second);
+        for (size_t p = 0; p < nl->ports.size(); ++p)
+            if (portslot[p] != UINT32_MAX)
+                SetInput(p, 0);
+        for (uint32_t c : cells)
+            Push(c);
+        return Settle();
+    }
+
+    inline void Push(uint32_t cell)
+    {
+        if (queued[cell])
+            return;
+        queued[cell] = 1;
+        queue[tail] = cell;
+        if (++tail == queue.size())
+            tail = 0;
+    }
+
+    /// @brief 多个驱动源接在同一根线上时的值
+    uint8_t Resolve(uint32_t net) const
+    {
+        uint8_t v = LVZ;
+        for (uint32_t i = drvidx[net]; i < drvidx[net + 1]; ++i)
+        {
+            uint8_t d = drive[drvlist[i]];
+            if (d == LV1)
+                return LV1;
+            if (d == LV0)
+                v = LV0;
+        }
+        return v;
+    }
+
+    /// @brief 改变一个驱动源的输出，线的值变化时把读这根线的单元放入队列
+    inline void Drive(uint32_t slot, uint8_t v)
+    {
+        if (drive[slot] == v)
+            return;
+        drive[slot] = v;
+        uint32_t net = slotnet[slot];
+        if (drvidx[net + 1] - drvidx[net] > 1)
+            v = Resolve(net);
+        if (value[net] == v)
+            return;
+        value[net] = v;
+        for (uint32_t i = fanidx[net]; i < fanidx[net + 1]; ++i)
+            Push(fanlist[i]);
+    }
+
+    /// @brief 求值一个门
+    inline void EvalGate(uint32_t g)
+    {
+        const NetGate &gate = nl->gates[g];
+        const uint32_t *in = &nl->pins[gate.first];
+        uint8_t r;
+        switch (gate.type)
+        {
+        case NG_AND:
+            r = LV1;
+            for (uint32_t k = 0; k < gate.count; ++k)
+                if (value[in[k]] == LV0)
+                {
+                    r = LV0;
+                    break;
+                }
+            break;
+        case NG_OR:
+            r = LV0;
+            for (uint32_t k = 0; k < gate.count; ++k)
+                if (value[in[k]] == LV1)
+                {
+                    r = LV1;
+                    break;
+                }
+            break;
+        case NG_XOR:
+            r = LV0;
+            for (uint32_t k = 0; k < gate.count; ++k)
+                r ^= value[in[k]] == LV1;
+            break;
+        case NG_BUF:
+            r = value[in[0]] == LV0 ? LV0 : LV1;
+            break;
+        default: // NG_TRI
+            r = value[in[1]] == LV1 ? value[in[0]] : LVZ;
+            break;
+        }
+        if (gate.invert && r != LVZ)
+            r ^= 1;
+        Drive(g, r);
+    }
+
+    /// @brief 多根线组成的数，未驱动视为0
+    inline uint32_t Bits(const uint32_t *nets, int count) const
+    {
+        uint32_t v = 0;
+        for (int b = 0; b < count; ++b)
+            v |= (uint32_t)(value[nets[b]] == LV1) << b;
+        return v;
+    }
+
+    /// @brief 求值一块存储器：写信号有效的边沿写入，读出数据随地址变化
+    void EvalMemory(uint32_t m)
+    {
+        const NetMemory &nm = nl->memories[m];
+        const uint32_t *pins = &nl->pins[nm.first];
+        uint32_t addr = Bits(pins, nm.abits);
+        if (nm.writable)
+        {
+            uint8_t w = value[pins[nm.abits + 2 * nm.dbits]];
+            uint8_t active = nm.writeon1 ? w == LV1 : w == LV0;
+            if (active && !memwrite[m])
+            {
+                mem[m][addr] = Bits(pins + nm.abits, nm.dbits);
+                if (logwrites)
+                    writes.emplace_back(m, addr);
+            }
+            memwrite[m] = active;
+        }
+        uint32_t word = mem[m][addr];
+        for (int b = 0; b < nm.dbits; ++b)
+            Drive(memslot[m] + b, (word >> b) & 1);
+    }
+
+    /// @brief 求值直到没有变化
+    /// @return 是否稳定，超过GATESIM_MAX_EVALS次求值时返回false
+    bool Settle()
+    {
+        uint64_t limit = evals + GATESIM_MAX_EVALS;
+        while (head != tail)
+        {
+            if (evals >= limit)
+                return false;
+            uint32_t cell = queue[head];
+            if (++head == queue.size())
+                head = 0;
+            queued[cell] = 0;
+            ++evals;
+            if (cell < ngates)
+                EvalGate(cell);
+            else
+                EvalMemory(cell - (uint32_t)ngates);
+        }
+        return true;
+    }
+
+    /// @brief 设置按钮或时钟，需要再调用Settle()
+    /// @param port Netlist::ports中的下标
+    /// @param v
+    void SetInput(size_t port, uint32_t v)
+    {
+        const NetPort &p = nl->ports[port];
+        for (size_t b = 0; b < p.nets.size(); ++b)
+            Drive(portslot[port] + (uint32_t)b, (v >> b) & 1);
+    }
+
+    /// @brief 读一组线，未驱动视为0
+    uint32_t Read(const NetPort &port) const
+    {
+        return Bits(port.nets.data(), (int)port.nets.size());
+    }
+
+    /// @brief 外部修改存储器内容后重新求值其输出
+    void Touch(size_t m)
+    {
+        Push((uint32_t)(ngates + m));
+    }
+};
+
+/// @brief 线程屏障：最后到达的线程放行其他线程。多核时先自旋等待，久等或单核时睡眠
+struct GateBarrier
+{
+    std::atomic<uint32_t> count, generation;
+    uint32_t total;
+    int spins;
+    std::mutex mutex;
+    std::condition_variable cond;
+
+    GateBarrier() : count(0), generation(0), total(1)
+    {
+        spins = std::thread::hardware_concurrency() > 1 ? 4096 : 0;
+    }
+
+    /// @brief 设置线程数，没有线程等待时才能调用
+    void Reset(uint32_t n)
+    {
+        total = n;
+        count.store(0);
+    }
+
+    void Wait()
+    {
+        uint32_t gen = generation.load(std::memory_order_acquire);
+        if (count.fetch_add(1, std::memory_order_acq_rel) + 1 == total)
+        {
+            count.store(0, std::memory_order_relaxed);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                generation.store(gen + 1, std::memory_order_release);
+            }
+            cond.notify_all();
+            return;
+        }
+        for (int i = 0; i < spins; ++i)
+            if (generation.load(std::memory_order_acquire) != gen)
+                return;
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&] { return generation.load(std::memory_order_acquire) != gen; });
+    }
+};
+
+/// @brief 分区并行的门级模拟：按顶层电路中的子电路实例（寄存器、计数器、ALU、控制器等）把单元
+/// 分成若干区，每区一个线程，各自保存一份线的值，只求值本区的单元。每轮各区先各自稳定，把其他区
+/// 要读入的驱动源写入本轮的发件箱，在屏障处等齐后读入其他区的发件箱。发件箱按轮次奇偶交替使用，
+/// 每轮只需一次屏障；某轮各区公布的值都与上一轮相同时已经一致，不必再多交换一轮确认。
+/// 寄存器的D>触发器只在时钟边沿锁存，各区内部的求值顺序不影响稳定后的结果，与单线程模拟相同
+struct PartSim
+{
+    const Netlist *nl;
+    std::vector<GateSim> parts;                                      // 每区一个模拟器
+    std::vector<std::vector<uint32_t>> exports;                      // 每区被其他区读入的驱动源
+    std::vector<std::vector<std::pair<uint32_t, uint32_t>>> imports; // 每区读入的驱动源所在的区及其在exports中的位置
+    std::vector<std::vector<uint8_t>> outbox[2];                     // 各区每轮公布的exports的值，按轮次奇偶交替
+    std::vector<uint8_t> state[2];                                   // 各区每轮的状态：0公布的值未变，1有变化，2振荡
+    std::vector<uint32_t> home;                                      // 线 -> 读或驱动它的一个区，其中的值是完整的
+    std::vector<uint32_t> memhome;                                   // 存储器所在的区
+    bool fresh;                                                      // 发件箱不是上次稳定时的值，下一轮须交换
+    uint64_t rounds;                                                 // 累计交换轮数
+
+    GateBarrier start, phase;
+    std::vector<std::thread> workers;
+    bool quit;
+
+    PartSim() : nl(NULL), fresh(true), rounds(0), quit(false)
+    {
+    }
+
+    PartSim(const PartSim &) = delete;
+    PartSim &operator=(const PartSim &) = delete;
+
+    ~PartSim()
+    {
+        Stop();
+    }
+
+    void Stop()
+    {
+        if (workers.empty())
+            return;
+        quit = true;
+        start.Wait();
+        for (std::thread &t : workers)
+            t.join();
+        workers.clear();
+        quit = false;
+    }
+
+    /// @brief 把顶层实例按门数从多到少依次分给门数最少的区，然后建立各区的模拟器并上电
+    /// @param netlist 在模拟器之后销毁
+    /// @param index 驱动与扇出表，为NULL时重新建立
+    /// @param threads 区数，不超过顶层实例数
+    /// @return 是否稳定
+    bool Build(const Netlist &netlist, const NetIndex *index = NULL, int threads = 1)
+    {
+        Stop();
+        nl = &netlist;
+        NetIndex built;
+        if (index == NULL)
+        {
+            built.Build(netlist);
+            index = &built;
+        }
+        size_t ngates = nl->gates.size(), ncells = ngates + nl->memories.size();
+        size_t nblocks = std::max<size_t>(nl->blocks.size(), 1);
+        // 核数少于区数时各区轮流占用核，每轮的屏障都要切换线程，没有收益
+        size_t cores = std::max<size_t>(1, std::thread::hardware_concurrency());
+        size_t nparts = std::max<size_t>(1, std::min<size_t>(std::min<size_t>(threads, cores), nblocks));
+        auto blockof = [&](size_t c) {
+            const std::vector<uint32_t> &tag = c < ngates ? nl->gateblock : nl->memblock;
+            size_t i = c < ngates ? c : c - ngates;
+            return i < tag.size() ? tag[i] : 0;
+        };
+
+        std::vector<uint64_t> weight(nblocks, 0), load(nparts, 0);
+        for (size_t c = 0; c < ncells; ++c)
+            ++weight[blockof(c)];
+        std::vector<uint32_t> order(nblocks), partof(nblocks);
+        for (size_t b = 0; b < nblocks; ++b)
+            order[b] = (uint32_t)b;
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return weight[a] > weight[b]; });
+        for (uint32_t b : order)
+        {
+            size_t p = std::min_element(load.begin(), load.end()) - load.begin();
+            partof[b] = (uint32_t)p;
+            load[p] += weight[b];
+        }
+        std::vector<std::vector<uint32_t>> own(nparts);
+        std::vector<uint32_t> cellpart(ncells);
+        for (size_t c = 0; c < ncells; ++c)
+        {
+            cellpart[c] = partof[blockof(c)];
+            own[cellpart[c]].push_back((uint32_t)c);
+        }
+
+        // 门与存储器的驱动源属于所在的区，常量与输入在每个区都驱动
+        std::vector<uint32_t> slotpart(index->constslot);
+        for (size_t g = 0; g < ngates; ++g)
+            slotpart[g] = cellpart[g];
+        for (size_t m = 0; m < nl->memories.size(); ++m)
+            for (int b = 0; b < nl->memories[m].dbits; ++b)
+                slotpart[index->memslot[m] + b] = cellpart[ngates + m];
+        memhome.resize(nl->memories.size());
+        for (size_t m = 0; m < nl->memories.size(); ++m)
+            memhome[m] = cellpart[ngates + m];
+
+        home.assign(nl->nets, UINT32_MAX);
+        exports.assign(nparts, {});
+        imports.assign(nparts, {});
+        std::vector<uint32_t> seen(nl->nets, UINT32_MAX), exported(index->constslot, UINT32_MAX);
+        for (size_t p = 0; p < nparts; ++p)
+        {
+            auto touch = [&](uint32_t n) {
+                if (seen[n] == p)
+                    return;
+                seen[n] = (uint32_t)p;
+                if (home[n] == UINT32_MAX)
+                    home[n] = (uint32_t)p;
+                for (uint32_t i = index->drvidx[n]; i < index->drvidx[n + 1]; ++i)
+                {
+                    uint32_t slot = index->drvlist[i];
+                    if (slot >= index->constslot || slotpart[slot] == p)
+                        continue;
+                    uint32_t q = slotpart[slot];
+                    if (exported[slot] == UINT32_MAX)
+                    {
+                        exported[slot] = (uint32_t)exports[q].size();
+                        exports[q].push_back(slot);
+                    }
+                    imports[p].emplace_back(q, exported[slot]);
+                }
+            };
+            for (uint32_t c : own[p])
+            {
+                if (c < ngates)
+                {
+                    const NetGate &gate = nl->gates[c];
+                    for (uint32_t k = 0; k < gate.count; ++k)
+                        touch(nl->pins[gate.first + k]);
+                    touch(gate.out);
+                }
+                else
+                {
+                    const NetMemory &nm = nl->memories[c - ngates];
+                    uint32_t npins = nm.abits + nm.dbits * (nm.writable ? 2 : 1) + (nm.writable ? 1 : 0);
+                    for (uint32_t k = 0; k < npins; ++k)
+                        touch(nl->pins[nm.first + k]);
+                }
+            }
+        }
+        for (uint32_t &h : home)
+            if (h == UINT32_MAX)
+                h = 0;
+
+        parts.clear();
+        parts.resize(nparts);
+        for (size_t p = 0; p < nparts; ++p)
+            parts[p].Build(netlist, index, nparts > 1 ? &own[p] : NULL);
+        for (int b = 0; b < 2; ++b)
+        {
+            outbox[b].resize(nparts);
+            for (size_t p = 0; p < nparts; ++p)
+                outbox[b][p].assign(exports[p].size(), 0);
+            state[b].assign(nparts, 0);
+        }
+        fresh = true;
+        rounds = 0;
+        start.Reset((uint32_t)nparts);
+        phase.Reset((uint32_t)nparts);
+        for (size_t p = 1; p < nparts; ++p)
+            workers.emplace_back([this, p] {
+                for (;;)
+                {
+                    start.Wait();
+                    if (quit)
+                        return;
+                    Work(p);
+                }
+            });
+        return Settle();
+    }
+
+    /// @brief 一个区的工作：稳定、公布、等齐、读入边界，直到各区公布的值都不再变化。
+    /// 第b个发件箱在第r轮写入、等齐后被读入，第r + 2轮再写入前其他区都已经过了第r + 1轮的屏障
+    /// @return 最后一轮各区状态的或，0为稳定
+    uint8_t Work(size_t p)
+    {
+        GateSim &sim = parts[p];
+        for (uint64_t round = 0;; ++round)
+        {
+            int b = (int)(round & 1);
+            bool ok = sim.Settle();
+            std::vector<uint8_t> &out = outbox[b][p];
+            const std::vector<uint8_t> &last = outbox[b ^ 1][p];
+            uint8_t changed = fresh && round == 0;
+            for (size_t k = 0; k < out.size(); ++k)
+            {
+                out[k] = sim.drive[exports[p][k]];
+                changed |= out[k] != last[k];
+            }
+            state[b][p] = !ok ? 2 : changed;
+            phase.Wait();
+            uint8_t any = 0;
+            for (uint8_t s : state[b])
+                any |= s;
+            if (any == 0 || (any & 2) || round >= GATESIM_MAX_ROUNDS)
+            {
+                if (p == 0)
+                    rounds += round + 1;
+                return any;
+            }
+            for (const auto &in : imports[p])
+                sim.Drive(exports[in.first][in.second], outbox[b][in.first][in.second]);
+        }
+    }
+
+    /// @brief 各区并行求值直到没有变化
+    /// @return 是否稳定
+    bool Settle()
+    {
+        if (parts.size() == 1)
+            return parts[0].Settle();
+        start.Wait();
+        // 正常结束时两个发件箱的值相同，振荡或超过轮数时下次须重新交换
+        uint8_t any = Work(0);
+        fresh = any != 0;
+        return any == 0;
+    }
+
+    /// @brief 所有区上电
+    /// @return 是否稳定
+    bool Reset()
+    {
+        for (GateSim &sim : parts)
+            sim.Reset();
+        fresh = true;
+        return Settle();
+    }
+
+    /// @brief 设置按钮或时钟，每个区都设置，需要再调用Settle()
+    void SetInput(size_t port, uint32_t v)
+    {
+        for (GateSim &sim : parts)
+            sim.SetInput(port, v);
+    }
+
+    /// @brief 多根线组成的数，未驱动视为0
+    uint32_t Bits(const uint32_t *nets, int count) const
+    {
+        uint32_t v = 0;
+        for (int b = 0; b < count; ++b)
+            v |= (uint32_t)(parts[home[nets[b]]].value[nets[b]] == LV1) << b;
+        return v;
+    }
+
+    /// @brief 读一组线，未驱动视为0
+    uint32_t Read(const NetPort &port) const
+    {
+        return Bits(port.nets.data(), (int)port.nets.size());
+    }
+
+    /// @brief 存储器的内容
+    std::vector<uint32_t> &Mem(size_t m)
+    {
+        return parts[memhome[m]].mem[m];
+    }
+
+    const std::vector<uint32_t> &Mem(size_t m) const
+    {
+        return parts[memhome[m]].mem[m];
+    }
+
+    /// @brief 外部修改存储器内容后重新求值其输出
+    void Touch(size_t m)
+    {
+        parts[memhome[m]].Touch(m);
+    }
+
+    /// @brief 保存各区的状态，需在稳定后调用
+    void Save(std::vector<GateSim::State> &s) const
+    {
+        s.resize(parts.size());
+        for (size_t p = 0; p < parts.size(); ++p)
+            parts[p].Save(s[p]);
+    }
+
+    /// @brief 恢复保存的状态
+    void Restore(const std::vector<GateSim::State> &s)
+    {
+        for (size_t p = 0; p < parts.size(); ++p)
+            parts[p].Restore(s[p]);
+        fresh = true;
+    }
+
+    /// @brief 各区累计求值次数之和
+    uint64_t Evals() const
+    {
+        uint64_t n = 0;
+        for (const GateSim &sim : parts)
+            n += sim.evals;
+        return n;
+    }
+
+    /// @brief 各区之间交换的驱动源数
+    size_t Boundary() const
+    {
+        size_t n = 0;
+        for (const auto &v : imports)
+            n += v.size();
+        return n;
+    }
+};
+
+/// @brief 门级模型的CPU：找到Power中的按钮、时钟和停机信号，以及主电路的RAM与微程序ROM，
+/// 按时钟周期执行，一个周期对应CPU::Step()的一个微周期。与CPU有两处不同：上电后PSW的IE位为1；
+/// 微周期计数器在下降沿计数，晚于上升沿锁存的PSW，同一微周期既写PSW又有PIN_CYC时按新PSW的控制字计数，
+/// 如IE为1时执行INT，最后一步关中断后计数器会继续走完空的微周期才回到取指
+struct GateMachine
+{
+    Netlist netlist;
+    PartSim sim;
+    int ram, rom;                     // 内存与微程序ROM在Netlist::memories中的下标
+    int cores;                        // 电路复制的份数，各份执行同一程序，见ReplicateNetlist
+    size_t permem;                    // 每份的存储器数，第k份的存储器下标加k * permem
+    size_t clock, pow, res, man;      // 输入在Netlist::ports中的下标
+    const NetPort *hil;               // Power的HIL引脚，为1时时钟停止
+    const NetPort *regs[32];          // 各寄存器的S引脚，下标为pin.h中的编号，找不到时为NULL
+    const NetPort *pc;                // 程序计数器的S引脚
+    uint64_t cycles;                  // 已执行的周期数
+    uint64_t instructions;            // 已执行的指令数，即微周期计数器回到0的次数
+    bool cached;                      // 网表是否取自缓存
+
+    GateMachine() : ram(-1), rom(-1), cores(1), permem(0), clock(0), pow(0), res(0), man(0), hil(NULL), pc(NULL), cycles(0), instructions(0), cached(false)
+    {
+        std::fill(regs, regs + 32, (const NetPort *)NULL);
+    }
+
+    /// @brief 读取电路文件并找到需要的部件
+    /// @param path
+    /// @param error
+    /// @param cachedir 网表缓存的目录，为空时不使用缓存
+    /// @param threads 模拟的线程数，按顶层实例分区，见PartSim
+    /// @param copies 把电路复制成几份，得到更大的多核电路
+    /// @return
+    bool Load(const std::string &path, std::string &error, const std::string &cachedir = "", int threads = 1, int copies = 1)
+    {
+        NetIndex index;
+        if (!LoadNetlistCached(path, cachedir, netlist, index, error, &cached))
+            return false;
+        cores = std::max(copies, 1);
+        permem = netlist.memories.size();
+        if (cores > 1)
+        {
+            ReplicateNetlist(netlist, cores);
+            index.Build(netlist);
+        }
+
+        for (size_t m = 0; m < permem; ++m)
+        {
+            const NetMemory &nm = netlist.memories[m];
+            if (nm.name.find('/') != std::string::npos || nm.abits != 16)
+                continue;
+            if (nm.writable && nm.dbits == 8)
+                ram = (int)m;
+            else if (!nm.writable && nm.dbits == 32)
+                rom = (int)m;
+        }
+        if (ram < 0 || rom < 0)
+        {
+            error = "main circuit has no 64K RAM or microcode ROM";
+            return false;
+        }
+
+        int found = 0;
+        for (size_t p = 0; p < netlist.ports.size(); ++p)
+        {
+            const NetPort &port = netlist.ports[p];
+            std::string name = port.name.substr(port.name.rfind('/') + 1);
+            if (port.name.compare(0, 6, "Power@") != 0)
+                continue;
+            if (port.kind == NetPort::CLOCK)
+                clock = p, found |= 1;
+            else if (name == "POW")
+                pow = p, found |= 2;
+            else if (name == "RES")
+                res = p, found |= 4;
+            else if (name == "MAN")
+                man = p, found |= 8;
+            else if (port.kind == NetPort::PIN && name == "HIL")
+                hil = &port, found |= 16;
+        }
+        if (found != 31)
+        {
+            error = "main circuit has no Power block with clock, POW, RES, MAN and HIL";
+            return false;
+        }
+
+        // 控制器按寄存器名输出读写信号，接到同一组线上的子电路的S引脚就是该寄存器的值
+        std::map<std::vector<uint32_t>, std::string> owner;
+        for (const NetPort &port : netlist.ports)
+            if (port.kind == NetPort::PIN && port.name.size() > 3 && port.name.compare(port.name.size() - 3, 3, "/IO") == 0)
+                owner[port.nets] = port.name.substr(0, port.name.size() - 2) + "S";
+        for (const NetPort &port : netlist.ports)
+        {
+            std::string name = port.name.substr(port.name.rfind('/') + 1);
+            if (port.kind != NetPort::PIN)
+                continue;
+            if (port.name.compare(0, 16, "Program Counter@") == 0 && name == "S")
+                pc = &port;
+            if (port.name.compare(0, 13, "Control Unit@") != 0 || owner.count(port.nets) == 0)
+                continue;
+            for (int i = MSR; i <= T2; ++i)
+                if (i != RAM && name == REG_NAMES[i])
+                    regs[i] = netlist.Port(owner[port.nets]);
+        }
+        sim.Build(netlist, &index, threads);
+        return true;
+    }
+
+    /// @brief 把微程序写入各份的ROM
+    void LoadMicro(const MicroCode &micro)
+    {
+        for (int k = 0; k < cores; ++k)
+        {
+            size_t m = rom + k * permem;
+            micro.Expand(sim.Mem(m).data());
+            sim.Touch(m);
+        }
+    }
+
+    /// @brief 清空各份的内存并载入程序
+    /// @param path
+    /// @return 载入的字节数，失败返回-1
+    long LoadProgram(const char *path)
+    {
+        FILE *pf = fopen(path, "rb");
+        if (pf == NULL)
+            return -1;
+        std::vector<uint8_t> buf(RAM_SIZE);
+        size_t cnt = fread(buf.data(), 1, RAM_SIZE, pf);
+        fclose(pf);
+        for (int k = 0; k < cores; ++k)
+        {
+            size_t m = ram + k * permem;
+            std::vector<uint32_t> &mem = sim.Mem(m);
+            std::fill(mem.begin(), mem.end(), 0);
+            for (size_t i = 0; i < cnt; ++i)
+                mem[i] = buf[i];
+            sim.Touch(m);
+        }
+        return (long)cnt;
+    }
+
+    /// @brief 开机：打开电源，按下再松开复位按钮
+    /// @return 是否稳定
+    bool Boot()
+    {
+        sim.SetInput(man, 0);
+        sim.SetInput(clock, 0);
+        sim.SetInput(pow, 1);
+        sim.SetInput(res, 1);
+        bool ok = sim.Settle();
+        sim.SetInput(res, 0);
+        cycles = instructions = 0;
+        return sim.Settle() && ok;
+    }
+
+    /// @brief 检查点，见Save
+    struct Checkpoint
+    {
+        std::vector<GateSim::State> sim;
+        uint64_t cycles, instructions;
+    };
+
+    /// @brief 保存电路状态与计数，需在两个周期之间调用
+    void Save(Checkpoint &cp) const
+    {
+        sim.Save(cp.sim);
+        cp.cycles = cycles;
+        cp.instructions = instructions;
+    }
+
+    /// @brief 回到保存时的状态
+    void Restore(const Checkpoint &cp)
+    {
+        sim.Restore(cp.sim);
+        cycles = cp.cycles;
+        instructions = cp.instructions;
+    }
+
+    /// @brief 记录第0份内存的写入地址，见RamWrites()
+    void LogRamWrites(bool on)
+    {
+        GateSim &home = sim.parts[sim.memhome[ram]];
+        home.logwrites = on;
+        home.writes.clear();
+    }
+
+    /// @brief 记录下的写入，存储器下标为ram的是内存地址
+    std::vector<std::pair<uint32_t, uint32_t>> &RamWrites()
+    {
+        return sim.parts[sim.memhome[ram]].writes;
+    }
+
+    /// @brief 读寄存器，编号见pin.h，电路中没有时为0
+    uint8_t Reg(int i) const
+    {
+        return regs[i] != NULL ? (uint8_t)sim.Read(*regs[i]) : 0;
+    }
+
+    /// @brief 读程序计数器
+    uint8_t Pc() const
+    {
+        return pc != NULL ? (uint8_t)sim.Read(*pc) : 0;
+    }
+
+    /// @brief 是否已停机
+    bool Halted() const
+    {
+        return sim.Read(*hil) != 0;
+    }
+
+    /// @brief 微程序ROM的地址，即IR << 8 | PSW << 4 | 微周期计数器
+    uint32_t MicroAddress() const
+    {
+        const NetMemory &nm = netlist.memories[rom];
+        return sim.Bits(&netlist.pins[nm.first], nm.abits);
+    }
+
+    /// @brief 时钟一个周期
+    /// @return 是否稳定
+    bool Cycle()
+    {
+        sim.SetInput(clock, 1);
+        bool ok = sim.Settle();
+        sim.SetInput(clock, 0);
+        ok = sim.Settle() && ok;
+        ++cycles;
+        if ((MicroAddress() & 0xf) == 0)
+            ++instructions;
+        return ok;
+    }
+
+    /// @brief 执行到停机或达到周期上限
+    /// @param maxcycles
+    /// @param error 电路振荡时的说明
+    /// @return 是否停机
+    bool Run(uint64_t maxcycles, std::string &error)
+    {
+        while (cycles < maxcycles)
+        {
+            if (Halted())
+                return true;
+            if (!Cycle())
+            {
+                error = "circuit does not settle in cycle " + std::to_string(cycles);
+                return false;
+            }
+        }
+        return Halted();
+    }
+
+    /// @brief 第k份电路的内存
+    const std::vector<uint32_t> &Ram(int k = 0) const
+    {
+        return sim.Mem(ram + k * permem);
+    }
+
+    /// @brief 把第0份的寄存器、内存与计数复制到CPU中，以便使用CPU的打印函数或与模拟器比较
+    /// @param cpu
+    void Export(CPU &cpu) const
+    {
+        uint32_t addr = MicroAddress();
+        for (int i = 0; i < 32; ++i)
+            cpu.reg[i] = Reg(i);
+        cpu.pc = Pc();
+        cpu.psw = (addr >> 4) & 0xf;
+        cpu.cyc = addr & 0xf;
+        cpu.halt = Halted();
+        cpu.cycles = cycles;
+        cpu.instructions = instructions;
+        const std::vector<uint32_t> &mem = Ram();
+        for (size_t i = 0; i < RAM_SIZE; ++i)
+            cpu.ram[i] = (uint8_t)mem[i];
+    }
+};
+
+#endif //_GATESIM_H_
@@ -0,0 +1,553 @@
+/**
+ * 空转快进
+ *
+ * 在底层引擎执行的间隙试探当前所在的循环，能证明结果的循环直接跳过，周期数与指令数保持精确：
+ *
+ * 1. 只读写寄存器与PSW的循环：以当前指令为循环头逐微周期执行一圈，符号化地记录每个寄存器
+ *    相对圈首寄存器的表达式（常数或某个寄存器加常数）。每圈执行的控制字序列由各微周期的IR、
+ *    PSW、DST、SRC与读内存的地址决定，把它们都记为条件，逐圈代入闭式求值，第一个不满足条件的圈
+ *    即循环出口，之前的圈直接算出寄存器。256圈内都满足时循环永不退出。
+ * 2. 写内存但整体状态循环的死循环，如test6、test7：在循环头用Brent算法找寄存器与内存完全相同的
+ *    两个时刻，之后的执行以这段周期数为周期重复，整周期跳过。写设备的循环不跳过，见device.h。
+ *
+ * 没有外部输入时，跳到循环出口或周期上限即为跳到下一个事件；有事件源时调用方以下一个事件的时间
+ * 为周期上限，见irq.h。停机且允许中断的CPU等待事件时直接把周期数推进到上限
+ */
+
+#ifndef _IDLE_H_
+#define _IDLE_H_
+
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "cpu.h"
+#include "fast.h"
+#include "jit.h"
+#include "trace.h"
+
+#define IDLE_BODY_MAX  64        // 寄存器循环每圈最多的指令数
+#define IDLE_GAP_MIN   (1 << 8)  // 跳过循环后下次试探前的微周期数，试探失败时加倍
+#define IDLE_GAP_MAX   (1 << 26) // 两次试探之间最多的微周期数
+#define IDLE_PROBE_DIV 64        // Brent算法最多执行的微周期数为试探间隔的几分之一
+#define IDLE_PROBE_MIN (1 << 12) // Brent算法至少执行的微周期数
+#define IDLE_GAIN_MIN  (1 << 10) // 一次试探至少跳过这么多微周期才算成功
+
+/// @brief 寄存器在一圈中的符号值：常数，或圈首某个寄存器的值加常数
+struct IdleSym
+{
+    int8_t base;  // IDLE_CONST、IDLE_UNKNOWN或寄存器编号
+    uint8_t off;
+
+    enum
+    {
+        IDLE_CONST = -1,  // 值为off
+        IDLE_UNKNOWN = -2 // 无法表示
+    };
+
+    static IdleSym Const(uint8_t v) { return {IDLE_CONST, v}; }
+    static IdleSym Unknown() { return {IDLE_UNKNOWN, 0}; }
+    bool IsConst() const { return base == IDLE_CONST; }
+    bool IsKnown() const { return base != IDLE_UNKNOWN; }
+};
+
+/// @brief 一圈中必须保持不变的条件
+struct IdleCond
+{
+    bool word;    // 为true时要求以a为IR、第psw次写入的PSW、cyc取得的控制字为val，否则要求a的值为val
+    IdleSym a;
+    int psw;      // IdleEngine::flagops的下标，-1为圈首的PSW
+    uint8_t cyc;
+    uint32_t val;
+};
+
+/// @brief 一圈中写PSW的ALU运算，PSW为ie | 标志位
+struct IdleFlags
+{
+    uint32_t op;
+    IdleSym a, b;
+    uint8_t ie;
+};
+
+/// @brief 空转快进引擎，包装fast、jit或逐微周期执行
+struct IdleEngine
+{
+    const FastEngine *fast; // 为NULL时逐微周期执行
+    JitEngine *jit;         // 不为NULL时使用jit
+    bool probe;             // 是否试探并跳过循环，为false时只转发给底层引擎
+    bool waithalt;          // 停机且IE为1时等待外部事件，直接推进到周期上限
+    TraceWriter *trace;     // 不为NULL时逐条指令执行并记录轨迹，不试探循环
+
+    uint64_t gap;     // 下次试探前执行的微周期数
+    uint64_t loops;   // 跳过的寄存器循环数
+    uint64_t repeats; // 跳过的重复状态数
+    uint64_t skipped; // 跳过的微周期数，含停机等待
+
+    std::vector<IdleCond> conds;
+    std::vector<IdleFlags> flagops; // 按顺序写PSW的运算
+    bool lost;                      // 条件中出现了无法表示的值
+    IdleSym sym[32];                // 各寄存器当前的符号值
+    int psw;                        // 当前PSW，flagops的下标，-1为圈首的PSW
+    uint8_t start[32];              // 记录的一圈圈首的寄存器
+    uint8_t startpsw;
+    const MicroCode *micro;
+    uint8_t dirty[RAM_SIZE >> 8];
+    std::vector<uint8_t> saved; // Brent算法中乌龟时刻的内存
+
+    explicit IdleEngine(const FastEngine *fast = NULL, JitEngine *jit = NULL)
+        : fast(fast), jit(jit), probe(true), waithalt(false), trace(NULL), gap(IDLE_GAP_MIN), loops(0), repeats(0), skipped(0),
+          lost(false), psw(-1), startpsw(0), micro(NULL), saved(RAM_SIZE)
+    {
+    }
+
+    /// @brief 执行到停止或达到微周期上限，结果与CPU::Run一致
+    /// @param cpu
+    /// @param maxcycles 微周期上限，有事件源时为下一个事件的时间
+    /// @return 是否因PIN_HLT而停止
+    bool Run(CPU &cpu, uint64_t maxcycles)
+    {
+        if (trace != NULL)
+            return RunTraced(cpu, maxcycles);
+        while (cpu.cycles < maxcycles)
+        {
+            uint64_t next = !probe || maxcycles - cpu.cycles <= gap ? maxcycles : cpu.cycles + gap;
+            bool halted = jit != NULL ? jit->Run(cpu, next) : fast != NULL ? fast->Run(cpu, next) : cpu.Run(next);
+            if (halted)
+                return Halted(cpu, maxcycles);
+            if (cpu.cycles >= maxcycles)
+                break;
+
+            // 停在指令中间时先执行到指令边界
+            while (cpu.cyc != 0 && cpu.cycles < maxcycles)
+                if (!cpu.Step())
+                    return Halted(cpu, maxcycles);
+            if (cpu.cycles >= maxcycles)
+                break;
+            // 跳过的周期太少时与失败同样对待，避免反复试探短循环
+            uint64_t before = skipped;
+            Probe(cpu, maxcycles);
+            gap = skipped - before >= IDLE_GAIN_MIN ? IDLE_GAP_MIN : std::min<uint64_t>(gap * 2, IDLE_GAP_MAX);
+        }
+        return false;
+    }
+
+    /// @brief IE为0时执行到IE变为1的指令边界、停止或达到微周期上限，不试探循环
+    /// @return 是否因PIN_HLT而停止
+    bool RunMasked(CPU &cpu, uint64_t maxcycles)
+    {
+        if (trace == NULL && fast != NULL && fast->fetchok && cpu.cyc == 0)
+            return jit != NULL ? jit->Run(cpu, maxcycles, true) : fast->Run(cpu, maxcycles, true);
+        while (!(cpu.psw & PSW_IE) && cpu.cycles < maxcycles)
+        {
+            bool ok = StepInstruction(cpu, maxcycles);
+            if (trace != NULL)
+                trace->Record(cpu);
+            if (!ok)
+                break;
+        }
+        return cpu.halt;
+    }
+
+    /// @brief 逐条指令执行，每条指令记录一次轨迹
+    bool RunTraced(CPU &cpu, uint64_t maxcycles)
+    {
+        while (cpu.cycles < maxcycles)
+        {
+            bool ok = StepInstruction(cpu, maxcycles);
+            trace->Record(cpu);
+            if (!ok && cpu.halt)
+            {
+                Halted(cpu, maxcycles);
+                trace->Record(cpu);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// @brief 停机后的处理
+    /// @return true
+    bool Halted(CPU &cpu, uint64_t maxcycles)
+    {
+        if (waithalt && (cpu.psw & PSW_IE) && cpu.cycles < maxcycles)
+            skipped += maxcycles - cpu.cycles, cpu.cycles = maxcycles;
+        return true;
+    }
+
+    /// @brief 在指令边界试探当前所在的循环，能跳过时跳过
+    /// @return 是否跳过了循环
+    bool Probe(CPU &cpu, uint64_t maxcycles)
+    {
+        uint16_t head = (cpu.reg[MSR] << 8) | cpu.pc;
+        uint32_t written;
+        bool writes;
+        if (!Lap(cpu, head, maxcycles, NULL, written, writes))
+            return false;
+        if (!writes && SkipLoop(cpu, head, maxcycles, written))
+            return true;
+        // 符号执行的一圈可能停机或因上限停在指令中间，这时不能再从这里试探
+        if (cpu.halt || cpu.cyc != 0)
+            return false;
+        return SkipRepeat(cpu, head, maxcycles);
+    }
+
+    /// @brief 逐微周期执行一圈，即从循环头执行到下一次在指令边界回到循环头
+    /// @param head 循环头，MSR << 8 | PC
+    /// @param trace 不为NULL时记录符号值与条件，遇到无法处理的控制字时置为false
+    /// @param written 这一圈写过的寄存器，下标为位
+    /// @param writes 这一圈是否写过内存
+    /// @return 是否回到了循环头，停机、超过IDLE_BODY_MAX条指令或达到上限时为false
+    bool Lap(CPU &cpu, uint16_t head, uint64_t maxcycles, bool *trace, uint32_t &written, bool &writes)
+    {
+        written = 0, writes = false;
+        for (int n = 0; n < IDLE_BODY_MAX; ++n)
+        {
+            do
+            {
+                if (cpu.cycles >= maxcycles)
+                    return false;
+                uint32_t w = cpu.micro->Word(cpu.reg[IR], cpu.psw, cpu.cyc);
+                if (trace != NULL && *trace && !Trace(cpu, w))
+                    *trace = false;
+                uint8_t targets[3] = {(uint8_t)((w & MASK_IN) >> _DST_SHIFT),
+                                      (uint8_t)((w & PIN_DST_W) ? cpu.reg[DST] & 0x1f : 0),
+                                      (uint8_t)((w & PIN_SRC_W) ? cpu.reg[SRC] & 0x1f : 0)};
+                for (uint8_t i : targets)
+                    written |= 1u << i;
+                writes = writes || (written & (1u << RAM));
+                if (!cpu.Step())
+                    return false;
+            } while (cpu.cyc != 0);
+            if (((cpu.reg[MSR] << 8) | cpu.pc) == head)
+                return true;
+        }
+        return false;
+    }
+
+    /// @brief 执行一条指令，能预译码时按fast引擎执行，不在指令边界时逐微周期执行到边界
+    /// @return 是否执行完，停机或达到上限时为false
+    bool StepInstruction(CPU &cpu, uint64_t maxcycles) const
+    {
+        if (fast != NULL && fast->fetchok && cpu.cyc == 0)
+        {
+            uint16_t seg = cpu.reg[MSR] << 8;
+            uint8_t pc = cpu.pc;
+            uint8_t ir = cpu.ram[seg | pc];
+            const Fused &f = fast->table[(ir << 4) | (cpu.psw & 0xf)];
+            if (cpu.cycles + f.cycles + !f.done <= maxcycles)
+            {
+                FastEngine::Fetch(cpu, f, pc, ir, cpu.ram[seg | (uint8_t)(pc + 1)], cpu.ram[seg | (uint8_t)(pc + 2)]);
+                return !FastEngine::Finish(cpu, f);
+            }
+        }
+        do
+        {
+            if (cpu.cycles >= maxcycles || !cpu.Step())
+                return false;
+        } while (cpu.cyc != 0);
+        return true;
+    }
+
+    /// @brief 指令在各PSW下这个微周期的控制字是否都相同，相同时不必记为条件
+    bool Uniform(uint8_t ir, uint8_t cyc, uint32_t w) const
+    {
+        for (int p = 0; p < 16; ++p)
+            if (micro->Word(ir, p, cyc) != w)
+                return false;
+        return true;
+    }
+
+    /// @brief 要求表达式在每圈中的值与这一圈相同
+    void Need(const IdleSym &s, uint8_t val)
+    {
+        if (!s.IsKnown())
+            lost = true;
+        else if (!s.IsConst())
+            conds.push_back({false, s, -1, 0, val});
+    }
+
+    /// @brief 读寄存器或内存的符号值，读内存要求地址不变
+    IdleSym Read(const CPU &cpu, uint8_t i)
+    {
+        if (i == RAM)
+        {
+            Need(sym[MSR], cpu.reg[MSR]);
+            Need(sym[MAR], cpu.reg[MAR]);
+            return IdleSym::Const(cpu.ram[cpu.Address()]);
+        }
+        return i >= MSR && i <= T2 ? sym[i] : IdleSym::Const(0);
+    }
+
+    /// @brief ALU结果的符号值
+    static IdleSym AluSym(uint32_t op, const IdleSym &a, const IdleSym &b)
+    {
+        uint8_t flags;
+        if (a.IsConst() && b.IsConst())
+            return IdleSym::Const(Alu(op, a.off, b.off, flags));
+        switch (op & MASK_OP)
+        {
+        case OP_ADD:
+            if (b.IsConst() && a.IsKnown())
+                return {a.base, (uint8_t)(a.off + b.off)};
+            if (a.IsConst() && b.IsKnown())
+                return {b.base, (uint8_t)(b.off + a.off)};
+            return IdleSym::Unknown();
+        case OP_SUB:
+            return b.IsConst() && a.IsKnown() ? IdleSym{a.base, (uint8_t)(a.off - b.off)} : IdleSym::Unknown();
+        case OP_INC:
+            return a.IsKnown() ? IdleSym{a.base, (uint8_t)(a.off + 1)} : IdleSym::Unknown();
+        case OP_DEC:
+            return a.IsKnown() ? IdleSym{a.base, (uint8_t)(a.off - 1)} : IdleSym::Unknown();
+        case OP_NOT:
+            return a.IsConst() ? IdleSym::Const(~a.off) : IdleSym::Unknown();
+        default:
+            return IdleSym::Unknown();
+        }
+    }
+
+    /// @brief 在执行控制字之前记录它对符号值的影响与要求的条件，与CPU::Step一一对应
+    /// @return 是否能够处理
+    bool Trace(const CPU &cpu, uint32_t w)
+    {
+        if (w & PIN_HLT)
+            return false;
+        if (!sym[IR].IsKnown())
+            return false;
+        if (!sym[IR].IsConst() || !Uniform(sym[IR].off, cpu.cyc, w))
+            conds.push_back({true, sym[IR], psw, cpu.cyc, w});
+
+        uint8_t dst = cpu.reg[DST] & 0x1f;
+        uint8_t src = cpu.reg[SRC] & 0x1f;
+        if (w & (PIN_DST_R | PIN_DST_W))
+            Need(sym[DST], cpu.reg[DST]);
+        if (w & (PIN_SRC_R | PIN_SRC_W))
+            Need(sym[SRC], cpu.reg[SRC]);
+
+        // 总线上只有一个非常数的来源时保留其符号值
+        IdleSym in[5];
+        int n = 0;
+        uint8_t flags, bus = 0;
+        if (w & MASK_OUT)
+            in[n++] = Read(cpu, w & MASK_OUT), bus |= cpu.ReadReg(w & MASK_OUT);
+        if (w & PIN_SRC_R)
+            in[n++] = Read(cpu, src), bus |= cpu.ReadReg(src);
+        if (w & PIN_DST_R)
+            in[n++] = Read(cpu, dst), bus |= cpu.ReadReg(dst);
+        if ((w & (PIN_PC_CS | PIN_PC_WE)) == PIN_PC_CS)
+            in[n++] = IdleSym::Const(cpu.pc), bus |= cpu.pc; // 每圈同一位置的PC相同
+        if (w & PIN_ALU_OUT)
+            in[n++] = AluSym(w, sym[A], sym[B]), bus |= Alu(w, cpu.reg[A], cpu.reg[B], flags);
+        IdleSym out = IdleSym::Const(0);
+        for (int i = 0; i < n; ++i)
+        {
+            if (in[i].IsConst() && out.IsConst())
+                out.off |= in[i].off;
+            else if (in[i].IsConst() && in[i].off == 0)
+                continue;
+            else if (out.IsConst() && out.off == 0)
+                out = in[i];
+            else
+                out = IdleSym::Unknown();
+        }
+
+        // 从总线写入PC时要求跳转目标不变
+        if ((w & (PIN_PC_CS | PIN_PC_WE)) == (PIN_PC_CS | PIN_PC_WE) && !(w & PIN_PC_EN))
+        {
+            if (!out.IsKnown())
+                return false;
+            Need(out, bus);
+        }
+
+        if (w & PIN_ALU_PSW)
+        {
+            uint32_t op = w & MASK_OP;
+            bool unary = op == OP_INC || op == OP_DEC || op == OP_NOT;
+            IdleSym a = sym[A], b = unary ? IdleSym::Const(0) : sym[B];
+            if (!a.IsKnown() || !b.IsKnown())
+                return false;
+            uint8_t ie = cpu.psw & PSW_IE;
+            if (w & PIN_ALU_INT_W)
+                ie = (w & PIN_ALU_INT) ? 0 : PSW_IE;
+            flagops.push_back({op, a, b, ie});
+            psw = (int)flagops.size() - 1;
+        }
+
+        // 写入使用周期开始时的DST、SRC
+        uint8_t targets[3] = {(uint8_t)((w & MASK_IN) >> _DST_SHIFT), (uint8_t)((w & PIN_DST_W) ? dst : 0),
+                              (uint8_t)((w & PIN_SRC_W) ? src : 0)};
+        for (uint8_t i : targets)
+        {
+            if (i == RAM)
+                return false;
+            if (i >= MSR && i <= T2)
+                sym[i] = out;
+        }
+        return true;
+    }
+
+    /// @brief 第j圈圈首寄存器i的值，第0圈为记录的一圈，j >= 1时由每圈末的符号值推出
+    uint8_t Start(int i, uint64_t j) const
+    {
+        const IdleSym &e = sym[i];
+        if (j == 0)
+            return start[i];
+        if (e.IsConst())
+            return e.off;
+        if (e.base == i)
+            return (uint8_t)(start[i] + (uint8_t)j * e.off);
+        return (uint8_t)(start[e.base] + (uint8_t)(j - 1) * sym[e.base].off + e.off);
+    }
+
+    /// @brief 第j圈中表达式的值
+    uint8_t At(const IdleSym &s, uint64_t j) const
+    {
+        return s.IsConst() ? s.off : (uint8_t)(Start(s.base, j) + s.off);
+    }
+
+    /// @brief 第j圈中第k次写入后的PSW，k为-1时为圈首的PSW，即上一圈最后写入的PSW
+    uint8_t Psw(int k, uint64_t j) const
+    {
+        if (k < 0)
+            return j == 0 || flagops.empty() ? startpsw : Psw((int)flagops.size() - 1, j - 1);
+        const IdleFlags &f = flagops[k];
+        uint8_t flags;
+        Alu(f.op, At(f.a, j), At(f.b, j), flags);
+        return f.ie | flags;
+    }
+
+    /// @brief 第j圈是否与记录的一圈执行相同的控制字
+    bool Same(uint64_t j) const
+    {
+        for (const IdleCond &c : conds)
+        {
+            if (c.word ? micro->Word(At(c.a, j), Psw(c.psw, j), c.cyc) != c.val : At(c.a, j) != c.val)
+                return false;
+        }
+        return true;
+    }
+
+    /// @brief 符号化地执行一圈只读写寄存器的循环，算出出口，跳过出口之前的圈
+    /// @param written 上一圈写过的寄存器，其余寄存器按常数处理
+    /// @return 是否跳过了
+    bool SkipLoop(CPU &cpu, uint16_t head, uint64_t maxcycles, uint32_t written)
+    {
+        memcpy(start, cpu.reg, sizeof(start));
+        startpsw = cpu.psw;
+        micro = cpu.micro;
+        for (int i = 0; i < 32; ++i)
+            sym[i] = (written & (1u << i)) ? IdleSym{(int8_t)i, 0} : IdleSym::Const(start[i]);
+        conds.clear();
+        flagops.clear();
+        psw = -1;
+        lost = false;
+
+        uint64_t c0 = cpu.cycles, n0 = cpu.instructions;
+        bool trace = true, writes;
+        if (!Lap(cpu, head, maxcycles, &trace, written, writes) || !trace || lost || writes ||
+            (cpu.psw & PSW_IE) != (startpsw & PSW_IE))
+            return false;
+        uint64_t cycles = cpu.cycles - c0, instructions = cpu.instructions - n0;
+
+        // 每圈末的寄存器须为常数、圈首自身加常数，或圈首另一个“自身加常数”的寄存器再加常数
+        for (int i = 0; i < 32; ++i)
+        {
+            const IdleSym &e = sym[i];
+            if (!e.IsKnown() || (!e.IsConst() && e.base != i && sym[e.base].base != e.base))
+                return false;
+            if (Start(i, 1) != cpu.reg[i])
+                return false;
+        }
+        if (Psw(-1, 1) != cpu.psw)
+            return false;
+
+        // 第2圈起各值以256圈为周期，257圈内都相同时永不退出
+        uint64_t exit = 0;
+        for (uint64_t j = 1; j <= 257 && exit == 0; ++j)
+            if (!Same(j))
+                exit = j;
+        uint64_t room = (maxcycles - cpu.cycles) / cycles;
+        uint64_t laps = exit == 0 ? room : std::min(exit - 1, room);
+        if (laps == 0)
+            return false;
+
+        uint8_t reg[32];
+        for (int i = 0; i < 32; ++i)
+            reg[i] = Start(i, laps + 1);
+        memcpy(cpu.reg, reg, sizeof(reg));
+        cpu.psw = Psw(-1, laps + 1);
+        cpu.cycles += laps * cycles;
+        cpu.instructions += laps * instructions;
+        skipped += laps * cycles;
+        ++loops;
+        return true;
+    }
+
+    /// @brief 在循环头用Brent算法寻找寄存器与内存完全相同的两个时刻，整周期跳过
+    /// @return 是否跳过了
+    bool SkipRepeat(CPU &cpu, uint16_t head, uint64_t maxcycles)
+    {
+        uint8_t *outer = cpu.dirty;
+        memset(dirty, 0, sizeof(dirty));
+        cpu.dirty = dirty;
+        memcpy(saved.data(), cpu.ram, RAM_SIZE);
+
+        uint64_t limit = std::min(maxcycles, cpu.cycles + std::max<uint64_t>(gap / IDLE_PROBE_DIV, IDLE_PROBE_MIN));
+        uint8_t reg[32], psw = cpu.psw;
+        memcpy(reg, cpu.reg, sizeof(reg));
+        uint64_t c0 = cpu.cycles, n0 = cpu.instructions;
+        uint64_t power = 1, lam = 1;
+        bool found = false;
+        while (StepInstruction(cpu, limit))
+        {
+            if (((cpu.reg[MSR] << 8) | cpu.pc) != head)
+                continue;
+            if (cpu.psw == psw && memcmp(cpu.reg, reg, sizeof(reg)) == 0 && SameRam(cpu))
+            {
+                found = true;
+                break;
+            }
+            if (power == lam)
+            {
+                for (int p = 0; p < (RAM_SIZE >> 8); ++p)
+                    if (dirty[p])
+                        memcpy(&saved[p << 8], cpu.ram + (p << 8), 256), dirty[p] = 0;
+                memcpy(reg, cpu.reg, sizeof(reg));
+                psw = cpu.psw;
+                c0 = cpu.cycles, n0 = cpu.instructions;
+                power *= 2, lam = 0;
+            }
+            ++lam;
+        }
+
+        if (outer != NULL)
+            for (int p = 0; p < (RAM_SIZE >> 8); ++p)
+                outer[p] |= dirty[p];
+        cpu.dirty = outer;
+        if (!found)
+            return false;
+        // 每圈都写设备的循环有外部效果，不能跳过
+        if (cpu.io != NULL)
+            for (int p = 0; p < (RAM_SIZE >> 8); ++p)
+                if (dirty[p] && cpu.io->mapped[p])
+                    return false;
+
+        // 之后的执行以period个微周期为周期重复，状态不变
+        uint64_t period = cpu.cycles - c0;
+        uint64_t times = (maxcycles - cpu.cycles) / period;
+        cpu.cycles += times * period;
+        cpu.instructions += times * (cpu.instructions - n0);
+        skipped += times * period;
+        ++repeats;
+        return times != 0;
+    }
+
+    /// @brief 乌龟时刻之后写过的页是否都与当时相同
+    bool SameRam(const CPU &cpu) const
+    {
+        for (int p = 0; p < (RAM_SIZE >> 8); ++p)
+            if (dirty[p] && memcmp(&saved[p << 8], cpu.ram + (p << 8), 256) != 0)
+                return false;
+        return true;
+    }
+};
+
+#endif //_IDLE_H_
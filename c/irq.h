@@ -0,0 +1,256 @@
+/**
+ * 外部中断与定时器
+ *
+ * 中断控制器有IRQ_LINES条中断线，边沿触发，请求锁存到响应为止，同一条线上未响应时的再次请求合并并计数。
+ * 指令边界上PSW的IE为1且有未屏蔽的请求时，按线号从小到大选一条响应：硬件把INT指令送入IR，
+ * 以代码段VEC + 线号处的字节为操作数，跳过取指执行INT的微程序，与软件INT一样把PC压栈、关中断并跳转，
+ * 即VEC指向代码段中的中断向量表。停机时收到请求且IE为1则唤醒，返回地址为HLT之后的指令。
+ * 定时器与脚本化的中断请求由emulator的选项设置，程序不能改变，都是按时间排序的事件，放在最小堆中，执行引擎每次只运行到下一个事件，
+ * 不必每个微周期检查；停机等待时直接跳到下一个事件。从请求到处理程序第一条指令开始的周期数计为中断延迟。
+ * INT与IRET只保存PC，且都会改写O、Z、P，被打断的程序在比较与条件转移之间可能看到改变了的标志位
+ */
+
+#ifndef _IRQ_H_
+#define _IRQ_H_
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include "cpu.h"
+#include "asm.h"
+#include "fast.h"
+#include "idle.h"
+
+#define IRQ_LINES 8 // 中断线数
+
+/// @brief 事件类型
+enum
+{
+    EV_TIMER, // 定时器到期，arg为定时器下标
+    EV_RAISE, // 中断请求，arg为线号
+};
+
+/// @brief 一个事件，按时间排序，时间相同时按加入的顺序
+struct IrqEvent
+{
+    uint64_t time; // 微周期
+    uint64_t seq;  // 加入的顺序
+    uint8_t kind;
+    uint8_t arg;
+};
+
+/// @brief 按时间排序的事件队列，最小堆
+struct EventQueue
+{
+    std::vector<IrqEvent> heap;
+    uint64_t seq;
+
+    EventQueue() : seq(0)
+    {
+    }
+
+    static bool Later(const IrqEvent &a, const IrqEvent &b)
+    {
+        return a.time != b.time ? a.time > b.time : a.seq > b.seq;
+    }
+
+    void Push(uint64_t time, uint8_t kind, uint8_t arg)
+    {
+        heap.push_back({time, seq++, kind, arg});
+        std::push_heap(heap.begin(), heap.end(), Later);
+    }
+
+    /// @brief 取出最早的事件
+    IrqEvent Pop()
+    {
+        std::pop_heap(heap.begin(), heap.end(), Later);
+        IrqEvent ev = heap.back();
+        heap.pop_back();
+        return ev;
+    }
+
+    bool Empty() const
+    {
+        return heap.empty();
+    }
+
+    /// @brief 最早的事件的时间，没有事件时为UINT64_MAX
+    uint64_t Next() const
+    {
+        return heap.empty() ? UINT64_MAX : heap.front().time;
+    }
+};
+
+/// @brief 定时器，每隔period个微周期在line上请求一次中断
+struct Timer
+{
+    uint8_t line;
+    uint64_t period;
+    bool periodic;  // 为false时只请求一次
+    uint64_t fired; // 到期次数
+};
+
+/// @brief 中断延迟的统计
+struct IrqLatency
+{
+    uint64_t count, total, min, max;
+
+    IrqLatency() : count(0), total(0), min(UINT64_MAX), max(0)
+    {
+    }
+
+    void Add(uint64_t cycles)
+    {
+        ++count, total += cycles;
+        min = std::min(min, cycles);
+        max = std::max(max, cycles);
+    }
+};
+
+/// @brief 中断控制器
+struct IrqController
+{
+    uint8_t pending;               // 已请求未响应的线
+    uint64_t raised[IRQ_LINES];    // 各线本次请求的时间
+    uint64_t merged[IRQ_LINES];    // 未响应时再次请求而合并的次数
+    IrqLatency latency[IRQ_LINES]; // 各线的中断延迟
+
+    IrqController() : pending(0)
+    {
+        std::fill(raised, raised + IRQ_LINES, 0);
+        std::fill(merged, merged + IRQ_LINES, 0);
+    }
+
+    /// @brief 在time时请求中断
+    void Raise(int line, uint64_t time)
+    {
+        if (pending & (1 << line))
+            ++merged[line];
+        else
+            pending |= 1 << line, raised[line] = time;
+    }
+
+    /// @brief 优先级最高的请求，没有时为-1
+    int Active() const
+    {
+        return pending ? __builtin_ctz(pending) : -1;
+    }
+};
+
+/// @brief 带中断控制器与定时器的机器，执行引擎只运行到下一个事件
+struct IrqMachine
+{
+    IdleEngine &engine;
+    EventQueue events;
+    IrqController pic;
+    std::vector<Timer> timers;
+    uint8_t entry; // INT的微程序中取指之后的第一个微周期
+
+    explicit IrqMachine(IdleEngine &engine) : engine(engine), entry(0)
+    {
+    }
+
+    /// @brief 检查微程序中INT以标准取指开始
+    /// @param micro
+    /// @return
+    bool Init(const MicroCode &micro)
+    {
+        entry = FastEngine::FetchLength(micro.Row(INT, PSW_IE)) * 2;
+        return entry != 0;
+    }
+
+    /// @brief 增加一个定时器，从now开始计时，period为0时不会到期
+    /// @return 定时器下标
+    int AddTimer(int line, uint64_t period, bool periodic, uint64_t now)
+    {
+        timers.push_back({(uint8_t)line, period, periodic, 0});
+        if (period != 0)
+            events.Push(now + period, EV_TIMER, (uint8_t)(timers.size() - 1));
+        return (int)timers.size() - 1;
+    }
+
+    /// @brief 在time时请求一次中断
+    void RaiseAt(uint64_t time, int line)
+    {
+        events.Push(time, EV_RAISE, (uint8_t)line);
+    }
+
+    /// @brief 处理时间不晚于now的事件
+    void Fire(uint64_t now)
+    {
+        while (events.Next() <= now)
+        {
+            IrqEvent ev = events.Pop();
+            if (ev.kind == EV_RAISE)
+            {
+                pic.Raise(ev.arg, ev.time);
+                continue;
+            }
+            Timer &t = timers[ev.arg];
+            ++t.fired;
+            pic.Raise(t.line, ev.time);
+            if (t.periodic)
+                events.Push(ev.time + t.period, EV_TIMER, ev.arg);
+        }
+    }
+
+    /// @brief 在指令边界响应line上的请求：把INT送入IR，操作数取自中断向量表，从取指之后执行
+    void Enter(CPU &cpu, int line)
+    {
+        pic.pending &= ~(1 << line);
+        cpu.halt = false;
+        cpu.reg[IR] = INT;
+        cpu.reg[DST] = cpu.ram[(cpu.reg[CS] << 8) | (uint8_t)(cpu.reg[VEC] + line)];
+        cpu.cyc = entry;
+        while (cpu.Step() && cpu.cyc != 0)
+            ;
+        --cpu.instructions; // 送入的INT不是程序中的指令
+        pic.latency[line].Add(cpu.cycles - pic.raised[line]);
+    }
+
+    /// @brief 执行到停止或达到微周期上限，停机而IE为0或不再有事件时结束
+    /// @param cpu
+    /// @param maxcycles 微周期上限
+    /// @return 是否因PIN_HLT而停止
+    bool Run(CPU &cpu, uint64_t maxcycles)
+    {
+        while (cpu.cycles < maxcycles)
+        {
+            Fire(cpu.cycles);
+            uint64_t next = std::min(maxcycles, events.Next());
+            int line = pic.Active();
+            bool ie = cpu.psw & PSW_IE;
+
+            if (line >= 0 && (ie || !cpu.halt))
+            {
+                // 走到指令边界，IE为1时响应，否则执行到IE变为1或下一个事件
+                while (cpu.cyc != 0 && !cpu.halt && cpu.cycles < maxcycles)
+                    cpu.Step();
+                if (engine.trace != NULL)
+                    engine.trace->Record(cpu);
+                if (cpu.cycles >= maxcycles || (cpu.halt && !(cpu.psw & PSW_IE)))
+                    continue;
+                if (cpu.psw & PSW_IE)
+                {
+                    Enter(cpu, line);
+                    if (engine.trace != NULL)
+                        engine.trace->Record(cpu);
+                    continue;
+                }
+                engine.RunMasked(cpu, next);
+                continue;
+            }
+
+            if (cpu.halt && (!ie || events.Empty()))
+                break;
+            engine.waithalt = !events.Empty();
+            engine.Run(cpu, next);
+        }
+        // 轨迹以离开时的状态结束，上限停在指令中间时也记录
+        if (engine.trace != NULL)
+            engine.trace->Record(cpu);
+        return cpu.halt;
+    }
+};
+
+#endif //_IRQ_H_
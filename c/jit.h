@@ -0,0 +1,740 @@
+/**
+ * 动态二进制翻译执行引擎
+ *
+ * 把从(段, PC)开始的一段指令翻译为x86-64代码并缓存，块在转移指令处结束，
+ * 块的出口在目标块翻译后直接改写为跳转到目标块。按字节记录翻译时读取过的代码，只有写入这些字节时才检查该页的块，
+ * 作废代码被改写的块，同一页中的数据不影响翻译过的代码。
+ * 只支持x86-64 Linux，其他平台退回预译码执行引擎。
+ */
+
+#ifndef _JIT_H_
+#define _JIT_H_
+
+#include "fast.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED
+#endif
+
+#ifdef JIT_SUPPORTED
+
+#include <stddef.h>
+#include <sys/mman.h>
+#include <vector>
+#include <unordered_map>
+
+#define JIT_CODE_SIZE   (32 << 20) // 代码缓冲区大小
+#define JIT_BLOCK_MAX   32         // 每块最多翻译的指令数
+#define JIT_BLOCK_BYTES 8192       // 每块代码的上限，缓冲区剩余不足时清空所有的块
+
+#define OFF_REG(i)       (offsetof(CPU, reg) + (i))
+#define OFF_PC           offsetof(CPU, pc)
+#define OFF_PSW          offsetof(CPU, psw)
+#define OFF_CYCLES       offsetof(CPU, cycles)
+#define OFF_INSTRUCTIONS offsetof(CPU, instructions)
+
+// 生成代码返回的原因
+enum
+{
+    JIT_NEXT,   // 执行完一块，或辅助函数执行完一条指令后继续
+    JIT_HALT,   // 遇到PIN_HLT
+    JIT_WATCH,  // 写入了翻译过的代码
+    JIT_BUDGET, // 剩余微周期不足执行一块
+};
+
+/// @brief 生成代码中调用的辅助函数，执行取指之后的部分
+/// @param cpu
+/// @param f
+/// @return JIT_NEXT、JIT_HALT或JIT_WATCH
+static int JitExec(CPU *cpu, const Fused *f)
+{
+    if (FastEngine::Finish(*cpu, *f))
+        return JIT_HALT;
+    return cpu->watchhit ? JIT_WATCH : JIT_NEXT;
+}
+
+/// @brief 同JitExec，按执行时的psw选择处理函数
+/// @param cpu
+/// @param row 该指令在FastEngine::table中的16项
+/// @return
+static int JitExecRow(CPU *cpu, const Fused *row)
+{
+    return JitExec(cpu, &row[cpu->psw & 0xf]);
+}
+
+/// @brief 翻译一块时的代码生成器，生成的代码中rbx为CPU*，r13为JitEngine::Context*
+struct JitEmitter
+{
+    uint8_t *p;              // 当前写入位置
+    uint8_t *epilogue;       // 返回调度循环的代码
+    uint8_t *const *entries; // 各块的入口，下标为MSR << 8 | PC
+
+    // 尚未写回CPU的状态，在调用辅助函数与离开块之前写回
+    uint32_t cycles, instructions;
+    bool fetch;
+    uint8_t ir, dst, src, mar, len;
+    bool pcdirty;
+    uint8_t pc;
+
+    void B(uint8_t b) { *p++ = b; }
+    void D(uint32_t d) { memcpy(p, &d, 4), p += 4; }
+    void Q(uint64_t q) { memcpy(p, &q, 8), p += 8; }
+
+    /// @brief jmp/jcc的rel32
+    void Rel(const uint8_t *target) { D((uint32_t)(target - (p + 4))); }
+
+    /// @brief movzx r32, byte [rbx+off]，r为0~2即eax、ecx、edx
+    void Load(int r, uint32_t off) { B(0x0f), B(0xb6), B(0x83 | r << 3), D(off); }
+
+    /// @brief mov byte [rbx+off], r8，r为0~2即al、cl、dl
+    void Store(int r, uint32_t off) { B(0x88), B(0x83 | r << 3), D(off); }
+
+    /// @brief mov byte [rbx+off], imm8
+    void StoreImm(uint32_t off, uint8_t imm) { B(0xc6), B(0x83), D(off), B(imm); }
+
+    /// @brief add qword [rbx+off], imm32
+    void AddQ(uint32_t off, uint32_t imm) { B(0x48), B(0x81), B(0x83), D(off), D(imm); }
+
+    /// @brief 不经出口返回调度循环：xor eax, eax; mov ecx, reason; jmp epilogue
+    void Leave(int reason)
+    {
+        B(0x31), B(0xc0);
+        if (reason == JIT_NEXT)
+            B(0x31), B(0xc9);
+        else
+            B(0xb9), D(reason);
+        B(0xe9), Rel(epilogue);
+    }
+
+    /// @brief 写回计数，withpc为false时PC由之后的出口写入
+    void Sync(bool withpc)
+    {
+        if (cycles)
+            AddQ(OFF_CYCLES, cycles);
+        if (instructions)
+            AddQ(OFF_INSTRUCTIONS, instructions);
+        cycles = instructions = 0;
+        SyncFetch();
+        if (withpc && pcdirty)
+            StoreImm(OFF_PC, pc);
+        pcdirty = false;
+    }
+
+    /// @brief 写回最后一条指令取指得到的IR、DST、SRC、MAR，变长编码时只写实际取到的
+    void SyncFetch()
+    {
+        if (!fetch)
+            return;
+        StoreImm(OFF_REG(IR), ir);
+        if (len > 1)
+            StoreImm(OFF_REG(DST), dst);
+        if (len > 2)
+            StoreImm(OFF_REG(SRC), src);
+        StoreImm(OFF_REG(MAR), mar);
+        fetch = false;
+    }
+
+    /// @brief 出口：写PC后返回调度循环，调度循环可将最后的jmp改写为直接跳转到目标块
+    /// @param target 目标PC
+    /// @return 出口的地址
+    uint8_t *Exit(uint8_t target)
+    {
+        uint8_t *stub = p;
+        StoreImm(OFF_PC, target);
+        B(0x48), B(0x8d), B(0x05), D((uint32_t)(stub - (p + 4))); // lea rax, [stub]
+        B(0x31), B(0xc9);                                        // xor ecx, ecx
+        B(0xe9), Rel(epilogue);
+        return stub;
+    }
+
+    /// @brief 调用辅助函数，返回值不为JIT_NEXT时返回调度循环
+    void Call(int (*fn)(CPU *, const Fused *), const Fused *arg)
+    {
+        B(0x48), B(0x89), B(0xdf); // mov rdi, rbx
+        B(0x48), B(0xbe), Q((uint64_t)arg);
+        B(0x48), B(0xb8), Q((uint64_t)fn);
+        B(0xff), B(0xd0);          // call rax
+        B(0x85), B(0xc0);          // test eax, eax
+        B(0x74), B(9);             // jz +9
+        B(0x89), B(0xc1);          // mov ecx, eax
+        B(0x31), B(0xc0);          // xor eax, eax
+        B(0xe9), Rel(epilogue);
+    }
+
+    /// @brief 按执行时的MSR与PC跳转到已翻译的块，没有时返回调度循环
+    void Dispatch()
+    {
+        Load(0, OFF_REG(MSR));
+        B(0xc1), B(0xe0), B(8);                     // shl eax, 8
+        B(0x0a), B(0x83), D(OFF_PC);                // or al, [rbx+pc]
+        B(0x48), B(0xba), Q((uint64_t)entries);     // mov rdx, entries
+        B(0x48), B(0x8b), B(0x14), B(0xc2);         // mov rdx, [rdx+rax*8]
+        B(0x48), B(0x85), B(0xd2);                  // test rdx, rdx
+        B(0x74), B(2);                              // jz +2
+        B(0xff), B(0xe2);                           // jmp rdx
+        Leave(JIT_NEXT);
+    }
+
+    /// @brief MSR被改变时之后的指令不再位于本块所在的段，转到对应的块
+    void CheckSegment(uint8_t seg)
+    {
+        B(0x80), B(0xbb), D(OFF_REG(MSR)), B(seg); // cmp byte [rbx+MSR], seg
+        B(0x0f), B(0x85);                          // jne rel32
+        uint8_t *jne = p;
+        D(0);
+        uint8_t *next = p;
+        B(0xe9), D(0); // 跳过Dispatch()
+        uint32_t rel = (uint32_t)(p - next);
+        memcpy(jne, &rel, 4);
+        Dispatch();
+        rel = (uint32_t)(p - (next + 5));
+        memcpy(next + 1, &rel, 4);
+    }
+
+    /// @brief Context::stopie不为0时返回调度循环，用在可能把IE置为1的指令之后，此前须已写回状态
+    void StopIe()
+    {
+        B(0x41), B(0x80), B(0x7d), B(16), B(0); // cmp byte [r13+16], 0
+        B(0x74), B(9);                          // je +9
+        Leave(JIT_NEXT);
+    }
+
+    /// @brief 对al与cl运算，结果在al，与Alu()一致
+    void AluOp(uint32_t op)
+    {
+        switch (op & MASK_OP)
+        {
+        case OP_ADD:
+            B(0x00), B(0xc8); // add al, cl
+            break;
+        case OP_SUB:
+            B(0x28), B(0xc8); // sub al, cl
+            break;
+        case OP_INC:
+            B(0x04), B(0x01); // add al, 1
+            break;
+        case OP_DEC:
+            B(0x2c), B(0x01); // sub al, 1
+            break;
+        case OP_AND:
+            B(0x20), B(0xc8); // and al, cl
+            break;
+        case OP_OR:
+            B(0x08), B(0xc8); // or al, cl
+            break;
+        case OP_XOR:
+            B(0x30), B(0xc8); // xor al, cl
+            break;
+        default:
+            B(0xf6), B(0xd0); // not al
+            B(0x84), B(0xc0); // test al, al
+            break;
+        }
+    }
+
+    /// @brief 由x86的CF、ZF、PF生成程序状态字，与CPU::LatchPsw()一致
+    void LatchPsw(uint32_t w)
+    {
+        B(0x0f), B(0x92), B(0xc2); // setc dl
+        B(0x0f), B(0x94), B(0xc1); // setz cl
+        B(0x0f), B(0x9a), B(0xc5); // setp ch
+        B(0x00), B(0xc9);          // add cl, cl
+        B(0xc0), B(0xe5), B(0x02); // shl ch, 2
+        B(0x08), B(0xca);          // or dl, cl
+        B(0x08), B(0xea);          // or dl, ch
+        if (!(w & PIN_ALU_INT_W))
+        {
+            Load(1, OFF_PSW);
+            B(0x80), B(0xe1), B(PSW_IE); // and cl, PSW_IE
+            B(0x08), B(0xca);            // or dl, cl
+        }
+        else if (!(w & PIN_ALU_INT))
+        {
+            B(0x80), B(0xca), B(PSW_IE); // or dl, PSW_IE
+        }
+        Store(2, OFF_PSW);
+    }
+};
+
+/// @brief 动态二进制翻译执行引擎
+struct JitEngine
+{
+    /// @brief 生成代码与调度循环之间传递的数据
+    struct Context
+    {
+        uint8_t *stub;  // 离开时经过的出口，不经出口时为NULL
+        uint64_t limit; // 微周期上限
+        bool stopie;    // 是否在把IE置为1的指令之后返回调度循环
+    };
+
+    /// @brief 翻译得到的一块
+    struct Block
+    {
+        uint8_t *code;                // 入口
+        std::vector<uint8_t *> links; // 已改写为直接跳转到本块的出口
+        uint8_t first;                // 翻译时读取的第一个代码字节在页中的位置
+        std::vector<uint8_t> source;  // 翻译时读取的代码字节，从first开始，在页中回绕
+    };
+
+    typedef int (*Enter)(CPU *cpu, Context *ctx, uint8_t *code);
+
+    const FastEngine *fast;
+    uint8_t *buf;      // 代码缓冲区
+    uint8_t *start;    // 缓冲区中块的开始
+    uint8_t *top;      // 缓冲区中未使用部分的开始
+    uint8_t *epilogue; // 返回调度循环的代码
+    Enter enter;       // 进入生成代码的函数
+    Context ctx;
+
+    Block *blocks[0x10000];                    // 下标为MSR << 8 | PC
+    uint8_t *entries[0x10000];                 // 各块的入口，供生成代码查找
+    std::vector<uint16_t> pages[256];          // 每页中开始的块
+    std::unordered_map<uint8_t *, uint16_t> exits; // 可以直接跳转的出口及其目标
+    uint8_t watch[256];                        // 交给CPU::watch，标记翻译过代码的页
+    uint8_t translated[RAM_SIZE / 8];          // 交给CPU::watchbits，标记翻译时读取过的字节
+
+    JitEngine() : fast(NULL), buf(NULL)
+    {
+        memset(blocks, 0, sizeof(blocks));
+        memset(entries, 0, sizeof(entries));
+        memset(watch, 0, sizeof(watch));
+        memset(translated, 0, sizeof(translated));
+    }
+
+    ~JitEngine()
+    {
+        for (int i = 0; i < 0x10000; ++i)
+            delete blocks[i];
+        if (buf != NULL)
+            munmap(buf, JIT_CODE_SIZE);
+    }
+
+    /// @brief 分配代码缓冲区并生成进入与返回的代码
+    /// @param fast 已调用Build()的预译码执行引擎，翻译时使用其处理函数表
+    /// @return 是否可用，不可用时Run()使用预译码执行引擎
+    bool Init(const FastEngine &fast)
+    {
+        this->fast = &fast;
+        void *p = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return false;
+        buf = (uint8_t *)p;
+
+        JitEmitter e = {buf, NULL, NULL, 0, 0, false, 0, 0, 0, 0, 0, false, 0};
+        enter = (Enter)e.p;
+        e.B(0x53), e.B(0x55);                   // push rbx; push rbp
+        e.B(0x41), e.B(0x54);                   // push r12
+        e.B(0x41), e.B(0x55);                   // push r13
+        e.B(0x41), e.B(0x56);                   // push r14
+        e.B(0x48), e.B(0x89), e.B(0xfb);        // mov rbx, rdi
+        e.B(0x49), e.B(0x89), e.B(0xf5);        // mov r13, rsi
+        e.B(0xff), e.B(0xe2);                   // jmp rdx
+
+        epilogue = e.p;
+        e.B(0x49), e.B(0x89), e.B(0x45), e.B(0); // mov [r13+0], rax
+        e.B(0x89), e.B(0xc8);                   // mov eax, ecx
+        e.B(0x41), e.B(0x5e);                   // pop r14
+        e.B(0x41), e.B(0x5d);                   // pop r13
+        e.B(0x41), e.B(0x5c);                   // pop r12
+        e.B(0x5d), e.B(0x5b);                   // pop rbp; pop rbx
+        e.B(0xc3);                              // ret
+
+        start = top = e.p;
+        return true;
+    }
+
+    /// @brief 清空所有的块
+    void Flush()
+    {
+        for (int page = 0; page < 256; ++page)
+        {
+            for (uint16_t key : pages[page])
+                delete blocks[key], blocks[key] = NULL, entries[key] = NULL;
+            pages[page].clear();
+        }
+        exits.clear();
+        memset(watch, 0, sizeof(watch));
+        memset(translated, 0, sizeof(translated));
+        top = start;
+        ctx.stub = NULL;
+    }
+
+    /// @brief 把出口的jmp改写为跳转到target
+    /// @param stub
+    /// @param target
+    static void Link(uint8_t *stub, const uint8_t *target)
+    {
+        uint8_t *rel = stub + 17;
+        uint32_t d = (uint32_t)(target - (rel + 4));
+        memcpy(rel, &d, 4);
+    }
+
+    /// @brief 标记块在页中读取过的字节
+    void Mark(int page, const Block *b)
+    {
+        for (size_t i = 0; i < b->source.size(); ++i)
+        {
+            int addr = (page << 8) | (uint8_t)(b->first + i);
+            translated[addr >> 3] |= 1 << (addr & 7);
+        }
+    }
+
+    /// @brief 作废一页中代码字节已被改写的块，跳转到这些块的出口恢复为返回调度循环，其余的块保留，
+    /// 同一页中的数据与代码互不影响
+    /// @param cpu
+    /// @param page
+    void Invalidate(const CPU &cpu, int page)
+    {
+        std::vector<uint16_t> &keys = pages[page];
+        const uint8_t *ram = &cpu.ram[page << 8];
+        size_t kept = 0;
+        memset(&translated[page << 5], 0, 32);
+        for (uint16_t key : keys)
+        {
+            Block *b = blocks[key];
+            bool same = true;
+            for (size_t i = 0; i < b->source.size() && same; ++i)
+                same = ram[(uint8_t)(b->first + i)] == b->source[i];
+            if (same)
+            {
+                keys[kept++] = key;
+                Mark(page, b);
+                continue;
+            }
+            for (uint8_t *stub : b->links)
+                Link(stub, epilogue);
+            delete b, blocks[key] = NULL, entries[key] = NULL;
+        }
+        keys.resize(kept);
+        watch[page] = kept != 0 ? WATCH_CODE : 0;
+    }
+
+    /// @brief 判断寄存器编号是否为取指写入的寄存器
+    /// @param i
+    /// @return
+    static bool IsFetchReg(uint8_t i)
+    {
+        return i == IR || i == DST || i == SRC || i == MAR;
+    }
+
+    /// @brief 生成不访问内存的常见指令，无法直接生成时返回false
+    /// @param e
+    /// @param f
+    /// @param d DST所指向的寄存器
+    /// @param s SRC所指向的寄存器
+    /// @param imm SRC的值
+    /// @return
+    static bool EmitInline(JitEmitter &e, const Fused &f, uint8_t d, uint8_t s, uint8_t imm)
+    {
+        bool reads = f.kind == K_MOV_RR || f.kind == K_ALU_RR || f.kind == K_CMP_RR;
+        switch (f.kind)
+        {
+        case K_NOP:
+            return true;
+        case K_MOV_RI:
+        case K_MOV_RR:
+        case K_ALU_RI:
+        case K_ALU_RR:
+        case K_CMP_RI:
+        case K_CMP_RR:
+        case K_ALU_R:
+            break;
+        default:
+            return false;
+        }
+        if (!FastEngine::IsPlain(d) || (reads && !FastEngine::IsPlain(s)))
+            return false;
+        if (IsFetchReg(d) || (reads && IsFetchReg(s)))
+            e.SyncFetch();
+
+        uint32_t op = f.last & MASK_OP;
+        switch (f.kind)
+        {
+        case K_MOV_RI:
+            e.StoreImm(OFF_REG(d), imm);
+            break;
+        case K_MOV_RR:
+            e.Load(0, OFF_REG(s));
+            e.Store(0, OFF_REG(d));
+            break;
+        case K_ALU_RI:
+        case K_CMP_RI:
+            e.Load(0, OFF_REG(d));
+            e.Store(0, OFF_REG(A));
+            e.StoreImm(OFF_REG(B), imm);
+            e.B(0xb1), e.B(imm); // mov cl, imm
+            e.AluOp(op);
+            if (f.kind == K_ALU_RI)
+                e.Store(0, OFF_REG(d));
+            e.LatchPsw(f.last);
+            break;
+        case K_ALU_RR:
+        case K_CMP_RR:
+            e.Load(0, OFF_REG(d));
+            e.Store(0, OFF_REG(A));
+            e.Load(1, OFF_REG(s));
+            e.Store(1, OFF_REG(B));
+            e.AluOp(op);
+            if (f.kind == K_ALU_RR)
+                e.Store(0, OFF_REG(d));
+            e.LatchPsw(f.last);
+            break;
+        default: // K_ALU_R
+            e.Load(0, OFF_REG(d));
+            e.Store(0, OFF_REG(A));
+            if (op != OP_INC && op != OP_DEC && op != OP_NOT)
+                e.Load(1, OFF_REG(B));
+            e.AluOp(op);
+            e.Store(0, OFF_REG(d));
+            e.LatchPsw(f.last);
+            break;
+        }
+        return true;
+    }
+
+    /// @brief 翻译从(段, PC)开始的一块
+    /// @param cpu
+    /// @param key MSR << 8 | PC
+    /// @return
+    Block *Translate(const CPU &cpu, uint16_t key)
+    {
+        if (top + JIT_BLOCK_BYTES > buf + JIT_CODE_SIZE)
+            Flush();
+
+        uint8_t seg = key >> 8;
+        uint8_t pc = key & 0xff;
+        const uint8_t *ram = &cpu.ram[seg << 8];
+
+        JitEmitter e = {top, epilogue, entries, 0, 0, false, 0, 0, 0, 0, 0, false, 0};
+        Block *b = new Block;
+        b->code = e.p;
+
+        // 入口：剩余微周期不足时返回，块的最大微周期数翻译完后回填
+        e.B(0x48), e.B(0x8b), e.B(0x83), e.D(OFF_CYCLES); // mov rax, [rbx+cycles]
+        e.B(0x48), e.B(0x05);                              // add rax, imm32
+        uint8_t *budget = e.p;
+        e.D(0);
+        e.B(0x49), e.B(0x3b), e.B(0x45), e.B(8); // cmp rax, [r13+8]
+        e.B(0x76), e.B(12);                      // jbe +12
+        e.Leave(JIT_BUDGET);
+
+        uint32_t maxcycles = 0;
+        uint32_t span = 0; // 读取过的代码字节数
+        b->first = pc;
+        for (int n = 0;; ++n)
+        {
+            if (n == JIT_BLOCK_MAX)
+            {
+                e.Sync(false);
+                exits[e.Exit(pc)] = (seg << 8) | pc;
+                break;
+            }
+
+            uint8_t ir = ram[pc];
+            uint8_t dst = ram[(uint8_t)(pc + 1)];
+            uint8_t src = ram[(uint8_t)(pc + 2)];
+            span = (uint8_t)(pc - b->first) + 3;
+            const Fused *row = &fast->table[ir << 4];
+            uint8_t d = dst & 0x1f, s = src & 0x1f;
+            uint8_t len = row->fetch;
+            uint32_t taken;
+
+            // 取指，变长编码时未取的DST、SRC保留前一条指令尚未写回的值
+            if (!e.fetch || len > e.len)
+                e.len = len;
+            e.fetch = true;
+            e.ir = ir, e.mar = pc + len - 1;
+            if (len > 1)
+                e.dst = dst;
+            if (len > 2)
+                e.src = src;
+            e.pcdirty = true;
+            e.pc = pc + len;
+
+            if (FastEngine::IsUniform(row) && row->kind == K_JMP)
+            {
+                maxcycles += row->cycles;
+                e.cycles += row->cycles;
+                e.instructions += row->done;
+                e.Sync(false);
+                exits[e.Exit(dst)] = (seg << 8) | dst;
+                break;
+            }
+            if (FastEngine::IsBranch(row, taken))
+            {
+                const Fused &nt = row[__builtin_ctz(~taken)];
+                const Fused &t = row[__builtin_ctz(taken)];
+                maxcycles += t.cycles > nt.cycles ? t.cycles : nt.cycles;
+                uint32_t cycles = e.cycles, instructions = e.instructions;
+                e.SyncFetch();
+                e.Load(0, OFF_PSW);
+                e.B(0x83), e.B(0xe0), e.B(0x0f); // and eax, 15
+                e.B(0xb9), e.D(taken);           // mov ecx, taken
+                e.B(0x0f), e.B(0xa3), e.B(0xc1); // bt ecx, eax
+                e.B(0x0f), e.B(0x82);            // jc rel32
+                uint8_t *jc = e.p;
+                e.D(0);
+
+                e.cycles = cycles + nt.cycles, e.instructions = instructions + nt.done;
+                e.Sync(false);
+                exits[e.Exit(pc + len)] = (seg << 8) | (uint8_t)(pc + len);
+
+                uint32_t rel = (uint32_t)(e.p - (jc + 4));
+                memcpy(jc, &rel, 4);
+                e.cycles = cycles + t.cycles, e.instructions = instructions + t.done;
+                e.Sync(false);
+                exits[e.Exit(dst)] = (seg << 8) | dst;
+                break;
+            }
+            if (FastEngine::IsUniform(row) && !fast->setie[ir] && EmitInline(e, *row, d, s, src))
+            {
+                maxcycles += row->cycles;
+                e.cycles += row->cycles;
+                e.instructions += row->done;
+                pc += len;
+                if (d == MSR && row->kind != K_NOP && row->kind != K_CMP_RI && row->kind != K_CMP_RR)
+                {
+                    e.Sync(true);
+                    e.CheckSegment(seg);
+                }
+                continue;
+            }
+
+            // 其余指令调用辅助函数执行
+            bool uniform = FastEngine::IsUniform(row);
+            e.Sync(true);
+            if (uniform)
+                e.Call(JitExec, row);
+            else
+                e.Call(JitExecRow, row);
+            maxcycles += uniform && row->kind != K_GENERIC ? row->cycles : 16;
+            pc += len;
+            if (fast->setie[ir])
+                e.StopIe();
+
+            // 可能改变PC的指令结束本块
+            switch (uniform ? row->kind : K_GENERIC)
+            {
+            case K_GENERIC:
+            case K_HLT:
+            case K_CALL:
+            case K_RET:
+            case K_IRET:
+            case K_INT:
+                e.Dispatch();
+                break;
+            default:
+                e.CheckSegment(seg);
+                continue;
+            }
+            break;
+        }
+
+        // 停止指令还需一个周期检测PIN_HLT，与FastEngine::Run一致
+        maxcycles += 1;
+        memcpy(budget, &maxcycles, 4);
+
+        top = e.p;
+        for (uint32_t i = 0; i < span && i < 256; ++i)
+            b->source.push_back(ram[(uint8_t)(b->first + i)]);
+        blocks[key] = b;
+        entries[key] = b->code;
+        pages[seg].push_back(key);
+        Mark(seg, b);
+        watch[seg] = WATCH_CODE;
+        return b;
+    }
+
+    /// @brief 执行到停止或达到微周期上限，结果与CPU::Run一致，之后cpu.watch与cpu.watchbits指向本引擎
+    /// @param cpu
+    /// @param maxcycles 微周期上限
+    /// @param stopie 同FastEngine::Run
+    /// @return 是否因PIN_HLT而停止
+    bool Run(CPU &cpu, uint64_t maxcycles, bool stopie = false)
+    {
+        if (buf == NULL || !fast->fetchok)
+            return fast->Run(cpu, maxcycles, stopie);
+
+        while (cpu.cyc != 0)
+        {
+            if (cpu.cycles >= maxcycles)
+                return false;
+            if (!cpu.Step())
+                return true;
+        }
+
+        cpu.watch = watch;
+        cpu.watchbits = translated;
+        ctx.stub = NULL;
+        ctx.limit = maxcycles;
+        ctx.stopie = stopie;
+
+        while (1)
+        {
+            // 作废被写入的代码，包括由其他执行引擎写入的
+            if (cpu.watchhit)
+            {
+                for (int page = 0; page < 256; ++page)
+                    if (watch[page] == WATCH_HIT)
+                        Invalidate(cpu, page);
+                cpu.watchhit = false;
+                ctx.stub = NULL;
+            }
+
+            uint16_t key = (cpu.reg[MSR] << 8) | cpu.pc;
+            Block *b = blocks[key];
+            if (b == NULL)
+                b = Translate(cpu, key);
+
+            // 上一块从可直接跳转的出口离开时，改写该出口
+            if (ctx.stub != NULL)
+            {
+                auto it = exits.find(ctx.stub);
+                if (it != exits.end() && it->second == key)
+                {
+                    Link(ctx.stub, b->code);
+                    b->links.push_back(ctx.stub);
+                }
+            }
+
+            switch (enter(&cpu, &ctx, b->code))
+            {
+            case JIT_HALT:
+                return true;
+            case JIT_BUDGET:
+                return fast->Run(cpu, maxcycles, stopie);
+            default:
+                break;
+            }
+            if (stopie && (cpu.psw & PSW_IE))
+                return false;
+        }
+    }
+};
+
+#else
+
+/// @brief 不支持的平台上使用预译码执行引擎
+struct JitEngine
+{
+    const FastEngine *fast;
+
+    bool Init(const FastEngine &fast)
+    {
+        this->fast = &fast;
+        return false;
+    }
+
+    void Flush()
+    {
+    }
+
+    bool Run(CPU &cpu, uint64_t maxcycles, bool stopie = false)
+    {
+        return fast->Run(cpu, maxcycles, stopie);
+    }
+};
+
+#endif //JIT_SUPPORTED
+
+#endif //_JIT_H_
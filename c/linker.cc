@@ -0,0 +1,146 @@
+/**
+ * 链接器
+ *
+ * 按命令行顺序拼接compiler -c生成的目标文件，收集各文件定义的标签，
+ * 填写转移指令的目标后输出程序。修改一个源文件时只需重新汇编该文件再链接
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include "object.h"
+
+/// @brief 打印用法
+static void PrintUsage()
+{
+    std::cout << "linker [-o outfile] [-l mapfile] objfile..." << std::endl
+              << std::endl
+              << "  objfile: object files from compiler -c, placed in the given order" << std::endl
+              << "  -o file: output file path, default a.bin" << std::endl
+              << "  -l file: write label map for the profiler, one \"addr 0 L name\" per line" << std::endl
+              << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string outfile = "a.bin";
+    std::string mapfile;
+    std::vector<std::string> objfiles;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc)
+            outfile = argv[++i];
+        else if (arg == "-l" && i + 1 < argc)
+            mapfile = argv[++i];
+        else if (arg[0] != '-')
+            objfiles.push_back(arg);
+        else
+        {
+            PrintUsage();
+            return 0;
+        }
+    }
+    if (objfiles.empty())
+    {
+        PrintUsage();
+        return 0;
+    }
+
+    // 读入所有目标文件并确定各自的位置
+    std::vector<ObjectFile> objs(objfiles.size());
+    std::vector<size_t> base(objfiles.size());
+    size_t size = 0;
+    for (size_t i = 0; i < objfiles.size(); ++i)
+    {
+        if (!objs[i].Read(objfiles[i]))
+        {
+            std::cout << "error: " << objfiles[i] << " is not a valid object file" << std::endl;
+            return 0;
+        }
+        if (objs[i].varlen != objs[0].varlen)
+        {
+            std::cout << "error: " << objfiles[i] << " and " << objfiles[0] << " use different encodings" << std::endl;
+            return 0;
+        }
+        base[i] = size;
+        size += objs[i].code.size();
+    }
+
+    // 符号表，标签 -> (地址, 所在文件)
+    std::unordered_map<std::string, std::pair<size_t, size_t>> symbols;
+    for (size_t i = 0; i < objs.size(); ++i)
+    {
+        for (const ObjSymbol &sym : objs[i].symbols)
+        {
+            auto res = symbols.emplace(sym.name, std::make_pair(base[i] + sym.offset, i));
+            if (!res.second)
+            {
+                std::cout << "error: label \"" << sym.name << "\" defined in both "
+                          << objfiles[res.first->second.second] << " and " << objfiles[i] << std::endl;
+                return 0;
+            }
+        }
+    }
+
+    // 拼接并重定位
+    std::vector<uint8_t> image;
+    image.reserve(size);
+    int cnterr = 0;
+    for (size_t i = 0; i < objs.size(); ++i)
+    {
+        image.insert(image.end(), objs[i].code.begin(), objs[i].code.end());
+        for (const ObjSymbol &rel : objs[i].relocs)
+        {
+            auto it = symbols.find(rel.name);
+            if (it == symbols.end())
+            {
+                std::cout << "error: undefined label \"" << rel.name << "\" referenced in " << objfiles[i] << std::endl;
+                ++cnterr;
+                continue;
+            }
+            image[base[i] + rel.offset + 1] = (uint8_t)it->second.first;
+        }
+    }
+    if (cnterr)
+    {
+        std::cout << "link error: " << cnterr << " undefined reference(s)" << std::endl;
+        return 0;
+    }
+
+    std::ofstream out(outfile, std::ios::out | std::ios::binary);
+    if (!out.is_open())
+    {
+        std::cout << "error: unable to open output file" << std::endl;
+        return 0;
+    }
+    out.write((const char *)image.data(), image.size());
+    out.close();
+
+    if (!mapfile.empty())
+    {
+        std::ofstream map(mapfile, std::ios::out);
+        if (!map.is_open())
+        {
+            std::cout << "error: unable to open map file" << std::endl;
+            return 0;
+        }
+        std::vector<std::pair<size_t, std::string>> labels;
+        for (const auto &item : symbols)
+            labels.emplace_back(item.second.first, item.first);
+        std::sort(labels.begin(), labels.end());
+        char addr[8];
+        for (const auto &item : labels)
+        {
+            snprintf(addr, sizeof(addr), "%04zx", item.first);
+            map << addr << " 0 L " << item.second << std::endl;
+        }
+    }
+
+    std::cout << "done" << std::endl;
+    return 0;
+}
@@ -0,0 +1,522 @@
+/**
+ * 微程序：指令到控制字的对应关系
+ *
+ * controller.c用它生成micro.bin，C++中各函数为constexpr，可在编译期生成整张表
+ */
+
+#ifndef _MICRO_H_
+#define _MICRO_H_
+
+#include <stdint.h>
+#include "asm.h"
+#include "pin.h"
+
+#ifdef __cplusplus
+#define MICRO_CONST constexpr
+#define MICRO_FUNC  constexpr
+#else
+#define MICRO_CONST static const
+#define MICRO_FUNC  static inline
+#endif
+
+#define MICRO_FETCH_CYCLES 6  // 取指的微周期数
+#define MICRO_STEPS        16 // 每条指令的微周期数
+
+// 取指
+MICRO_CONST uint32_t MICRO_FETCH[MICRO_FETCH_CYCLES] = {
+    PC_OUT | MAR_IN,
+    RAM_OUT | IR_IN | PC_INC,
+
+    PC_OUT | MAR_IN,
+    RAM_OUT | DST_IN | PC_INC,
+
+    PC_OUT | MAR_IN,
+    RAM_OUT | SRC_IN | PC_INC,
+};
+
+/// @brief 根据指令和状态字写微指令
+/// @param buf 写微指令的位置
+/// @param ir 指令
+/// @param psw 程序状态字
+/// @return
+MICRO_FUNC int MicroWrite(uint32_t *buf, uint8_t ir, uint8_t psw)
+{
+    uint8_t op = 0;
+    uint8_t amd = 0; // 目标地址寻址方式
+    uint8_t ams = 0; // 源地址寻址方式
+
+    int isok = 1;
+
+    if (ir & ADDR2)
+    {
+        // 二地址指令
+        op = ir & 0xf0;
+        amd = ((ir >> 2) & 0x3);
+        ams = (ir & 0x3);
+
+        switch (op)
+        {
+        case MOV:
+        {
+            // MOV指令
+            if (amd == AM_REG && ams == AM_INS) // e.g MOV A, 1
+            {
+                *buf = PIN_DST_W | SRC_OUT | PIN_CYC;
+            }
+            else if (amd == AM_REG && ams == AM_REG) // e.g MOV A, B
+            {
+                *buf = PIN_DST_W | PIN_SRC_R | PIN_CYC;
+            }
+            else if (amd == AM_REG && ams == AM_DIR) // e.g MOV A, [5]
+            {
+                *buf = MAR_IN | SRC_OUT;
+                *++buf = PIN_DST_W | RAM_OUT | PIN_CYC;
+            }
+            else if (amd == AM_REG && ams == AM_RAM) // e.g MOV A, [B]
+            {
+                *buf = MAR_IN | PIN_SRC_R;
+                *++buf = PIN_DST_W | RAM_OUT | PIN_CYC;
+            }
+            else if (amd == AM_DIR && ams == AM_INS) // e.g MOV [5], 1
+            {
+                *buf = MAR_IN | DST_OUT;
+                *++buf = RAM_IN | SRC_OUT | PIN_CYC;
+            }
+            else if (amd == AM_DIR && ams == AM_REG) // e.g MOV [5], A
+            {
+                *buf = MAR_IN | DST_OUT;
+                *++buf = RAM_IN | PIN_SRC_R | PIN_CYC;
+            }
+            else if (amd == AM_RAM && ams == AM_INS) // e.g MOV [A], 1
+            {
+                *buf = MAR_IN | PIN_DST_R;
+                *++buf = RAM_IN | SRC_OUT | PIN_CYC;
+            }
+            else if (amd == AM_RAM && ams == AM_REG) // e.g MOV [A], B
+            {
+                *buf = MAR_IN | PIN_DST_R;
+                *++buf = RAM_IN | PIN_SRC_R | PIN_CYC;
+            }
+            else
+            {
+                isok = 0;
+            }
+        }
+        break;
+
+        case ADD:
+        {
+            // ADD指令
+            if (amd == AM_REG && ams == AM_INS) // e.g ADD A, 1
+            {
+                *buf = A_IN | PIN_DST_R;
+                *++buf = B_IN | SRC_OUT;
+                *++buf = PIN_DST_W | OP_ADD | PIN_ALU_OUT | PIN_ALU_PSW | PIN_CYC;
+            }
+            else if (amd == AM_REG && ams == AM_REG) // e.g ADD A, B
+            {
+                *buf = A_IN | PIN_DST_R;
+                *++buf = B_IN | PIN_SRC_R;
+                *++buf = PIN_DST_W | OP_ADD | PIN_ALU_OUT | PIN_ALU_PSW | PIN_CYC;
+            }
+            else
+            {
+                isok = 0;
+            }
+        }
+        break;
+
+        case SUB:
+        {
+            // SUB指令
+            if (amd == AM_REG && ams == AM_INS) // e.g SUB A, 1
+            {
+                *buf = A_IN | PIN_DST_R;
+                *++buf = B_IN | SRC_OUT;
+                *++buf = PIN_DST_W | OP_SUB | PIN_ALU_OUT | PIN_ALU_PSW | PIN_CYC;
+            }
+            else if (amd == AM_REG && ams == AM_REG) // e.g SUB A, B
+            {
+                *buf = A_IN | PIN_DST_R;
+                *++buf = B_IN | PIN_SRC_R;
+                *++buf = PIN_DST_W | OP_SUB | PIN_ALU_OUT | PIN_ALU_PSW | PIN_CYC;
+            }
+            else
+            {
+                isok = 0;
+            }
+        }
+        break;
+
+        case AND:
+        {
+            // AND指令
+            if (amd == AM_REG && ams == AM_INS) // e.g AND A, 1
+            {
+                *buf = A_IN | PIN_DST_R;
+                *++buf = B_IN | SRC_OUT;
+                *++buf = PIN_DST_W | OP_AND | PIN_ALU_OUT | PIN_ALU_PSW | PIN_CYC;
+            }
+            else if (amd == AM_REG && ams == AM_REG) // e.g AND A, B
+            {
+                *buf = A_IN | PIN_DST_R;
+                *++buf = B_IN | PIN_SRC_R;
+                *++buf = PIN_DST_W | OP_AND | PIN_ALU_OUT | PIN_ALU_PSW | PIN_CYC;
+            }
+            else
+            {
+                isok = 0;
+            }
+        }
+        break;
+
+        case OR:
+        {
+            // OR指令
+            if (amd == AM_REG && ams == AM_INS) // e.g OR A, 1
+            {
+                *buf = A_IN | PIN_DST_R;
+                *++buf = B_IN | SRC_OUT;
+                *++buf = PIN_DST_W | OP_OR | PIN_ALU_OUT | PIN_ALU_PSW | PIN_CYC;
+            }
+            else if (amd == AM_REG && ams == AM_REG) // e.g OR A, B
+            {
+                *buf = A_IN | PIN_DST_R;
+                *++buf = B_IN | PIN_SRC_R;
+                *++buf = PIN_DST_W | OP_OR | PIN_ALU_OUT | PIN_ALU_PSW | PIN_CYC;
+            }
+            else
+            {
+                isok = 0;
+            }
+        }
+        break;
+
+        case XOR:
+        {
+            // XOR指令
+            if (amd == AM_REG && ams == AM_INS) // e.g XOR A, 1
+            {
+                *buf = A_IN | PIN_DST_R;
+                *++buf = B_IN | SRC_OUT;
+                *++buf = PIN_DST_W | OP_XOR | PIN_ALU_OUT | PIN_ALU_PSW | PIN_CYC;
+            }
+            else if (amd == AM_REG && ams == AM_REG) // e.g XOR A, B
+            {
+                *buf = A_IN | PIN_DST_R;
+                *++buf = B_IN | PIN_SRC_R;
+                *++buf = PIN_DST_W | OP_XOR | PIN_ALU_OUT | PIN_ALU_PSW | PIN_CYC;
+            }
+            else
+            {
+                isok = 0;
+            }
+        }
+        break;
+
+        case CMP:
+        {
+            // CMP指令
+            if (amd == AM_REG && ams == AM_INS) // e.g CMP A, 1
+            {
+                *buf = A_IN | PIN_DST_R;
+                *++buf = B_IN | SRC_OUT;
+                *++buf = OP_SUB | PIN_ALU_PSW | PIN_CYC;
+            }
+            else if (amd == AM_REG && ams == AM_REG) // e.g CMP A, B
+            {
+                *buf = A_IN | PIN_DST_R;
+                *++buf = B_IN | PIN_SRC_R;
+                *++buf = OP_SUB | PIN_ALU_PSW | PIN_CYC;
+            }
+            else
+            {
+                isok = 0;
+            }
+        }
+        break;
+
+        default:
+            isok = 0;
+            break;
+        }
+    }
+    else if (ir & ADDR1)
+    {
+        // 一地址指令
+        op = ir & 0xfc;
+        amd = (ir & 0x3);
+
+        switch (op)
+        {
+        case INC:
+        {
+            // INC指令
+            if (amd == AM_REG)
+            {
+                *buf = A_IN | PIN_DST_R;
+                *++buf = PIN_DST_W | OP_INC | PIN_ALU_OUT | PIN_ALU_PSW | PIN_CYC;
+            }
+            else
+            {
+                isok = 0;
+            }
+        }
+        break;
+
+        case DEC:
+        {
+            // DEC指令
+            if (amd == AM_REG)
+            {
+                *buf = A_IN | PIN_DST_R;
+                *++buf = PIN_DST_W | OP_DEC | PIN_ALU_OUT | PIN_ALU_PSW | PIN_CYC;
+            }
+            else
+            {
+                isok = 0;
+            }
+        }
+        break;
+
+        case NOT:
+        {
+            // NOT指令
+            if (amd == AM_REG)
+            {
+                *buf = A_IN | PIN_DST_R;
+                *++buf = PIN_DST_W | OP_NOT | PIN_ALU_OUT | PIN_ALU_PSW | PIN_CYC;
+            }
+            else
+            {
+                isok = 0;
+            }
+        }
+        break;
+
+        case JMP:
+        case JO:
+        case JZ:
+        case JP:
+        case JNO:
+        case JNZ:
+        case JNP:
+        {
+            // 转移指令
+            int overflow = psw & 1;
+            int zero = psw & 2;
+            int parity = psw & 4;
+            int jump = op == JMP                   // 无条件跳转
+                       || (op == JO && overflow)   // 溢出跳转
+                       || (op == JZ && zero)       // 零跳转
+                       || (op == JP && parity)     // 奇跳转
+                       || (op == JNO && !overflow) // 非溢出跳转
+                       || (op == JNZ && !zero)     // 非零跳转
+                       || (op == JNP && !parity);  // 偶跳转
+            if (amd == AM_INS)
+                *buf = jump ? (PC_IN | DST_OUT | PIN_CYC)
+                            : (PIN_CYC);
+            else
+                isok = 0;
+        }
+        break;
+
+        case PUSH:
+        {
+            // PUSH指令
+            if (amd == AM_INS)
+            {
+                *buf = A_IN | SP_OUT;
+                *++buf = SP_IN | OP_DEC | PIN_ALU_OUT;
+                *++buf = MAR_IN | SP_OUT;
+                *++buf = MSR_IN | SS_OUT;
+                *++buf = RAM_IN | DST_OUT;
+                *++buf = MSR_IN | CS_OUT | PIN_CYC;
+            }
+            else if (amd == AM_REG)
+            {
+                *buf = A_IN | SP_OUT;
+                *++buf = SP_IN | OP_DEC | PIN_ALU_OUT;
+                *++buf = MAR_IN | SP_OUT;
+                *++buf = MSR_IN | SS_OUT;
+                *++buf = RAM_IN | PIN_DST_R;
+                *++buf = MSR_IN | CS_OUT | PIN_CYC;
+            }
+            else
+            {
+                isok = 0;
+            }
+        }
+        break;
+
+        case POP:
+        {
+            // POP指令
+            if (amd == AM_REG)
+            {
+                *buf = MAR_IN | SP_OUT;
+                *++buf = MSR_IN | SS_OUT;
+                *++buf = PIN_DST_W | RAM_OUT;
+                *++buf = A_IN | SP_OUT;
+                *++buf = SP_IN | OP_INC | PIN_ALU_OUT;
+                *++buf = MSR_IN | CS_OUT | PIN_CYC;
+            }
+            else
+            {
+                isok = 0;
+            }
+        }
+        break;
+
+        case CALL:
+        {
+            // CALL指令
+            if (amd == AM_INS)
+            {
+                // push pc
+                *buf = A_IN | SP_OUT;
+                *++buf = SP_IN | OP_DEC | PIN_ALU_OUT;
+                *++buf = MAR_IN | SP_OUT;
+                *++buf = MSR_IN | SS_OUT;
+                *++buf = RAM_IN | PC_OUT;
+                *++buf = MSR_IN | CS_OUT;
+                // mov pc, dst
+                *++buf = PC_IN | DST_OUT | PIN_CYC;
+            }
+            else
+            {
+                isok = 0;
+            }
+        }
+        break;
+
+        case INT:
+        {
+            // INT指令
+            int interrupt = psw & 8;
+            if (amd == AM_INS)
+            {
+                if (interrupt)
+                {
+                    *buf = A_IN | SP_OUT;
+                    *++buf = SP_IN | OP_DEC | PIN_ALU_OUT;
+                    *++buf = MAR_IN | SP_OUT;
+                    *++buf = MSR_IN | SS_OUT;
+                    *++buf = RAM_IN | PC_OUT;
+                    *++buf = MSR_IN | CS_OUT;
+                    *++buf = PC_IN | DST_OUT | PIN_ALU_PSW | ALU_CLI | PIN_CYC;
+                }
+                else
+                    *buf = PIN_CYC;
+            }
+            else
+            {
+                isok = 0;
+            }
+        }
+        break;
+
+        default:
+            isok = 0;
+            break;
+        }
+    }
+    else
+    {
+        // 零地址指令
+        op = ir;
+
+        switch (op)
+        {
+        case NOP:
+            *buf = PIN_CYC;
+            break;
+
+        case RET:
+        {
+            // pop pc
+            *buf = MAR_IN | SP_OUT;
+            *++buf = MSR_IN | SS_OUT;
+            *++buf = PC_IN | RAM_OUT;
+            *++buf = A_IN | SP_OUT;
+            *++buf = SP_IN | OP_INC | PIN_ALU_OUT;
+            *++buf = MSR_IN | CS_OUT | PIN_CYC;
+        }
+        break;
+
+        case IRET:
+        {
+            *buf = MAR_IN | SP_OUT;
+            *++buf = MSR_IN | SS_OUT;
+            *++buf = PC_IN | RAM_OUT;
+            *++buf = A_IN | SP_OUT;
+            *++buf = SP_IN | OP_INC | PIN_ALU_OUT;
+            *++buf = MSR_IN | CS_OUT | PIN_ALU_PSW | ALU_STI | PIN_CYC;
+        }
+        break;
+
+        case STI:
+            *buf = PIN_ALU_PSW | ALU_STI | PIN_CYC;
+            break;
+
+        case CLI:
+            *buf = PIN_ALU_PSW | ALU_CLI | PIN_CYC;
+            break;
+
+        case HLT:
+            *buf = PIN_HLT;
+            break;
+
+        default:
+            isok = 0;
+            break;
+        }
+    }
+
+    if (!isok)
+        *buf = PIN_HLT; // 未定义指令直接HLT
+    return isok;
+}
+
+/// @brief 指令的字节数
+/// @param ir 指令
+/// @param varlen 是否使用变长编码：零地址指令1字节，一地址指令2字节，二地址指令3字节，否则均为3字节
+/// @return
+MICRO_FUNC int MicroLength(uint8_t ir, int varlen)
+{
+    if (!varlen || (ir & ADDR2))
+        return 3;
+    return (ir & ADDR1) ? 2 : 1;
+}
+
+/// @brief 生成一个(ir, psw)对应的一行控制字，即取指和执行阶段。
+/// 变长编码时只取指令实际占用的字节，前两个微周期取IR，与指令无关
+/// @param row MICRO_STEPS个控制字，未用到的为0
+/// @param ir 指令
+/// @param psw 程序状态字
+/// @param varlen 是否使用变长编码
+/// @return 是否为已定义的指令
+MICRO_FUNC int MicroRow(uint32_t *row, uint8_t ir, uint8_t psw, int varlen)
+{
+    int fetch = MicroLength(ir, varlen) * 2;
+    int cyc = 0;
+    for (cyc = 0; cyc < MICRO_STEPS; ++cyc)
+        row[cyc] = 0;
+    for (cyc = 0; cyc < fetch; ++cyc)
+        row[cyc] = MICRO_FETCH[cyc];
+    return MicroWrite(row + fetch, ir, psw);
+}
+
+/// @brief 判断一行控制字是否在MICRO_STEPS个微周期内以PIN_CYC或PIN_HLT结束
+/// @param row
+/// @return
+MICRO_FUNC int MicroRowEnds(const uint32_t *row)
+{
+    int cyc = 0;
+    for (cyc = 0; cyc < MICRO_STEPS; ++cyc)
+        if (row[cyc] & (PIN_CYC | PIN_HLT))
+            return 1;
+    return 0;
+}
+
+#endif //_MICRO_H_
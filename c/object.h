@@ -0,0 +1,146 @@
+/**
+ * 可重定位目标文件
+ *
+ * compiler -c 将每个源文件单独汇编为目标文件，linker按命令行顺序拼接并填写转移指令的目标。
+ * 标签都是全局的，转移指令（JMP、Jcc、CALL、INT）的标签操作数记为重定位项，
+ * 包括本文件内定义的标签，因为链接后整个文件的位置会改变。文件布局，小端：
+ *
+ *   char     magic[4];          OBJ_MAGIC
+ *   uint8_t  varlen;            是否为变长编码
+ *   uint8_t  optimized;         是否经过compiler -O优化
+ *   uint8_t  reserved[2];
+ *   uint32_t size;              代码字节数
+ *   uint32_t nsymbols;          符号数
+ *   uint32_t nrelocs;           重定位项数
+ *   uint8_t  code[size];        代码，待重定位的指令目标为0
+ *   symbols[nsymbols]:          uint32_t offset; uint16_t len; char name[len];
+ *   relocs[nrelocs]:            uint32_t offset; uint16_t len; char name[len];
+ *
+ * 重定位项的offset为指令第一个字节的位置，链接时将其后一个字节改为符号地址的低8位
+ */
+
+#ifndef _OBJECT_H_
+#define _OBJECT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#define OBJ_MAGIC "MOBJ" // 文件标识
+
+/// @brief 符号或重定位项
+struct ObjSymbol
+{
+    uint32_t offset;  // 符号为标签在本文件中的位置，重定位项为指令的位置
+    std::string name; // 大写的标签名
+};
+
+/// @brief 目标文件
+struct ObjectFile
+{
+    bool varlen;                    // 是否为变长编码
+    bool optimized;                 // 是否经过优化
+    std::vector<uint8_t> code;      // 代码
+    std::vector<ObjSymbol> symbols; // 本文件定义的标签，按名字排序
+    std::vector<ObjSymbol> relocs;  // 需要填写目标的转移指令，按位置排序
+
+    ObjectFile() : varlen(false), optimized(false)
+    {
+    }
+
+    /// @brief 写一个字符串表
+    static bool WriteTable(FILE *pf, const std::vector<ObjSymbol> &table)
+    {
+        for (const ObjSymbol &item : table)
+        {
+            uint16_t len = (uint16_t)item.name.size();
+            if (fwrite(&item.offset, sizeof(item.offset), 1, pf) != 1 ||
+                fwrite(&len, sizeof(len), 1, pf) != 1 ||
+                fwrite(item.name.data(), 1, len, pf) != len)
+                return false;
+        }
+        return true;
+    }
+
+    /// @brief 读一个字符串表
+    static bool ReadTable(FILE *pf, std::vector<ObjSymbol> &table, uint32_t count)
+    {
+        table.resize(count);
+        for (ObjSymbol &item : table)
+        {
+            uint16_t len;
+            if (fread(&item.offset, sizeof(item.offset), 1, pf) != 1 ||
+                fread(&len, sizeof(len), 1, pf) != 1)
+                return false;
+            item.name.resize(len);
+            if (len != 0 && fread(&item.name[0], 1, len, pf) != len)
+                return false;
+        }
+        return true;
+    }
+
+    /// @brief 写目标文件，符号先按名字排序，使快速路径与Compile()的输出相同
+    /// @param path
+    /// @return
+    bool Write(const std::string &path)
+    {
+        std::sort(symbols.begin(), symbols.end(),
+                  [](const ObjSymbol &a, const ObjSymbol &b) { return a.name < b.name; });
+        for (const ObjSymbol &item : symbols)
+            if (item.name.size() > 0xffff)
+                return false;
+        for (const ObjSymbol &item : relocs)
+            if (item.name.size() > 0xffff)
+                return false;
+
+        FILE *pf = fopen(path.c_str(), "wb");
+        if (pf == NULL)
+            return false;
+        uint8_t head[4] = {(uint8_t)varlen, (uint8_t)optimized, 0, 0};
+        uint32_t counts[3] = {(uint32_t)code.size(), (uint32_t)symbols.size(), (uint32_t)relocs.size()};
+        bool ok = fwrite(OBJ_MAGIC, 4, 1, pf) == 1;
+        ok = ok && fwrite(head, sizeof(head), 1, pf) == 1;
+        ok = ok && fwrite(counts, sizeof(counts), 1, pf) == 1;
+        ok = ok && (code.empty() || fwrite(code.data(), 1, code.size(), pf) == code.size());
+        ok = ok && WriteTable(pf, symbols) && WriteTable(pf, relocs);
+        ok = fclose(pf) == 0 && ok;
+        return ok;
+    }
+
+    /// @brief 读目标文件
+    /// @param path
+    /// @return 文件不存在、不是目标文件或已损坏时返回false
+    bool Read(const std::string &path)
+    {
+        FILE *pf = fopen(path.c_str(), "rb");
+        if (pf == NULL)
+            return false;
+        char magic[4];
+        uint8_t head[4];
+        uint32_t counts[3];
+        bool ok = fread(magic, 4, 1, pf) == 1 && memcmp(magic, OBJ_MAGIC, 4) == 0;
+        ok = ok && fread(head, sizeof(head), 1, pf) == 1;
+        ok = ok && fread(counts, sizeof(counts), 1, pf) == 1;
+        if (ok)
+        {
+            varlen = head[0] != 0;
+            optimized = head[1] != 0;
+            code.resize(counts[0]);
+            ok = code.empty() || fread(code.data(), 1, code.size(), pf) == code.size();
+            ok = ok && ReadTable(pf, symbols, counts[1]) && ReadTable(pf, relocs, counts[2]);
+        }
+        fclose(pf);
+
+        // 重定位项必须指向代码内的完整指令
+        for (const ObjSymbol &item : relocs)
+            ok = ok && (uint64_t)item.offset + 2 <= code.size();
+        for (const ObjSymbol &item : symbols)
+            ok = ok && item.offset <= code.size();
+        return ok;
+    }
+};
+
+#endif //_OBJECT_H_
@@ -0,0 +1,320 @@
+/**
+ * 源码级性能分析
+ *
+ * 逐条指令执行，统计每个地址的指令数、微周期数以及其中取指的微周期数，
+ * 借助汇编器输出的行号表（compiler -l）汇总到源码行和标签。
+ * 按CALL、INT与RET、IRET维护调用栈，可输出火焰图使用的折叠栈格式
+ */
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include "fast.h"
+
+#define PROFILE_MAX_DEPTH 256 // 调用栈的最大深度，更深的调用不再展开
+
+/// @brief 行号表中的一行
+struct LineInfo
+{
+    uint16_t addr;    // 地址
+    size_t lineno;    // 源文件行号
+    bool label;       // 是否为标签
+    std::string text; // 指令内容或标签名
+};
+
+/// @brief 性能分析器
+struct Profiler
+{
+    std::vector<LineInfo> lines; // 行号表
+    std::vector<int> lineof;     // 每个地址上指令在lines中的下标，-1表示没有
+    std::vector<int> labelof;    // 每个地址所属标签，即之前最近的标签在lines中的下标，-1表示没有
+
+    std::vector<uint64_t> count;  // 每个地址执行的指令数
+    std::vector<uint64_t> cycles; // 每个地址消耗的微周期数，含取指
+    std::vector<uint64_t> fetch;  // 每个地址取指消耗的微周期数
+
+    /// @brief 调用树的节点
+    struct Frame
+    {
+        int parent;    // 父节点，根节点为-1
+        int label;     // 被调用地址所属的标签
+        uint16_t addr; // 被调用地址
+    };
+    std::vector<Frame> frames;
+    std::map<std::pair<int, uint16_t>, int> children; // (父节点, 被调用地址) -> 节点
+    std::vector<int> stack;                           // 当前调用栈，元素为节点
+    int overflow;                                     // 超过最大深度而未展开的调用数
+    std::unordered_map<uint64_t, uint64_t> folded;    // 节点 << 16 | 地址 -> 微周期数
+
+    Profiler() : lineof(0x10000, -1), labelof(0x10000, -1), count(0x10000), cycles(0x10000), fetch(0x10000), overflow(0)
+    {
+    }
+
+    /// @brief 读取汇编器生成的行号表
+    /// @param path
+    /// @return
+    bool LoadMap(const std::string &path)
+    {
+        std::ifstream in(path);
+        if (!in.is_open())
+            return false;
+
+        std::string line;
+        while (std::getline(in, line))
+        {
+            std::istringstream ss(line);
+            LineInfo info;
+            std::string addr, kind;
+            if (!(ss >> addr >> info.lineno >> kind))
+                continue;
+            info.addr = (uint16_t)std::strtoul(addr.c_str(), NULL, 16);
+            info.label = kind == "L";
+            std::getline(ss >> std::ws, info.text);
+            lines.push_back(info);
+        }
+
+        // 行号表按地址递增，标签作用到下一个标签之前
+        int label = -1;
+        size_t next = 0;
+        for (int addr = 0; addr < 0x10000; ++addr)
+        {
+            for (; next < lines.size() && lines[next].addr <= addr; ++next)
+            {
+                if (lines[next].label)
+                    label = (int)next;
+                else if (lines[next].addr == addr)
+                    lineof[addr] = (int)next;
+            }
+            labelof[addr] = label;
+        }
+        return true;
+    }
+
+    /// @brief 地址所属标签的名字，没有标签时为地址
+    /// @param addr
+    /// @return
+    std::string LabelName(uint16_t addr) const
+    {
+        if (labelof[addr] >= 0)
+            return lines[labelof[addr]].text;
+        char buf[8];
+        snprintf(buf, sizeof(buf), "0x%04x", addr);
+        return buf;
+    }
+
+    /// @brief 进入被调用的地址
+    /// @param addr
+    void Push(uint16_t addr)
+    {
+        if (stack.size() >= PROFILE_MAX_DEPTH)
+        {
+            ++overflow;
+            return;
+        }
+        auto key = std::make_pair(stack.back(), addr);
+        auto it = children.find(key);
+        if (it == children.end())
+        {
+            frames.push_back({stack.back(), labelof[addr], addr});
+            it = children.emplace(key, (int)frames.size() - 1).first;
+        }
+        stack.push_back(it->second);
+    }
+
+    /// @brief 从被调用处返回，栈已空时忽略
+    void Pop()
+    {
+        if (overflow > 0)
+            --overflow;
+        else if (stack.size() > 1)
+            stack.pop_back();
+    }
+
+    /// @brief 记录一条指令
+    /// @param addr 指令地址，MSR << 8 | PC
+    /// @param instructions
+    /// @param cyc 微周期数
+    /// @param fetchcyc 其中取指的微周期数
+    void Account(uint16_t addr, uint64_t instructions, uint64_t cyc, uint64_t fetchcyc)
+    {
+        count[addr] += instructions;
+        cycles[addr] += cyc;
+        fetch[addr] += fetchcyc;
+        folded[(uint64_t)stack.back() << 16 | addr] += cyc;
+    }
+
+    /// @brief 执行并统计，结果与CPU::Run一致
+    /// @param fast
+    /// @param cpu
+    /// @param maxcycles 微周期上限
+    /// @return 是否因PIN_HLT而停止
+    bool Run(const FastEngine &fast, CPU &cpu, uint64_t maxcycles)
+    {
+        uint8_t *reg = cpu.reg;
+        uint8_t *ram = cpu.ram;
+
+        if (stack.empty())
+        {
+            uint16_t entry = (reg[MSR] << 8) | cpu.pc;
+            frames.push_back({-1, labelof[entry], entry});
+            stack.push_back(0);
+        }
+
+        // 从指令中间开始时先执行到指令边界，计入当前地址
+        uint16_t addr = (reg[MSR] << 8) | cpu.pc;
+        while (cpu.cyc != 0)
+        {
+            if (cpu.cycles >= maxcycles)
+                return false;
+            uint64_t n = cpu.instructions;
+            bool ok = cpu.Step();
+            Account(addr, cpu.instructions - n, 1, 0);
+            if (!ok)
+                return true;
+        }
+
+        while (1)
+        {
+            uint16_t seg = reg[MSR] << 8;
+            uint8_t pc = cpu.pc;
+            uint8_t ir = ram[seg | pc];
+            const Fused &f = fast.table[(ir << 4) | (cpu.psw & 0xf)];
+            uint64_t c = cpu.cycles, n = cpu.instructions;
+            addr = seg | pc;
+
+            // 不以标准取指开始的微程序只能逐微周期执行，不区分取指
+            if (!fast.fetchok)
+            {
+                if (cpu.cycles >= maxcycles)
+                    return false;
+                bool halted = FastEngine::StepInstruction(cpu);
+                Account(addr, cpu.instructions - n, cpu.cycles - c, 0);
+                if (halted)
+                    return true;
+                continue;
+            }
+
+            if (cpu.cycles + f.cycles + !f.done > maxcycles)
+            {
+                bool halted = cpu.Run(maxcycles);
+                Account(addr, cpu.instructions - n, cpu.cycles - c, 0);
+                return halted;
+            }
+
+            FastEngine::Fetch(cpu, f, pc, ir, ram[seg | (uint8_t)(pc + 1)], ram[seg | (uint8_t)(pc + 2)]);
+            bool halted = FastEngine::Finish(cpu, f);
+            Account(addr, cpu.instructions - n, cpu.cycles - c, f.fetch * 2);
+            if (halted)
+                return true;
+
+            switch (f.kind)
+            {
+            case K_CALL:
+            case K_INT:
+                Push((reg[MSR] << 8) | cpu.pc);
+                break;
+            case K_RET:
+            case K_IRET:
+                Pop();
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    /// @brief 输出按源码行与按标签汇总的结果
+    /// @param out
+    void Print(std::ostream &out) const
+    {
+        uint64_t total = 0, totalfetch = 0, totalcount = 0;
+        for (int i = 0; i < 0x10000; ++i)
+            total += cycles[i], totalfetch += fetch[i], totalcount += count[i];
+        if (total == 0)
+            return;
+
+        char buf[256];
+        snprintf(buf, sizeof(buf), "profile: %llu cycles, %llu instructions, %llu fetch cycles (%.1f%%)",
+                 (unsigned long long)total, (unsigned long long)totalcount,
+                 (unsigned long long)totalfetch, 100.0 * totalfetch / total);
+        out << buf << std::endl
+            << std::endl;
+
+        // 按地址
+        std::vector<int> addrs;
+        for (int i = 0; i < 0x10000; ++i)
+            if (cycles[i] != 0)
+                addrs.push_back(i);
+        std::sort(addrs.begin(), addrs.end(), [this](int a, int b) { return cycles[a] > cycles[b]; });
+
+        out << "      cycles       %       fetch  instructions  addr  line  source" << std::endl;
+        for (int addr : addrs)
+        {
+            int line = lineof[addr];
+            snprintf(buf, sizeof(buf), "%12llu  %5.1f%%  %10llu  %12llu  %04x  %4s  %s",
+                     (unsigned long long)cycles[addr], 100.0 * cycles[addr] / total,
+                     (unsigned long long)fetch[addr], (unsigned long long)count[addr], addr,
+                     line >= 0 ? std::to_string(lines[line].lineno).c_str() : "?",
+                     line >= 0 ? lines[line].text.c_str() : "");
+            out << buf << std::endl;
+        }
+        out << std::endl;
+
+        // 按标签
+        std::map<std::string, uint64_t> bycycles, byfetch, bycount;
+        for (int addr : addrs)
+        {
+            std::string name = labelof[addr] >= 0 ? lines[labelof[addr]].text : "?";
+            bycycles[name] += cycles[addr];
+            byfetch[name] += fetch[addr];
+            bycount[name] += count[addr];
+        }
+        std::vector<std::pair<uint64_t, std::string>> labels;
+        for (const auto &item : bycycles)
+            labels.emplace_back(item.second, item.first);
+        std::sort(labels.rbegin(), labels.rend());
+
+        for (const auto &item : labels)
+        {
+            const std::string &name = item.second;
+            snprintf(buf, sizeof(buf), "%s: %.1f%% of cycles (%llu cycles, %llu fetch, %llu instructions)",
+                     name.c_str(), 100.0 * item.first / total, (unsigned long long)item.first,
+                     (unsigned long long)byfetch.at(name), (unsigned long long)bycount.at(name));
+            out << buf << std::endl;
+        }
+    }
+
+    /// @brief 输出折叠栈格式，每行为“调用者;被调用者;当前标签 微周期数”，可直接交给flamegraph.pl
+    /// @param out
+    void WriteFolded(std::ostream &out) const
+    {
+        std::vector<std::string> names(frames.size());
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            std::string name = LabelName(frames[i].addr);
+            names[i] = frames[i].parent < 0 ? name : names[frames[i].parent] + ";" + name;
+        }
+
+        std::map<std::string, uint64_t> stacks;
+        for (const auto &item : folded)
+        {
+            int node = (int)(item.first >> 16);
+            uint16_t addr = item.first & 0xffff;
+            std::string stack = names[node];
+            if (labelof[addr] != frames[node].label)
+                stack += ";" + LabelName(addr);
+            stacks[stack] += item.second;
+        }
+        for (const auto &item : stacks)
+            out << item.first << ' ' << item.second << std::endl;
+    }
+};
+
+#endif //_PROFILE_H_
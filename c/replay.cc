@@ -0,0 +1,200 @@
+/**
+ * 执行轨迹的回放
+ *
+ * 读取emulator -T记录的轨迹，定位到任意记录或微周期，向前或向后单步，查看寄存器与内存
+ */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include "trace.h"
+
+#define REPLAY_MAX_WRITES 8 // 每条记录最多打印的内存写入
+
+/// @brief 打印用法
+static void PrintUsage()
+{
+    std::cout << "replay [options] trace" << std::endl
+              << std::endl
+              << "  trace:   trace file recorded by emulator -T" << std::endl
+              << "  -c num:  go to the last record at or before micro cycle num" << std::endl
+              << "  -n num:  go to record num, 0 is the initial state" << std::endl
+              << "  -l num:  list num records from there instead of printing the state" << std::endl
+              << "  -q:      do not print ram" << std::endl
+              << std::endl
+              << "without -c, -n or -l, read commands from stdin:" << std::endl
+              << "  s [n]    step n records forward, default 1" << std::endl
+              << "  b [n]    step n records backward, default 1" << std::endl
+              << "  c num    go to micro cycle num" << std::endl
+              << "  n num    go to record num" << std::endl
+              << "  l [n]    list n records forward, default 16" << std::endl
+              << "  r        print registers" << std::endl
+              << "  m a [n]  print n bytes of ram from address a, default 64, all non-zero rows without a" << std::endl
+              << "  q        quit" << std::endl
+              << std::endl;
+}
+
+/// @brief 打印当前记录：执行的指令所在地址，之后的IR、DST、SRC、PSW与变化了的内存
+/// @param t
+static void PrintRecord(const TraceReader &t)
+{
+    const CPU &cpu = t.cpu;
+    printf("#%llu cycle %llu", (unsigned long long)t.record, (unsigned long long)cpu.cycles);
+    if (t.record == 0)
+    {
+        printf(": start at %04x\n", (cpu.reg[MSR] << 8) | cpu.pc);
+        return;
+    }
+    printf(": %04x  IR=%02x DST=%02x SRC=%02x PSW=%x", t.from, cpu.reg[IR], cpu.reg[DST], cpu.reg[SRC], cpu.psw);
+    for (size_t i = 0; i < t.writes.size() && i < REPLAY_MAX_WRITES; ++i)
+        printf("  [%04x]=%02x", t.writes[i].first, t.writes[i].second);
+    if (t.writes.size() > REPLAY_MAX_WRITES)
+        printf("  ... %zu writes", t.writes.size());
+    if (cpu.cyc != 0)
+        printf("  CYC=%d", cpu.cyc);
+    if (cpu.halt)
+        printf("  HLT");
+    printf("\n");
+}
+
+/// @brief 打印从addr开始的n个字节
+static void PrintBytes(const CPU &cpu, uint32_t addr, uint32_t n)
+{
+    for (uint32_t row = addr & ~0xfu; row < addr + n && row < RAM_SIZE; row += 16)
+    {
+        printf("%04x:", row);
+        for (int i = 0; i < 16; ++i)
+            printf(" %02x", cpu.ram[row + i]);
+        printf("\n");
+    }
+}
+
+/// @brief 执行一行命令
+/// @return 是否继续
+static bool Command(TraceReader &t, const std::string &line)
+{
+    std::istringstream in(line);
+    std::string cmd, arg1, arg2;
+    in >> cmd >> arg1 >> arg2;
+    uint64_t n = arg1.empty() ? 0 : std::strtoull(arg1.c_str(), NULL, 0);
+
+    if (cmd == "q")
+        return false;
+    if (cmd == "s" || cmd == "b")
+    {
+        n = arg1.empty() ? 1 : n;
+        t.Seek(cmd == "s" ? t.record + n : t.record - std::min(n, t.record));
+        PrintRecord(t);
+    }
+    else if (cmd == "c" && !arg1.empty())
+    {
+        t.SeekCycle(n);
+        PrintRecord(t);
+    }
+    else if (cmd == "n" && !arg1.empty())
+    {
+        t.Seek(n);
+        PrintRecord(t);
+    }
+    else if (cmd == "l")
+    {
+        n = arg1.empty() ? 16 : n;
+        for (uint64_t i = 0; i < n && t.record < t.records; ++i)
+        {
+            t.Seek(t.record + 1);
+            PrintRecord(t);
+        }
+    }
+    else if (cmd == "r")
+        t.cpu.PrintRegisters(stdout);
+    else if (cmd == "m")
+    {
+        if (arg1.empty())
+            t.cpu.PrintRam(stdout);
+        else
+            PrintBytes(t.cpu, (uint32_t)n & 0xffff, arg2.empty() ? 64 : (uint32_t)std::strtoul(arg2.c_str(), NULL, 0));
+    }
+    else if (!cmd.empty())
+        std::cout << "unknown command, see replay without arguments" << std::endl;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string tracefile;
+    bool cycle = false, byrecord = false;
+    uint64_t target = 0;
+    uint64_t list = 0;
+    bool printram = true;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if ((arg == "-c" || arg == "-n") && i + 1 < argc)
+        {
+            (arg == "-c" ? cycle : byrecord) = true;
+            target = std::strtoull(argv[++i], NULL, 0);
+        }
+        else if (arg == "-l" && i + 1 < argc)
+            list = std::strtoull(argv[++i], NULL, 0);
+        else if (arg == "-q")
+            printram = false;
+        else if (arg[0] != '-' && tracefile.empty())
+            tracefile = arg;
+        else
+        {
+            PrintUsage();
+            return 0;
+        }
+    }
+
+    if (tracefile.empty() || (cycle && byrecord))
+    {
+        PrintUsage();
+        return 0;
+    }
+
+    static TraceReader t;
+    std::string error;
+    if (!t.Open(tracefile, error))
+    {
+        std::cout << "error: " << error << std::endl;
+        return 0;
+    }
+    if (!error.empty())
+        std::cout << "warning: " << error << std::endl;
+    t.Seek(t.records);
+    std::cout << "records: " << t.records << ", keyframes: " << t.keys.size() << ", cycles: " << t.cpu.cycles
+              << ", instructions: " << t.cpu.instructions << std::endl;
+    t.Seek(0);
+
+    if (!cycle && !byrecord && list == 0)
+    {
+        PrintRecord(t);
+        std::string line;
+        while (std::cout << "> " << std::flush, std::getline(std::cin, line))
+            if (!Command(t, line))
+                break;
+        return 0;
+    }
+
+    if (cycle)
+        t.SeekCycle(target);
+    else
+        t.Seek(target);
+    PrintRecord(t);
+    if (list != 0)
+    {
+        Command(t, "l " + std::to_string(list));
+        return 0;
+    }
+    std::cout << std::endl;
+    t.cpu.PrintRegisters(stdout);
+    if (printram)
+    {
+        std::cout << std::endl;
+        t.cpu.PrintRam(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,122 @@
+/**
+ * 压缩的微程序格式
+ *
+ * 平铺的micro.bin中大部分(ir, psw)行完全相同，压缩格式只保存去重后的行，
+ * 每个(ir, psw)用一个编号指向其中一行，行尾的0不保存。文件布局，小端：
+ *
+ *   char     magic[4];          ROM_MAGIC
+ *   uint16_t count;             去重后的行数
+ *   uint16_t index[ROM_ROWS];   下标为ir << 4 | psw，值为行号
+ *   uint8_t  length[count];     每行去掉行尾0后的控制字个数
+ *   uint32_t word[];            各行的控制字，依次存放
+ *
+ * C与C++均可使用
+ */
+
+#ifndef _ROM_H_
+#define _ROM_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define ROM_MAGIC "MROM" // 文件标识
+#define ROM_ROWS  0x1000 // (ir, psw)组合数
+#define ROM_STEPS 16     // 每行的微周期数
+
+/// @brief 将平铺的微程序去重
+/// @param flat 平铺的微程序，ROM_ROWS * ROM_STEPS个控制字
+/// @param index 每个(ir, psw)对应的行号
+/// @param pool 去重后的行，最多ROM_ROWS行
+/// @return 去重后的行数
+static inline int RomCompress(const uint32_t *flat, uint16_t *index, uint32_t *pool)
+{
+    int count = 0;
+    int i, j;
+
+    for (i = 0; i < ROM_ROWS; ++i)
+    {
+        const uint32_t *row = flat + i * ROM_STEPS;
+
+        // 不同的行很少，直接逐行比较
+        for (j = 0; j < count; ++j)
+            if (memcmp(pool + j * ROM_STEPS, row, ROM_STEPS * sizeof(uint32_t)) == 0)
+                break;
+        if (j == count)
+            memcpy(pool + count++ * ROM_STEPS, row, ROM_STEPS * sizeof(uint32_t));
+        index[i] = (uint16_t)j;
+    }
+    return count;
+}
+
+/// @brief 将去重后的微程序还原为平铺格式，与压缩前逐位相同
+/// @param index
+/// @param pool
+/// @param flat
+static inline void RomExpand(const uint16_t *index, const uint32_t *pool, uint32_t *flat)
+{
+    int i;
+    for (i = 0; i < ROM_ROWS; ++i)
+        memcpy(flat + i * ROM_STEPS, pool + index[i] * ROM_STEPS, ROM_STEPS * sizeof(uint32_t));
+}
+
+/// @brief 写压缩格式
+/// @param pf
+/// @param index
+/// @param pool
+/// @param count
+/// @return 是否成功
+static inline int RomWrite(FILE *pf, const uint16_t *index, const uint32_t *pool, int count)
+{
+    uint8_t length[ROM_ROWS];
+    uint16_t cnt = (uint16_t)count;
+    int i, ok;
+
+    for (i = 0; i < count; ++i)
+    {
+        length[i] = ROM_STEPS;
+        while (length[i] > 0 && pool[i * ROM_STEPS + length[i] - 1] == 0)
+            --length[i];
+    }
+
+    ok = fwrite(ROM_MAGIC, 4, 1, pf) == 1;
+    ok = ok && fwrite(&cnt, sizeof(cnt), 1, pf) == 1;
+    ok = ok && fwrite(index, sizeof(uint16_t), ROM_ROWS, pf) == ROM_ROWS;
+    ok = ok && fwrite(length, 1, count, pf) == (size_t)count;
+    for (i = 0; i < count && ok; ++i)
+        ok = fwrite(pool + i * ROM_STEPS, sizeof(uint32_t), length[i], pf) == length[i];
+    return ok;
+}
+
+/// @brief 读压缩格式
+/// @param pf
+/// @param index
+/// @param pool 至少ROM_ROWS行
+/// @return 行数，文件不是压缩格式或已损坏时返回-1
+static inline int RomRead(FILE *pf, uint16_t *index, uint32_t *pool)
+{
+    char magic[4];
+    uint8_t length[ROM_ROWS];
+    uint16_t count;
+    int i;
+
+    if (fread(magic, 4, 1, pf) != 1 || memcmp(magic, ROM_MAGIC, 4) != 0)
+        return -1;
+    if (fread(&count, sizeof(count), 1, pf) != 1 || count == 0 || count > ROM_ROWS)
+        return -1;
+    if (fread(index, sizeof(uint16_t), ROM_ROWS, pf) != ROM_ROWS)
+        return -1;
+    if (fread(length, 1, count, pf) != count)
+        return -1;
+
+    memset(pool, 0, (size_t)count * ROM_STEPS * sizeof(uint32_t));
+    for (i = 0; i < ROM_ROWS; ++i)
+        if (index[i] >= count)
+            return -1;
+    for (i = 0; i < count; ++i)
+        if (length[i] > ROM_STEPS || fread(pool + i * ROM_STEPS, sizeof(uint32_t), length[i], pf) != length[i])
+            return -1;
+    return count;
+}
+
+#endif //_ROM_H_
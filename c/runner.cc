@@ -0,0 +1,468 @@
+/**
+ * 多线程任务执行器
+ *
+ * 清单每行一个任务：程序文件 [内存映像] [微周期上限]，内存映像为-表示不使用，
+ * 以#开头的行为注释。程序文件也可以是emulator -s保存的快照，从快照的状态继续执行。
+ * 任务按工作窃取调度在多个线程上执行，每个线程使用自己的CPU与执行引擎，
+ * 执行中只访问本线程的数据，结果以定长记录写入输出文件。
+ * 每个线程把各任务的初始状态保存为快照，之后同样的任务只恢复上一个任务写过的页，
+ * 翻译过的代码也只作废这些页中的。
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include "cpu.h"
+#include "builtin.h"
+#include "fast.h"
+#include "jit.h"
+#include "snapshot.h"
+
+/// @brief 一个任务
+struct Job
+{
+    int program;        // 程序在文件表中的下标
+    int image;          // 内存映像在文件表中的下标，-1表示不使用
+    uint64_t maxcycles; // 微周期上限
+};
+
+/// @brief 输出文件中的一条记录，按任务完成的顺序写入
+struct Result
+{
+    uint32_t job;          // 任务在清单中的序号，从0开始
+    uint32_t halted;       // 是否因PIN_HLT而停止
+    uint64_t cycles;       // 执行的微周期数
+    uint64_t instructions; // 执行的指令数
+    uint64_t hash;         // 结束时内存的FNV-1a散列
+};
+
+/// @brief 一个线程的任务区间[begin, end)，begin为高32位，end为低32位。
+/// 本线程从前面取任务，其他线程从后面窃取一半，两者都用CAS修改
+struct alignas(64) JobRange
+{
+    std::atomic<uint64_t> word;
+
+    static uint64_t Pack(uint32_t begin, uint32_t end)
+    {
+        return (uint64_t)begin << 32 | end;
+    }
+
+    /// @brief 从前面取一个任务
+    /// @param job
+    /// @return 区间为空时返回false
+    bool Pop(uint32_t &job)
+    {
+        uint64_t w = word.load(std::memory_order_relaxed);
+        while (1)
+        {
+            uint32_t begin = w >> 32, end = (uint32_t)w;
+            if (begin >= end)
+                return false;
+            if (word.compare_exchange_weak(w, Pack(begin + 1, end), std::memory_order_acquire))
+            {
+                job = begin;
+                return true;
+            }
+        }
+    }
+
+    /// @brief 从后面窃取一半任务
+    /// @param begin
+    /// @param end
+    /// @return 区间为空时返回false
+    bool Steal(uint32_t &begin, uint32_t &end)
+    {
+        uint64_t w = word.load(std::memory_order_relaxed);
+        while (1)
+        {
+            uint32_t b = w >> 32, e = (uint32_t)w;
+            if (b >= e)
+                return false;
+            uint32_t mid = e - (e - b + 1) / 2;
+            if (word.compare_exchange_weak(w, Pack(b, mid), std::memory_order_acquire))
+            {
+                begin = mid, end = e;
+                return true;
+            }
+        }
+    }
+};
+
+/// @brief 一个线程的统计
+struct alignas(64) WorkerStats
+{
+    uint64_t jobs;
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t steals;
+    uint64_t pages; // 恢复初始状态时复制的页数
+};
+
+static MicroCode micro;
+static FastEngine fast;
+static std::string engine = "fast";
+static std::vector<std::vector<uint8_t>> files; // 程序与内存映像的内容
+static std::vector<std::shared_ptr<const Snapshot>> snaps; // 文件为快照时是其内容，否则为NULL
+static std::vector<Job> jobs;
+
+/// @brief 计算内存的FNV-1a散列
+/// @param data
+/// @param size
+/// @return
+static uint64_t Fnv1a(const uint8_t *data, size_t size)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; ++i)
+        h = (h ^ data[i]) * 0x100000001b3ull;
+    return h;
+}
+
+/// @brief 读取整个文件
+/// @param path
+/// @param data
+/// @return
+static bool ReadFile(const std::string &path, std::vector<uint8_t> &data)
+{
+    FILE *pf = fopen(path.c_str(), "rb");
+    if (pf == NULL)
+        return false;
+    data.resize(RAM_SIZE);
+    data.resize(fread(data.data(), 1, RAM_SIZE, pf));
+    fclose(pf);
+    return true;
+}
+
+/// @brief 读取清单，程序与内存映像只读取一次
+/// @param path
+/// @param maxcycles 未指定上限的任务使用的微周期上限
+/// @return
+static bool ReadManifest(const std::string &path, uint64_t maxcycles)
+{
+    std::ifstream in(path);
+    if (!in.is_open())
+    {
+        std::cout << "error: unable to open manifest " << path << std::endl;
+        return false;
+    }
+
+    std::map<std::string, int> index;
+    auto load = [&](const std::string &name) -> int {
+        auto it = index.find(name);
+        if (it != index.end())
+            return it->second;
+        files.emplace_back();
+        snaps.push_back(Snapshot::Read(name));
+        if (snaps.back() == NULL && !ReadFile(name, files.back()))
+        {
+            std::cout << "error: unable to open " << name << std::endl;
+            return -1;
+        }
+        return index[name] = (int)files.size() - 1;
+    };
+
+    std::string line;
+    size_t lineno = 0;
+    while (std::getline(in, line))
+    {
+        ++lineno;
+        std::istringstream ss(line);
+        std::string program, image = "-", cycles;
+        if (!(ss >> program) || program[0] == '#')
+            continue;
+        ss >> image >> cycles;
+
+        Job job = {load(program), image == "-" ? -1 : load(image), maxcycles};
+        if (job.program < 0 || (image != "-" && job.image < 0))
+            return false;
+        if (job.image >= 0 && (snaps[job.image] != NULL || snaps[job.program] != NULL))
+        {
+            std::cout << "error: line " << lineno << ": a snapshot cannot be combined with a ram image" << std::endl;
+            return false;
+        }
+        if (!cycles.empty())
+            job.maxcycles = std::strtoull(cycles.c_str(), NULL, 0);
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+/// @brief 任务执行器
+struct Runner
+{
+    int nthreads;
+    std::vector<JobRange> ranges;
+    std::vector<WorkerStats> stats;
+    FILE *out;
+    std::mutex outlock;
+
+    Runner(int nthreads, FILE *out) : nthreads(nthreads), ranges(nthreads), stats(nthreads), out(out)
+    {
+        // 初始时按序号平均分配
+        size_t n = jobs.size();
+        for (int i = 0; i < nthreads; ++i)
+            ranges[i].word.store(JobRange::Pack(n * i / nthreads, n * (i + 1) / nthreads));
+        memset(stats.data(), 0, sizeof(WorkerStats) * nthreads);
+    }
+
+    /// @brief 写出缓冲的结果
+    /// @param buf
+    void Flush(std::vector<Result> &buf)
+    {
+        if (out != NULL && !buf.empty())
+        {
+            std::lock_guard<std::mutex> lock(outlock);
+            fwrite(buf.data(), sizeof(Result), buf.size(), out);
+        }
+        buf.clear();
+    }
+
+    /// @brief 本线程的区间为空时从其他线程窃取
+    /// @param id
+    /// @param rng
+    /// @return 所有线程都没有剩余任务时返回false
+    bool Steal(int id, std::minstd_rand &rng)
+    {
+        int start = rng() % nthreads;
+        for (int i = 0; i < nthreads; ++i)
+        {
+            int victim = (start + i) % nthreads;
+            uint32_t begin, end;
+            if (victim != id && ranges[victim].Steal(begin, end))
+            {
+                ranges[id].word.store(JobRange::Pack(begin, end), std::memory_order_release);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// @brief 线程函数
+    /// @param id
+    void Work(int id)
+    {
+        CPU *cpu = new CPU(&micro);
+        SnapshotTracker *tracker = new SnapshotTracker(*cpu);
+        std::map<std::pair<int, int>, std::shared_ptr<const Snapshot>> initial; // (程序, 内存映像) -> 初始状态
+        JitEngine *jit = NULL;
+        if (engine == "jit")
+        {
+            jit = new JitEngine;
+            jit->Init(fast);
+        }
+
+        std::vector<Result> buf;
+        std::minstd_rand rng(id + 1);
+        WorkerStats local = {0, 0, 0, 0, 0};
+
+        while (1)
+        {
+            uint32_t index;
+            if (!ranges[id].Pop(index))
+            {
+                if (!Steal(id, rng))
+                    break;
+                ++local.steals;
+                continue;
+            }
+
+            const Job &job = jobs[index];
+            uint64_t copied = tracker->copied;
+            std::shared_ptr<const Snapshot> &start = initial[std::make_pair(job.program, job.image)];
+            if (start == NULL && snaps[job.program] != NULL)
+                start = snaps[job.program];
+            if (start != NULL)
+            {
+                tracker->Restore(start);
+            }
+            else
+            {
+                cpu->Reset();
+                memset(cpu->ram, 0, sizeof(cpu->ram));
+                if (job.image >= 0)
+                    memcpy(cpu->ram, files[job.image].data(), files[job.image].size());
+                memcpy(cpu->ram, files[job.program].data(), files[job.program].size());
+                tracker->Invalidate();
+                start = tracker->Take();
+                // 内存已被整体改写，之前翻译的块全部作废
+                if (jit != NULL)
+                    jit->Flush();
+            }
+            local.pages += tracker->copied - copied;
+
+            bool halted;
+            if (jit != NULL)
+                halted = jit->Run(*cpu, job.maxcycles);
+            else if (engine == "fast")
+                halted = fast.Run(*cpu, job.maxcycles);
+            else
+                halted = cpu->Run(job.maxcycles);
+
+            Result r = {index, halted, cpu->cycles, cpu->instructions, Fnv1a(cpu->ram, sizeof(cpu->ram))};
+            buf.push_back(r);
+            if (buf.size() >= 1024)
+                Flush(buf);
+
+            ++local.jobs;
+            local.cycles += cpu->cycles;
+            local.instructions += cpu->instructions;
+        }
+
+        Flush(buf);
+        stats[id] = local;
+        delete jit;
+        delete tracker;
+        delete cpu;
+    }
+
+    /// @brief 执行所有任务
+    /// @return 用时，秒
+    double Run()
+    {
+        auto beg = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (int i = 1; i < nthreads; ++i)
+            threads.emplace_back(&Runner::Work, this, i);
+        Work(0);
+        for (auto &t : threads)
+            t.join();
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double>(end - beg).count();
+    }
+};
+
+/// @brief 打印用法
+static void PrintUsage()
+{
+    std::cout << "runner [options] manifest" << std::endl
+              << std::endl
+              << "  manifest: one job per line, program [ram image or -] [max micro cycles]" << std::endl
+              << "  -m file:  microcode file, default built-in table" << std::endl
+              << "  -v:       use built-in variable-length microcode, see compiler -v" << std::endl
+              << "  -c num:   default max micro cycles, default 100000000" << std::endl
+              << "  -e name:  execution engine, micro, fast or jit, default fast" << std::endl
+              << "  -t num:   number of threads, default number of cores" << std::endl
+              << "  -o file:  result file, default results.bin" << std::endl
+              << "  -s:       also run with 1, 2, 4, ... threads and print scaling" << std::endl
+              << std::endl
+              << "  each result is 32 bytes: uint32 job, uint32 halted, uint64 cycles," << std::endl
+              << "  uint64 instructions, uint64 FNV-1a hash of ram" << std::endl
+              << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string microfile;
+    bool varlen = false;
+    std::string manifest;
+    std::string outfile = "results.bin";
+    uint64_t maxcycles = 100000000;
+    int nthreads = (int)std::thread::hardware_concurrency();
+    bool scaling = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-m" && i + 1 < argc)
+            microfile = argv[++i];
+        else if (arg == "-v")
+            varlen = true;
+        else if (arg == "-c" && i + 1 < argc)
+            maxcycles = std::strtoull(argv[++i], NULL, 0);
+        else if (arg == "-e" && i + 1 < argc)
+            engine = argv[++i];
+        else if (arg == "-t" && i + 1 < argc)
+            nthreads = std::atoi(argv[++i]);
+        else if (arg == "-o" && i + 1 < argc)
+            outfile = argv[++i];
+        else if (arg == "-s")
+            scaling = true;
+        else if (arg[0] != '-' && manifest.empty())
+            manifest = arg;
+        else
+        {
+            PrintUsage();
+            return 0;
+        }
+    }
+
+    if (manifest.empty() || (engine != "micro" && engine != "fast" && engine != "jit"))
+    {
+        PrintUsage();
+        return 0;
+    }
+    if (nthreads < 1)
+        nthreads = 1;
+
+    if (microfile.empty())
+    {
+        const BuiltinMicro &builtin = varlen ? BUILTIN_MICRO_VARLEN : BUILTIN_MICRO;
+        micro.Load(builtin.index, builtin.pool[0], builtin.count);
+    }
+    else if (!micro.Load(microfile.c_str()))
+    {
+        std::cout << "error: unable to load microcode file" << std::endl;
+        return 0;
+    }
+    fast.Build(micro);
+
+    if (!ReadManifest(manifest, maxcycles))
+        return 0;
+    if (jobs.empty())
+    {
+        std::cout << "error: no jobs in manifest" << std::endl;
+        return 0;
+    }
+
+    // 扩展性测试：依次使用1、2、4……个线程，最后一次使用全部线程并写出结果
+    std::vector<int> counts;
+    if (scaling)
+        for (int t = 1; t < nthreads; t *= 2)
+            counts.push_back(t);
+    counts.push_back(nthreads);
+
+    double base = 0;
+    for (int t : counts)
+    {
+        FILE *out = NULL;
+        if (t == nthreads)
+        {
+            out = fopen(outfile.c_str(), "wb");
+            if (out == NULL)
+            {
+                std::cout << "error: unable to open result file" << std::endl;
+                return 0;
+            }
+        }
+
+        Runner runner(t, out);
+        double sec = runner.Run();
+        if (out != NULL)
+            fclose(out);
+
+        uint64_t cycles = 0, instructions = 0, steals = 0, pages = 0;
+        for (const auto &s : runner.stats)
+            cycles += s.cycles, instructions += s.instructions, steals += s.steals, pages += s.pages;
+        if (t == 1)
+            base = sec;
+
+        std::cout << "threads: " << t << ", jobs: " << jobs.size() << ", time: " << sec * 1000 << " ms, "
+                  << jobs.size() / sec << " jobs/s, "
+                  << cycles / sec / t / 1e6 << " M cycles/s per core, "
+                  << instructions / sec / 1e6 << " M instructions/s, steals: " << steals
+                  << ", pages copied per job: " << (double)pages / jobs.size();
+        if (scaling && base > 0)
+            std::cout << ", speedup: " << base / sec << ", efficiency: " << base / sec / t * 100 << "%";
+        std::cout << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,302 @@
+/**
+ * 机器状态的快照
+ *
+ * 快照由寄存器与256个页组成，每页256字节。页一旦放入快照就不再修改，可以由多个快照共用：
+ * SnapshotTracker通过CPU::dirty记录上次拍快照或恢复之后写过的页，再拍快照时只复制写过的页，
+ * 其余页与上一个快照共用，即页粒度的写时复制；恢复时只复制写过的页和两个快照之间不同的页，
+ * 从同一个状态反复重新开始时，每次只涉及运行中写过的几页。全零的页所有快照共用一份。
+ * 快照不可修改，交给SnapshotWriter在后台线程写入文件，执行不必暂停。文件格式，小端：
+ *
+ *   char     magic[4];     SNAPSHOT_MAGIC
+ *   uint32_t version;      SNAPSHOT_VERSION
+ *   uint8_t  reg[32], pc, psw, cyc, halt;
+ *   uint64_t cycles, instructions;
+ *   uint8_t  used[32];     非零页的位图
+ *   uint8_t  pages[][256]; 非零页的内容，按页号从小到大
+ */
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "cpu.h"
+
+#define SNAPSHOT_MAGIC   "MSNP"          // 文件标识
+#define SNAPSHOT_VERSION 1               // 文件格式改变时加一
+#define SNAPSHOT_PAGES   (RAM_SIZE >> 8) // 内存的页数，页号为地址高8位
+
+/// @brief 内存的一页，放入快照后不再修改
+struct SnapshotPage
+{
+    uint8_t data[256];
+};
+
+/// @brief 寄存器与内存的快照
+struct Snapshot
+{
+    uint8_t reg[32];
+    uint8_t pc, psw, cyc;
+    bool halt;
+    uint64_t cycles, instructions;
+    std::shared_ptr<const SnapshotPage> pages[SNAPSHOT_PAGES];
+
+    /// @brief 全零的页，所有快照共用
+    static const std::shared_ptr<const SnapshotPage> &ZeroPage()
+    {
+        static const std::shared_ptr<const SnapshotPage> zero = std::make_shared<SnapshotPage>();
+        return zero;
+    }
+
+    /// @brief 复制一页，全零时返回ZeroPage()
+    static std::shared_ptr<const SnapshotPage> MakePage(const uint8_t *data)
+    {
+        const std::shared_ptr<const SnapshotPage> &zero = ZeroPage();
+        if (memcmp(data, zero->data, 256) == 0)
+            return zero;
+        std::shared_ptr<SnapshotPage> page = std::make_shared<SnapshotPage>();
+        memcpy(page->data, data, 256);
+        return page;
+    }
+
+    /// @brief 复制CPU的全部状态
+    static std::shared_ptr<Snapshot> Of(const CPU &cpu)
+    {
+        std::shared_ptr<Snapshot> snap = std::make_shared<Snapshot>();
+        snap->SaveRegisters(cpu);
+        for (int p = 0; p < SNAPSHOT_PAGES; ++p)
+            snap->pages[p] = MakePage(cpu.ram + (p << 8));
+        return snap;
+    }
+
+    void SaveRegisters(const CPU &cpu)
+    {
+        memcpy(reg, cpu.reg, sizeof(reg));
+        pc = cpu.pc, psw = cpu.psw, cyc = cpu.cyc, halt = cpu.halt;
+        cycles = cpu.cycles, instructions = cpu.instructions;
+    }
+
+    void LoadRegisters(CPU &cpu) const
+    {
+        memcpy(cpu.reg, reg, sizeof(reg));
+        cpu.pc = pc, cpu.psw = psw, cpu.cyc = cyc, cpu.halt = halt;
+        cpu.cycles = cycles, cpu.instructions = instructions;
+    }
+
+    /// @brief 把全部状态复制到CPU，写入的页按CPU::watch标记
+    void Export(CPU &cpu) const
+    {
+        for (int p = 0; p < SNAPSHOT_PAGES; ++p)
+        {
+            memcpy(cpu.ram + (p << 8), pages[p]->data, 256);
+            if (cpu.watch != NULL && cpu.watch[p])
+                cpu.watch[p] = WATCH_HIT, cpu.watchhit = true;
+        }
+        LoadRegisters(cpu);
+    }
+
+    /// @brief 写入文件：先写临时文件再改名
+    /// @param path
+    /// @return
+    bool Write(const std::string &path) const
+    {
+        std::string tmp = path + ".tmp";
+        FILE *pf = fopen(tmp.c_str(), "wb");
+        if (pf == NULL)
+            return false;
+        uint32_t version = SNAPSHOT_VERSION;
+        uint8_t state[4] = {pc, psw, cyc, (uint8_t)halt};
+        uint64_t counts[2] = {cycles, instructions};
+        uint8_t used[SNAPSHOT_PAGES / 8] = {0};
+        for (int p = 0; p < SNAPSHOT_PAGES; ++p)
+            if (pages[p] != ZeroPage())
+                used[p >> 3] |= 1 << (p & 7);
+        bool ok = fwrite(SNAPSHOT_MAGIC, 4, 1, pf) == 1 && fwrite(&version, 4, 1, pf) == 1 &&
+                  fwrite(reg, sizeof(reg), 1, pf) == 1 && fwrite(state, sizeof(state), 1, pf) == 1 &&
+                  fwrite(counts, sizeof(counts), 1, pf) == 1 && fwrite(used, sizeof(used), 1, pf) == 1;
+        for (int p = 0; ok && p < SNAPSHOT_PAGES; ++p)
+            if (used[p >> 3] & (1 << (p & 7)))
+                ok = fwrite(pages[p]->data, 256, 1, pf) == 1;
+        ok = fclose(pf) == 0 && ok;
+        ok = ok && rename(tmp.c_str(), path.c_str()) == 0;
+        if (!ok)
+            remove(tmp.c_str());
+        return ok;
+    }
+
+    /// @brief 读取文件
+    /// @param path
+    /// @return 不存在或格式不对时返回NULL
+    static std::shared_ptr<Snapshot> Read(const std::string &path)
+    {
+        FILE *pf = fopen(path.c_str(), "rb");
+        if (pf == NULL)
+            return NULL;
+        std::shared_ptr<Snapshot> snap = std::make_shared<Snapshot>();
+        char magic[4];
+        uint32_t version;
+        uint8_t state[4];
+        uint64_t counts[2];
+        uint8_t used[SNAPSHOT_PAGES / 8];
+        bool ok = fread(magic, 4, 1, pf) == 1 && memcmp(magic, SNAPSHOT_MAGIC, 4) == 0 &&
+                  fread(&version, 4, 1, pf) == 1 && version == SNAPSHOT_VERSION &&
+                  fread(snap->reg, sizeof(snap->reg), 1, pf) == 1 && fread(state, sizeof(state), 1, pf) == 1 &&
+                  fread(counts, sizeof(counts), 1, pf) == 1 && fread(used, sizeof(used), 1, pf) == 1;
+        uint8_t data[256];
+        for (int p = 0; ok && p < SNAPSHOT_PAGES; ++p)
+        {
+            if (!(used[p >> 3] & (1 << (p & 7))))
+                snap->pages[p] = ZeroPage();
+            else if ((ok = fread(data, 256, 1, pf) == 1))
+                snap->pages[p] = MakePage(data);
+        }
+        ok = ok && fgetc(pf) == EOF;
+        fclose(pf);
+        if (!ok)
+            return NULL;
+        snap->pc = state[0], snap->psw = state[1] & 0xf, snap->cyc = state[2] & 0xf, snap->halt = state[3] != 0;
+        snap->cycles = counts[0], snap->instructions = counts[1];
+        return snap;
+    }
+};
+
+/// @brief 跟踪一个CPU写过的页，在其上拍快照与恢复
+struct SnapshotTracker
+{
+    CPU &cpu;
+    uint8_t dirty[SNAPSHOT_PAGES];        // 交给CPU::dirty
+    std::shared_ptr<const Snapshot> base; // 内存中没有写过的页与这个快照相同，为NULL时未知
+    uint64_t copied;                      // 累计复制的页数
+
+    explicit SnapshotTracker(CPU &cpu) : cpu(cpu), copied(0)
+    {
+        memset(dirty, 0, sizeof(dirty));
+        cpu.dirty = dirty;
+    }
+
+    ~SnapshotTracker()
+    {
+        if (cpu.dirty == dirty)
+            cpu.dirty = NULL;
+    }
+
+    SnapshotTracker(const SnapshotTracker &) = delete;
+    SnapshotTracker &operator=(const SnapshotTracker &) = delete;
+
+    /// @brief 不经过CPU::Store整体改写内存后调用，如载入程序，之后拍快照时复制所有页
+    void Invalidate()
+    {
+        base.reset();
+    }
+
+    /// @brief 拍快照，没有写过的页与上一个快照共用
+    std::shared_ptr<const Snapshot> Take()
+    {
+        std::shared_ptr<Snapshot> snap = std::make_shared<Snapshot>();
+        snap->SaveRegisters(cpu);
+        for (int p = 0; p < SNAPSHOT_PAGES; ++p)
+        {
+            if (base != NULL && !dirty[p])
+                snap->pages[p] = base->pages[p];
+            else
+                snap->pages[p] = Snapshot::MakePage(cpu.ram + (p << 8)), ++copied;
+        }
+        memset(dirty, 0, sizeof(dirty));
+        base = snap;
+        return snap;
+    }
+
+    /// @brief 恢复到快照：只复制写过的页与和上一个快照不同的页，复制的页按CPU::watch标记，
+    /// 执行引擎据此作废这些页中翻译过的代码
+    void Restore(const std::shared_ptr<const Snapshot> &snap)
+    {
+        for (int p = 0; p < SNAPSHOT_PAGES; ++p)
+        {
+            if (base != NULL && !dirty[p] && base->pages[p] == snap->pages[p])
+                continue;
+            memcpy(cpu.ram + (p << 8), snap->pages[p]->data, 256);
+            ++copied;
+            if (cpu.watch != NULL && cpu.watch[p])
+                cpu.watch[p] = WATCH_HIT, cpu.watchhit = true;
+        }
+        snap->LoadRegisters(cpu);
+        memset(dirty, 0, sizeof(dirty));
+        base = snap;
+    }
+};
+
+/// @brief 后台写快照文件的线程，Write()只把快照放入队列，执行不必等待磁盘
+struct SnapshotWriter
+{
+    std::deque<std::pair<std::shared_ptr<const Snapshot>, std::string>> queue;
+    std::vector<std::string> failed; // 写入失败的文件
+    bool busy, quit;
+    std::mutex mutex;
+    std::condition_variable cond, idle;
+    std::thread thread;
+
+    SnapshotWriter() : busy(false), quit(false)
+    {
+        thread = std::thread(&SnapshotWriter::Work, this);
+    }
+
+    /// @brief 写完队列中所有的快照后结束
+    ~SnapshotWriter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        cond.notify_all();
+        thread.join();
+    }
+
+    /// @brief 把快照放入队列
+    void Write(const std::shared_ptr<const Snapshot> &snap, const std::string &path)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.emplace_back(snap, path);
+        }
+        cond.notify_all();
+    }
+
+    /// @brief 等待队列中的快照都写完
+    /// @return 是否都写入成功
+    bool Wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [&] { return queue.empty() && !busy; });
+        return failed.empty();
+    }
+
+    void Work()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (1)
+        {
+            cond.wait(lock, [&] { return quit || !queue.empty(); });
+            if (queue.empty())
+                return;
+            auto item = queue.front();
+            queue.pop_front();
+            busy = true;
+            lock.unlock();
+            bool ok = item.first->Write(item.second);
+            lock.lock();
+            busy = false;
+            if (!ok)
+                failed.push_back(item.second);
+            idle.notify_all();
+        }
+    }
+};
+
+#endif //_SNAPSHOT_H_
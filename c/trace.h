@@ -0,0 +1,570 @@
+/**
+ * 执行轨迹
+ *
+ * TraceWriter在每条指令之后记录与上一条记录相比变化了的状态：执行的指令即(PC, IR, DST, SRC, PSW)，
+ * 其他变化了的寄存器与写过的内存。数值按差分与变长整数编码，一条指令通常只占几个字节。
+ * 写内存经CPU::io交给TraceWriter记下地址，原来的设备接在它后面。
+ * 编码写入两个交替使用的缓冲页，写满的页交给后台线程写入文件，执行只在磁盘跟不上时等待。
+ * 每隔interval条记录插入一个关键帧，即全部状态，TraceReader从最近的关键帧向后解码，
+ * 可以定位到任意一条记录或微周期，后退一步即重新定位到前一条记录。文件格式，小端：
+ *
+ *   char     magic[4]; TRACE_MAGIC
+ *   uint32_t version;  TRACE_VERSION
+ *   uint32_t interval; 关键帧间隔的记录数
+ *   之后为关键帧与记录，文件从一个关键帧开始
+ *
+ * 关键帧：
+ *   uint8_t  TRACE_KEY;
+ *   uint8_t  reg[32], pc, psw, cyc, halt;
+ *   varint   cycles, instructions;
+ *   uint8_t  used[32];     非零页的位图
+ *   uint8_t  pages[][256]; 非零页的内容
+ *
+ * 记录：
+ *   uint8_t  flags;        低4位为PSW，以及TRACE_HALT、TRACE_WRITES、TRACE_MORE
+ *   varint   cycles;       与上一条记录的微周期数之差
+ *   varint   instructions; 有TRACE_MORE时：与上一条记录的指令数之差，没有时为1
+ *   uint8_t  cyc;          有TRACE_MORE时：微周期计数器，没有时为0
+ *   zigzag   pc;           PC之差
+ *   varint   mask;         变化了的寄存器，位i对应pin.h中编号为i + 1的寄存器
+ *   uint8_t  values[];     按位从低到高的新值
+ *   varint   count;        有TRACE_WRITES时：内存中变化了的字节数，之后每个字节为
+ *   zigzag   addr;         与上一个写入地址之差，关键帧之后从0开始
+ *   uint8_t  val;
+ *
+ * 一条记录通常是一条指令；中断响应、空转快进跳过的周期等由调用方决定记录的粒度，
+ * 合在一条记录里时instructions与cycles为实际的差
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "cpu.h"
+
+#define TRACE_MAGIC     "MTRC"          // 文件标识
+#define TRACE_VERSION   1               // 文件格式改变时加一
+#define TRACE_INTERVAL  (1 << 18)       // 默认的关键帧间隔
+#define TRACE_PAGE      (1 << 20)       // 缓冲页的字节数
+#define TRACE_PAGES     (RAM_SIZE >> 8) // 内存的页数
+#define TRACE_HEAD_MAX  64              // 一条记录除内存写入外最多的字节数
+#define TRACE_WRITE_MAX 4               // 一个内存写入最多的字节数
+#define TRACE_KEY_MAX   (64 + RAM_SIZE + TRACE_PAGES / 8) // 一个关键帧最多的字节数
+
+// 记录的flags
+#define TRACE_HALT   0x10 // 已停机
+#define TRACE_WRITES 0x20 // 有内存写入
+#define TRACE_MORE   0x40 // 指令数之差不为1或停在指令中间
+#define TRACE_KEY    0x80 // 关键帧，不是记录
+
+/// @brief 两组32个寄存器中不同的字节，按8字节比较
+/// @return 位i为1表示第i个字节不同
+static inline uint32_t TraceChanged(const uint8_t *a, const uint8_t *b)
+{
+    uint32_t mask = 0;
+    for (int i = 0; i < 32; i += 8)
+    {
+        uint64_t x, y;
+        memcpy(&x, a + i, 8), memcpy(&y, b + i, 8);
+        x ^= y;
+        // 每个非零字节的最高位置1，再把8个最高位收集到一个字节
+        x = (((x & 0x7f7f7f7f7f7f7f7full) + 0x7f7f7f7f7f7f7f7full) | x) & 0x8080808080808080ull;
+        mask |= (uint32_t)(((x >> 7) * 0x0102040810204080ull) >> 56) << i;
+    }
+    return mask;
+}
+
+/// @brief 写变长整数，每字节7位，低位在前
+static inline uint8_t *TracePutVarint(uint8_t *p, uint64_t val)
+{
+    while (val >= 0x80)
+        *p++ = (uint8_t)val | 0x80, val >>= 7;
+    *p++ = (uint8_t)val;
+    return p;
+}
+
+/// @brief 读变长整数
+/// @return 越过end时返回NULL
+static inline const uint8_t *TraceGetVarint(const uint8_t *p, const uint8_t *end, uint64_t &val)
+{
+    val = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7)
+    {
+        uint8_t b = *p++;
+        val |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return p;
+    }
+    return NULL;
+}
+
+static inline uint64_t TraceZigzag(int64_t val)
+{
+    return ((uint64_t)val << 1) ^ (uint64_t)(val >> 63);
+}
+
+static inline int64_t TraceUnzigzag(uint64_t val)
+{
+    return (int64_t)(val >> 1) ^ -(int64_t)(val & 1);
+}
+
+/// @brief 记录执行轨迹，编码在调用方的线程中进行，写文件在后台线程中进行
+struct TraceWriter : IoBus
+{
+    // 上一条记录之后的状态
+    uint8_t reg[32];
+    uint8_t pc, psw, cyc;
+    bool halt;
+    uint64_t cycles, instructions;
+    std::vector<uint8_t> ram;
+    uint16_t lastaddr; // 上一个写入地址
+
+    CPU *cpu;
+    IoBus *next;                  // 原来的CPU::io
+    std::vector<uint16_t> stores; // 上一条记录之后写过的地址
+    uint8_t poked[TRACE_PAGES];   // 设备自己改写过寄存器的页，记录时与保存的内存比较
+    bool anypoked;
+
+    uint64_t interval; // 关键帧间隔
+    uint64_t sincekey; // 上一个关键帧之后的记录数
+    uint64_t records, keyframes, bytes;
+    std::vector<std::pair<uint16_t, uint8_t>> writes;
+
+    // 双缓冲，buf[cur]由调用方写入，另一个可能正在由后台线程写入文件
+    std::vector<uint8_t> buf[2];
+    size_t len[2];
+    bool full[2];
+    int cur;
+    size_t pos;
+
+    FILE *file;
+    bool failed, quit;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::thread thread;
+
+    TraceWriter()
+        : ram(RAM_SIZE), lastaddr(0), cpu(NULL), next(NULL), anypoked(false), interval(TRACE_INTERVAL), sincekey(0), records(0), keyframes(0), bytes(0),
+          cur(0), pos(0), file(NULL), failed(false), quit(false)
+    {
+        memset(mapped, 1, sizeof(mapped));
+        memset(poked, 0, sizeof(poked));
+        store = Store;
+        buf[0].resize(TRACE_PAGE), buf[1].resize(TRACE_PAGE);
+        len[0] = len[1] = 0;
+        full[0] = full[1] = false;
+    }
+
+    ~TraceWriter()
+    {
+        Close();
+    }
+
+    TraceWriter(const TraceWriter &) = delete;
+    TraceWriter &operator=(const TraceWriter &) = delete;
+
+    /// @brief 打开文件并写入cpu当前状态的关键帧，之后cpu.io指向本对象，设备已接上时在Open之前接
+    /// @param path
+    /// @param cpu
+    /// @param interval 关键帧间隔的记录数
+    /// @return
+    bool Open(const std::string &path, CPU &cpu, uint64_t interval = TRACE_INTERVAL)
+    {
+        file = fopen(path.c_str(), "wb");
+        if (file == NULL)
+            return false;
+        this->interval = interval < 1 ? 1 : interval;
+        uint32_t header[2] = {TRACE_VERSION, (uint32_t)this->interval};
+        failed = fwrite(TRACE_MAGIC, 4, 1, file) != 1 || fwrite(header, sizeof(header), 1, file) != 1;
+        bytes = 12;
+        quit = false;
+        thread = std::thread(&TraceWriter::Work, this);
+
+        this->cpu = &cpu;
+        next = cpu.io;
+        cpu.io = this;
+        Save(cpu);
+        memcpy(ram.data(), cpu.ram, RAM_SIZE);
+        Key();
+        return true;
+    }
+
+    /// @brief 写出缓冲中的内容，结束后台线程并关闭文件
+    /// @return 是否都写入成功
+    bool Close()
+    {
+        if (file == NULL)
+            return !failed;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (pos != 0)
+                len[cur] = pos, full[cur] = true;
+            quit = true;
+        }
+        cond.notify_all();
+        thread.join();
+        if (cpu->io == this)
+            cpu->io = next;
+        failed = fclose(file) != 0 || failed;
+        file = NULL;
+        return !failed;
+    }
+
+    /// @brief 记下写内存的地址，设备的寄存器交给原来的CPU::io
+    static bool Store(IoBus *io, CPU &cpu, uint16_t addr, uint8_t val)
+    {
+        TraceWriter *t = static_cast<TraceWriter *>(io);
+        if (t->next != NULL && t->next->mapped[addr >> 8] && t->next->store(t->next, cpu, addr, val))
+        {
+            // 设备可能同时改写相邻的寄存器
+            uint8_t page = addr >> 8;
+            t->poked[(uint8_t)(page - 1)] = t->poked[page] = t->poked[(uint8_t)(page + 1)] = 1;
+            t->anypoked = true;
+            return true;
+        }
+        t->stores.push_back(addr);
+        return false;
+    }
+
+    void Save(const CPU &cpu)
+    {
+        memcpy(reg, cpu.reg, sizeof(reg));
+        pc = cpu.pc, psw = cpu.psw, cyc = cpu.cyc, halt = cpu.halt;
+        cycles = cpu.cycles, instructions = cpu.instructions;
+    }
+
+    /// @brief 保证当前缓冲页还有n个字节，不够时换页
+    void Reserve(size_t n)
+    {
+        if (pos + n <= TRACE_PAGE)
+            return;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            len[cur] = pos, full[cur] = true;
+            cond.notify_all();
+            cond.wait(lock, [&] { return !full[cur ^ 1]; });
+        }
+        cur ^= 1, pos = 0;
+    }
+
+    /// @brief 写入保存的状态作为关键帧
+    void Key()
+    {
+        Reserve(TRACE_KEY_MAX);
+        uint8_t *p = &buf[cur][pos], *begin = p;
+        *p++ = TRACE_KEY;
+        memcpy(p, reg, sizeof(reg)), p += sizeof(reg);
+        *p++ = pc, *p++ = psw, *p++ = cyc, *p++ = halt;
+        p = TracePutVarint(p, cycles);
+        p = TracePutVarint(p, instructions);
+        uint8_t *used = p;
+        memset(used, 0, TRACE_PAGES / 8), p += TRACE_PAGES / 8;
+        static const uint8_t zero[256] = {0};
+        for (int page = 0; page < TRACE_PAGES; ++page)
+            if (memcmp(&ram[page << 8], zero, 256) != 0)
+            {
+                used[page >> 3] |= 1 << (page & 7);
+                memcpy(p, &ram[page << 8], 256), p += 256;
+            }
+        pos += p - begin;
+        lastaddr = 0, sincekey = 0;
+        ++keyframes;
+    }
+
+    /// @brief 记录上一次记录之后的变化，状态不变时不记录
+    /// @param cpu
+    void Record(const CPU &cpu)
+    {
+        if (cpu.cycles == cycles && cpu.instructions == instructions)
+            return;
+
+        // 写过的地址中值变化了的，同一地址写多次时只记最后的值
+        writes.clear();
+        for (uint16_t addr : stores)
+            if (ram[addr] != cpu.ram[addr])
+                ram[addr] = cpu.ram[addr], writes.emplace_back(addr, ram[addr]);
+        stores.clear();
+        if (anypoked)
+        {
+            for (int page = 0; page < TRACE_PAGES; ++page)
+            {
+                if (!poked[page])
+                    continue;
+                poked[page] = 0;
+                for (int i = page << 8; i < (page + 1) << 8; ++i)
+                    if (ram[i] != cpu.ram[i])
+                        ram[i] = cpu.ram[i], writes.emplace_back(i, ram[i]);
+            }
+            anypoked = false;
+        }
+
+        Reserve(TRACE_HEAD_MAX + writes.size() * TRACE_WRITE_MAX);
+        uint8_t *p = &buf[cur][pos], *begin = p;
+        uint64_t n = cpu.instructions - instructions;
+        bool more = n != 1 || cpu.cyc != 0;
+        *p++ = (cpu.psw & 0xf) | (cpu.halt ? TRACE_HALT : 0) | (writes.empty() ? 0 : TRACE_WRITES) |
+               (more ? TRACE_MORE : 0);
+        p = TracePutVarint(p, cpu.cycles - cycles);
+        if (more)
+        {
+            p = TracePutVarint(p, n);
+            *p++ = cpu.cyc;
+        }
+        p = TracePutVarint(p, TraceZigzag((int8_t)(cpu.pc - pc)));
+
+        uint32_t mask = TraceChanged(cpu.reg, reg);
+        p = TracePutVarint(p, mask >> 1);
+        for (uint32_t m = mask; m != 0; m &= m - 1)
+            *p++ = cpu.reg[__builtin_ctz(m)];
+
+        if (!writes.empty())
+        {
+            p = TracePutVarint(p, writes.size());
+            for (const auto &w : writes)
+            {
+                p = TracePutVarint(p, TraceZigzag((int16_t)(w.first - lastaddr)));
+                *p++ = w.second;
+                lastaddr = w.first;
+            }
+        }
+        pos += p - begin;
+        Save(cpu);
+        ++records;
+        if (++sincekey >= interval)
+            Key();
+    }
+
+    void Work()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (int i = 0;; i ^= 1)
+        {
+            cond.wait(lock, [&] { return full[i] || quit; });
+            if (!full[i])
+                return;
+            lock.unlock();
+            bool ok = fwrite(buf[i].data(), 1, len[i], file) == len[i];
+            lock.lock();
+            failed = failed || !ok;
+            bytes += len[i];
+            full[i] = false;
+            cond.notify_all();
+        }
+    }
+};
+
+/// @brief 读取执行轨迹，定位到任意记录，状态在cpu中
+struct TraceReader
+{
+    /// @brief 关键帧的位置
+    struct Key
+    {
+        size_t offset;
+        uint64_t record; // 关键帧之前的记录数
+        uint64_t cycles;
+    };
+
+    std::vector<uint8_t> data;
+    uint32_t interval;
+    std::vector<Key> keys;
+    uint64_t records; // 记录总数
+
+    CPU cpu;                                          // 当前记录之后的状态，micro为NULL
+    uint64_t record;                                  // 当前记录，0为开始时的状态
+    uint16_t from;                                    // 当前记录执行的指令的地址，即上一条记录之后的MSR:PC
+    std::vector<std::pair<uint16_t, uint8_t>> writes; // 当前记录中变化的内存
+    size_t pos;                                       // 下一项的位置
+    uint16_t lastaddr;
+
+    TraceReader() : interval(0), records(0), cpu(NULL), record(0), from(0), pos(0), lastaddr(0)
+    {
+    }
+
+    /// @brief 读入整个文件并建立关键帧的索引
+    /// @param path
+    /// @param error 失败时的说明
+    /// @return
+    bool Open(const std::string &path, std::string &error)
+    {
+        FILE *pf = fopen(path.c_str(), "rb");
+        if (pf == NULL)
+        {
+            error = "unable to open " + path;
+            return false;
+        }
+        uint8_t chunk[1 << 16];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), pf)) != 0)
+            data.insert(data.end(), chunk, chunk + n);
+        fclose(pf);
+
+        uint32_t version;
+        if (data.size() <= 12 || memcmp(data.data(), TRACE_MAGIC, 4) != 0 ||
+            (memcpy(&version, &data[4], 4), version != TRACE_VERSION) || data[12] != TRACE_KEY)
+        {
+            error = path + " is not a trace file";
+            return false;
+        }
+        memcpy(&interval, &data[8], 4);
+
+        // 程序异常退出时文件可能在记录中间结束，保留能完整解码的部分
+        pos = 12, record = 0;
+        while (pos < data.size())
+        {
+            const uint8_t *p = &data[0] + pos, *end = &data[0] + data.size();
+            bool key = *p == TRACE_KEY;
+            if (key ? !LoadKey(p, end) : !Next())
+            {
+                error = "trace is truncated after record " + std::to_string(record);
+                data.resize(pos);
+                break;
+            }
+            if (key)
+            {
+                keys.push_back({pos, record, cpu.cycles});
+                pos = p - &data[0];
+            }
+        }
+        records = record;
+        Seek(0);
+        return true;
+    }
+
+    /// @brief 解码下一项，关键帧载入后继续解码下一条记录
+    /// @return 没有下一条记录或数据不完整时返回false
+    bool Next()
+    {
+        const uint8_t *p = &data[0] + pos, *end = &data[0] + data.size();
+        if (p < end && *p == TRACE_KEY)
+        {
+            if (!LoadKey(p, end))
+                return false;
+            pos = p - &data[0];
+        }
+        if (p >= end)
+            return false;
+
+        uint8_t flags = *p++;
+        uint64_t val;
+        writes.clear();
+        from = (cpu.reg[MSR] << 8) | cpu.pc;
+        if ((p = TraceGetVarint(p, end, val)) == NULL)
+            return false;
+        cpu.cycles += val;
+        if (flags & TRACE_MORE)
+        {
+            if ((p = TraceGetVarint(p, end, val)) == NULL || p >= end)
+                return false;
+            cpu.instructions += val;
+            cpu.cyc = *p++ & 0xf;
+        }
+        else
+            cpu.instructions += 1, cpu.cyc = 0;
+        if ((p = TraceGetVarint(p, end, val)) == NULL)
+            return false;
+        cpu.pc += (uint8_t)TraceUnzigzag(val);
+        cpu.psw = flags & 0xf;
+        cpu.halt = (flags & TRACE_HALT) != 0;
+
+        uint64_t mask;
+        if ((p = TraceGetVarint(p, end, mask)) == NULL)
+            return false;
+        for (int i = 1; mask != 0; ++i, mask >>= 1)
+            if (mask & 1)
+            {
+                if (p >= end || i >= 32)
+                    return false;
+                cpu.reg[i] = *p++;
+            }
+
+        if (flags & TRACE_WRITES)
+        {
+            uint64_t count;
+            if ((p = TraceGetVarint(p, end, count)) == NULL)
+                return false;
+            for (uint64_t i = 0; i < count; ++i)
+            {
+                if ((p = TraceGetVarint(p, end, val)) == NULL || p >= end)
+                    return false;
+                lastaddr += (uint16_t)TraceUnzigzag(val);
+                cpu.ram[lastaddr] = *p++;
+                writes.emplace_back(lastaddr, cpu.ram[lastaddr]);
+            }
+        }
+        pos = p - &data[0];
+        ++record;
+        return true;
+    }
+
+    /// @brief 载入p处的关键帧
+    bool LoadKey(const uint8_t *&p, const uint8_t *end)
+    {
+        if (end - p < 1 + 32 + 4)
+            return false;
+        ++p;
+        memcpy(cpu.reg, p, 32), p += 32;
+        cpu.pc = p[0], cpu.psw = p[1] & 0xf, cpu.cyc = p[2] & 0xf, cpu.halt = p[3] != 0, p += 4;
+        if ((p = TraceGetVarint(p, end, cpu.cycles)) == NULL || (p = TraceGetVarint(p, end, cpu.instructions)) == NULL ||
+            end - p < TRACE_PAGES / 8)
+            return false;
+        const uint8_t *used = p;
+        p += TRACE_PAGES / 8;
+        for (int page = 0; page < TRACE_PAGES; ++page)
+        {
+            if (!(used[page >> 3] & (1 << (page & 7))))
+            {
+                memset(cpu.ram + (page << 8), 0, 256);
+                continue;
+            }
+            if (end - p < 256)
+                return false;
+            memcpy(cpu.ram + (page << 8), p, 256), p += 256;
+        }
+        lastaddr = 0;
+        return true;
+    }
+
+    /// @brief 定位到第n条记录之后，超出时定位到最后一条
+    void Seek(uint64_t n)
+    {
+        n = std::min(n, records);
+        // 从第n条记录之前的关键帧开始，使第n条记录总是解码得到，有from与writes
+        size_t k = keys.size() - 1;
+        while (k > 0 && keys[k].record + (n > 0) > n)
+            --k;
+        // 向后定位且中间没有关键帧时从当前位置解码
+        if (n < record || keys[k].record > record)
+        {
+            const uint8_t *p = &data[0] + keys[k].offset, *end = &data[0] + data.size();
+            LoadKey(p, end);
+            pos = p - &data[0];
+            record = keys[k].record;
+            from = (cpu.reg[MSR] << 8) | cpu.pc;
+            writes.clear();
+        }
+        while (record < n && Next())
+            ;
+    }
+
+    /// @brief 定位到微周期数不超过cycles的最后一条记录
+    void SeekCycle(uint64_t cycles)
+    {
+        size_t k = keys.size() - 1;
+        while (k > 0 && keys[k].cycles > cycles)
+            --k;
+        Seek(keys[k].record);
+        uint64_t found = record;
+        while (Next() && cpu.cycles <= cycles)
+            found = record;
+        Seek(found);
+    }
+};
+
+#endif //_TRACE_H_